@@ -0,0 +1,136 @@
+/*
+ * Benchmark of the call data encoder on production-like traffic
+ *
+ * Encodes getDigestHash(username, realm, method, uri, nonce) for a corpus
+ * shaped like our REGISTER-heavy traffic: three realms of uneven size,
+ * mostly REGISTER, request URIs that repeat for registrations and vary for
+ * calls, a large user base and a fresh nonce per request. Runs with and
+ * without the segment memo, checks both produce the same encodings, and
+ * prints the best time per call over the rounds. Build with: make bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "web3_auth.h"
+#include "web3_auth_abi.h"
+#include "web3_auth_hex.h"
+
+// Small enough to stay in cache: real fields were just parsed from the message
+#define CORPUS 1024
+#define ROUNDS 500
+#define FIELD 96
+
+typedef struct {
+    char f[5][FIELD];
+    size_t len[5];
+} request_t;
+
+static const char* realms[] = {"sip.example.com", "voice.example.org", "pbx.tenant-three.net"};
+static const char* methods[] = {"REGISTER", "INVITE", "SUBSCRIBE", "MESSAGE", "OPTIONS"};
+
+// Index drawn from cumulative percentages
+static int pick(const int* cum, int n) {
+    int r = rand() % 100;
+    for (int i = 0; i < n; i++) {
+        if (r < cum[i]) return i;
+    }
+    return n - 1;
+}
+
+static void make_corpus(request_t* reqs) {
+    static const int realm_cum[] = {80, 95, 100};
+    static const int method_cum[] = {60, 85, 93, 98, 100};
+
+    for (int i = 0; i < CORPUS; i++) {
+        request_t* r = &reqs[i];
+        const char* realm = realms[pick(realm_cum, 3)];
+        int m = pick(method_cum, 5);
+
+        snprintf(r->f[0], FIELD, "user%06d", rand() % 100000);
+        snprintf(r->f[1], FIELD, "%s", realm);
+        snprintf(r->f[2], FIELD, "%s", methods[m]);
+        if (m == 1 || m == 3) {
+            snprintf(r->f[3], FIELD, "sip:user%04d@%s", rand() % 2000, realm);
+        } else {
+            snprintf(r->f[3], FIELD, "sip:%s", realm);
+        }
+        snprintf(r->f[4], FIELD, "%08x%08x%08x%08x", rand(), rand(), rand(), rand());
+        for (int f = 0; f < 5; f++) r->len[f] = strlen(r->f[f]);
+    }
+}
+
+static void set_args(const request_t* r, w3_abi_value_t fields[5], w3_abi_value_t* tuple) {
+    for (int f = 0; f < 5; f++) {
+        fields[f].data = (const uint8_t*)r->f[f];
+        fields[f].len = r->len[f];
+        fields[f].num = 0;
+        fields[f].items = NULL;
+    }
+    tuple->data = NULL;
+    tuple->items = fields;
+    tuple->len = 5;
+}
+
+static double run(const w3_abi_fn_t* fn, const request_t* reqs, char* out) {
+    w3_abi_value_t fields[5], tuple;
+    static volatile char sink;
+    uint64_t best = UINT64_MAX;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        uint64_t start = w3_now_us();
+        for (int i = 0; i < CORPUS; i++) {
+            set_args(&reqs[i], fields, &tuple);
+            if (w3_abi_size(&fn->args, &tuple) < 0) abort();
+            sink ^= *w3_abi_encode_hex(&fn->args, &tuple, out);
+        }
+        if (w3_now_us() - start < best) best = w3_now_us() - start;
+    }
+    return (double)best * 1000.0 / CORPUS;
+}
+
+int main(void) {
+    request_t* reqs = malloc(sizeof(request_t) * CORPUS);
+    w3_abi_value_t fields[5], tuple;
+    char plain[4096], memo[4096];
+    unsigned long lookups, hits;
+    const char* err;
+    w3_abi_fn_t fn;
+    double t_plain, t_memo;
+
+    if (!reqs || w3_abi_compile("getDigestHash(string,string,string,string,string)", &fn, &err) < 0) {
+        return 1;
+    }
+    srand(7);
+    make_corpus(reqs);
+
+    for (int level = W3_HEX_SCALAR; level <= W3_HEX_BEST; level++) {
+        if (w3_hex_select(level) != level) continue;
+
+        // Same bytes with and without the memo
+        for (int i = 0; i < CORPUS; i++) {
+            char* end;
+            set_args(&reqs[i], fields, &tuple);
+            w3_abi_memo_enable(0);
+            end = w3_abi_encode_hex(&fn.args, &tuple, plain);
+            w3_abi_memo_enable(1);
+            if (w3_abi_encode_hex(&fn.args, &tuple, memo) != memo + (end - plain)
+                    || memcmp(plain, memo, end - plain) != 0) {
+                fprintf(stderr, "memo encoding differs for request %d\n", i);
+                return 1;
+            }
+        }
+
+        w3_abi_memo_enable(0);
+        t_plain = run(&fn, reqs, plain);
+        w3_abi_memo_enable(1);
+        t_memo = run(&fn, reqs, memo);
+        w3_abi_memo_stats(&lookups, &hits);
+
+        printf("%-7s plain %6.1f ns  memo %6.1f ns  (%.0f%% of lookups hit)\n",
+                w3_hex_name(level), t_plain, t_memo, lookups ? 100.0 * hits / lookups : 0.0);
+    }
+    free(reqs);
+    return 0;
+}
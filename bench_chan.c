@@ -0,0 +1,220 @@
+/*
+ * Benchmark of the completion channel between processes
+ *
+ * Measures the hand-off latency of one result (ping-pong between two
+ * processes, each one asleep when the item arrives) and the throughput of
+ * several producers completing into one consumer, one item and batches per
+ * put, next to a pipe doing the same. Build with: make bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "web3_auth.h"
+#include "web3_auth_chan.h"
+
+#define PINGS 100000
+#define PRODUCERS 4
+#define ITEMS 500000            // per producer
+#define SLOTS 1024
+
+// What an RPC process hands back to a SIP worker
+typedef struct result {
+    unsigned long id;
+    int status;
+    uint8_t digest[20];
+} result_t;
+
+static void* shared(size_t size) {
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    return mem;
+}
+
+static w3_chan_t* chan_new(void) {
+    size_t size = w3_chan_size(SLOTS, sizeof(result_t));
+
+    return w3_chan_init(shared(size), SLOTS, sizeof(result_t));
+}
+
+static void wait_all(void) {
+    int status;
+
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "child failed\n");
+            exit(1);
+        }
+    }
+}
+
+static void pingpong_chan(void) {
+    w3_chan_t* to = chan_new();
+    w3_chan_t* back = chan_new();
+    result_t r = {0};
+    uint64_t start;
+
+    if (fork() == 0) {
+        for (long i = 0; i < PINGS; i++) {
+            if (w3_chan_get(to, &r, 1, 1000) != 1) _exit(1);
+            r.status++;
+            while (w3_chan_put(back, &r, 1) != 1) sched_yield();
+        }
+        _exit(0);
+    }
+    start = w3_now_us();
+    for (long i = 0; i < PINGS; i++) {
+        r.id = i;
+        w3_chan_put(to, &r, 1);
+        if (w3_chan_get(back, &r, 1, 1000) != 1 || r.id != (unsigned long)i) {
+            fprintf(stderr, "channel lost an item\n");
+            exit(1);
+        }
+    }
+    printf("  %-8s hand-off %6.2f us\n", "channel",
+            (double)(w3_now_us() - start) / PINGS / 2);
+    wait_all();
+}
+
+static void pingpong_pipe(void) {
+    int to[2], back[2];
+    result_t r = {0};
+    uint64_t start;
+
+    if (pipe(to) < 0 || pipe(back) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    if (fork() == 0) {
+        for (long i = 0; i < PINGS; i++) {
+            if (read(to[0], &r, sizeof(r)) != sizeof(r)) _exit(1);
+            r.status++;
+            if (write(back[1], &r, sizeof(r)) != sizeof(r)) _exit(1);
+        }
+        _exit(0);
+    }
+    start = w3_now_us();
+    for (long i = 0; i < PINGS; i++) {
+        r.id = i;
+        if (write(to[1], &r, sizeof(r)) != sizeof(r) || read(back[0], &r, sizeof(r)) != sizeof(r)) {
+            perror("pipe");
+            exit(1);
+        }
+    }
+    printf("  %-8s hand-off %6.2f us\n", "pipe", (double)(w3_now_us() - start) / PINGS / 2);
+    wait_all();
+    close(to[0]); close(to[1]); close(back[0]); close(back[1]);
+}
+
+static void throughput_chan(int batch) {
+    w3_chan_t* ch = chan_new();
+    result_t out[64], in[64];
+    unsigned long seen[PRODUCERS] = {0};
+    long total = 0;
+    w3_chan_stats_t st;
+    uint64_t start = w3_now_us();
+
+    for (int p = 0; p < PRODUCERS; p++) {
+        if (fork() == 0) {
+            for (long i = 0; i < ITEMS; i += batch) {
+                int n = 0;
+
+                for (int j = 0; j < batch; j++) {
+                    out[j].id = (unsigned long)p << 32 | (i + j);
+                }
+                while (n < batch) {
+                    int put = w3_chan_put(ch, out + n, batch - n);
+
+                    n += put;
+                    if (put == 0) sched_yield();
+                }
+            }
+            _exit(0);
+        }
+    }
+    while (total < (long)PRODUCERS * ITEMS) {
+        int n = w3_chan_get(ch, in, 64, 1000);
+
+        if (n <= 0) {
+            fprintf(stderr, "channel stalled\n");
+            exit(1);
+        }
+        for (int j = 0; j < n; j++) {
+            unsigned long p = in[j].id >> 32;
+
+            // Items of one producer arrive in order
+            if (p >= PRODUCERS || (in[j].id & 0xffffffffUL) != seen[p]++) {
+                fprintf(stderr, "channel reordered items\n");
+                exit(1);
+            }
+        }
+        total += n;
+    }
+    w3_chan_stats(ch, &st);
+    printf("  %-8s batch %2d %6.1f M/s, %5.2f wakeups per 1000 items\n", "channel", batch,
+            total / (double)(w3_now_us() - start), st.wakes * 1000.0 / total);
+    wait_all();
+}
+
+static void throughput_pipe(void) {
+    result_t out = {0}, in[64];
+    long total = 0;
+    uint64_t start = w3_now_us();
+    int fds[2];
+
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    for (int p = 0; p < PRODUCERS; p++) {
+        if (fork() == 0) {
+            close(fds[0]);
+            for (long i = 0; i < ITEMS; i++) {
+                out.id = i;
+                if (write(fds[1], &out, sizeof(out)) != sizeof(out)) _exit(1);
+            }
+            _exit(0);
+        }
+    }
+    close(fds[1]);
+    while (total < (long)PRODUCERS * ITEMS) {
+        ssize_t got = read(fds[0], in, sizeof(in));
+
+        if (got <= 0) {
+            fprintf(stderr, "pipe closed early\n");
+            exit(1);
+        }
+        // Writes below PIPE_BUF are atomic, reads may split items
+        total += got / sizeof(result_t);
+        if (got % sizeof(result_t)) {
+            size_t rest = sizeof(result_t) - got % sizeof(result_t);
+
+            if (read(fds[0], in, rest) != (ssize_t)rest) exit(1);
+            total++;
+        }
+    }
+    printf("  %-8s batch  1 %6.1f M/s\n", "pipe", total / (double)(w3_now_us() - start));
+    wait_all();
+    close(fds[0]);
+}
+
+int main(void) {
+    printf("result hand-off between processes, %zu byte items\n", sizeof(result_t));
+    pingpong_chan();
+    pingpong_pipe();
+
+    printf("%d producers into one consumer, %d items each\n", PRODUCERS, ITEMS);
+    throughput_chan(1);
+    throughput_chan(16);
+    throughput_pipe();
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Benchmark of the hex kernels on SIP field sized inputs
+ *
+ * Encodes and decodes 8 to 200 byte buffers with every kernel level this
+ * CPU supports, plus the former sprintf loop as a baseline, and prints the
+ * time per call. Build with: make bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "web3_auth.h"
+#include "web3_auth_hex.h"
+
+#define ROUNDS 2000000
+
+static const size_t sizes[] = {8, 16, 24, 32, 48, 64, 100, 128, 200};
+
+static volatile uint8_t sink;
+
+static double ns_per_call(uint64_t start_us, long calls) {
+    return (double)(w3_now_us() - start_us) * 1000.0 / calls;
+}
+
+static void bench_sprintf(const uint8_t* in, size_t len, char* out) {
+    uint64_t start = w3_now_us();
+
+    for (long r = 0; r < ROUNDS; r++) {
+        for (size_t i = 0; i < len; i++) {
+            sprintf(out + i * 2, "%02x", in[i]);
+        }
+        sink ^= (uint8_t)out[r % (2 * len)];
+    }
+    printf("  %-8s encode %7.1f ns\n", "sprintf", ns_per_call(start, ROUNDS));
+}
+
+static void bench_level(int level, const uint8_t* in, size_t len, char* hex, uint8_t* back) {
+    uint64_t start;
+    double enc, dec;
+
+    start = w3_now_us();
+    for (long r = 0; r < ROUNDS; r++) {
+        w3_hex_encode(in, len, hex);
+        sink ^= (uint8_t)hex[r % (2 * len)];
+    }
+    enc = ns_per_call(start, ROUNDS);
+
+    start = w3_now_us();
+    for (long r = 0; r < ROUNDS; r++) {
+        if (w3_hex_decode(hex, 2 * len, back) < 0) abort();
+        sink ^= back[r % len];
+    }
+    dec = ns_per_call(start, ROUNDS);
+
+    if (memcmp(in, back, len) != 0) {
+        fprintf(stderr, "%s kernels do not round-trip\n", w3_hex_name(level));
+        exit(1);
+    }
+    printf("  %-8s encode %7.1f ns  decode %7.1f ns\n", w3_hex_name(level), enc, dec);
+}
+
+int main(void) {
+    uint8_t in[256], back[256];
+    char hex[2 * 256 + 1];
+    int best = w3_hex_select(W3_HEX_BEST);
+
+    for (size_t i = 0; i < sizeof(in); i++) in[i] = (uint8_t)(rand() & 0xff);
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        printf("%zu bytes\n", sizes[s]);
+        bench_sprintf(in, sizes[s], hex);
+        for (int level = W3_HEX_SCALAR; level <= best; level++) {
+            if (w3_hex_select(level) != level) continue;
+            bench_level(level, in, sizes[s], hex, back);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * Benchmark of the RPC transports against a local keep-alive server
+ *
+ * Forks a minimal HTTP/1.1 server on 127.0.0.1 that answers every request
+ * with a fixed eth_call result, then times a reused curl handle (as the
+ * module drives it) against the io_uring client, one request at a time and
+ * pipelined. Build with: make bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <curl/curl.h>
+
+#include "web3_auth.h"
+#include "web3_auth_uring.h"
+
+#define ROUNDS 20000
+
+static const char request[] =
+    "{\"jsonrpc\":\"2.0\",\"method\":\"eth_call\",\"params\":[{\"to\":"
+    "\"0x2c5f1b5c0a0c4bd1e1f7a2e2e0c1d3e1f8a4b5c6\",\"data\":\"0x5a2c3b9e"
+    "0000000000000000000000000000000000000000000000000000000000000020\"},"
+    "\"latest\"],\"id\":1}";
+
+static const char result[] =
+    "{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":\"0x"
+    "0000000000000000000000000000000000000000000000000000000000000020"
+    "0000000000000000000000000000000000000000000000000000000000000020"
+    "6d6435000000000000000000000000000000000000000000000000000000000000\"}";
+
+// One request from the front of buf: its length, 0 when incomplete
+static size_t server_request(const char* buf, size_t len) {
+    const char* cl;
+    size_t head = 0;
+
+    for (size_t i = 3; i < len; i++) {
+        if (buf[i] == '\n' && buf[i - 1] == '\r' && buf[i - 2] == '\n' && buf[i - 3] == '\r') {
+            head = i + 1;
+            break;
+        }
+    }
+    if (!head) return 0;
+    cl = strstr(buf, "Content-Length: ");
+    if (!cl || cl > buf + head) return head;
+    head += strtoul(cl + 16, NULL, 10);
+    return head <= len ? head : 0;
+}
+
+// Answer the pipelined requests of one connection; /chunked gets the body
+// in two chunks to cover that path of the client
+static void server_conn(int fd) {
+    static char in[65536], out[262144];
+    size_t have = 0;
+    ssize_t got;
+
+    while ((got = read(fd, in + have, sizeof(in) - have - 1)) > 0) {
+        size_t off = 0, used = 0, req;
+
+        have += got;
+        in[have] = '\0';
+        while ((req = server_request(in + off, have - off)) > 0) {
+            size_t half = (sizeof(result) - 1) / 2;
+
+            if (strncmp(in + off, "POST /chunked ", 14) == 0) {
+                used += snprintf(out + used, sizeof(out) - used,
+                        "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                        "Transfer-Encoding: chunked\r\n\r\n%zx\r\n%.*s\r\n%zx\r\n%s\r\n0\r\n\r\n",
+                        half, (int)half, result, sizeof(result) - 1 - half, result + half);
+            } else {
+                used += snprintf(out + used, sizeof(out) - used,
+                        "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                        "Content-Length: %zu\r\n\r\n%s", sizeof(result) - 1, result);
+            }
+            off += req;
+        }
+        memmove(in, in + off, have - off);
+        have -= off;
+        if (used && write(fd, out, used) != (ssize_t)used) break;
+    }
+    close(fd);
+}
+
+static pid_t server_start(int* port) {
+    struct sockaddr_in addr = {.sin_family = AF_INET};
+    socklen_t alen = sizeof(addr);
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    pid_t pid;
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (lfd < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, 16) < 0
+            || getsockname(lfd, (struct sockaddr*)&addr, &alen) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    *port = ntohs(addr.sin_port);
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid > 0) {
+        close(lfd);
+        return pid;
+    }
+    signal(SIGCHLD, SIG_IGN);
+    for (;;) {
+        int one = 1, fd = accept(lfd, NULL, NULL);
+
+        if (fd < 0) continue;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (fork() == 0) {
+            close(lfd);
+            server_conn(fd);
+            _exit(0);
+        }
+        close(fd);
+    }
+}
+
+typedef struct body {
+    char data[1024];
+    size_t len;
+} body_t;
+
+static size_t curl_write(void* ptr, size_t size, size_t nmemb, void* userp) {
+    body_t* b = userp;
+    size_t n = size * nmemb;
+
+    if (b->len + n >= sizeof(b->data)) return 0;
+    memcpy(b->data + b->len, ptr, n);
+    b->len += n;
+    return n;
+}
+
+static void check(const char* what, int ok) {
+    if (!ok) {
+        fprintf(stderr, "%s: unexpected response\n", what);
+        exit(1);
+    }
+}
+
+static void bench_curl(const char* url) {
+    CURL* curl = curl_easy_init();
+    struct curl_slist* headers = curl_slist_append(NULL, "Content-Type: application/json");
+    uint64_t start;
+    body_t body;
+    long code;
+
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+
+    start = w3_now_us();
+    for (long r = 0; r < ROUNDS; r++) {
+        body.len = 0;
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)(sizeof(request) - 1));
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 1000L);
+        check("curl", curl_easy_perform(curl) == CURLE_OK);
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+        check("curl", code == 200 && body.len == sizeof(result) - 1);
+    }
+    printf("  %-14s %7.1f us/request\n", "curl", (double)(w3_now_us() - start) / ROUNDS);
+
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+}
+
+static void bench_uring(const char* url, int depth) {
+    const char* bodies[32];
+    size_t lens[32];
+    w3_uring_resp_t resp[32];
+    char name[32];
+    uint64_t start;
+
+    for (int i = 0; i < depth; i++) {
+        bodies[i] = request;
+        lens[i] = sizeof(request) - 1;
+    }
+    start = w3_now_us();
+    for (long r = 0; r < ROUNDS; r += depth) {
+        check("io_uring", w3_uring_post(url, bodies, lens, depth, resp, 1000) == 0);
+        for (int i = 0; i < depth; i++) {
+            check("io_uring", resp[i].status == 200 && resp[i].len == sizeof(result) - 1
+                    && memcmp(resp[i].body, result, resp[i].len) == 0);
+        }
+    }
+    snprintf(name, sizeof(name), depth > 1 ? "io_uring x%d" : "io_uring", depth);
+    printf("  %-14s %7.1f us/request\n", name, (double)(w3_now_us() - start) / ROUNDS);
+}
+
+int main(void) {
+    const char* bodies[4] = {request, request, request, request};
+    size_t lens[4];
+    w3_uring_resp_t resp[4];
+    char url[64], chunked[64];
+    int port, status;
+    pid_t server;
+
+    server = server_start(&port);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/", port);
+    snprintf(chunked, sizeof(chunked), "http://127.0.0.1:%d/chunked", port);
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    printf("eth_call over keep-alive HTTP/1.1 on loopback, %d requests\n", ROUNDS);
+    bench_curl(url);
+
+    if (w3_uring_init(0) < 0) {
+        printf("  io_uring       unavailable: %s\n", w3_uring_error());
+    } else {
+        for (int i = 0; i < 4; i++) lens[i] = sizeof(request) - 1;
+        check("chunked", w3_uring_post(chunked, bodies, lens, 4, resp, 1000) == 0);
+        for (int i = 0; i < 4; i++) {
+            check("chunked", resp[i].status == 200 && strcmp(resp[i].body, result) == 0);
+        }
+        bench_uring(url, 1);
+        bench_uring(url, 8);
+        bench_uring(url, 32);
+        w3_uring_destroy();
+    }
+
+    curl_global_cleanup();
+    kill(server, SIGTERM);
+    waitpid(server, &status, 0);
+    return 0;
+}
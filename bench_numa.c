@@ -0,0 +1,113 @@
+/*
+ * Benchmark of result hand-off across memory nodes
+ *
+ * Ping-pongs a 32 byte result between two pinned processes over the
+ * completion channel, with the processes and the rings on the same node,
+ * the rings on another node, and the processes on different nodes. On a
+ * single-node machine only the local case runs. Build with: make bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "web3_auth.h"
+#include "web3_auth_chan.h"
+#include "web3_auth_cpu.h"
+
+#define PINGS 100000
+#define SLOTS 256
+
+typedef struct result {
+    unsigned long id;
+    int status;
+    uint8_t digest[20];
+} result_t;
+
+// Channel whose pages live on node
+static w3_chan_t* chan_on(int node) {
+    size_t size = w3_chan_size(SLOTS, sizeof(result_t));
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    if (w3_numa_bind(mem, size, node) < 0) {
+        perror("mbind");
+        exit(1);
+    }
+    return w3_chan_init(mem, SLOTS, sizeof(result_t));
+}
+
+static void pin(const w3_cpus_t* cpus, int index) {
+    if (w3_cpu_pin(cpus, index) < 0) {
+        perror("sched_setaffinity");
+        exit(1);
+    }
+}
+
+// Caller on CPU a, responder on CPU b; each ring on the node given
+static void pingpong(const char* name, const w3_cpus_t* a, const w3_cpus_t* b, int b_index,
+        int to_node, int back_node) {
+    w3_chan_t* to = chan_on(to_node);
+    w3_chan_t* back = chan_on(back_node);
+    result_t r = {0};
+    uint64_t start;
+    int status;
+
+    if (fork() == 0) {
+        pin(b, b_index);
+        for (long i = 0; i < PINGS; i++) {
+            if (w3_chan_get(to, &r, 1, 1000) != 1) _exit(1);
+            r.status++;
+            while (w3_chan_put(back, &r, 1) != 1) sched_yield();
+        }
+        _exit(0);
+    }
+    pin(a, 0);
+    start = w3_now_us();
+    for (long i = 0; i < PINGS; i++) {
+        r.id = i;
+        w3_chan_put(to, &r, 1);
+        if (w3_chan_get(back, &r, 1, 1000) != 1 || r.id != (unsigned long)i) {
+            fprintf(stderr, "channel lost an item\n");
+            exit(1);
+        }
+    }
+    printf("  %-34s %6.2f us\n", name, (double)(w3_now_us() - start) / PINGS / 2);
+    if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "responder failed\n");
+        exit(1);
+    }
+}
+
+int main(void) {
+    w3_cpus_t n0, n1;
+    int nodes = w3_numa_nodes();
+    int far = -1;
+
+    if (w3_numa_cpus(0, &n0) < 0) {
+        // No sysfs node information; treat the allowed CPUs as one node
+        w3_cpu_parse("0", &n0);
+    }
+    for (int node = 1; node < nodes && far < 0; node++) {
+        if (w3_numa_cpus(node, &n1) > 0) far = node;
+    }
+
+    printf("result hand-off latency, %d memory node%s\n", nodes, nodes > 1 ? "s" : "");
+    // Second CPU of the node when there is one, else both share the first
+    pingpong("same node, rings local", &n0, &n0, n0.n > 1 ? 1 : 0, 0, 0);
+    if (far < 0) {
+        printf("  single memory node, cross-node cases skipped\n");
+        return 0;
+    }
+    pingpong("same node, rings on remote node", &n0, &n0, n0.n > 1 ? 1 : 0, far, far);
+    pingpong("across nodes, rings at consumer", &n0, &n1, 0, far, 0);
+    pingpong("across nodes, rings at caller", &n0, &n1, 0, 0, 0);
+    return 0;
+}
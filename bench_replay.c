@@ -0,0 +1,535 @@
+/*
+ * Replay of recorded authentication traffic
+ *
+ * Plays a trace written by web3_auth.record (or, without one, a synthetic
+ * trace of REGISTER-heavy traffic) against a local mock node at the
+ * recorded pace or scaled by -s. A dispatcher process checks every request
+ * against a model of the digest cache (same set-associative layout and
+ * eviction as the module, size and TTL from -c and -t) and hands misses to
+ * -w worker processes over the completion channel. Workers encode the call
+ * data with the module's ABI encoder and send eth_calls through the
+ * io_uring client, pipelining what arrives within the -b batching window.
+ * The mock node answers each call after the RPC time recorded for it, so
+ * the replay reproduces both the arrival pattern and the node latency.
+ *
+ * Usage: bench_replay [-w workers] [-s speed] [-c cache] [-t ttl_s]
+ *                     [-b batch_ms] [trace]
+ * Without a trace it compares a few configurations. Build with: make bench
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "web3_auth.h"
+#include "web3_auth_abi.h"
+#include "web3_auth_chan.h"
+#include "web3_auth_hex.h"
+#include "web3_auth_trace.h"
+#include "web3_auth_uring.h"
+
+#define MAX_WORKERS 64
+#define MAX_BATCH 32
+#define CACHE_WAYS 4
+#define JOB_SLOTS 4096
+#define STOP UINT32_MAX
+#define REQUEST_HEAD 256        // request line and headers, at most
+
+#define SYNTH_RECORDS 20000
+#define SYNTH_RATE 8000         // requests per second
+#define SYNTH_USERS 3000
+
+typedef struct options {
+    int workers;
+    double speed;
+    int cache_size;
+    int ttl_s;
+    int batch_ms;
+} options_t;
+
+// Dispatcher to worker: one eth_call
+typedef struct job {
+    uint32_t index;
+    uint32_t rpc_us;
+    uint64_t key;
+    uint64_t user;
+    uint32_t realm;
+} job_t;
+
+// Worker to dispatcher
+typedef struct done {
+    uint32_t index;
+    int32_t ok;
+    uint64_t done_us;
+} done_t;
+
+typedef struct cache_entry {
+    uint64_t key;
+    uint64_t expires_us;
+} cache_entry_t;
+
+static const char result[] =
+    "{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":\"0x"
+    "6d64350000000000000000000000000000000000000000000000000000000000\"}";
+
+// Mock node ------------------------------------------------------------------
+
+// One request from the front of buf: its length, 0 when incomplete; the
+// JSON-RPC id carries the time the node should take
+static size_t node_request(const char* buf, size_t len, long* delay_us) {
+    const char *cl, *id;
+    size_t head = 0;
+
+    for (size_t i = 3; i < len; i++) {
+        if (buf[i] == '\n' && buf[i - 1] == '\r' && buf[i - 2] == '\n' && buf[i - 3] == '\r') {
+            head = i + 1;
+            break;
+        }
+    }
+    if (!head) return 0;
+    cl = strstr(buf, "Content-Length: ");
+    if (!cl || cl > buf + head) return head;
+    head += strtoul(cl + 16, NULL, 10);
+    if (head > len) return 0;
+    id = memchr(buf, '}', head) ? strstr(buf, "\"id\":") : NULL;
+    *delay_us = id && id < buf + head ? strtol(id + 5, NULL, 10) : 0;
+    return head;
+}
+
+// Answer each pipelined batch once its slowest call would be done
+static void node_conn(int fd) {
+    static char in[262144], out[262144];
+    size_t have = 0;
+    ssize_t got;
+
+    while ((got = read(fd, in + have, sizeof(in) - have - 1)) > 0) {
+        size_t off = 0, used = 0, req;
+        long delay = 0, slowest = 0;
+
+        have += got;
+        in[have] = '\0';
+        while ((req = node_request(in + off, have - off, &delay)) > 0) {
+            if (delay > slowest) slowest = delay;
+            used += snprintf(out + used, sizeof(out) - used,
+                    "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                    "Content-Length: %zu\r\n\r\n%s", sizeof(result) - 1, result);
+            off += req;
+        }
+        memmove(in, in + off, have - off);
+        have -= off;
+        if (slowest > 0) usleep(slowest);
+        if (used && write(fd, out, used) != (ssize_t)used) break;
+    }
+    close(fd);
+}
+
+static pid_t node_start(int* port) {
+    struct sockaddr_in addr = {.sin_family = AF_INET};
+    socklen_t alen = sizeof(addr);
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    pid_t pid;
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (lfd < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, 64) < 0
+            || getsockname(lfd, (struct sockaddr*)&addr, &alen) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    *port = ntohs(addr.sin_port);
+
+    pid = fork();
+    if (pid != 0) {
+        close(lfd);
+        return pid;
+    }
+    // Go with the bench however it ends
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    signal(SIGCHLD, SIG_IGN);
+    for (;;) {
+        int one = 1, fd = accept(lfd, NULL, NULL);
+
+        if (fd < 0) continue;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (fork() == 0) {
+            close(lfd);
+            node_conn(fd);
+            _exit(0);
+        }
+        close(fd);
+    }
+}
+
+// Traces ---------------------------------------------------------------------
+
+static int by_arrival(const void* a, const void* b) {
+    const w3_trace_rec_t* x = a;
+    const w3_trace_rec_t* y = b;
+
+    return x->t_us < y->t_us ? -1 : x->t_us > y->t_us;
+}
+
+static w3_trace_rec_t* trace_load(const char* file, long* n) {
+    w3_trace_header_t h;
+    w3_trace_rec_t* recs;
+    FILE* f = fopen(file, "rb");
+    long size;
+
+    if (!f) {
+        perror(file);
+        exit(1);
+    }
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, W3_TRACE_MAGIC, sizeof(h.magic)) != 0
+            || h.record_size != sizeof(w3_trace_rec_t)) {
+        fprintf(stderr, "%s: not a trace of this version\n", file);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f) - (long)sizeof(h);
+    fseek(f, sizeof(h), SEEK_SET);
+    *n = size / (long)sizeof(w3_trace_rec_t);
+    recs = malloc(sizeof(w3_trace_rec_t) * (*n > 0 ? *n : 1));
+    if (!recs || (long)fread(recs, sizeof(w3_trace_rec_t), *n, f) != *n) {
+        fprintf(stderr, "%s: short read\n", file);
+        exit(1);
+    }
+    fclose(f);
+
+    // Workers append as checks finish; play back in arrival order
+    qsort(recs, *n, sizeof(w3_trace_rec_t), by_arrival);
+    return recs;
+}
+
+// Poisson arrivals, a skewed user base re-registering with the same nonce a
+// few times, node time between 0.3 and 1.5 ms
+static w3_trace_rec_t* trace_synth(long n) {
+    w3_trace_rec_t* recs = calloc(n, sizeof(w3_trace_rec_t));
+    uint32_t* seen = calloc(SYNTH_USERS, sizeof(uint32_t));
+    double t = 0;
+
+    if (!recs || !seen) exit(1);
+    srand(7);
+    for (long i = 0; i < n; i++) {
+        double u = (rand() + 1.0) / ((double)RAND_MAX + 2.0);
+        uint32_t user = (uint32_t)(SYNTH_USERS * u * u * u);
+
+        t += -1e6 / SYNTH_RATE * log(u);
+        recs[i].t_us = (uint64_t)t;
+        recs[i].user = user;
+        recs[i].realm = user % 3;
+        recs[i].key = (uint64_t)user << 32 | seen[user]++ / 4;
+        recs[i].rpc_us = 300 + rand() % 1200;
+        recs[i].total_us = recs[i].rpc_us + 40;
+        recs[i].prio = user % 7 ? 0 : 1;
+        recs[i].source = W3_TRACE_RPC;
+        recs[i].result = WEB3_AUTH_OK;
+    }
+    free(seen);
+    return recs;
+}
+
+// Workers --------------------------------------------------------------------
+
+static w3_chan_t* chan_new(unsigned int slots, size_t item) {
+    size_t size = w3_chan_size(slots, item);
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    return w3_chan_init(mem, slots, item);
+}
+
+// eth_call of getDigestHash() with the hashed identities standing in for
+// the real fields; the id tells the mock node how long to take
+static size_t job_payload(const w3_abi_fn_t* fn, const job_t* j, char* out) {
+    char f[5][40];
+    w3_abi_value_t fields[5], tuple = {0};
+    char* p = out;
+
+    snprintf(f[0], sizeof(f[0]), "u%016llx", (unsigned long long)j->user);
+    snprintf(f[1], sizeof(f[1]), "r%08x.example.com", j->realm);
+    snprintf(f[2], sizeof(f[2]), "REGISTER");
+    snprintf(f[3], sizeof(f[3]), "sip:r%08x.example.com", j->realm);
+    snprintf(f[4], sizeof(f[4]), "%016llx", (unsigned long long)j->key);
+    for (int i = 0; i < 5; i++) {
+        memset(&fields[i], 0, sizeof(fields[i]));
+        fields[i].data = (const uint8_t*)f[i];
+        fields[i].len = strlen(f[i]);
+    }
+    tuple.items = fields;
+    tuple.len = 5;
+    if (w3_abi_size(&fn->args, &tuple) < 0) abort();
+
+    p += sprintf(p, "{\"jsonrpc\":\"2.0\",\"method\":\"eth_call\",\"params\":[{\"to\":"
+            "\"0x2c5f1b5c0a0c4bd1e1f7a2e2e0c1d3e1f8a4b5c6\",\"data\":\"0x");
+    w3_hex_encode(fn->selector, 4, p);
+    p = w3_abi_encode_hex(&fn->args, &tuple, p + 8);
+    p += sprintf(p, "\"},\"latest\"],\"id\":%u}", j->rpc_us);
+    return p - out;
+}
+
+static void worker(w3_chan_t* jobs, w3_chan_t* done, const char* url, int batch_ms) {
+    static char payloads[MAX_BATCH][2048];
+    const char* bodies[MAX_BATCH];
+    size_t lens[MAX_BATCH];
+    w3_uring_resp_t resp[MAX_BATCH];
+    job_t batch[MAX_BATCH];
+    done_t out[MAX_BATCH];
+    const char* err;
+    w3_abi_fn_t fn;
+
+    if (w3_abi_compile("getDigestHash(string,string,string,string,string)", &fn, &err) < 0
+            || w3_uring_init(0) < 0) {
+        _exit(2);
+    }
+    for (;;) {
+        int n = w3_chan_get(jobs, batch, MAX_BATCH, -1);
+        uint64_t until = w3_now_us() + (uint64_t)batch_ms * 1000;
+        int stop = 0;
+
+        // Gather what else arrives within the batching window
+        while (batch_ms > 0 && n < MAX_BATCH && batch[n - 1].index != STOP) {
+            uint64_t now = w3_now_us();
+            int more;
+
+            if (now >= until) break;
+            more = w3_chan_get(jobs, batch + n, MAX_BATCH - n, (int)((until - now + 999) / 1000));
+            if (more == 0) break;
+            n += more;
+        }
+        if (batch[n - 1].index == STOP) {
+            stop = 1;
+            n--;
+        }
+        for (int i = 0; i < n; i++) {
+            lens[i] = job_payload(&fn, &batch[i], payloads[i]);
+            bodies[i] = payloads[i];
+        }
+        // As many per post as the send buffer of the connection takes
+        for (int first = 0, last; first < n; first = last) {
+            size_t bytes = 0;
+            int rc;
+
+            for (last = first; last < n && bytes + REQUEST_HEAD + lens[last] <= W3_URING_SEND_SIZE;
+                    last++) {
+                bytes += REQUEST_HEAD + lens[last];
+            }
+            rc = w3_uring_post(url, bodies + first, lens + first, last - first, resp + first, 10000);
+            for (int i = first; i < last; i++) {
+                out[i].index = batch[i].index;
+                out[i].ok = rc == 0 && resp[i].status == 200;
+                out[i].done_us = w3_now_us();
+            }
+        }
+        for (int put = 0; put < n; ) put += w3_chan_put(done, out + put, n - put);
+        if (stop) break;
+    }
+    w3_uring_destroy();
+    _exit(0);
+}
+
+// Dispatcher -----------------------------------------------------------------
+
+static int cache_hit(cache_entry_t* cache, int sets, uint64_t key, uint64_t now) {
+    cache_entry_t* set = &cache[(key % sets) * CACHE_WAYS];
+
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        if (set[i].key == key && set[i].expires_us > now) return 1;
+    }
+    return 0;
+}
+
+static void cache_put(cache_entry_t* cache, int sets, uint64_t key, uint64_t expires_us) {
+    cache_entry_t* set = &cache[(key % sets) * CACHE_WAYS];
+    cache_entry_t* victim = &set[0];
+
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        if (set[i].key == key) {
+            victim = &set[i];
+            break;
+        }
+        if (set[i].expires_us < victim->expires_us) victim = &set[i];
+    }
+    victim->key = key;
+    victim->expires_us = expires_us;
+}
+
+static int by_value(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double pct(uint32_t* v, long n, double p) {
+    return n ? v[(long)(p * (n - 1))] / 1000.0 : 0;
+}
+
+static void replay(const w3_trace_rec_t* recs, long n, const options_t* o, const char* url) {
+    w3_chan_t* jobs[MAX_WORKERS];
+    pid_t pids[MAX_WORKERS];
+    w3_chan_t* done = chan_new(JOB_SLOTS, sizeof(done_t));
+    int sets = o->cache_size > CACHE_WAYS ? o->cache_size / CACHE_WAYS : 1;
+    cache_entry_t* cache = o->cache_size > 0 ? calloc(sets * CACHE_WAYS, sizeof(cache_entry_t)) : NULL;
+    uint64_t* due = malloc(sizeof(uint64_t) * n);
+    uint32_t* lat = malloc(sizeof(uint32_t) * n);
+    uint32_t* rpc_lat = malloc(sizeof(uint32_t) * n);
+    long hits = 0, calls = 0, completed = 0, failed = 0, nlat = 0, nrpc = 0;
+    uint64_t start, lag = 0, elapsed;
+    done_t d[64];
+    int status;
+
+    if (!due || !lat || !rpc_lat || (o->cache_size > 0 && !cache)) exit(1);
+    for (int w = 0; w < o->workers; w++) {
+        jobs[w] = chan_new(JOB_SLOTS, sizeof(job_t));
+        pids[w] = fork();
+        if (pids[w] == 0) worker(jobs[w], done, url, o->batch_ms);
+    }
+
+    start = w3_now_us() + 100000;   // let the workers set up their rings
+    for (long i = 0; i <= n; i++) {
+        uint64_t at = i < n ? start + (uint64_t)(recs[i].t_us / o->speed) : 0;
+
+        // Collect completions until the next arrival is due
+        for (;;) {
+            uint64_t now = w3_now_us();
+            int got, wait_ms = i == n ? 1000 : at > now + 1000 ? (int)((at - now) / 1000) : 0;
+
+            if (i == n && completed == calls) break;
+            got = w3_chan_get(done, d, 64, wait_ms);
+            for (int k = 0; k < got; k++) {
+                const w3_trace_rec_t* r = &recs[d[k].index];
+
+                if (cache) cache_put(cache, sets, r->key, d[k].done_us + o->ttl_s * 1000000ULL);
+                if (!d[k].ok) failed++;
+                lat[nlat++] = rpc_lat[nrpc++] = (uint32_t)(d[k].done_us - due[d[k].index]);
+                completed++;
+            }
+            if (i == n || got > 0) continue;
+            now = w3_now_us();
+            if (now >= at) break;
+            if (at - now < 1000) usleep(at - now);
+        }
+        if (i == n) break;
+
+        due[i] = at;
+        if (w3_now_us() - at > lag) lag = w3_now_us() - at;
+        if (cache && cache_hit(cache, sets, recs[i].key, at)) {
+            hits++;
+            lat[nlat++] = (uint32_t)(w3_now_us() - at);
+        } else {
+            job_t j = {(uint32_t)i, recs[i].rpc_us, recs[i].key, recs[i].user, recs[i].realm};
+
+            while (w3_chan_put(jobs[i % o->workers], &j, 1) != 1) usleep(50);
+            calls++;
+        }
+    }
+    elapsed = w3_now_us() - start;
+
+    for (int w = 0; w < o->workers; w++) {
+        job_t stop = {STOP, 0, 0, 0, 0};
+
+        w3_chan_put(jobs[w], &stop, 1);
+    }
+    for (int w = 0; w < o->workers; w++) {
+        if (waitpid(pids[w], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "worker failed%s\n", WEXITSTATUS(status) == 2
+                    ? ": io_uring unavailable" : "");
+            exit(1);
+        }
+    }
+
+    qsort(lat, nlat, sizeof(uint32_t), by_value);
+    qsort(rpc_lat, nrpc, sizeof(uint32_t), by_value);
+    printf("  w %2d  b %2d ms  cache %5d/%3ds  %5.1f%% hits  %6ld calls%s  "
+            "p50 %6.2f  p99 %7.2f ms (calls p50 %6.2f  p99 %7.2f)  %.2fx, lag %.1f ms\n",
+            o->workers, o->batch_ms, o->cache_size, o->ttl_s, n ? 100.0 * hits / n : 0.0,
+            calls, failed ? " (failures)" : "", pct(lat, nlat, 0.5), pct(lat, nlat, 0.99),
+            pct(rpc_lat, nrpc, 0.5), pct(rpc_lat, nrpc, 0.99),
+            elapsed ? (double)recs[n - 1].t_us / elapsed : 0.0, lag / 1000.0);
+
+    free(cache);
+    free(due);
+    free(lat);
+    free(rpc_lat);
+}
+
+// What the trace itself says, to compare the replay with
+static void trace_summary(const w3_trace_rec_t* recs, long n) {
+    uint32_t* total = malloc(sizeof(uint32_t) * (n > 0 ? n : 1));
+    long rpc = 0;
+
+    if (!total) exit(1);
+    for (long i = 0; i < n; i++) {
+        total[i] = recs[i].total_us;
+        if (recs[i].source == W3_TRACE_RPC) rpc++;
+    }
+    qsort(total, n, sizeof(uint32_t), by_value);
+    printf("  recorded: %ld checks over %.1f s, %.1f%% went to the node, p50 %.2f  p99 %.2f ms\n",
+            n, n ? recs[n - 1].t_us / 1e6 : 0.0, n ? 100.0 * rpc / n : 0.0,
+            pct(total, n, 0.5), pct(total, n, 0.99));
+    free(total);
+}
+
+int main(int argc, char** argv) {
+    options_t o = {.workers = 4, .speed = 1.0, .cache_size = 4096, .ttl_s = 60, .batch_ms = 0};
+    w3_trace_rec_t* recs;
+    char url[64];
+    long n;
+    int opt, port, status;
+    pid_t node;
+
+    while ((opt = getopt(argc, argv, "w:s:c:t:b:")) != -1) {
+        switch (opt) {
+            case 'w': o.workers = atoi(optarg); break;
+            case 's': o.speed = atof(optarg); break;
+            case 'c': o.cache_size = atoi(optarg); break;
+            case 't': o.ttl_s = atoi(optarg); break;
+            case 'b': o.batch_ms = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-w workers] [-s speed] [-c cache] [-t ttl_s] "
+                        "[-b batch_ms] [trace]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (o.workers < 1 || o.workers > MAX_WORKERS || o.speed <= 0 || o.batch_ms < 0) {
+        fprintf(stderr, "workers must be 1 to %d, speed above 0\n", MAX_WORKERS);
+        return 1;
+    }
+
+    // Load the trace first so that a bad one does not leave the node behind
+    recs = optind < argc ? trace_load(argv[optind], &n) : trace_synth(n = SYNTH_RECORDS);
+    node = node_start(&port);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/", port);
+
+    if (optind < argc) {
+        printf("replay of %s at %.2fx\n", argv[optind], o.speed);
+        trace_summary(recs, n);
+        if (n > 0) replay(recs, n, &o, url);
+    } else {
+        static const options_t runs[] = {
+            {4, 1.0, 0, 60, 0}, {4, 1.0, 4096, 60, 0}, {4, 1.0, 4096, 60, 2},
+            {8, 1.0, 4096, 60, 0}, {2, 1.0, 4096, 60, 2},
+        };
+
+        printf("replay of a synthetic trace, %d requests/s from %d users\n",
+                SYNTH_RATE, SYNTH_USERS);
+        trace_summary(recs, n);
+        for (size_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++) replay(recs, n, &runs[r], url);
+    }
+
+    free(recs);
+    kill(node, SIGTERM);
+    waitpid(node, &status, 0);
+    return 0;
+}
@@ -0,0 +1,369 @@
+/*
+ * Test of the ABI encoder and decoder
+ *
+ * Encodes the examples of the Solidity ABI specification and compares
+ * getDigestHash(string,string,string,string,string) byte for byte with the
+ * encoder the module used before signatures were configurable, with and
+ * without the memo, over fields of every length up to three words. Results
+ * that are truncated or point outside themselves must not decode, and
+ * malformed signatures must not compile. Build and run with: make check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "web3_auth_abi.h"
+#include "web3_auth_hex.h"
+#include "web3_auth_keccak.h"
+#include "test_util.h"
+
+#define LEGACY_ARGS 5
+#define LEGACY_CALLS 2000
+#define HEX_SIZE 8192
+
+static char hex[HEX_SIZE];
+
+static void compile(const char* signature, w3_abi_fn_t* fn) {
+    const char* err = NULL;
+
+    if (w3_abi_compile(signature, fn, &err) < 0) {
+        fprintf(stderr, "    cannot compile %s: %s\n", signature, err);
+        exit(1);
+    }
+}
+
+// Selector and arguments as hex, as they go into the request
+static const char* encode(const w3_abi_fn_t* fn, const w3_abi_value_t* tuple) {
+    long size = w3_abi_size(&fn->args, tuple);
+    char* end;
+
+    if (size < 0 || 8 + 2 * size >= HEX_SIZE) return "";
+    w3_hex_encode(fn->selector, 4, hex);
+    end = w3_abi_encode_hex(&fn->args, tuple, hex + 8);
+    *end = '\0';
+    return end - hex == 8 + 2 * size ? hex : "";
+}
+
+static int same(const char* got, const char* want) {
+    if (strcmp(got, want) == 0) return 1;
+    fprintf(stderr, "    got  %s\n    want %s\n", got, want);
+    return 0;
+}
+
+// Slot of a hand-written result
+static void word(uint8_t* buf, size_t at, uint64_t v) {
+    memset(buf + at, 0, 32);
+    for (int i = 31; v; i--, v >>= 8) buf[at + i] = (uint8_t)v;
+}
+
+// Encoder of the module before signatures were configurable -----------------
+
+static size_t legacy_padded_len(size_t len) {
+    return (len + 31) & ~(size_t)31;
+}
+
+static char* legacy_write_word(char* out, uint64_t v) {
+    uint8_t be[8];
+
+    for (int i = 7; i >= 0; i--, v >>= 8) be[i] = (uint8_t)v;
+    memset(out, '0', 48);
+    w3_hex_encode(be, sizeof(be), out + 48);
+    return out + 64;
+}
+
+static char* legacy_encode(char* out, const char* selector,
+        const char* const args[LEGACY_ARGS], const size_t lens[LEGACY_ARGS]) {
+    size_t offset = 32 * LEGACY_ARGS;
+
+    memcpy(out, selector, 8);
+    out += 8;
+    for (int i = 0; i < LEGACY_ARGS; i++) {
+        out = legacy_write_word(out, offset);
+        offset += 32 + legacy_padded_len(lens[i]);
+    }
+    for (int i = 0; i < LEGACY_ARGS; i++) {
+        size_t pad = legacy_padded_len(lens[i]) - lens[i];
+
+        out = legacy_write_word(out, lens[i]);
+        w3_hex_encode((const uint8_t*)args[i], lens[i], out);
+        out += 2 * lens[i];
+        memset(out, '0', 2 * pad);
+        out += 2 * pad;
+    }
+    return out;
+}
+
+// Scenarios ----------------------------------------------------------------
+
+// The examples of the ABI specification
+static void spec_examples(void) {
+    static const w3_abi_value_t u32s[] = {{.num = 0x456}, {.num = 0x789}};
+    static const w3_abi_value_t row1[] = {{.num = 1}, {.num = 2}}, row2[] = {{.num = 3}};
+    static const w3_abi_value_t rows[] = {{.items = row1, .len = 2}, {.items = row2, .len = 1}};
+    static const w3_abi_value_t strings[] = {
+        {.data = (const uint8_t*)"one", .len = 3},
+        {.data = (const uint8_t*)"two", .len = 3},
+        {.data = (const uint8_t*)"three", .len = 5},
+    };
+    static const w3_abi_value_t numbers[] = {{.num = 1}, {.num = 2}, {.num = 3}};
+    const w3_abi_value_t f_args[] = {
+        {.num = 0x123},
+        {.items = u32s, .len = 2},
+        {.data = (const uint8_t*)"1234567890", .len = 10},
+        {.data = (const uint8_t*)"Hello, world!", .len = 13},
+    };
+    const w3_abi_value_t g_args[] = {{.items = rows, .len = 2}, {.items = strings, .len = 3}};
+    const w3_abi_value_t sam_args[] = {
+        {.data = (const uint8_t*)"dave", .len = 4}, {.num = 1}, {.items = numbers, .len = 3},
+    };
+    const w3_abi_value_t baz_args[] = {{.num = 69}, {.num = 1}};
+    w3_abi_value_t tuple = {0};
+    w3_abi_fn_t fn;
+
+    compile("f(uint256,uint32[],bytes10,bytes)", &fn);
+    tuple.items = f_args;
+    tuple.len = 4;
+    CHECK(same(encode(&fn, &tuple), "8be65246"
+            "0000000000000000000000000000000000000000000000000000000000000123"
+            "0000000000000000000000000000000000000000000000000000000000000080"
+            "3132333435363738393000000000000000000000000000000000000000000000"
+            "00000000000000000000000000000000000000000000000000000000000000e0"
+            "0000000000000000000000000000000000000000000000000000000000000002"
+            "0000000000000000000000000000000000000000000000000000000000000456"
+            "0000000000000000000000000000000000000000000000000000000000000789"
+            "000000000000000000000000000000000000000000000000000000000000000d"
+            "48656c6c6f2c20776f726c642100000000000000000000000000000000000000"));
+
+    compile("g(uint256[][],string[])", &fn);
+    tuple.items = g_args;
+    tuple.len = 2;
+    CHECK(same(encode(&fn, &tuple), "2289b18c"
+            "0000000000000000000000000000000000000000000000000000000000000040"
+            "0000000000000000000000000000000000000000000000000000000000000140"
+            "0000000000000000000000000000000000000000000000000000000000000002"
+            "0000000000000000000000000000000000000000000000000000000000000040"
+            "00000000000000000000000000000000000000000000000000000000000000a0"
+            "0000000000000000000000000000000000000000000000000000000000000002"
+            "0000000000000000000000000000000000000000000000000000000000000001"
+            "0000000000000000000000000000000000000000000000000000000000000002"
+            "0000000000000000000000000000000000000000000000000000000000000001"
+            "0000000000000000000000000000000000000000000000000000000000000003"
+            "0000000000000000000000000000000000000000000000000000000000000003"
+            "0000000000000000000000000000000000000000000000000000000000000060"
+            "00000000000000000000000000000000000000000000000000000000000000a0"
+            "00000000000000000000000000000000000000000000000000000000000000e0"
+            "0000000000000000000000000000000000000000000000000000000000000003"
+            "6f6e650000000000000000000000000000000000000000000000000000000000"
+            "0000000000000000000000000000000000000000000000000000000000000003"
+            "74776f0000000000000000000000000000000000000000000000000000000000"
+            "0000000000000000000000000000000000000000000000000000000000000005"
+            "7468726565000000000000000000000000000000000000000000000000000000"));
+
+    compile("sam(bytes,bool,uint256[])", &fn);
+    tuple.items = sam_args;
+    tuple.len = 3;
+    CHECK(same(encode(&fn, &tuple), "a5643bf2"
+            "0000000000000000000000000000000000000000000000000000000000000060"
+            "0000000000000000000000000000000000000000000000000000000000000001"
+            "00000000000000000000000000000000000000000000000000000000000000a0"
+            "0000000000000000000000000000000000000000000000000000000000000004"
+            "6461766500000000000000000000000000000000000000000000000000000000"
+            "0000000000000000000000000000000000000000000000000000000000000003"
+            "0000000000000000000000000000000000000000000000000000000000000001"
+            "0000000000000000000000000000000000000000000000000000000000000002"
+            "0000000000000000000000000000000000000000000000000000000000000003"));
+
+    compile("baz(uint32,bool)", &fn);
+    tuple.items = baz_args;
+    tuple.len = 2;
+    CHECK(same(encode(&fn, &tuple), "cdcd77c0"
+            "0000000000000000000000000000000000000000000000000000000000000045"
+            "0000000000000000000000000000000000000000000000000000000000000001"));
+
+    // Values that do not fit their types
+    tuple.items = (const w3_abi_value_t[]){{.num = 1ull << 32}, {.num = 1}};
+    CHECK(w3_abi_size(&fn.args, &tuple) < 0);
+    tuple.items = (const w3_abi_value_t[]){{.num = 69}, {.num = 2}};
+    CHECK(w3_abi_size(&fn.args, &tuple) < 0);
+    tuple.len = 1;
+    CHECK(w3_abi_size(&fn.args, &tuple) < 0);
+}
+
+// Fields of every length from 0 to 96 bytes, also bytes that are not ASCII;
+// memo set: realm and method come from a few values, as in real traffic
+static void legacy_calls(int memo) {
+    static const char* const realms[] = {"sip.example.com", "voice.example.org", "p.example.net"};
+    static const char* const methods[] = {"REGISTER", "INVITE", "SUBSCRIBE"};
+    static char fields[LEGACY_ARGS][97];
+    static char want[HEX_SIZE];
+    const char* args[LEGACY_ARGS];
+    size_t lens[LEGACY_ARGS];
+    w3_abi_value_t values[LEGACY_ARGS], tuple = {0};
+    char selector[8];
+    unsigned long lookups, hits;
+    w3_abi_fn_t fn;
+    char* end;
+    int differ = 0;
+
+    compile("getDigestHash(string,string,string,string,string)", &fn);
+    w3_hex_encode(fn.selector, 4, selector);
+    w3_abi_memo_enable(memo);
+
+    for (int call = 0; call < LEGACY_CALLS; call++) {
+        for (int i = 0; i < LEGACY_ARGS; i++) {
+            lens[i] = (size_t)(call * (7 + 6 * i) + i) % 97;
+            for (size_t k = 0; k < lens[i]; k++) fields[i][k] = (char)(call + 31 * i + k * 89);
+            args[i] = fields[i];
+        }
+        if (memo) {
+            args[1] = realms[call % 3];
+            args[2] = methods[call % 7 % 3];
+            lens[1] = strlen(args[1]);
+            lens[2] = strlen(args[2]);
+        }
+        for (int i = 0; i < LEGACY_ARGS; i++) {
+            values[i] = (w3_abi_value_t){.data = (const uint8_t*)args[i], .len = lens[i]};
+        }
+        tuple.items = values;
+        tuple.len = LEGACY_ARGS;
+
+        end = legacy_encode(want, selector, args, lens);
+        *end = '\0';
+        if (strcmp(encode(&fn, &tuple), want) != 0 && differ++ < 3) {
+            fprintf(stderr, "    call %d: lengths %zu %zu %zu %zu %zu\n", call, lens[0], lens[1],
+                    lens[2], lens[3], lens[4]);
+        }
+    }
+    CHECK(differ == 0);
+
+    w3_abi_memo_stats(&lookups, &hits);
+    // Realm and method hit but for their first values
+    if (memo) CHECK(hits > 2 * LEGACY_CALLS - 10);
+    else CHECK(lookups == 0);
+}
+
+static void legacy_plain(void) {
+    legacy_calls(0);
+}
+
+static void legacy_memo(void) {
+    legacy_calls(1);
+}
+
+static void malformed_results(void) {
+    uint8_t buf[256];
+    w3_abi_value_t out[W3_ABI_MAX_ARGS];
+    w3_abi_fn_t b32, str, pair, arr;
+
+    compile("f()", &b32);
+    compile("f()(string)", &str);
+    compile("f()(bytes,uint256)", &pair);
+    compile("f()(uint256[])", &arr);
+
+    // bytes32, the default return
+    memset(buf, 0xab, 32);
+    CHECK(w3_abi_decode(&b32.returns, buf, 32, out) == 1 && out[0].data == buf
+            && out[0].len == 32);
+    CHECK(w3_abi_decode(&b32.returns, buf, 31, out) < 0);
+    CHECK(w3_abi_decode(&b32.returns, buf, 0, out) < 0);
+
+    // string "hello"
+    word(buf, 0, 32);
+    word(buf, 32, 5);
+    memset(buf + 64, 0, 32);
+    memcpy(buf + 64, "hello", 5);
+    CHECK(w3_abi_decode(&str.returns, buf, 96, out) == 1 && out[0].len == 5
+            && memcmp(out[0].data, "hello", 5) == 0);
+    CHECK(w3_abi_decode(&str.returns, buf, 68, out) < 0);         // cut inside the text
+    CHECK(w3_abi_decode(&str.returns, buf, 64, out) < 0);
+    CHECK(w3_abi_decode(&str.returns, buf, 32, out) < 0);         // no length slot
+
+    // Offsets past the end, straddling it or too large to be one
+    word(buf, 0, 0x1000);
+    CHECK(w3_abi_decode(&str.returns, buf, 96, out) < 0);
+    word(buf, 0, 80);
+    CHECK(w3_abi_decode(&str.returns, buf, 96, out) < 0);
+    word(buf, 0, 32);
+    buf[0] = 1;
+    CHECK(w3_abi_decode(&str.returns, buf, 96, out) < 0);
+    word(buf, 0, 32);
+
+    // Lengths past the end or too large to be one
+    word(buf, 32, 33);
+    CHECK(w3_abi_decode(&str.returns, buf, 96, out) < 0);
+    word(buf, 32, 1ull << 40);
+    CHECK(w3_abi_decode(&str.returns, buf, 96, out) < 0);
+    word(buf, 32, 0);
+    buf[40] = 0x80;
+    CHECK(w3_abi_decode(&str.returns, buf, 96, out) < 0);
+
+    // Empty string ending the result
+    word(buf, 32, 0);
+    CHECK(w3_abi_decode(&str.returns, buf, 64, out) == 1 && out[0].len == 0);
+
+    // (bytes, uint256): both head slots are needed
+    word(buf, 0, 64);
+    word(buf, 32, 7);
+    word(buf, 64, 2);
+    memset(buf + 96, 0, 32);
+    buf[96] = 0xde;
+    buf[97] = 0xad;
+    CHECK(w3_abi_decode(&pair.returns, buf, 128, out) == 2 && out[0].len == 2
+            && out[0].data == buf + 96 && out[1].num == 7);
+    CHECK(w3_abi_decode(&pair.returns, buf, 32, out) < 0);
+
+    // uint256[] of two, then claiming three
+    word(buf, 0, 32);
+    word(buf, 32, 2);
+    word(buf, 64, 10);
+    word(buf, 96, 11);
+    CHECK(w3_abi_decode(&arr.returns, buf, 128, out) == 1 && out[0].len == 2
+            && out[0].data == buf + 64);
+    word(buf, 32, 3);
+    CHECK(w3_abi_decode(&arr.returns, buf, 128, out) < 0);
+    word(buf, 32, 1ull << 30);
+    CHECK(w3_abi_decode(&arr.returns, buf, 128, out) < 0);
+}
+
+static void signatures(void) {
+    static const char* const bad[] = {
+        "f(uint7)", "f(uint264)", "f(bytes33)", "f(float)", "f(uint256", "(uint256)",
+        "f(string,)", "f(uint256[x])", "f()(bytes32)x", "f()bytes32",
+    };
+    const char* err;
+    uint8_t hash[32];
+    w3_abi_fn_t fn;
+
+    compile("getDigestHash(string, string,string,\tstring,string)", &fn);
+    CHECK(strcmp(fn.canonical, "getDigestHash(string,string,string,string,string)") == 0);
+    keccak256((const uint8_t*)fn.canonical, strlen(fn.canonical), hash);
+    CHECK(memcmp(fn.selector, hash, 4) == 0);
+    CHECK(w3_abi_count(&fn.args) == 5 && w3_abi_count(&fn.returns) == 1);
+    CHECK(w3_abi_component(&fn.returns, 0)->kind == W3_ABI_BYTESN);
+
+    compile("f(uint,int8[2],(bool,address)[],tuple(bytes))(bytes16,string)", &fn);
+    CHECK(strcmp(fn.canonical, "f(uint256,int8[2],(bool,address)[],(bytes))") == 0);
+    CHECK(w3_abi_component(&fn.args, 2)->dynamic && !w3_abi_component(&fn.args, 1)->dynamic);
+    CHECK(w3_abi_component(&fn.args, 1)->head == 64);
+    CHECK(w3_abi_count(&fn.returns) == 2 && !w3_abi_component(&fn.returns, 2));
+
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        err = NULL;
+        CHECK(w3_abi_compile(bad[i], &fn, &err) < 0 && err);
+    }
+}
+
+int main(void) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("ABI encoder and decoder\n");
+
+    run("Solidity ABI specification examples", spec_examples);
+    run("getDigestHash against the 5-string encoder", legacy_plain);
+    run("getDigestHash against the 5-string encoder, memo", legacy_memo);
+    run("truncated results, bad offsets and lengths", malformed_results);
+    run("signatures: canonical form, malformed", signatures);
+
+    printf("%s\n", failed_scenarios ? "FAILED" : "ok");
+    return failed_scenarios != 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * Test of the EVM interpreter
+ *
+ * Runs the cases test_evm_gen.py computes from the definitions of the
+ * opcodes: calls of a hand-assembled contract in the shape of the
+ * credentials contract, which must return the digest or revert with its
+ * reason, and 75,000 arithmetic cases of 25 opcodes, each of which must
+ * return its word. Missing storage, bad jumps, stack underflow, the step
+ * limit and opcodes outside the subset must end the run without a result.
+ * Build and run with: make check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "web3_auth_evm.h"
+#include "web3_auth_hex.h"
+#include "test_util.h"
+
+#define CASES "test_evm_cases.txt"
+#define LINE_MAX_LEN 8192
+#define MAX_WORDS 16
+#define MAX_CALLS 16
+
+typedef struct call {
+    uint8_t data[LINE_MAX_LEN / 2];
+    size_t len;
+    int outcome;
+    uint8_t want[LINE_MAX_LEN / 2];
+    size_t want_len;
+} call_t;
+
+static uint8_t code[W3_EVM_MAX_CODE];
+static size_t code_len;
+static uint8_t slots[MAX_WORDS][32], words[MAX_WORDS][32];
+static int nwords;
+static call_t calls[MAX_CALLS];
+static int ncalls;
+static FILE* cases;
+
+static int read_line(char* line) {
+    if (!fgets(line, LINE_MAX_LEN, cases)) return -1;
+    line[strcspn(line, "\n")] = 0;
+    return 0;
+}
+
+static void malformed(void) {
+    fprintf(stderr, CASES " is malformed, run make check to generate it again\n");
+    exit(1);
+}
+
+static int decode(const char* hex, uint8_t* out, size_t size, size_t* len) {
+    size_t digits = strlen(hex);
+
+    if (digits % 2 || digits / 2 > size || w3_hex_decode(hex, digits, out) < 0) return -1;
+    *len = digits / 2;
+    return 0;
+}
+
+// The contract part of the cases; the arithmetic ones follow
+static void read_contract(void) {
+    char line[LINE_MAX_LEN];
+    char* sp;
+    size_t len;
+
+    if (read_line(line) < 0 || decode(line, code, sizeof(code), &code_len) < 0) malformed();
+    if (read_line(line) < 0 || (nwords = atoi(line)) <= 0 || nwords > MAX_WORDS) malformed();
+    for (int i = 0; i < nwords; i++) {
+        if (read_line(line) < 0 || strlen(line) != 129 || w3_hex_decode(line, 64, slots[i]) < 0
+                || w3_hex_decode(line + 65, 64, words[i]) < 0) {
+            malformed();
+        }
+    }
+    if (read_line(line) < 0 || (ncalls = atoi(line)) <= 0 || ncalls > MAX_CALLS) malformed();
+    for (int i = 0; i < ncalls; i++) {
+        call_t* c = &calls[i];
+
+        if (read_line(line) < 0 || !(sp = strchr(line, ' ')) || (sp[1] != 'R' && sp[1] != 'V')
+                || sp[2] != ' ') {
+            malformed();
+        }
+        *sp = 0;
+        c->outcome = sp[1] == 'R' ? W3_EVM_RETURN : W3_EVM_REVERT;
+        if (decode(line, c->data, sizeof(c->data), &c->len) < 0
+                || decode(sp + 3, c->want, sizeof(c->want), &len) < 0) {
+            malformed();
+        }
+        c->want_len = len;
+    }
+}
+
+static int missing_slot;            // sload fails for every slot
+
+// slot and value may be the same buffer
+static int sload(void* ctx, const uint8_t slot[32], uint8_t value[32]) {
+    (void)ctx;
+    if (missing_slot) return -1;
+    for (int i = 0; i < nwords; i++) {
+        if (memcmp(slots[i], slot, 32) == 0) {
+            memcpy(value, words[i], 32);
+            return 0;
+        }
+    }
+    memset(value, 0, 32);
+    return 0;
+}
+
+static int run_code(const uint8_t* c, size_t len, const uint8_t* calldata, size_t calldata_len,
+        uint8_t* out, size_t out_size, size_t* out_len) {
+    static uint8_t jumpdests[(W3_EVM_MAX_CODE + 7) / 8];
+    w3_evm_env_t env = {
+        .code = c, .code_len = len, .jumpdests = jumpdests,
+        .calldata = calldata, .calldata_len = calldata_len, .sload = sload,
+    };
+
+    w3_evm_analyze(c, len, jumpdests);
+    return w3_evm_run(&env, out, out_size, out_len);
+}
+
+// Scenarios ----------------------------------------------------------------
+
+static void contract_calls(void) {
+    uint8_t out[512];
+    size_t len;
+
+    for (int i = 0; i < ncalls; i++) {
+        int rc = run_code(code, code_len, calls[i].data, calls[i].len, out, sizeof(out), &len);
+
+        CHECK(rc == calls[i].outcome);
+        CHECK(len == calls[i].want_len && memcmp(out, calls[i].want, len) == 0);
+        if (rc != calls[i].outcome) fprintf(stderr, "    call %d: %s\n", i, w3_evm_name(rc));
+    }
+}
+
+static void contract_missing_storage(void) {
+    uint8_t out[512];
+    size_t len;
+
+    missing_slot = 1;
+    CHECK(run_code(code, code_len, calls[0].data, calls[0].len, out, sizeof(out), &len)
+            == W3_EVM_MISSING);
+}
+
+static void faults(void) {
+    static const uint8_t bad_jump[] = {0x60, 0x03, 0x56, 0x00};           // into no JUMPDEST
+    static const uint8_t into_push[] = {0x60, 0x04, 0x56, 0x61, 0x5b, 0x00}; // 0x5b is data
+    static const uint8_t underflow[] = {0x60, 0x01, 0x01};
+    static const uint8_t endless[] = {0x5b, 0x5f, 0x56};
+    static const uint8_t invalid[] = {0xfe};
+    static const uint8_t sstore[] = {0x5f, 0x5f, 0x55};
+    uint8_t out[32];
+    size_t len;
+
+    CHECK(run_code(bad_jump, sizeof(bad_jump), NULL, 0, out, sizeof(out), &len) == W3_EVM_FAULT);
+    CHECK(run_code(into_push, sizeof(into_push), NULL, 0, out, sizeof(out), &len) == W3_EVM_FAULT);
+    CHECK(run_code(underflow, sizeof(underflow), NULL, 0, out, sizeof(out), &len) == W3_EVM_FAULT);
+    CHECK(run_code(endless, sizeof(endless), NULL, 0, out, sizeof(out), &len) == W3_EVM_FAULT);
+    CHECK(run_code(invalid, sizeof(invalid), NULL, 0, out, sizeof(out), &len) == W3_EVM_FAULT);
+    CHECK(run_code(sstore, sizeof(sstore), NULL, 0, out, sizeof(out), &len)
+            == W3_EVM_UNSUPPORTED);
+}
+
+static void arithmetic(void) {
+    char line[LINE_MAX_LEN];
+    uint8_t c[LINE_MAX_LEN / 2], want[32], out[64];
+    size_t len, out_len;
+    int n = 0, bad = 0;
+    char* sp;
+
+    while (read_line(line) == 0) {
+        if (!(sp = strchr(line, ' ')) || strlen(sp + 1) != 64) malformed();
+        *sp = 0;
+        if (decode(line, c, sizeof(c), &len) < 0 || len < 7
+                || w3_hex_decode(sp + 1, 64, want) < 0) {
+            malformed();
+        }
+        n++;
+        if (run_code(c, len, NULL, 0, out, sizeof(out), &out_len) != W3_EVM_RETURN
+                || out_len != 32 || memcmp(out, want, 32) != 0) {
+            // The opcode precedes the 6 bytes that return its result
+            if (bad++ < 10) fprintf(stderr, "    opcode %02x: %s\n", c[len - 7], sp + 1);
+        }
+    }
+    CHECK(bad == 0);
+    CHECK(n >= 75000);
+    printf("  %d arithmetic cases, %d wrong\n", n, bad);
+}
+
+int main(void) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    cases = fopen(CASES, "r");
+    if (!cases) {
+        fprintf(stderr, "Cannot open " CASES ", run make check to generate it\n");
+        return 1;
+    }
+    read_contract();
+    printf("EVM interpreter against " CASES "\n");
+
+    run("contract: found, long realm, not found, no such function", contract_calls);
+    run("contract: storage word missing from the snapshot", contract_missing_storage);
+    run("bad jumps, underflow, step limit, INVALID, SSTORE", faults);
+    run("arithmetic opcodes", arithmetic);
+    fclose(cases);
+
+    printf("%s\n", failed_scenarios ? "FAILED" : "ok");
+    return failed_scenarios != 0;
+}
@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+"""Generator of the cases of test_evm.
+
+Prints a hand-assembled contract in the shape of the credentials contract,
+then arithmetic cases, with results computed here from the definitions of
+the opcodes rather than by the module:
+
+  contract code
+  number of storage words, then "slot value" per line
+  number of calls, then "calldata R|V data" per line (RETURN or REVERT)
+  "code result" per arithmetic case, to the end
+
+Each arithmetic case pushes the operands of one opcode, runs it and returns
+the word. Operands mix edge values, short and full words; the seed is
+fixed, so the output is the same on every run.
+
+  test_evm_gen.py > test_evm_cases.txt
+"""
+
+import random
+
+from test_keccak import keccak
+
+CASES_PER_OPCODE = 3000
+
+# Contract -------------------------------------------------------------------
+
+OPS = {
+    "STOP": 0x00, "ADD": 0x01, "SUB": 0x03, "DIV": 0x04, "LT": 0x10, "EQ": 0x14, "ISZERO": 0x15,
+    "AND": 0x16, "SHL": 0x1b, "SHR": 0x1c, "KECCAK256": 0x20, "CALLVALUE": 0x34,
+    "CALLDATALOAD": 0x35, "CALLDATASIZE": 0x36, "CALLDATACOPY": 0x37, "RETURNDATASIZE": 0x3d,
+    "POP": 0x50, "MLOAD": 0x51, "MSTORE": 0x52, "SLOAD": 0x54, "JUMP": 0x56, "JUMPI": 0x57,
+    "GAS": 0x5a, "JUMPDEST": 0x5b, "MCOPY": 0x5e, "PUSH0": 0x5f, "RETURN": 0xf3,
+    "STATICCALL": 0xfa, "REVERT": 0xfd,
+}
+for i in range(1, 17):
+    OPS["DUP%d" % i] = 0x7f + i
+    OPS["SWAP%d" % i] = 0x8f + i
+
+
+def assemble(src):
+    """Opcodes by name, numbers as the shortest PUSH, "name:" a JUMPDEST
+    and "@name" its address as PUSH2."""
+    labels = {}
+    for _ in range(2):
+        out = bytearray()
+        for t in src.split():
+            if t.endswith(":"):
+                labels[t[:-1]] = len(out)
+                out.append(OPS["JUMPDEST"])
+            elif t.startswith("@"):
+                out.append(0x61)
+                out += labels.get(t[1:], 0).to_bytes(2, "big")
+            elif t.startswith("0x") or t.isdigit():
+                v = int(t, 0)
+                b = v.to_bytes(max(1, (v.bit_length() + 7) // 8), "big")
+                out.append(0x5f + len(b))
+                out += b
+            else:
+                out.append(OPS[t])
+    return bytes(out)
+
+
+SELECTOR = keccak(b"getDigestHash(string,string,string,string,string)")[:4]
+ERROR = keccak(b"Error(string)")[:4]
+
+# getDigestHash(username, realm, ...): the secret hash of the user is in
+# the mapping at slot 0; returns keccak256(hash . realm) through the
+# identity precompile, or reverts with Error("User not found")
+CONTRACT = assemble(f"""
+    CALLVALUE ISZERO @payable JUMPI 0 0 REVERT
+payable:
+    0 CALLDATALOAD 224 SHR 0x{SELECTOR.hex()} EQ @main JUMPI 0 0 REVERT
+main:
+    4 CALLDATALOAD 4 ADD DUP1 CALLDATALOAD
+    SWAP1 32 ADD
+    DUP2 SWAP1 0x80 CALLDATACOPY
+    0 DUP2 0x80 ADD MSTORE
+    32 ADD 0x80 KECCAK256
+    SLOAD DUP1 @found JUMPI
+    0x{ERROR.hex()} 224 SHL 0 MSTORE 32 4 MSTORE 14 36 MSTORE
+    0x{b"User not found".hex()} 144 SHL 68 MSTORE 100 0 REVERT
+found:
+    0 MSTORE
+    36 CALLDATALOAD 4 ADD DUP1 CALLDATALOAD SWAP1 32 ADD DUP2 SWAP1 32 CALLDATACOPY
+    32 ADD 0 KECCAK256
+    0 MSTORE
+    0x20 0x40 0x20 0 4 GAS STATICCALL POP
+    RETURNDATASIZE 0x40 RETURN
+""")
+
+
+def encode_call(args):
+    head, tail, off = b"", b"", 32 * len(args)
+    for a in args:
+        head += off.to_bytes(32, "big")
+        t = len(a).to_bytes(32, "big") + a + b"\0" * ((-len(a)) % 32)
+        tail += t
+        off += len(t)
+    return SELECTOR + head + tail
+
+
+def contract():
+    users = {b"alice": keccak(b"secret-a"), b"bob": keccak(b"secret-b")}
+    print(CONTRACT.hex())
+    print(len(users))
+    for user, secret in users.items():
+        print(keccak(user + b"\0" * 32).hex(), secret.hex())
+    calls = [
+        [b"alice", b"sip.example.com", b"REGISTER", b"sip:x", b"n1"],
+        [b"bob", b"r" * 70, b"INVITE", b"sip:y", b"n2"],
+        [b"carol", b"x", b"y", b"z", b"w"],
+    ]
+    print(len(calls) + 1)
+    for c in calls:
+        if c[0] in users:
+            print(encode_call(c).hex(), "R", keccak(users[c[0]] + c[1]).hex())
+        else:
+            reason = b"User not found"
+            print(encode_call(c).hex(), "V", (ERROR + (32).to_bytes(32, "big")
+                  + len(reason).to_bytes(32, "big") + reason + b"\0" * 18).hex())
+    # Unknown selector: REVERT without data
+    print("12345678", "V", "")
+
+# Arithmetic -----------------------------------------------------------------
+
+
+M = 2**256
+
+
+def signed(x):
+    return x - M if x >> 255 else x
+
+
+def word(x):
+    return x % M
+
+
+def sdiv(a, b):
+    if b == 0:
+        return 0
+    q = abs(signed(a)) // abs(signed(b))
+    return word(-q if (signed(a) < 0) != (signed(b) < 0) else q)
+
+
+def smod(a, b):
+    if b == 0:
+        return 0
+    r = abs(signed(a)) % abs(signed(b))
+    return word(-r if signed(a) < 0 else r)
+
+
+def signextend(b, x):
+    if b >= 31:
+        return x
+    bit = b * 8 + 7
+    if (x >> bit) & 1:
+        return word(x | (M - (1 << (bit + 1))))
+    return x & ((1 << (bit + 1)) - 1)
+
+
+def byte(i, x):
+    return (x >> (8 * (31 - i))) & 0xff if i < 32 else 0
+
+
+def sar(n, x):
+    if n >= 256:
+        return M - 1 if x >> 255 else 0
+    return word(signed(x) >> n)
+
+
+# Opcode: (operands, result), operands in stack order from the top
+ARITHMETIC = {
+    0x01: (2, lambda a, b: word(a + b)),
+    0x02: (2, lambda a, b: word(a * b)),
+    0x03: (2, lambda a, b: word(a - b)),
+    0x04: (2, lambda a, b: a // b if b else 0),
+    0x05: (2, sdiv),
+    0x06: (2, lambda a, b: a % b if b else 0),
+    0x07: (2, smod),
+    0x08: (3, lambda a, b, m: (a + b) % m if m else 0),
+    0x09: (3, lambda a, b, m: (a * b) % m if m else 0),
+    0x0a: (2, lambda a, b: pow(a, b, M)),
+    0x0b: (2, signextend),
+    0x10: (2, lambda a, b: int(a < b)),
+    0x11: (2, lambda a, b: int(a > b)),
+    0x12: (2, lambda a, b: int(signed(a) < signed(b))),
+    0x13: (2, lambda a, b: int(signed(a) > signed(b))),
+    0x14: (2, lambda a, b: int(a == b)),
+    0x15: (1, lambda a: int(a == 0)),
+    0x16: (2, lambda a, b: a & b),
+    0x17: (2, lambda a, b: a | b),
+    0x18: (2, lambda a, b: a ^ b),
+    0x19: (1, lambda a: M - 1 - a),
+    0x1a: (2, byte),
+    0x1b: (2, lambda n, x: word(x << n) if n < 256 else 0),
+    0x1c: (2, lambda n, x: x >> n if n < 256 else 0),
+    0x1d: (2, sar),
+}
+EDGES = [0, 1, 2, 3, 7, 31, 32, 255, 256, 2**64 - 1, 2**64, 2**128 + 5, 2**255 - 1, 2**255,
+         M - 2, M - 1]
+
+
+def operand(op, i):
+    r = random.random()
+    # Byte indexes, shifts and widths are small more often than not
+    if op in (0x0b, 0x1a, 0x1b, 0x1c, 0x1d) and i == 0 and r < 0.8:
+        return random.randint(0, 300)
+    if r < 0.3:
+        return random.choice(EDGES)
+    if r < 0.5:
+        return random.getrandbits(random.randint(1, 64))
+    if op == 0x0a and i == 1 and r < 0.9:
+        return random.randint(0, 300)
+    return random.getrandbits(256)
+
+
+def arithmetic():
+    random.seed(42)
+    for op, (n, f) in ARITHMETIC.items():
+        for _ in range(CASES_PER_OPCODE):
+            args = [operand(op, i) for i in range(n)]
+            code = b"".join(b"\x7f" + a.to_bytes(32, "big") for a in reversed(args))
+            # op PUSH0 MSTORE PUSH1 32 PUSH0 RETURN
+            code += bytes([op, 0x5f, 0x52, 0x60, 0x20, 0x5f, 0xf3])
+            print(code.hex(), "%064x" % f(*args))
+
+
+contract()
+arithmetic()
@@ -0,0 +1,306 @@
+/*
+ * Test of the L2 cache client against a local stand-in server
+ *
+ * Starts test_l2_server.py as redis-server or memcached on loopback and
+ * runs the client through hits, absent users and misses, the versions of
+ * the answers, flushes of one partition and of all, database selection and
+ * AUTH, values written under another l2_secret, more unread stores than it
+ * keeps pending, a server slower than the deadline, a closed port, a wrong
+ * password and malformed replies. Every scenario runs in a fresh process, as a SIP worker would
+ * with its own connection, and reads the counters of web3_auth.l2_stats.
+ * Build and run with: make check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "web3_auth.h"
+#include "web3_auth_l2.h"
+#include "web3_auth_repl.h"
+#include "test_util.h"
+
+#define SECRET "test-l2-secret-0123"
+
+static test_stat_t* stat(const char* name) {
+    return rpc_stat(w3_l2_rpc_stats, name);
+}
+
+// Stand-in server ----------------------------------------------------------
+
+static pid_t server_start(const char* mode, const char* opt, const char* value, int* port) {
+    char line[16] = "";
+    int fds[2];
+    FILE* f;
+    pid_t pid;
+
+    if (pipe(fds) < 0) exit(1);
+    pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], 1);
+        close(fds[0]);
+        execlp("python3", "python3", "test_l2_server.py", mode, opt, value, (char*)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    f = fdopen(fds[0], "r");
+    if (!f || !fgets(line, sizeof(line), f) || (*port = atoi(line)) <= 0) {
+        fprintf(stderr, "test_l2_server.py did not start (python3 needed)\n");
+        exit(1);
+    }
+    fclose(f);
+    return pid;
+}
+
+static void server_stop(pid_t pid) {
+    int status;
+
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+}
+
+// A port nothing listens on
+static int closed_port(void) {
+    struct sockaddr_in addr = {.sin_family = AF_INET};
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+            || getsockname(fd, (struct sockaddr*)&addr, &len) < 0) {
+        exit(1);
+    }
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+// Scenarios ----------------------------------------------------------------
+
+static char url[128];
+static const uint8_t digest[W3_DIGEST_SIZE] = {
+    0x6d, 0x64, 0x35, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0xff,
+};
+
+static const char* secret = SECRET;
+
+static void init(int timeout_ms, int fail_threshold) {
+    if (w3_l2_init(url, secret, timeout_ms, 60, 30, fail_threshold, 1) < 0) exit(2);
+}
+
+static void hit_absent_miss(void) {
+    uint8_t got[W3_DIGEST_SIZE];
+    uint64_t now = w3_realtime_ms(), version = 0;
+
+    init(200, 3);
+    CHECK(w3_l2_get(0, 1, 2, got, &version) == W3_L2_MISS);
+    w3_l2_put(1, digest, now - 5000);
+    w3_l2_put_absent(2, now - 7000);
+    memset(got, 0, sizeof(got));
+    CHECK(w3_l2_get(0, 1, 9, got, &version) == W3_L2_HIT
+            && memcmp(got, digest, sizeof(got)) == 0);
+    CHECK(version == now - 5000);
+    CHECK(w3_l2_get(0, 7, 2, got, &version) == W3_L2_ABSENT && version == now - 7000);
+    CHECK(w3_l2_get(0, 7, 8, got, &version) == W3_L2_MISS);
+
+    // More stores than replies are left unread
+    for (int i = 0; i < 200; i++) w3_l2_put(100 + i, digest, now);
+    CHECK(w3_l2_get(0, 299, 8, got, &version) == W3_L2_HIT);
+    CHECK(w3_l2_get(0, 100, 8, got, &version) == W3_L2_HIT);
+
+    CHECK(stat("hits")->value == 3);
+    CHECK(stat("absent_hits")->value == 1);
+    CHECK(stat("misses")->value == 2);
+    CHECK(stat("writes")->value == 202);
+    CHECK(stat("errors")->value == 0);
+}
+
+// Answers up to the flush of their partition, or of all, are gone
+static void flush(void) {
+    uint8_t got[W3_DIGEST_SIZE];
+    uint64_t now = w3_realtime_ms(), version;
+
+    init(200, 3);
+    w3_l2_put(1001, digest, now - 1);
+    w3_l2_put_absent(1002, now - 1);
+    w3_l2_put(2001, digest, now - 1);
+    CHECK(w3_l2_flush(1, now) == 0);
+    CHECK(w3_l2_get(1, 1001, 1002, got, &version) == W3_L2_MISS);
+    CHECK(w3_l2_get(2, 2001, 1002, got, &version) == W3_L2_HIT);
+
+    // Answered after the flush
+    w3_l2_put(1001, digest, now + 1);
+    CHECK(w3_l2_get(1, 1001, 1002, got, &version) == W3_L2_HIT && version == now + 1);
+
+    CHECK(w3_l2_flush(W3_REPL_ALL, now + 1) == 0);
+    CHECK(w3_l2_get(1, 1001, 1002, got, &version) == W3_L2_MISS);
+    CHECK(w3_l2_get(2, 2001, 1002, got, &version) == W3_L2_MISS);
+    CHECK(stat("writes")->value == 6 && stat("errors")->value == 0);
+}
+
+static void store_in_db(void) {
+    uint8_t got[W3_DIGEST_SIZE];
+    uint64_t version;
+
+    init(200, 3);
+    w3_l2_put(42, digest, w3_realtime_ms());
+    w3_l2_put_absent(43, w3_realtime_ms());
+    // Read back on the same connection, so the stores are applied
+    CHECK(w3_l2_get(0, 42, 43, got, &version) == W3_L2_HIT);
+}
+
+static void found_in_db(void) {
+    uint8_t got[W3_DIGEST_SIZE];
+    uint64_t version;
+
+    init(200, 3);
+    CHECK(w3_l2_get(0, 42, 43, got, &version) == W3_L2_HIT);
+    CHECK(stat("errors")->value == 0);
+}
+
+static void not_in_db(void) {
+    uint8_t got[W3_DIGEST_SIZE];
+    uint64_t version;
+
+    init(200, 3);
+    CHECK(w3_l2_get(0, 42, 43, got, &version) == W3_L2_MISS);
+    CHECK(stat("misses")->value == 1 && stat("errors")->value == 0);
+}
+
+// Values whose MAC does not match are not taken
+static void other_secret(void) {
+    uint8_t got[W3_DIGEST_SIZE];
+    uint64_t version;
+
+    secret = "another-l2-secret-0123";
+    init(200, 3);
+    CHECK(w3_l2_get(0, 42, 43, got, &version) == W3_L2_MISS);
+    CHECK(stat("rejected")->value == 2 && stat("errors")->value == 0);
+}
+
+static void secret_required(void) {
+    char long_secret[66];
+
+    memset(long_secret, 'k', 65);
+    long_secret[65] = '\0';
+    CHECK(w3_l2_init(url, NULL, 200, 60, 30, 3, 1) < 0);
+    CHECK(w3_l2_init(url, "short", 200, 60, 30, 3, 1) < 0);
+    CHECK(w3_l2_init(url, long_secret, 200, 60, 30, 3, 1) < 0);
+}
+
+// Each failure counts until the breaker opens, then lookups skip the server
+static void breaker_opens(void) {
+    uint8_t got[W3_DIGEST_SIZE];
+    uint64_t start, version;
+
+    init(20, 2);
+    for (int i = 0; i < 2; i++) CHECK(w3_l2_get(0, 1, 2, got, &version) == W3_L2_MISS);
+    CHECK(stat("errors")->value == 2);
+    CHECK(strcmp(stat("breaker")->text, "open") == 0);
+
+    start = w3_now_us();
+    CHECK(w3_l2_get(0, 1, 2, got, &version) == W3_L2_MISS);
+    CHECK(w3_now_us() - start < 5000);
+    CHECK(stat("skipped")->value == 1);
+    CHECK(stat("errors")->value == 2);
+
+    // A flush that cannot reach the server says so
+    CHECK(w3_l2_flush(W3_REPL_ALL, w3_realtime_ms()) < 0);
+}
+
+// Two timeouts of the deadline, not of the server
+static void slow_server(void) {
+    uint64_t start = w3_now_us();
+
+    breaker_opens();
+    CHECK(w3_now_us() - start < 150000);
+}
+
+static void malformed(void) {
+    uint8_t got[W3_DIGEST_SIZE];
+    uint64_t start = w3_now_us(), version;
+
+    init(200, 1);
+    CHECK(w3_l2_get(0, 1, 2, got, &version) == W3_L2_MISS);
+    CHECK(stat("errors")->value == 1);
+    // Rejected when read, not after waiting for a reply that cannot come
+    CHECK(w3_now_us() - start < 150000);
+}
+
+int main(void) {
+    static const char* const bad_redis[] = {
+        "*2\\r\\n$9223372036854775807\\r\\nab\\r\\n$-1\\r\\n",
+        "*2\\r\\n$4097\\r\\nab\\r\\n$-1\\r\\n",
+        "*2\\r\\n$-7\\r\\n$-1\\r\\n",
+        "*2\\r\\n$x\\r\\n$-1\\r\\n",
+        "*99999999999999999999\\r\\n",
+        "*1\\r\\n$-1\\r\\n",
+        "*3\\r\\n$-1\\r\\n$-1\\r\\n$-1\\r\\n",
+        "*5\\r\\n$-1\\r\\n$-1\\r\\n$-1\\r\\n$-1\\r\\n$-1\\r\\n",
+    };
+    static const char* const bad_memcached[] = {
+        "VALUE w3a:0000000000000001 0 18446744073709551615\\r\\nab\\r\\nEND\\r\\n",
+        "VALUE w3a:0000000000000001 0 4097\\r\\nab\\r\\nEND\\r\\n",
+        "VALUE w3a:0000000000000001 0 -1\\r\\nab\\r\\nEND\\r\\n",
+    };
+    char name[160];
+    pid_t srv;
+    int port;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("L2 cache client against test_l2_server.py\n");
+
+    srv = server_start("redis", NULL, NULL, &port);
+    snprintf(url, sizeof(url), "redis://127.0.0.1:%d", port);
+    run("redis: hit, absent, miss, 200 unread stores", hit_absent_miss);
+    run("redis: flush of a partition, then of all", flush);
+    server_stop(srv);
+
+    srv = server_start("memcached", NULL, NULL, &port);
+    snprintf(url, sizeof(url), "memcached://127.0.0.1:%d", port);
+    run("memcached: hit, absent, miss, 200 stores", hit_absent_miss);
+    run("memcached: flush of a partition, then of all", flush);
+    server_stop(srv);
+
+    srv = server_start("redis", "--password", "l2-test-password", &port);
+    snprintf(url, sizeof(url), "redis://:l2-test-password@127.0.0.1:%d/3", port);
+    run("redis: AUTH and SELECT 3, store", store_in_db);
+    run("redis: AUTH and SELECT 3, found from a new connection", found_in_db);
+    run("redis: values written under another secret", other_secret);
+    snprintf(url, sizeof(url), "redis://:l2-test-password@127.0.0.1:%d", port);
+    run("redis: AUTH, database 0 does not have it", not_in_db);
+    snprintf(url, sizeof(url), "redis://:wrong@127.0.0.1:%d", port);
+    run("redis: wrong password opens the breaker", breaker_opens);
+    server_stop(srv);
+
+    srv = server_start("redis", "--delay", "0.2", &port);
+    snprintf(url, sizeof(url), "redis://127.0.0.1:%d", port);
+    run("redis: 200 ms server, 20 ms deadline", slow_server);
+    server_stop(srv);
+
+    snprintf(url, sizeof(url), "redis://127.0.0.1:%d", closed_port());
+    run("redis: closed port opens the breaker", breaker_opens);
+    run("l2_url without an l2_secret of 16 to 64 bytes", secret_required);
+
+    for (size_t i = 0; i < sizeof(bad_redis) / sizeof(bad_redis[0]); i++) {
+        srv = server_start("redis", "--raw", bad_redis[i], &port);
+        snprintf(url, sizeof(url), "redis://127.0.0.1:%d", port);
+        snprintf(name, sizeof(name), "redis: malformed %.36s", bad_redis[i]);
+        run(name, malformed);
+        server_stop(srv);
+    }
+    for (size_t i = 0; i < sizeof(bad_memcached) / sizeof(bad_memcached[0]); i++) {
+        srv = server_start("memcached", "--raw", bad_memcached[i], &port);
+        snprintf(url, sizeof(url), "memcached://127.0.0.1:%d", port);
+        snprintf(name, sizeof(name), "memcached: malformed %.32s", bad_memcached[i] + 28);
+        run(name, malformed);
+        server_stop(srv);
+    }
+
+    printf("%s\n", failed_scenarios ? "FAILED" : "ok");
+    return failed_scenarios != 0;
+}
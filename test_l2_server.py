@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""Stand-in for redis-server and memcached, for test_l2.
+
+Speaks the part of RESP (MGET, SET ... EX, AUTH, SELECT) and of the
+memcached text protocol (get, set [noreply]) that the L2 client uses, on
+127.0.0.1. Prints the port it listens on, then serves until killed.
+
+  test_l2_server.py redis|memcached [--password PW] [--delay S] [--raw REPLY]
+
+--raw answers every lookup with REPLY (Python escapes, e.g. '$99\\r\\n')
+instead of the stored values, to feed the client malformed replies.
+"""
+
+import argparse
+import codecs
+import socket
+import sys
+import threading
+import time
+
+args = argparse.ArgumentParser()
+args.add_argument("mode", choices=["redis", "memcached"])
+args.add_argument("--password")
+args.add_argument("--delay", type=float, default=0)
+args.add_argument("--raw")
+opt = args.parse_args()
+raw = codecs.escape_decode(opt.raw)[0] if opt.raw is not None else None
+
+stores = {}     # redis database or 0 -> {key: value}
+lock = threading.Lock()
+
+
+def bulk(v):
+    return b"$-1\r\n" if v is None else b"$%d\r\n%s\r\n" % (len(v), v)
+
+
+def redis(conn):
+    f = conn.makefile("rb")
+    db, authed = 0, opt.password is None
+    while True:
+        line = f.readline()
+        if not line:
+            return
+        if line[:1] == b"*":
+            argv = []
+            for _ in range(int(line[1:])):
+                n = int(f.readline()[1:])
+                argv.append(f.read(n + 2)[:-2])
+        else:
+            argv = line.split()
+        cmd = argv[0].upper()
+        time.sleep(opt.delay)
+        if cmd == b"AUTH":
+            authed = opt.password is not None and argv[1].decode() == opt.password
+            out = b"+OK\r\n" if authed else b"-WRONGPASS invalid password\r\n"
+        elif not authed:
+            out = b"-NOAUTH Authentication required.\r\n"
+        elif cmd == b"SELECT":
+            db = int(argv[1])
+            out = b"+OK\r\n"
+        elif cmd == b"MGET":
+            with lock:
+                store = stores.setdefault(db, {})
+                out = raw if raw is not None else (
+                    b"*%d\r\n" % (len(argv) - 1) + b"".join(bulk(store.get(k)) for k in argv[1:]))
+        elif cmd == b"SET":
+            with lock:
+                stores.setdefault(db, {})[argv[1]] = argv[2]
+            out = b"+OK\r\n"
+        else:
+            out = b"-ERR unknown command\r\n"
+        conn.sendall(out)
+
+
+def memcached(conn):
+    f = conn.makefile("rb")
+    while True:
+        line = f.readline()
+        if not line:
+            return
+        argv = line.split()
+        time.sleep(opt.delay)
+        if argv[0] == b"get":
+            with lock:
+                store = stores.setdefault(0, {})
+                out = raw if raw is not None else b"".join(
+                    b"VALUE %s 0 %d\r\n%s\r\n" % (k, len(store[k]), store[k])
+                    for k in argv[1:] if k in store) + b"END\r\n"
+            conn.sendall(out)
+        elif argv[0] == b"set":
+            data = f.read(int(argv[4]) + 2)[:-2]
+            with lock:
+                stores.setdefault(0, {})[argv[1]] = data
+            if argv[-1] != b"noreply":
+                conn.sendall(b"STORED\r\n")
+        else:
+            conn.sendall(b"ERROR\r\n")
+
+
+def serve(conn):
+    try:
+        (redis if opt.mode == "redis" else memcached)(conn)
+    except (OSError, ValueError, IndexError):
+        pass
+    conn.close()
+
+
+s = socket.socket()
+s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.bind(("127.0.0.1", 0))
+s.listen(16)
+print(s.getsockname()[1], flush=True)
+sys.stdout.close()
+while True:
+    c, _ = s.accept()
+    threading.Thread(target=serve, args=(c,), daemon=True).start()
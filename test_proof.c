@@ -0,0 +1,199 @@
+/*
+ * Test of the Merkle-Patricia proof verification
+ *
+ * Reads the tries of test_proof_vectors.txt, made by test_proof_gen.py with
+ * its own Keccak, RLP and trie code, and verifies their eth_getProof
+ * answers: account fields and slot values must come out as generated, an
+ * absent account must be proven absent, and a wrong address, a wrong root
+ * or an altered digit of a proof node must fail. RLP that is not canonical
+ * and mapping keys out of range are rejected. Build and run with: make check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "web3_auth_hex.h"
+#include "web3_auth_proof.h"
+#include "test_util.h"
+
+#define VECTORS "test_proof_vectors.txt"
+#define LINE_MAX_LEN (1 << 16)
+
+typedef struct vector {
+    uint8_t root[32];
+    uint8_t address[20];
+    int nslots;
+    uint8_t slots[W3_PROOF_MAX_SLOTS][32];
+    uint8_t values[W3_PROOF_MAX_SLOTS][32];
+    uint8_t absent[20];
+    uint8_t mapping_slot[32];
+    char response[LINE_MAX_LEN];
+    char absent_response[LINE_MAX_LEN];
+} vector_t;
+
+static vector_t v;
+static uint8_t scratch[LINE_MAX_LEN];
+
+static int read_line(FILE* f, char* line) {
+    if (!fgets(line, LINE_MAX_LEN, f)) return -1;
+    line[strcspn(line, "\n")] = 0;
+    return 0;
+}
+
+static int read_hex(FILE* f, uint8_t* out, size_t bytes) {
+    char line[LINE_MAX_LEN];
+
+    if (read_line(f, line) < 0 || strlen(line) != 2 * bytes) return -1;
+    return w3_hex_decode(line, 2 * bytes, out) < 0 ? -1 : 0;
+}
+
+// Next vector of f; 0, or -1 at the end
+static int read_vector(FILE* f) {
+    char line[LINE_MAX_LEN];
+
+    if (read_hex(f, v.root, 32) < 0) return -1;
+    if (read_hex(f, v.address, 20) < 0 || read_line(f, line) < 0) goto malformed;
+    v.nslots = atoi(line);
+    if (v.nslots <= 0 || v.nslots > W3_PROOF_MAX_SLOTS) goto malformed;
+    for (int i = 0; i < v.nslots; i++) {
+        if (read_line(f, line) < 0 || strlen(line) != 129
+                || w3_hex_decode(line, 64, v.slots[i]) < 0
+                || w3_hex_decode(line + 65, 64, v.values[i]) < 0) {
+            goto malformed;
+        }
+    }
+    if (read_hex(f, v.absent, 20) < 0 || read_hex(f, v.mapping_slot, 32) < 0
+            || read_line(f, v.response) < 0 || read_line(f, v.absent_response) < 0) {
+        goto malformed;
+    }
+    return 0;
+
+malformed:
+    fprintf(stderr, VECTORS " is malformed\n");
+    exit(1);
+}
+
+static int verify(const char* json, const uint8_t root[32], const uint8_t address[20],
+        w3_account_t* account, uint8_t (*values)[32]) {
+    return w3_proof_verify_response(json, strlen(json), root, address,
+            (const uint8_t (*)[32])v.slots, v.nslots, account, values, scratch);
+}
+
+// Scenarios ----------------------------------------------------------------
+
+static void answer_verifies(void) {
+    static const uint8_t wei[32] = {[24] = 0x0d, 0xe0, 0xb6, 0xb3, 0xa7, 0x64, 0x00, 0x00};
+    uint8_t values[W3_PROOF_MAX_SLOTS][32];
+    w3_account_t account;
+
+    CHECK(verify(v.response, v.root, v.address, &account, values) == 0);
+    CHECK(account.exists && account.nonce == 5);
+    CHECK(memcmp(account.balance, wei, 32) == 0);
+    for (int i = 0; i < v.nslots; i++) CHECK(memcmp(values[i], v.values[i], 32) == 0);
+}
+
+static void absent_account(void) {
+    uint8_t values[W3_PROOF_MAX_SLOTS][32];
+    w3_account_t account;
+
+    CHECK(w3_proof_verify_response(v.absent_response, strlen(v.absent_response), v.root,
+            v.absent, NULL, 0, &account, values, scratch) == 0);
+    CHECK(!account.exists);
+}
+
+static void wrong_address_or_root(void) {
+    uint8_t values[W3_PROOF_MAX_SLOTS][32];
+    uint8_t root[32];
+    w3_account_t account;
+
+    CHECK(verify(v.response, v.root, v.absent, &account, values) < 0 || !account.exists);
+    memcpy(root, v.root, 32);
+    root[31] ^= 1;
+    CHECK(verify(v.response, root, v.address, &account, values) < 0);
+}
+
+// Every node hashes into its parent, so any altered digit of one fails
+static void altered_digits(void) {
+    uint8_t values[W3_PROOF_MAX_SLOTS][32];
+    w3_account_t account;
+    char* p = v.response;
+    char* hex;
+    size_t digits;
+    int altered = 0, rejected = 0;
+
+    while ((p = strstr(p, "\"0x"))) {
+        hex = p + 3;
+        digits = strspn(hex, "0123456789abcdef");
+        p = hex + digits;
+        // Hashes and words have up to 64 digits, nodes at least as many more
+        if (digits <= 64) continue;
+        for (size_t i = 0; i < digits; i += 3) {
+            char c = hex[i];
+
+            hex[i] = c == '0' ? '1' : '0';
+            altered++;
+            if (verify(v.response, v.root, v.address, &account, values) < 0) rejected++;
+            hex[i] = c;
+        }
+    }
+    CHECK(altered > 0 && rejected == altered);
+}
+
+static void mapping_slot(void) {
+    uint8_t key[W3_PROOF_MAX_KEY + 1];
+    uint8_t out[32];
+
+    CHECK(w3_proof_mapping_slot((const uint8_t*)"alice", 5, 3, out) == 0);
+    CHECK(memcmp(out, v.mapping_slot, 32) == 0);
+    memset(key, 'a', sizeof(key));
+    CHECK(w3_proof_mapping_slot(key, W3_PROOF_MAX_KEY, 3, out) == 0);
+    CHECK(w3_proof_mapping_slot(key, W3_PROOF_MAX_KEY + 1, 3, out) < 0);
+}
+
+static void rlp_canonical(void) {
+    static const uint8_t short_byte[] = {0x81, 0x05};       // single byte below 0x80
+    static const uint8_t long_short[] = {0xb8, 0x02, 1, 2};  // long form for 2 bytes
+    static const uint8_t zero_len[] = {0xb9, 0x00, 0x40};    // length with a leading zero
+    static const uint8_t past_end[] = {0x83, 1, 2};
+    static const uint8_t ok[] = {0x82, 1, 2};
+    w3_rlp_t item;
+
+    CHECK(w3_rlp_item(short_byte, sizeof(short_byte), &item) < 0);
+    CHECK(w3_rlp_item(long_short, sizeof(long_short), &item) < 0);
+    CHECK(w3_rlp_item(zero_len, sizeof(zero_len), &item) < 0);
+    CHECK(w3_rlp_item(past_end, sizeof(past_end), &item) < 0);
+    CHECK(w3_rlp_item(ok, sizeof(ok), &item) == 3 && item.len == 2 && !item.list);
+}
+
+int main(void) {
+    FILE* f = fopen(VECTORS, "r");
+    char name[96];
+    int n = 0;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if (!f) {
+        fprintf(stderr, "Cannot open " VECTORS "\n");
+        return 1;
+    }
+    printf("Merkle-Patricia proofs of " VECTORS "\n");
+
+    run("RLP: not canonical or past the end", rlp_canonical);
+    while (read_vector(f) == 0) {
+        n++;
+        snprintf(name, sizeof(name), "trie %d: %d slots verify", n, v.nslots);
+        run(name, answer_verifies);
+        snprintf(name, sizeof(name), "trie %d: absent account", n);
+        run(name, absent_account);
+        snprintf(name, sizeof(name), "trie %d: wrong address, wrong root", n);
+        run(name, wrong_address_or_root);
+        snprintf(name, sizeof(name), "trie %d: altered proof digits", n);
+        run(name, altered_digits);
+        snprintf(name, sizeof(name), "trie %d: mapping slot", n);
+        run(name, mapping_slot);
+    }
+    fclose(f);
+
+    printf("%s\n", failed_scenarios || n == 0 ? "FAILED" : "ok");
+    return failed_scenarios || n == 0;
+}
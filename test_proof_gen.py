@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+"""Generator of the Merkle-Patricia proof vectors of test_proof.
+
+Builds a random storage trie of a contract and a state trie holding it
+among other accounts, independently of the module (own Keccak-256, RLP and
+trie code), and prints what test_proof reads: the state root, the address,
+the requested slots with their values (the last one is not set), an
+address that is not in the state, the slot of mapping entry "alice" at
+slot 3, the eth_getProof answer for the address and the one for the
+absent address, one per line.
+
+  test_proof_gen.py SEED [SLOTS] [ACCOUNTS] >> test_proof_vectors.txt
+"""
+
+import json
+import random
+import sys
+
+from test_keccak import keccak
+
+# RLP ------------------------------------------------------------------------
+
+
+def rlp(x):
+    if isinstance(x, list):
+        payload = b"".join(rlp(i) for i in x)
+        return rlp_header(len(payload), 0xc0) + payload
+    if len(x) == 1 and x[0] < 0x80:
+        return x
+    return rlp_header(len(x), 0x80) + x
+
+
+def rlp_header(n, offset):
+    if n < 56:
+        return bytes([offset + n])
+    b = n.to_bytes((n.bit_length() + 7) // 8, "big")
+    return bytes([offset + 55 + len(b)]) + b
+
+
+def rlp_decode(b):
+    """Item at the start of b and the bytes it takes."""
+    c = b[0]
+    if c < 0x80:
+        return b[:1], 1
+    if c < 0xb8:
+        n = c - 0x80
+        return b[1:1 + n], 1 + n
+    if c < 0xc0:
+        ll = c - 0xb7
+        n = int.from_bytes(b[1:1 + ll], "big")
+        return b[1 + ll:1 + ll + n], 1 + ll + n
+    if c < 0xf8:
+        n, h = c - 0xc0, 1
+    else:
+        ll = c - 0xf7
+        n, h = int.from_bytes(b[1:1 + ll], "big"), 1 + ll
+    out, p = [], h
+    while p < h + n:
+        item, used = rlp_decode(b[p:])
+        out.append(item)
+        p += used
+    return out, h + n
+
+
+def uint(n):
+    return n.to_bytes((n.bit_length() + 7) // 8, "big") if n else b""
+
+# Trie -----------------------------------------------------------------------
+
+
+def nibbles(b):
+    return [n for c in b for n in (c >> 4, c & 15)]
+
+
+def hex_prefix(ns, leaf):
+    flag = 2 if leaf else 0
+    if len(ns) % 2:
+        return bytes([(flag + 1) * 16 + ns[0]]) + bytes(
+            ns[i] * 16 + ns[i + 1] for i in range(1, len(ns), 2))
+    return bytes([flag * 16]) + bytes(ns[i] * 16 + ns[i + 1] for i in range(0, len(ns), 2))
+
+
+def ref(node, db):
+    """Nodes under 32 bytes are embedded in their parent, others hashed."""
+    e = rlp(node)
+    if len(e) < 32:
+        return node
+    h = keccak(e)
+    db[h] = e
+    return h
+
+
+def build(items, db):
+    """Reference to the trie of items, (nibbles, value) pairs."""
+    if not items:
+        return b""
+    if len(items) == 1:
+        k, v = items[0]
+        return ref([hex_prefix(k, True), v], db)
+    pre = 0
+    while all(len(k) > pre for k, _ in items) and len(set(k[pre] for k, _ in items)) == 1:
+        pre += 1
+    if pre:
+        child = build([(k[pre:], v) for k, v in items], db)
+        return ref([hex_prefix(items[0][0][:pre], False), child], db)
+    branch = [b""] * 17
+    for n in range(16):
+        sub = [(k[1:], v) for k, v in items if k and k[0] == n]
+        branch[n] = build(sub, db) if sub else b""
+    for k, v in items:
+        if not k:
+            branch[16] = v
+    return ref(branch, db)
+
+
+def trie(items):
+    """Root hash and the hashed nodes by hash."""
+    db = {}
+    r = build(items, db)
+    if isinstance(r, list):
+        e = rlp(r)
+        r = keccak(e)
+        db[r] = e
+    if r == b"":
+        return keccak(rlp(b"")), db
+    return r, db
+
+
+def prove(root, db, key):
+    """Hashed nodes from root along keccak(key), as eth_getProof lists them."""
+    path, proof, pos, cur = nibbles(keccak(key)), [], 0, root
+    while True:
+        if isinstance(cur, bytes):
+            if not cur:
+                return proof
+            proof.append(db[cur])
+            cur = rlp_decode(db[cur])[0]
+        if len(cur) == 17:
+            if pos == 64:
+                return proof
+            cur = cur[path[pos]]
+            pos += 1
+            continue
+        flag = cur[0][0] >> 4
+        ns = nibbles(cur[0])[1 if flag & 1 else 2:]
+        if path[pos:pos + len(ns)] != ns or flag & 2:
+            return proof
+        pos += len(ns)
+        cur = cur[1]
+
+
+def hexes(nodes):
+    return ["0x" + n.hex() for n in nodes]
+
+# Vectors --------------------------------------------------------------------
+
+
+random.seed(int(sys.argv[1]))
+nslots = int(sys.argv[2]) if len(sys.argv) > 2 else 50
+naccounts = int(sys.argv[3]) if len(sys.argv) > 3 else 200
+
+# Low slots as Solidity lays out plain variables, the rest as mappings
+storage = {}
+for i in range(nslots):
+    slot = random.randbytes(32) if i % 3 else i.to_bytes(32, "big")
+    storage[slot] = random.choice([1, 0xff, 2**255 + 7,
+                                   random.getrandbits(random.randint(1, 256)) or 1])
+storage_root, storage_db = trie([(nibbles(keccak(s)), rlp(uint(v))) for s, v in storage.items()])
+
+address = random.randbytes(20)
+code_hash = keccak(b"code")
+accounts = {address: [uint(5), uint(10**18), storage_root, code_hash]}
+for i in range(naccounts):
+    accounts[random.randbytes(20)] = [uint(random.randint(0, 100)),
+                                      uint(random.getrandbits(70)), keccak(rlp(b"")), keccak(b"")]
+state_root, state_db = trie([(nibbles(keccak(a)), rlp(v)) for a, v in accounts.items()])
+
+slots = list(storage)[:5] + [random.randbytes(32)]
+absent = random.randbytes(20)
+result = {
+    "address": "0x" + address.hex(),
+    "accountProof": hexes(prove(state_root, state_db, address)),
+    "balance": hex(10**18),
+    "codeHash": "0x" + code_hash.hex(),
+    "nonce": "0x5",
+    "storageHash": "0x" + storage_root.hex(),
+    # Nodes shorten keys as quantities
+    "storageProof": [{"key": "0x" + (s.hex().lstrip("0") or "0"), "value": hex(storage.get(s, 0)),
+                      "proof": hexes(prove(storage_root, storage_db, s))} for s in slots],
+}
+absent_result = {"accountProof": hexes(prove(state_root, state_db, absent)), "storageProof": []}
+
+print(state_root.hex())
+print(address.hex())
+print(len(slots))
+for s in slots:
+    print(s.hex(), "%064x" % storage.get(s, 0))
+print(absent.hex())
+print(keccak(b"alice" + (3).to_bytes(32, "big")).hex())
+print(json.dumps({"jsonrpc": "2.0", "id": 1, "result": result}))
+print(json.dumps({"jsonrpc": "2.0", "id": 1, "result": absent_result}))
@@ -0,0 +1,317 @@
+/*
+ * Test of cache replication between two instances on loopback
+ *
+ * Runs two nodes, each a process with its own digest cache and replication
+ * state as a Kamailio instance would have, that list each other as peers
+ * (the first also itself). Node A inserts digests, an absent user and a
+ * partition; node B must see them, its own newer answer must win on A,
+ * and A's flush must reach B. A third party then sends B datagrams by
+ * hand: repeated, reordered, from the future, too old, unauthenticated or
+ * truncated, which must leave the cache as the protocol promises. Build
+ * and run with: make check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "web3_auth.h"
+#include "web3_auth_cache.h"
+#include "web3_auth_keccak.h"
+#include "web3_auth_l2.h"
+#include "web3_auth_repl.h"
+#include "web3_auth_route.h"
+#include "test_util.h"
+
+#define SECRET "test-replication-secret"
+#define WAIT_US 3000000
+
+#define PARTITION 1
+#define PARTITION_KEYS 100
+
+// The cache looks tenants up only for the flush RPC
+const w3_tenant_t* w3_route_lookup(const char* realm, int len) {
+    (void)realm;
+    (void)len;
+    return NULL;
+}
+
+void w3_route_enter(void) {
+}
+
+void w3_route_leave(void) {
+}
+
+// ... and flushes the L2 cache there
+int w3_l2_flush(unsigned int partition, uint64_t version) {
+    (void)partition;
+    (void)version;
+    return 0;
+}
+
+static int port_a, port_b;
+static int to_a[2];                 // commands from B to A
+static uint8_t d1[W3_DIGEST_SIZE], d2[W3_DIGEST_SIZE], d3[W3_DIGEST_SIZE];
+
+static test_stat_t* stat(const char* name) {
+    return rpc_stat(w3_repl_rpc_stats, name);
+}
+
+// A free UDP port on loopback
+static int udp_port(void) {
+    struct sockaddr_in addr = {.sin_family = AF_INET};
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+            || getsockname(fd, (struct sockaddr*)&addr, &len) < 0) {
+        exit(1);
+    }
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+static void node_init(int listen_port, const char* peers) {
+    char listen[32];
+
+    snprintf(listen, sizeof(listen), "127.0.0.1:%d", listen_port);
+    if (w3_cache_init(1024, 60, 60, 30) < 0
+            || w3_repl_init(listen, peers, SECRET, 1024) < 0) {
+        exit(2);
+    }
+}
+
+// Run the replication process until cond holds or the wait is over
+#define PUMP_UNTIL(cond) ({ \
+    uint64_t until_ = w3_now_us() + WAIT_US; \
+    int ok_; \
+    while (!(ok_ = (cond)) && w3_now_us() < until_) { \
+        w3_repl_timer(0, NULL); \
+        usleep(2000); \
+    } \
+    ok_; \
+})
+
+static int has(uint64_t key, const uint8_t* digest) {
+    uint8_t got[W3_DIGEST_SIZE];
+
+    return w3_cache_get(key, got, 0) && memcmp(got, digest, W3_DIGEST_SIZE) == 0;
+}
+
+// Node A ------------------------------------------------------------------
+
+static void node_a(void) {
+    char peers[64], cmd;
+    int status = 0;
+
+    close(to_a[1]);
+    fcntl(to_a[0], F_SETFL, O_NONBLOCK);
+    snprintf(peers, sizeof(peers), "127.0.0.1:%d, 127.0.0.1:%d", port_b, port_a);
+    node_init(port_a, peers);
+
+    // Insert once B listens
+    if (!PUMP_UNTIL(read(to_a[0], &cmd, 1) == 1)) _exit(3);
+    w3_cache_put(1001, 0, d1);
+    w3_cache_put_absent(1002, 0);
+    for (int k = 0; k < PARTITION_KEYS; k++) {
+        uint8_t d[W3_DIGEST_SIZE];
+
+        memset(d, k, sizeof(d));
+        w3_cache_put(5000 + k, PARTITION, d);
+    }
+
+    // Serve until B asks for the flush, then for the check of its answer
+    for (;;) {
+        if (!PUMP_UNTIL(read(to_a[0], &cmd, 1) == 1)) _exit(3);
+        if (cmd == 'f') {
+            w3_repl_record(W3_REPL_FLUSH, PARTITION, 0, w3_realtime_ms(), NULL);
+        } else {
+            // B's newer digest for 1001 replaced the one A made, and A
+            // dropped its own datagrams as they came back
+            if (!PUMP_UNTIL(has(1001, d2))) status |= 4;
+            if (stat("rejected")->value != 0) status |= 8;
+            _exit(status);
+        }
+    }
+}
+
+// Datagrams by hand -------------------------------------------------------
+
+typedef struct record {
+    int type;
+    unsigned int partition;
+    uint64_t key;
+    uint64_t version;
+    const uint8_t* digest;
+} record_t;
+
+static void put_be(uint8_t* p, uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--, v >>= 8) p[i] = (uint8_t)v;
+}
+
+// Datagram of node 0x7e57 as documented in web3_auth_repl.c; its length
+static size_t datagram(uint8_t* pkt, const record_t* r, int n, uint64_t sent_ms,
+        const char* secret) {
+    uint8_t buf[1500], hash[32];
+    size_t len = 20, slen = strlen(secret);
+
+    memcpy(pkt, "W3R\1", 4);
+    put_be(pkt + 4, 0x7e57, 4);
+    put_be(pkt + 8, n, 2);
+    put_be(pkt + 10, 0, 2);
+    put_be(pkt + 12, sent_ms, 8);
+    for (int i = 0; i < n; i++, len += 40) {
+        memset(pkt + len, 0, 40);
+        pkt[len] = r[i].type;
+        put_be(pkt + len + 4, r[i].partition, 4);
+        put_be(pkt + len + 8, r[i].key, 8);
+        put_be(pkt + len + 16, r[i].version, 8);
+        if (r[i].digest) memcpy(pkt + len + 24, r[i].digest, W3_DIGEST_SIZE);
+    }
+    memcpy(buf, secret, slen);
+    memcpy(buf + slen, pkt, len);
+    keccak256(buf, slen + len, hash);
+    memcpy(pkt + len, hash, 16);
+    return len + 16;
+}
+
+// Send to B and let it handle the datagram; the counter that moved
+static const char* deliver(const uint8_t* pkt, size_t len) {
+    static const char* const counters[] = {"records_applied", "records_ignored", "rejected"};
+    struct sockaddr_in addr = {.sin_family = AF_INET};
+    unsigned long before[3];
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    const char* moved = "none";
+
+    for (int i = 0; i < 3; i++) before[i] = stat(counters[i])->value;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port_b);
+    if (fd < 0 || sendto(fd, pkt, len, 0, (struct sockaddr*)&addr, sizeof(addr)) < 0) exit(1);
+    close(fd);
+
+    PUMP_UNTIL(stat("records_applied")->value != before[0]
+            || stat("records_ignored")->value != before[1]
+            || stat("rejected")->value != before[2]);
+    for (int i = 0; i < 3; i++) {
+        if (stat(counters[i])->value != before[i]) moved = counters[i];
+    }
+    return moved;
+}
+
+static const char* send_records(const record_t* r, int n) {
+    uint8_t pkt[1500];
+
+    return deliver(pkt, datagram(pkt, r, n, w3_realtime_ms(), SECRET));
+}
+
+// Node B, the one under test -----------------------------------------------
+
+static void node_b(void) {
+    char peers[32];
+    uint8_t pkt[1500], got[W3_DIGEST_SIZE];
+    uint64_t now = w3_realtime_ms();
+    record_t r;
+    size_t len;
+    int status;
+    pid_t a;
+
+    if (pipe(to_a) < 0) exit(1);
+    a = fork();
+    if (a == 0) node_a();
+    close(to_a[0]);
+
+    snprintf(peers, sizeof(peers), "127.0.0.1:%d", port_a);
+    node_init(port_b, peers);
+    w3_repl_timer(0, NULL);
+    CHECK(write(to_a[1], "g", 1) == 1);
+
+    // What A inserted
+    CHECK(PUMP_UNTIL(has(1001, d1) && w3_cache_absent(1002)
+            && w3_cache_get(5000 + PARTITION_KEYS - 1, got, 0)));
+    CHECK(got[0] == PARTITION_KEYS - 1);
+    CHECK(stat("records_applied")->value == 2 + PARTITION_KEYS);
+
+    // Idempotent: the same record again changes nothing
+    r = (record_t){W3_REPL_PUT, 0, 2001, now - 1000, d1};
+    CHECK(strcmp(send_records(&r, 1), "records_applied") == 0);
+    CHECK(strcmp(send_records(&r, 1), "records_ignored") == 0);
+    CHECK(has(2001, d1));
+
+    // Ordered: an older answer arriving late does not replace a newer one
+    r = (record_t){W3_REPL_PUT, 0, 2001, now - 1500, d2};
+    CHECK(strcmp(send_records(&r, 1), "records_ignored") == 0);
+    CHECK(has(2001, d1));
+    r = (record_t){W3_REPL_PUT, 0, 2001, now - 500, d3};
+    CHECK(strcmp(send_records(&r, 1), "records_applied") == 0);
+    CHECK(has(2001, d3));
+
+    // An absent mark is an answer like any other
+    r = (record_t){W3_REPL_ABSENT, 0, 2001, now - 100, NULL};
+    CHECK(strcmp(send_records(&r, 1), "records_applied") == 0);
+    CHECK(w3_cache_absent(2001) && !w3_cache_get(2001, got, 1));
+
+    // A skewed clock cannot pin an entry that real answers never replace
+    r = (record_t){W3_REPL_PUT, 0, 2002, now + 2 * W3_REPL_MAX_AGE_MS, d1};
+    CHECK(strcmp(send_records(&r, 1), "records_ignored") == 0);
+    CHECK(!w3_cache_get(2002, got, 1));
+    r = (record_t){W3_REPL_PUT, 0, 2002, now, d2};
+    CHECK(strcmp(send_records(&r, 1), "records_applied") == 0);
+    CHECK(has(2002, d2));
+
+    // Answers past their lifetime are not cached
+    r = (record_t){W3_REPL_PUT, 0, 2003, now - 200000, d1};
+    CHECK(strcmp(send_records(&r, 1), "records_ignored") == 0);
+    CHECK(!w3_cache_get(2003, got, 1));
+
+    // Whole datagrams that are old, early, forged or cut are rejected
+    r = (record_t){W3_REPL_PUT, 0, 2004, now, d1};
+    len = datagram(pkt, &r, 1, now - 2 * W3_REPL_MAX_AGE_MS, SECRET);
+    CHECK(strcmp(deliver(pkt, len), "rejected") == 0);
+    len = datagram(pkt, &r, 1, now + 2 * W3_REPL_MAX_AGE_MS, SECRET);
+    CHECK(strcmp(deliver(pkt, len), "rejected") == 0);
+    len = datagram(pkt, &r, 1, now, "not-the-replication-secret");
+    CHECK(strcmp(deliver(pkt, len), "rejected") == 0);
+    len = datagram(pkt, &r, 1, now, SECRET);
+    CHECK(strcmp(deliver(pkt, len - 1), "rejected") == 0);
+    pkt[30] ^= 1;
+    CHECK(strcmp(deliver(pkt, len), "rejected") == 0);
+    CHECK(!w3_cache_get(2004, got, 1));
+
+    // B's newer answer goes back to A; A's flush reaches B
+    w3_cache_put(1001, 0, d2);
+    CHECK(PUMP_UNTIL(stat("queued")->value == 0));
+    CHECK(write(to_a[1], "f", 1) == 1);
+    CHECK(PUMP_UNTIL(!w3_cache_get(5000, got, 1)));
+    CHECK(!w3_cache_get(5000 + PARTITION_KEYS / 2, got, 1));
+    CHECK(has(1001, d2));
+
+    CHECK(write(to_a[1], "q", 1) == 1);
+    // Keep receiving so that A's last datagrams do not pile up
+    CHECK(PUMP_UNTIL(waitpid(a, &status, WNOHANG) == a));
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "    node A exited with %d\n", WEXITSTATUS(status));
+    }
+}
+
+int main(void) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    memset(d1, 0x11, sizeof(d1));
+    memset(d2, 0x22, sizeof(d2));
+    memset(d3, 0x33, sizeof(d3));
+    port_a = udp_port();
+    port_b = udp_port();
+
+    printf("cache replication between two instances on loopback\n");
+    run("A to B, idempotence, ordering, skew, forgery, flush", node_b);
+
+    printf("%s\n", failed_scenarios ? "FAILED" : "ok");
+    return failed_scenarios != 0;
+}
@@ -0,0 +1,278 @@
+/*
+ * Test of the classification of JSON-RPC errors and contract reverts
+ *
+ * Builds revert payloads here, with selectors hashed from their signatures,
+ * and classifies them as eth_call errors and as failures of confidential
+ * calls: Error(string) and custom errors must map through the table,
+ * Panic(uint256) and unknown selectors must be internal errors, and node
+ * error codes must tell throttling and node faults from bad requests.
+ * Truncated payloads, bad offsets and malformed tables are rejected.
+ * Build and run with: make check
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "web3_auth_hex.h"
+#include "web3_auth_keccak.h"
+#include "web3_auth_revert.h"
+#include "test_util.h"
+
+#define PAYLOAD_SIZE 512
+#define LONG_TEXT 150           // past W3_REVERT_REASON_SIZE, within a signature
+
+static char long_error[LONG_TEXT + 16];     // E..E(address)
+static char long_message[LONG_TEXT + 1];
+
+static size_t put_selector(const char* sig, uint8_t* out) {
+    uint8_t hash[32];
+
+    keccak256((const uint8_t*)sig, strlen(sig), hash);
+    memcpy(out, hash, 4);
+    return 4;
+}
+
+static size_t put_word(uint64_t v, uint8_t* out) {
+    memset(out, 0, 32);
+    for (int i = 31; v; i--, v >>= 8) out[i] = (uint8_t)v;
+    return 32;
+}
+
+// Error(string) with msg
+static size_t error_string(const char* msg, uint8_t* out) {
+    size_t len = strlen(msg);
+    size_t n = put_selector("Error(string)", out);
+
+    n += put_word(32, out + n);
+    n += put_word(len, out + n);
+    memset(out + n, 0, (len + 31) / 32 * 32);
+    memcpy(out + n, msg, len);
+    return n + (len + 31) / 32 * 32;
+}
+
+// Custom error sig with one word argument
+static size_t custom_error(const char* sig, uint64_t arg, uint8_t* out) {
+    size_t n = put_selector(sig, out);
+
+    return n + put_word(arg, out + n);
+}
+
+// eth_call answer with the payload in data, as form gives its digits
+static int classify(const uint8_t* data, size_t len, const char* form, w3_revert_t* out) {
+    char hex[2 * PAYLOAD_SIZE + 1];
+    char member[2 * PAYLOAD_SIZE + 32];
+    char json[2 * PAYLOAD_SIZE + 128];
+
+    w3_hex_encode(data, len, hex);
+    hex[2 * len] = '\0';
+    snprintf(member, sizeof(member), form, hex);
+    snprintf(json, sizeof(json), "{\"jsonrpc\":\"2.0\",\"id\":1,\"error\":{\"code\":3,"
+            "\"message\":\"execution reverted\",\"data\":%s}}", member);
+    return w3_revert_classify(json, strlen(json), out);
+}
+
+static int classify_json(const char* json, w3_revert_t* out) {
+    return w3_revert_classify(json, strlen(json), out);
+}
+
+static size_t base64(const uint8_t* in, size_t len, char* out) {
+    static const char alphabet[] =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)in[i] << 16 | (i + 1 < len ? in[i + 1] << 8 : 0)
+                | (i + 2 < len ? in[i + 2] : 0);
+
+        out[n++] = alphabet[v >> 18];
+        out[n++] = alphabet[v >> 12 & 63];
+        out[n++] = i + 1 < len ? alphabet[v >> 6 & 63] : '=';
+        out[n++] = i + 2 < len ? alphabet[v & 63] : '=';
+    }
+    out[n] = '\0';
+    return n;
+}
+
+static int failure(const char* module, const char* msg, w3_revert_t* out) {
+    return w3_revert_failure(module, strlen(module), 9, msg, strlen(msg), out);
+}
+
+// Scenarios ----------------------------------------------------------------
+
+static void error_string_mapped(void) {
+    uint8_t data[PAYLOAD_SIZE];
+    size_t len;
+    w3_revert_t r;
+
+    CHECK(classify(data, error_string("user disabled", data), "\"0x%s\"", &r)
+            == W3_REVERT_DISABLED);
+    CHECK(r.code == 3 && !r.node_fault && strcmp(r.reason, "user disabled") == 0);
+    CHECK(classify(data, error_string("a;b=c", data), "\"0x%s\"", &r)
+            == W3_REVERT_RATE_LIMITED);
+    CHECK(strcmp(r.reason, "a;b=c") == 0);
+    CHECK(classify(data, error_string(long_message, data), "\"0x%s\"", &r)
+            == W3_REVERT_DISABLED);
+    CHECK(strlen(r.reason) == W3_REVERT_REASON_SIZE - 1);
+
+    // Messages outside the table are internal, with the message for logs
+    CHECK(classify(data, error_string("out of \"gas\"", data), "\"0x%s\"", &r)
+            == W3_REVERT_INTERNAL);
+    CHECK(strcmp(r.reason, "out of ?gas?") == 0 && !r.node_fault);
+    // Prefixes do not match
+    CHECK(classify(data, error_string("user disabled!", data), "\"0x%s\"", &r)
+            == W3_REVERT_INTERNAL);
+
+    // Missing the last word of the message, or an offset past the end
+    len = error_string("user disabled", data);
+    CHECK(classify(data, len - 32, "\"0x%s\"", &r) == W3_REVERT_INTERNAL);
+    CHECK(strcmp(r.reason, "malformed Error(string)") == 0);
+    put_word(4096, data + 4);
+    CHECK(classify(data, len, "\"0x%s\"", &r) == W3_REVERT_INTERNAL);
+    CHECK(strcmp(r.reason, "malformed Error(string)") == 0);
+}
+
+static void panic(void) {
+    uint8_t data[PAYLOAD_SIZE];
+    size_t len = put_selector("Panic(uint256)", data);
+    w3_revert_t r;
+
+    len += put_word(0x11, data + len);
+    CHECK(classify(data, len, "\"0x%s\"", &r) == W3_REVERT_INTERNAL);
+    CHECK(strcmp(r.reason, "Panic(0x11)") == 0 && !r.node_fault);
+    CHECK(classify(data, 4, "\"0x%s\"", &r) == W3_REVERT_INTERNAL);
+    CHECK(strcmp(r.reason, "Panic(0x00)") == 0);
+}
+
+static void custom_errors(void) {
+    uint8_t data[PAYLOAD_SIZE];
+    size_t len = custom_error("UserNotFound(address)", 0xabcdef, data);
+    w3_revert_t r;
+
+    CHECK(classify(data, len, "\"0x%s\"", &r) == W3_REVERT_NOT_FOUND);
+    CHECK(strcmp(r.reason, "UserNotFound(address)") == 0);
+    // As geth, Erigon and Hardhat nest or prefix the payload
+    CHECK(classify(data, len, "{\"data\":\"0x%s\"}", &r) == W3_REVERT_NOT_FOUND);
+    CHECK(classify(data, len, "\"Reverted 0x%s\"", &r) == W3_REVERT_NOT_FOUND);
+
+    // uint is written as uint256 and hashed as such
+    CHECK(classify(data, custom_error("RateLimited(uint256)", 60, data), "\"0x%s\"", &r)
+            == W3_REVERT_RATE_LIMITED);
+    CHECK(!r.node_fault);
+
+    CHECK(classify(data, custom_error(long_error, 1, data), "\"0x%s\"", &r)
+            == W3_REVERT_DISABLED);
+    CHECK(strncmp(r.reason, long_error, W3_REVERT_REASON_SIZE - 1) == 0);
+
+    memcpy(data, "\xde\xad\xbe\xef", 4);
+    CHECK(classify(data, 36, "\"0x%s\"", &r) == W3_REVERT_INTERNAL);
+    CHECK(strcmp(r.reason, "custom error 0xdeadbeef") == 0);
+    CHECK(classify(data, 0, "\"0x%s\"", &r) == W3_REVERT_INTERNAL);
+    CHECK(strcmp(r.reason, "revert without reason") == 0);
+}
+
+static void node_messages(void) {
+    w3_revert_t r;
+
+    CHECK(classify_json("{\"error\":{\"code\":3,\"message\":\"execution reverted: user disabled\"}}",
+            &r) == W3_REVERT_DISABLED);
+    CHECK(!r.node_fault);
+    CHECK(classify_json("{\"error\":{\"code\":-32000,\"message\":\"execution reverted\"}}", &r)
+            == W3_REVERT_INTERNAL);
+    CHECK(!r.node_fault && r.code == -32000);
+    CHECK(classify_json("{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":\"0x00\"}", &r)
+            == W3_REVERT_NONE);
+}
+
+static void node_codes(void) {
+    w3_revert_t r;
+
+    CHECK(classify_json("{\"error\":{\"code\":-32005,\"message\":\"limit exceeded\"}}", &r)
+            == W3_REVERT_RATE_LIMITED);
+    CHECK(r.node_fault && r.code == -32005);
+    CHECK(classify_json("{\"error\":{\"code\":429,\"message\":\"Too Many Requests\"}}", &r)
+            == W3_REVERT_RATE_LIMITED);
+    CHECK(r.node_fault);
+
+    // Our request was bad: another node would reject it as well
+    CHECK(classify_json("{\"error\":{\"code\":-32602,\"message\":\"invalid argument\"}}", &r)
+            == W3_REVERT_INTERNAL);
+    CHECK(!r.node_fault);
+    CHECK(classify_json("{\"error\":{\"code\":-32700,\"message\":\"parse error\"}}", &r)
+            == W3_REVERT_INTERNAL);
+    CHECK(!r.node_fault);
+
+    CHECK(classify_json("{\"error\":{\"code\":-32000,\"message\":\"header not found\"}}", &r)
+            == W3_REVERT_INTERNAL);
+    CHECK(r.node_fault && strcmp(r.reason, "header not found") == 0);
+}
+
+static void confidential_failures(void) {
+    uint8_t data[PAYLOAD_SIZE];
+    char msg[2 * PAYLOAD_SIZE] = "reverted: ";
+    size_t len;
+    w3_revert_t r;
+
+    base64(data, error_string("user disabled", data), msg + 10);
+    CHECK(failure("evm", msg, &r) == W3_REVERT_DISABLED);
+    CHECK(!r.node_fault && r.code == 9 && strcmp(r.reason, "user disabled") == 0);
+
+    base64(data, custom_error("UserNotFound(address)", 7, data), msg + 10);
+    CHECK(failure("evm", msg, &r) == W3_REVERT_NOT_FOUND);
+
+    len = put_selector("Panic(uint256)", data);
+    base64(data, len + put_word(0x32, data + len), msg + 10);
+    CHECK(failure("evm", msg, &r) == W3_REVERT_INTERNAL);
+    CHECK(strcmp(r.reason, "Panic(0x32)") == 0);
+
+    // Older nodes give the message as is
+    CHECK(failure("evm", "reverted: user disabled", &r) == W3_REVERT_DISABLED);
+    CHECK(failure("evm", "reverted: ", &r) == W3_REVERT_INTERNAL);
+    CHECK(strcmp(r.reason, "revert without reason") == 0);
+    CHECK(failure("evm", "out of gas", &r) == W3_REVERT_INTERNAL);
+    CHECK(!r.node_fault);
+
+    // Any other module failing is the node's doing
+    CHECK(failure("core", "invalid nonce", &r) == W3_REVERT_INTERNAL);
+    CHECK(r.node_fault && strcmp(r.reason, "invalid nonce") == 0);
+}
+
+static void bad_tables(void) {
+    char spec[W3_REVERT_REASON_SIZE * 2 + 32];
+
+    CHECK(w3_revert_init("UserNotFound(address=not_found") < 0);
+    CHECK(w3_revert_init("UserNotFound(address)=gone") < 0);
+    CHECK(w3_revert_init("UserNotFound(address)") < 0);
+    CHECK(w3_revert_init("'user disabled=disabled") < 0);
+    snprintf(spec, sizeof(spec), "'%0*d'=disabled", (int)sizeof(spec) - 16, 0);
+    CHECK(w3_revert_init(spec) < 0);
+    CHECK(w3_revert_init(" ; ") == 0);
+}
+
+int main(void) {
+    char spec[1024];
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    memset(long_error, 'E', LONG_TEXT);
+    strcpy(long_error + LONG_TEXT, "(address)");
+    memset(long_message, 'm', LONG_TEXT);
+    snprintf(spec, sizeof(spec), "UserNotFound(address)=not_found; 'user disabled'=disabled;"
+            "RateLimited(uint)=rate_limited; 'a;b=c'=rate_limited; %s=disabled; '%s'=disabled",
+            long_error, long_message);
+    if (w3_revert_init(spec) < 0) {
+        fprintf(stderr, "Cannot load the error table\n");
+        return 1;
+    }
+    printf("Revert and JSON-RPC error classification\n");
+
+    run("Error(string): mapped, unmapped, malformed", error_string_mapped);
+    run("Panic(uint256)", panic);
+    run("custom errors: mapped, nested, unknown selector", custom_errors);
+    run("node messages without revert data", node_messages);
+    run("node error codes", node_codes);
+    run("confidential calls: base64 payloads, other modules", confidential_failures);
+    run("malformed error tables", bad_tables);
+
+    printf("%s\n", failed_scenarios ? "FAILED" : "ok");
+    return failed_scenarios != 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * Test of the primitives of confidential calls
+ *
+ * Checks X25519 against the vectors of RFC 7748, SHA-512/256 against the
+ * examples of FIPS 180-4, and its HMAC and the Sapphire key derivation
+ * against Python's hmac and hashlib. Deoxys-II-256-128 must give the tags
+ * and ciphertext of the reference implementation, the same with AES-NI as
+ * with the portable rounds at every length, and open must give back what
+ * seal took but reject a changed tag, ciphertext, nonce or associated data.
+ * Build and run with: make check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "web3_auth_deoxys.h"
+#include "web3_auth_hex.h"
+#include "web3_auth_sha512.h"
+#include "web3_auth_x25519.h"
+#include "test_util.h"
+
+#define KERNEL_LENGTHS 161
+
+// Bytes of a hex constant of the test
+static void unhex(const char* hex, uint8_t* out) {
+    if (w3_hex_decode(hex, strlen(hex), out) < 0) abort();
+}
+
+static int is_hex(const uint8_t* data, size_t len, const char* want) {
+    char hex[512];
+
+    if (2 * len != strlen(want) || 2 * len > sizeof(hex)) return 0;
+    w3_hex_encode(data, len, hex);
+    return memcmp(hex, want, 2 * len) == 0;
+}
+
+// Scenarios ----------------------------------------------------------------
+
+// RFC 7748 section 5.2
+static void x25519_vectors(void) {
+    static const char* const vectors[][3] = {
+        {"a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4",
+         "e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c",
+         "c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552"},
+        {"4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d",
+         "e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493",
+         "95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957"},
+    };
+    uint8_t k[32], u[32], out[32];
+
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        unhex(vectors[i][0], k);
+        unhex(vectors[i][1], u);
+        x25519(out, k, u);
+        CHECK(is_hex(out, 32, vectors[i][2]));
+    }
+
+    // k and u start as 9; each round k = X25519(k, u), u = old k
+    memset(k, 0, sizeof(k));
+    k[0] = 9;
+    memcpy(u, k, sizeof(u));
+    for (int i = 1; i <= 1000; i++) {
+        x25519(out, k, u);
+        memcpy(u, k, sizeof(u));
+        memcpy(k, out, sizeof(k));
+        if (i == 1) {
+            CHECK(is_hex(k, 32, "422c8e7a6227d7bca1350b3e2bb7279f7897b87bb6854b783c60e80311ae3079"));
+        }
+    }
+    CHECK(is_hex(k, 32, "684cf59ba83309552800ef566f2f4d3c1c3887c49360e3875f2eb94d99532c51"));
+}
+
+// RFC 7748 section 6.1, then the key Sapphire derives from the shared secret
+static void key_agreement(void) {
+    static const char label[] = "MRAE_Box_Deoxys-II-256-128";
+    uint8_t a[32], b[32], pa[32], pb[32], sa[32], sb[32], key[32], zero[32] = {0};
+
+    unhex("77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a", a);
+    unhex("5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb", b);
+    x25519_base(pa, a);
+    x25519_base(pb, b);
+    CHECK(is_hex(pa, 32, "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a"));
+    CHECK(is_hex(pb, 32, "de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f"));
+    x25519(sa, a, pb);
+    x25519(sb, b, pa);
+    CHECK(is_hex(sa, 32, "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742"));
+    CHECK(memcmp(sa, sb, 32) == 0);
+
+    hmac_sha512_256((const uint8_t*)label, sizeof(label) - 1, sa, sizeof(sa), key);
+    CHECK(is_hex(key, 32, "3b14f131ff64374a00f001cebbc65c784229bd88570731e1772216d8c5bcf7b8"));
+
+    // A low-order point gives no secret; the session refuses it
+    x25519(sa, a, zero);
+    CHECK(memcmp(sa, zero, 32) == 0);
+}
+
+static void sha512_256_vectors(void) {
+    static const char two_blocks[] = "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+            "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu";
+    static uint8_t million[1000000];
+    uint8_t out[32];
+
+    sha512_256((const uint8_t*)"abc", 3, out);
+    CHECK(is_hex(out, 32, "53048e2681941ef99b2e29b76b4c7dabe4c2d0c634fc6d46e0e2f13107e7af23"));
+    sha512_256((const uint8_t*)two_blocks, sizeof(two_blocks) - 1, out);
+    CHECK(is_hex(out, 32, "3928e184fb8690f840da3988121d31be65cb9d3ef83ee6146feac861e19b563a"));
+    sha512_256((const uint8_t*)"", 0, out);
+    CHECK(is_hex(out, 32, "c672b8d1ef56ed28ab87c3622c5114069bdd3ad7b8f9737498d0c01ecef0967a"));
+    memset(million, 'a', sizeof(million));
+    sha512_256(million, sizeof(million), out);
+    CHECK(is_hex(out, 32, "9a59a052930187a97038cae692f30708aa6491923ef5194394dc68d56c74fb21"));
+}
+
+// The cases of RFC 4231 with a short key and a key longer than the block
+static void hmac_vectors(void) {
+    static const char jefe_data[] = "what do ya want for nothing?";
+    static const char long_data[] = "Test Using Larger Than Block-Size Key - Hash Key First";
+    uint8_t long_key[131], out[32];
+
+    hmac_sha512_256((const uint8_t*)"Jefe", 4, (const uint8_t*)jefe_data,
+            sizeof(jefe_data) - 1, out);
+    CHECK(is_hex(out, 32, "6df7b24630d5ccb2ee335407081a87188c221489768fa2020513b2d593359456"));
+    memset(long_key, 0xaa, sizeof(long_key));
+    hmac_sha512_256(long_key, sizeof(long_key), (const uint8_t*)long_data,
+            sizeof(long_data) - 1, out);
+    CHECK(is_hex(out, 32, "87123c45f7c537a404f8f47cdbedda1fc9bec60eeb971982ce7ef10e774e6539"));
+}
+
+static void deoxys_vectors(void) {
+    uint8_t key[32], nonce[15], msg[32], out[48];
+    w3_deoxys_t ctx;
+
+    unhex("101112131415161718191a1b1c1d1e1f202122232425262728292a2b2c2d2e2f", key);
+    unhex("202122232425262728292a2b2c2d2e", nonce);
+    for (int i = 0; i < 32; i++) msg[i] = i;
+    w3_deoxys_init(&ctx, key);
+
+    w3_deoxys_seal(&ctx, nonce, NULL, 0, NULL, 0, out);
+    CHECK(is_hex(out, 16, "2b97bd77712f0cde975309959dfe1d7c"));
+    w3_deoxys_seal(&ctx, nonce, NULL, 0, msg, sizeof(msg), out);
+    CHECK(is_hex(out, 48, "9da20db1c2781f6669257d87e2a4d9be1970f7581bef2c995e1149331e5e8cc1"
+            "92ce3aec3a4b72ff9eab71c2a93492fa"));
+}
+
+// Every length of message and associated data up to ten blocks
+static void deoxys_kernels(void) {
+    static uint8_t portable[KERNEL_LENGTHS][KERNEL_LENGTHS + W3_DEOXYS_TAG_SIZE];
+    uint8_t key[32], nonce[15], data[KERNEL_LENGTHS], out[KERNEL_LENGTHS + W3_DEOXYS_TAG_SIZE];
+    w3_deoxys_t ctx;
+    const char* impl;
+    int differ = 0;
+
+    for (int i = 0; i < 32; i++) key[i] = 0xa0 ^ i;
+    for (int i = 0; i < 15; i++) nonce[i] = i * 7;
+    for (int i = 0; i < KERNEL_LENGTHS; i++) data[i] = i * 13 + 1;
+    w3_deoxys_init(&ctx, key);
+
+    // The portable rounds are used until a kernel is selected
+    for (int len = 0; len < KERNEL_LENGTHS; len++) {
+        w3_deoxys_seal(&ctx, nonce, data, len % 37, data, len, portable[len]);
+    }
+    impl = w3_deoxys_select();
+    for (int len = 0; len < KERNEL_LENGTHS; len++) {
+        w3_deoxys_seal(&ctx, nonce, data, len % 37, data, len, out);
+        if (memcmp(out, portable[len], len + W3_DEOXYS_TAG_SIZE) != 0) differ++;
+    }
+    CHECK(differ == 0);
+    printf("  %s against portable, %d of %d lengths differ\n", impl, differ, KERNEL_LENGTHS);
+}
+
+static void seal_open(void) {
+    static const char ad[] = "associated data";
+    uint8_t key[32], nonce[15], msg[75], sealed[75 + W3_DEOXYS_TAG_SIZE], bad[sizeof(sealed)];
+    uint8_t out[sizeof(msg)], zero[sizeof(msg)] = {0};
+    size_t len = sizeof(sealed);
+    w3_deoxys_t ctx;
+
+    w3_deoxys_select();
+    for (int i = 0; i < 32; i++) key[i] = i * 3;
+    for (int i = 0; i < 15; i++) nonce[i] = 0xf0 ^ i;
+    for (size_t i = 0; i < sizeof(msg); i++) msg[i] = 'a' + i % 26;
+    w3_deoxys_init(&ctx, key);
+    w3_deoxys_seal(&ctx, nonce, (const uint8_t*)ad, sizeof(ad), msg, sizeof(msg), sealed);
+    CHECK(memcmp(sealed, msg, sizeof(msg)) != 0);
+
+    CHECK(w3_deoxys_open(&ctx, nonce, (const uint8_t*)ad, sizeof(ad), sealed, len, out) == 0);
+    CHECK(memcmp(out, msg, sizeof(msg)) == 0);
+    memcpy(bad, sealed, len);
+    CHECK(w3_deoxys_open(&ctx, nonce, (const uint8_t*)ad, sizeof(ad), bad, len, bad) == 0);
+    CHECK(memcmp(bad, msg, sizeof(msg)) == 0);
+
+    // Changed tag, then ciphertext: rejected, with nothing left in out
+    memcpy(bad, sealed, len);
+    bad[len - 1] ^= 0x01;
+    CHECK(w3_deoxys_open(&ctx, nonce, (const uint8_t*)ad, sizeof(ad), bad, len, out) < 0);
+    CHECK(memcmp(out, zero, sizeof(out)) == 0);
+    memcpy(bad, sealed, len);
+    bad[10] ^= 0x80;
+    CHECK(w3_deoxys_open(&ctx, nonce, (const uint8_t*)ad, sizeof(ad), bad, len, out) < 0);
+    CHECK(memcmp(out, zero, sizeof(out)) == 0);
+
+    // Other associated data or nonce
+    CHECK(w3_deoxys_open(&ctx, nonce, (const uint8_t*)ad, sizeof(ad) - 1, sealed, len, out) < 0);
+    nonce[14] ^= 1;
+    CHECK(w3_deoxys_open(&ctx, nonce, (const uint8_t*)ad, sizeof(ad), sealed, len, out) < 0);
+}
+
+int main(void) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("X25519, SHA-512/256 and Deoxys-II of confidential calls\n");
+
+    run("X25519: RFC 7748 vectors, 1000 iterations", x25519_vectors);
+    run("X25519: RFC 7748 key agreement, Sapphire key", key_agreement);
+    run("SHA-512/256: FIPS 180-4 examples, a million 'a'", sha512_256_vectors);
+    run("HMAC-SHA512/256: short key, key over a block", hmac_vectors);
+    run("Deoxys-II-256-128: reference vectors", deoxys_vectors);
+    run("Deoxys-II-256-128: selected kernel, 0 to 160 bytes", deoxys_kernels);
+    run("Deoxys-II-256-128: open, changed tag, data, nonce", seal_open);
+
+    printf("%s\n", failed_scenarios ? "FAILED" : "ok");
+    return failed_scenarios != 0;
+}
@@ -0,0 +1,24 @@
+/*
+ * Minimal stand-in of Kamailio's core/atomic_ops.h for the module tests
+ */
+
+#ifndef _ATOMIC_OPS_H
+#define _ATOMIC_OPS_H
+
+static inline void atomic_inc_int(volatile int* v) {
+    __atomic_add_fetch(v, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_inc_long(volatile long* v) {
+    __atomic_add_fetch(v, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline long atomic_add_long(volatile long* v, long n) {
+    return __atomic_add_fetch(v, n, __ATOMIC_SEQ_CST);
+}
+
+#define membar() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define membar_read() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define membar_write() __atomic_thread_fence(__ATOMIC_RELEASE)
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * Minimal stand-in of Kamailio's core/locking.h for the module tests
+ */
+
+#ifndef _LOCKING_H
+#define _LOCKING_H
+
+#include <sched.h>
+#include <stdlib.h>
+
+typedef struct {
+    volatile int v;
+} gen_lock_t;
+
+typedef struct {
+    int size;
+    gen_lock_t* locks;
+} gen_lock_set_t;
+
+static inline gen_lock_t* lock_init(gen_lock_t* l) {
+    l->v = 0;
+    return l;
+}
+
+static inline void lock_get(gen_lock_t* l) {
+    while (__atomic_exchange_n(&l->v, 1, __ATOMIC_ACQUIRE)) sched_yield();
+}
+
+static inline void lock_release(gen_lock_t* l) {
+    __atomic_store_n(&l->v, 0, __ATOMIC_RELEASE);
+}
+
+static inline void lock_destroy(gen_lock_t* l) {
+    (void)l;
+}
+
+static inline gen_lock_set_t* lock_set_alloc(int n) {
+    gen_lock_set_t* s = malloc(sizeof(gen_lock_set_t) + n * sizeof(gen_lock_t));
+
+    if (!s) return NULL;
+    s->size = n;
+    s->locks = (gen_lock_t*)(s + 1);
+    return s;
+}
+
+static inline gen_lock_set_t* lock_set_init(gen_lock_set_t* s) {
+    for (int i = 0; i < s->size; i++) lock_init(&s->locks[i]);
+    return s;
+}
+
+static inline void lock_set_get(gen_lock_set_t* s, int i) {
+    lock_get(&s->locks[i]);
+}
+
+static inline void lock_set_release(gen_lock_set_t* s, int i) {
+    lock_release(&s->locks[i]);
+}
+
+static inline void lock_set_destroy(gen_lock_set_t* s) {
+    (void)s;
+}
+
+static inline void lock_set_dealloc(gen_lock_set_t* s) {
+    free(s);
+}
+
+#endif
@@ -0,0 +1,14 @@
+/*
+ * Minimal stand-in of Kamailio's core/mem/shm_mem.h for the module tests;
+ * each test process is a whole node, so its own heap will do
+ */
+
+#ifndef _SHM_MEM_H
+#define _SHM_MEM_H
+
+#include <stdlib.h>
+
+#define shm_malloc(size) malloc(size)
+#define shm_free(p) free(p)
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * Minimal stand-in of Kamailio's core/rpc.h for the module tests
+ */
+
+#ifndef _RPC_H
+#define _RPC_H
+
+typedef int (*rpc_fault_f)(void* ctx, int code, char* fmt, ...);
+typedef int (*rpc_add_f)(void* ctx, char* fmt, ...);
+typedef int (*rpc_scan_f)(void* ctx, char* fmt, ...);
+typedef int (*rpc_struct_add_f)(void* ctx, char* fmt, ...);
+
+typedef struct rpc {
+    rpc_fault_f fault;
+    rpc_add_f add;
+    rpc_scan_f scan;
+    rpc_struct_add_f struct_add;
+} rpc_t;
+
+#endif
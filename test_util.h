@@ -0,0 +1,118 @@
+/*
+ * Helpers shared by the module tests
+ *
+ * CHECK() counts failed conditions of the running scenario; run() runs each
+ * scenario in a fresh process, since module state is per process as in a
+ * Kamailio worker; rpc_stat() calls an RPC handler with a context that
+ * keeps the struct it reports.
+ */
+
+#ifndef _TEST_UTIL_H_
+#define _TEST_UTIL_H_
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../../core/rpc.h"
+
+#define TEST_STATS_MAX 16
+
+typedef struct test_stat {
+    const char* name;
+    unsigned long value;
+    const char* text;       // 's' members
+} test_stat_t;
+
+static int failures;            // of the running scenario
+static int failed_scenarios;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "    %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+static inline void run(const char* name, void (*scenario)(void)) {
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        failures = 0;
+        scenario();
+        _exit(failures ? 1 : 0);
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        failed_scenarios++;
+        printf("  %-56s FAILED\n", name);
+    } else {
+        printf("  %-56s ok\n", name);
+    }
+}
+
+// RPC context ---------------------------------------------------------------
+
+static test_stat_t test_stats[TEST_STATS_MAX];
+static int test_nstats;
+
+static inline int test_rpc_fault(void* ctx, int code, char* fmt, ...) {
+    (void)ctx;
+    (void)fmt;
+    test_nstats = 0;
+    fprintf(stderr, "    rpc fault %d\n", code);
+    return 0;
+}
+
+static inline int test_rpc_add(void* ctx, char* fmt, ...) {
+    va_list ap;
+
+    (void)fmt;
+    va_start(ap, fmt);
+    *va_arg(ap, void**) = ctx;
+    va_end(ap);
+    return 0;
+}
+
+static inline int test_rpc_struct_add(void* ctx, char* fmt, ...) {
+    va_list ap;
+
+    (void)ctx;
+    va_start(ap, fmt);
+    for (test_nstats = 0; *fmt && test_nstats < TEST_STATS_MAX; fmt++, test_nstats++) {
+        test_stat_t* s = &test_stats[test_nstats];
+
+        s->name = va_arg(ap, const char*);
+        s->text = NULL;
+        s->value = 0;
+        if (*fmt == 's') s->text = va_arg(ap, const char*);
+        else if (*fmt == 'd') s->value = (unsigned long)va_arg(ap, int);
+        else s->value = va_arg(ap, unsigned int);
+    }
+    va_end(ap);
+    return 0;
+}
+
+// Member name of the struct the RPC handler reports
+static inline test_stat_t* rpc_stat(void (*handler)(rpc_t*, void*), const char* name) {
+    static rpc_t rpc = {
+        .fault = test_rpc_fault, .add = test_rpc_add, .struct_add = test_rpc_struct_add,
+    };
+    static test_stat_t none = {"", 0, ""};
+    int ctx;
+
+    test_nstats = 0;
+    handler(&rpc, &ctx);
+    for (int i = 0; i < test_nstats; i++) {
+        if (strcmp(test_stats[i].name, name) == 0) return &test_stats[i];
+    }
+    fprintf(stderr, "    no statistic %s\n", name);
+    failures++;
+    return &none;
+}
+
+#endif
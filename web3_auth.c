@@ -5,9 +5,11 @@
  * It verifies SIP digest authentication against smart contract stored credentials.
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <curl/curl.h>
 #include <stdint.h>
 #include <ctype.h>
@@ -18,40 +20,130 @@
 #include "../../core/parser/parse_param.h"
 #include "../../core/parser/digest/digest.h"
 #include "../../core/parser/parse_uri.h"
+#include "../../core/rpc.h"
+#include "../../core/pvar.h"
+#include "../../core/ip_addr.h"
+#include "../../core/timer.h"
+#include "../../core/timer_proc.h"
+#include "../../core/pt.h"
+#include "../../core/rand/fastrand.h"
+
+#include "web3_auth.h"
+#include "web3_auth_limiter.h"
+#include "web3_auth_ban.h"
+#include "web3_auth_topk.h"
+#include "web3_auth_cache.h"
+#include "web3_auth_quota.h"
+#include "web3_auth_acct.h"
+#include "web3_auth_route.h"
+#include "web3_auth_shard.h"
+#include "web3_auth_http.h"
+#include "web3_auth_hex.h"
+#include "web3_auth_abi.h"
+#include "web3_auth_revert.h"
+#include "web3_auth_evm.h"
+#include "web3_auth_state.h"
+#include "web3_auth_repl.h"
+#include "web3_auth_l2.h"
+#include "web3_auth_sapphire.h"
+#include "web3_auth_uring.h"
+#include "web3_auth_cpu.h"
+#include "web3_auth_rec.h"
 
 MODULE_VERSION
 
 // Module configuration
 #define DEFAULT_RPC_URL "https://testnet.sapphire.oasis.dev"
 #define DEFAULT_CONTRACT_ADDRESS "0x1b55e67Ce5118559672Bf9EC0564AE3A46C41000"
+#define DEFAULT_REVERT_ERRORS "'User not found'=not_found"
+#define LOCAL_EXEC_OFF 0
+#define LOCAL_EXEC_SHADOW 1     // eth_call answers, local results are compared
+#define LOCAL_EXEC_SERVE 2      // local results answer, a sample is compared
 #define MAX_AUTH_HEADER_SIZE 2048
 #define MAX_FIELD_SIZE 256
 
 // Module parameters
 static char *rpc_url = DEFAULT_RPC_URL;
 static char *contract_address = DEFAULT_CONTRACT_ADDRESS;
+static char *function_signature = W3_DEFAULT_SIGNATURE;
+static char *routing_file = NULL;    // per-realm contracts and endpoints
+static int abi_memo = 0;             // reuse encodings of repeating arguments
+static int rpc_sharding = W3_SHARD_ORDERED; // 1 places users by rendezvous hashing
+static int rpc_failover = 2;         // endpoints tried per lookup
+static int endpoint_fail_threshold = 3; // failures in a row that mark an endpoint down
+static int endpoint_down_time = 10;  // seconds a down endpoint is avoided
+static int dns_cache_ttl = 60;       // seconds resolved addresses are shared
+static int prewarm_connections = 1;  // connect to all endpoints in child_init
+static int keepalive_interval = 30;  // idle seconds before a keep-alive call, 0 disables
+static int max_requests_per_connection = 0; // server limit per connection, 0 for none
+static char *rpc_transport = "curl"; // "curl" or "io_uring" for plain-http endpoints
+static char *rpc_cpus = NULL;        // CPU list for workers and helpers, unset disables pinning
+static int rpc_cpu_spread = 1;       // 1 pins each worker to one CPU of rpc_cpus in turn
+static int numa_local = 0;           // 1 places per-worker memory on the worker's node
+static int rpc_limit_init = 8;       // initial concurrent eth_call limit
+static int rpc_limit_min = 1;        // adaptive limit floor
+static int rpc_limit_max = 128;      // adaptive limit ceiling
+static int rpc_queue_size = 128;     // callers allowed to wait for a slot
+static int rpc_queue_timeout = 2000; // max wait for a slot in ms
+static int rpc_timeout = 10000;      // whole eth_call request in ms
+static int retry_after_min = 1;      // Retry-After bounds in seconds
+static int retry_after_max = 120;
+static int retry_after_jitter = 50;  // random spread in percent of the value
+static int rpc_weight_high = 8;      // dequeue weights of the priority classes
+static int rpc_weight_normal = 4;
+static int rpc_weight_low = 1;
+static int rpc_starvation_ms = 1000; // queued longer than this is served first
+static int ban_threshold = 5;        // failures that trigger a ban, 0 disables
+static int ban_window = 60;          // seconds in which failures are counted
+static int ban_time = 30;            // first ban in seconds, doubled on repeats
+static int ban_max_time = 3600;      // longest ban in seconds
+static int ban_table_size = 4096;    // tracked IPs and users
+static int cache_size = 4096;        // cached contract digests, 0 disables
+static int cache_ttl = 60;           // seconds a digest is reused
+static int cache_stale_ttl = 300;    // extra seconds served when over quota
+static int negative_cache_ttl = 30;  // seconds unknown users are rejected without a call
+static char *revert_errors = DEFAULT_REVERT_ERRORS; // contract errors to outcomes
+static int local_exec = LOCAL_EXEC_OFF; // run the contract locally: 1 shadow, 2 serve
+static int local_exec_sample = 10;   // percent of served calls still checked by eth_call
+static int local_exec_slots = 4096;  // storage words kept for local execution
+static int local_exec_interval = 1;  // seconds between snapshot syncs
+static char *repl_listen = NULL;     // "host:port" for cache replication, unset disables
+static char *repl_peers = NULL;      // comma-separated "host:port" of the other nodes
+static char *repl_secret = NULL;     // shared key authenticating replication datagrams
+static int repl_queue_size = 4096;   // cache changes waiting to be sent
+static int repl_interval = 20;       // ms between replication batches
+static char *l2_url = NULL;          // redis:// or memcached:// second-level cache
+static char *l2_secret = NULL;       // shared key authenticating L2 values
+static int l2_timeout = 20;          // ms per L2 lookup or store
+static int l2_ttl = 300;             // seconds digests are kept in L2
+static int l2_fail_threshold = 3;    // L2 failures in a row that open the breaker
+static int l2_down_time = 5;         // seconds L2 is bypassed once open
+static int confidential_calls = 0;   // 1 encrypts eth_call for Sapphire
+static int confidential_key_refresh = 60; // seconds between runtime key fetches
+static int confidential_session_ttl = 600; // seconds a process reuses its session key
+static int rpc_rate_limit = 0;       // eth_calls per second, 0 disables
+static int rpc_rate_burst = 0;       // bucket depth, defaults to the rate
+static int realm_rate_limit = 0;     // eth_calls per second and realm
+static int realm_rate_burst = 0;
+static int realm_table_size = 256;   // realms tracked by the quota
+static char *quota_fallback = "cache"; // "cache" or "fail" when over quota
+static char *accounting_file = NULL; // persisted per-endpoint totals
+static int accounting_interval = 60; // seconds between saves
 
-// Keccak-256 implementation
-#define KECCAK_ROUNDS 24
-
-static const uint64_t keccak_round_constants[KECCAK_ROUNDS] = {
-    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808aULL,
-    0x8000000080008000ULL, 0x000000000000808bULL, 0x0000000080000001ULL,
-    0x8000000080008081ULL, 0x8000000000008009ULL, 0x000000000000008aULL,
-    0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000aULL,
-    0x000000008000808bULL, 0x800000000000008bULL, 0x8000000000008089ULL,
-    0x8000000000008003ULL, 0x8000000000008002ULL, 0x8000000000000080ULL,
-    0x000000000000800aULL, 0x800000008000000aULL, 0x8000000080008081ULL,
-    0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL
-};
+#define QUOTA_FALLBACK_FAIL 0
+#define QUOTA_FALLBACK_CACHE 1
+static int quota_fallback_mode = QUOTA_FALLBACK_CACHE;
 
-static const int rho_offsets[24] = {
-    1, 3, 6, 10, 15, 21, 28, 36, 45, 55, 2, 14, 27, 41, 56, 8, 25, 43, 62, 18, 39, 61, 20, 44
-};
+#define RPC_TRANSPORT_CURL 0
+#define RPC_TRANSPORT_URING 1
+static int rpc_transport_mode = RPC_TRANSPORT_CURL;
 
-static const int pi_offsets[24] = {
-    10, 7, 11, 17, 18, 3, 5, 16, 8, 21, 24, 4, 15, 23, 19, 13, 12, 2, 20, 14, 22, 9, 6, 1
-};
+static w3_cpus_t rpc_cpu_set;
+
+// Retry-After computed for the last shed or banned request of this process
+#define PV_WEB3_RETRY_AFTER 1
+static unsigned int retry_after_msg_id = 0;
+static int retry_after_value = 0;
 
 // Structure to hold SIP digest auth components
 typedef struct {
@@ -61,6 +153,8 @@ typedef struct {
     char nonce[MAX_FIELD_SIZE];
     char response[MAX_FIELD_SIZE];
     char method[MAX_FIELD_SIZE];
+    const w3_tenant_t* tenant;   // routing entry of the realm
+    uint8_t digest[W3_DIGEST_SIZE]; // response decoded, set once validated
 } sip_auth_t;
 
 // Structure to hold response data
@@ -71,223 +165,236 @@ struct ResponseData {
 
 // Function prototypes
 static int mod_init(void);
+static int child_init(int rank);
 static void mod_destroy(void);
 static int web3_auth_check(struct sip_msg* msg, char* p1, char* p2);
+static int pv_parse_web3_auth_name(pv_spec_p sp, str* in);
+static int pv_get_web3_auth(struct sip_msg* msg, pv_param_t* param, pv_value_t* res);
 
 // Module exports
 static cmd_export_t cmds[] = {
     {"web3_auth_check", (cmd_function)web3_auth_check, 0, 0, 0, REQUEST_ROUTE},
+    {"web3_auth_check", (cmd_function)web3_auth_check, 1, fixup_spve_null,
+        fixup_free_spve_null, REQUEST_ROUTE},
     {0, 0, 0, 0, 0, 0}
 };
 
 static param_export_t params[] = {
     {"rpc_url", PARAM_STRING, &rpc_url},
     {"contract_address", PARAM_STRING, &contract_address},
+    {"function_signature", PARAM_STRING, &function_signature},
+    {"routing_file", PARAM_STRING, &routing_file},
+    {"abi_memo", PARAM_INT, &abi_memo},
+    {"rpc_sharding", PARAM_INT, &rpc_sharding},
+    {"rpc_failover", PARAM_INT, &rpc_failover},
+    {"endpoint_fail_threshold", PARAM_INT, &endpoint_fail_threshold},
+    {"endpoint_down_time", PARAM_INT, &endpoint_down_time},
+    {"dns_cache_ttl", PARAM_INT, &dns_cache_ttl},
+    {"prewarm_connections", PARAM_INT, &prewarm_connections},
+    {"keepalive_interval", PARAM_INT, &keepalive_interval},
+    {"max_requests_per_connection", PARAM_INT, &max_requests_per_connection},
+    {"rpc_transport", PARAM_STRING, &rpc_transport},
+    {"rpc_cpus", PARAM_STRING, &rpc_cpus},
+    {"rpc_cpu_spread", PARAM_INT, &rpc_cpu_spread},
+    {"numa_local", PARAM_INT, &numa_local},
+    {"rpc_limit_init", PARAM_INT, &rpc_limit_init},
+    {"rpc_limit_min", PARAM_INT, &rpc_limit_min},
+    {"rpc_limit_max", PARAM_INT, &rpc_limit_max},
+    {"rpc_queue_size", PARAM_INT, &rpc_queue_size},
+    {"rpc_queue_timeout", PARAM_INT, &rpc_queue_timeout},
+    {"rpc_timeout", PARAM_INT, &rpc_timeout},
+    {"retry_after_min", PARAM_INT, &retry_after_min},
+    {"retry_after_max", PARAM_INT, &retry_after_max},
+    {"retry_after_jitter", PARAM_INT, &retry_after_jitter},
+    {"rpc_weight_high", PARAM_INT, &rpc_weight_high},
+    {"rpc_weight_normal", PARAM_INT, &rpc_weight_normal},
+    {"rpc_weight_low", PARAM_INT, &rpc_weight_low},
+    {"rpc_starvation_ms", PARAM_INT, &rpc_starvation_ms},
+    {"ban_threshold", PARAM_INT, &ban_threshold},
+    {"ban_window", PARAM_INT, &ban_window},
+    {"ban_time", PARAM_INT, &ban_time},
+    {"ban_max_time", PARAM_INT, &ban_max_time},
+    {"ban_table_size", PARAM_INT, &ban_table_size},
+    {"cache_size", PARAM_INT, &cache_size},
+    {"cache_ttl", PARAM_INT, &cache_ttl},
+    {"cache_stale_ttl", PARAM_INT, &cache_stale_ttl},
+    {"negative_cache_ttl", PARAM_INT, &negative_cache_ttl},
+    {"revert_errors", PARAM_STRING, &revert_errors},
+    {"local_exec", PARAM_INT, &local_exec},
+    {"local_exec_sample", PARAM_INT, &local_exec_sample},
+    {"local_exec_slots", PARAM_INT, &local_exec_slots},
+    {"local_exec_interval", PARAM_INT, &local_exec_interval},
+    {"repl_listen", PARAM_STRING, &repl_listen},
+    {"repl_peers", PARAM_STRING, &repl_peers},
+    {"repl_secret", PARAM_STRING, &repl_secret},
+    {"repl_queue_size", PARAM_INT, &repl_queue_size},
+    {"repl_interval", PARAM_INT, &repl_interval},
+    {"l2_url", PARAM_STRING, &l2_url},
+    {"l2_secret", PARAM_STRING, &l2_secret},
+    {"l2_timeout", PARAM_INT, &l2_timeout},
+    {"l2_ttl", PARAM_INT, &l2_ttl},
+    {"l2_fail_threshold", PARAM_INT, &l2_fail_threshold},
+    {"l2_down_time", PARAM_INT, &l2_down_time},
+    {"confidential_calls", PARAM_INT, &confidential_calls},
+    {"confidential_key_refresh", PARAM_INT, &confidential_key_refresh},
+    {"confidential_session_ttl", PARAM_INT, &confidential_session_ttl},
+    {"rpc_rate_limit", PARAM_INT, &rpc_rate_limit},
+    {"rpc_rate_burst", PARAM_INT, &rpc_rate_burst},
+    {"realm_rate_limit", PARAM_INT, &realm_rate_limit},
+    {"realm_rate_burst", PARAM_INT, &realm_rate_burst},
+    {"realm_table_size", PARAM_INT, &realm_table_size},
+    {"quota_fallback", PARAM_STRING, &quota_fallback},
+    {"accounting_file", PARAM_STRING, &accounting_file},
+    {"accounting_interval", PARAM_INT, &accounting_interval},
     {0, 0, 0}
 };
 
+static pv_export_t mod_pvs[] = {
+    {{"web3_auth", sizeof("web3_auth") - 1}, PVT_OTHER, pv_get_web3_auth, 0,
+        pv_parse_web3_auth_name, 0, 0, 0},
+    {{0, 0}, 0, 0, 0, 0, 0, 0, 0}
+};
+
+static const char* web3_rpc_limiter_doc[2] = {
+    "Show the adaptive eth_call concurrency limit and queue depth", 0
+};
+
+static const char* web3_rpc_ban_list_doc[2] = {
+    "List source IPs and users with recent authentication failures or bans", 0
+};
+
+static const char* web3_rpc_ban_clear_doc[2] = {
+    "Clear all bans, or one with parameters: ip <address> | user <user@realm>", 0
+};
+
+static const char* web3_rpc_top_doc[2] = {
+    "Show the usernames or source IPs with the most attempts: [users|ips] [rows]", 0
+};
+
+static const char* web3_rpc_accounting_doc[2] = {
+    "Show eth_calls, errors and bytes per RPC endpoint since the totals started", 0
+};
+
+static const char* web3_rpc_quota_doc[2] = {
+    "Show the global and per-realm eth_call token buckets", 0
+};
+
+static const char* web3_rpc_cache_stats_doc[2] = {
+    "Show digest cache size and hit counters", 0
+};
+
+static const char* web3_rpc_cache_flush_doc[2] = {
+    "Drop all cached digests, or those of one tenant: [realm]", 0
+};
+
+static const char* web3_rpc_routes_doc[2] = {
+    "List the realm routing table", 0
+};
+
+static const char* web3_rpc_config_doc[2] = {
+    "Show the version and inputs of the active RPC configuration", 0
+};
+
+static const char* web3_rpc_reload_doc[2] = {
+    "Reload the routing file, or switch to another one: [file]", 0
+};
+
+static const char* web3_rpc_set_endpoints_doc[2] = {
+    "Replace the default RPC endpoints: <rpc_url[,rpc_url...]>", 0
+};
+
+static const char* web3_rpc_set_contract_doc[2] = {
+    "Replace the default contract: <address> [function signature]", 0
+};
+
+static const char* web3_rpc_set_timeouts_doc[2] = {
+    "Replace the RPC timeouts: <rpc_timeout_ms> [rpc_queue_timeout_ms]", 0
+};
+
+static const char* web3_rpc_dns_doc[2] = {
+    "Show the resolver results shared between processes", 0
+};
+
+static const char* web3_rpc_endpoints_doc[2] = {
+    "Show the health of the RPC endpoints", 0
+};
+
+static const char* web3_rpc_l2_doc[2] = {
+    "Show the L2 cache server, breaker state and counters", 0
+};
+
+static const char* web3_rpc_repl_doc[2] = {
+    "Show the cache replication peers and counters", 0
+};
+
+static const char* web3_rpc_local_exec_doc[2] = {
+    "Show the contract snapshots of local execution and their shadow checks", 0
+};
+
+static const char* web3_rpc_confidential_doc[2] = {
+    "Show the Sapphire runtime keys and confidential call counters", 0
+};
+
+static const char* web3_rpc_record_doc[2] = {
+    "Record authentication traffic for bench_replay: [start <file> | stop]", 0
+};
+
+static rpc_export_t web3_rpc_cmds[] = {
+    {"web3_auth.limiter", w3_limiter_rpc_stats, web3_rpc_limiter_doc, 0},
+    {"web3_auth.ban_list", w3_ban_rpc_list, web3_rpc_ban_list_doc, RET_ARRAY},
+    {"web3_auth.ban_clear", w3_ban_rpc_clear, web3_rpc_ban_clear_doc, 0},
+    {"web3_auth.top", w3_topk_rpc_top, web3_rpc_top_doc, RET_ARRAY},
+    {"web3_auth.accounting", w3_acct_rpc_stats, web3_rpc_accounting_doc, RET_ARRAY},
+    {"web3_auth.quota", w3_quota_rpc_stats, web3_rpc_quota_doc, RET_ARRAY},
+    {"web3_auth.cache_stats", w3_cache_rpc_stats, web3_rpc_cache_stats_doc, 0},
+    {"web3_auth.cache_flush", w3_cache_rpc_flush, web3_rpc_cache_flush_doc, 0},
+    {"web3_auth.repl", w3_repl_rpc_stats, web3_rpc_repl_doc, 0},
+    {"web3_auth.l2_stats", w3_l2_rpc_stats, web3_rpc_l2_doc, 0},
+    {"web3_auth.routes", w3_route_rpc_list, web3_rpc_routes_doc, RET_ARRAY},
+    {"web3_auth.endpoints", w3_shard_rpc_endpoints, web3_rpc_endpoints_doc, RET_ARRAY},
+    {"web3_auth.dns", w3_http_rpc_dns, web3_rpc_dns_doc, RET_ARRAY},
+    {"web3_auth.local_exec", w3_state_rpc_stats, web3_rpc_local_exec_doc, RET_ARRAY},
+    {"web3_auth.confidential", w3_sapphire_rpc_stats, web3_rpc_confidential_doc, RET_ARRAY},
+    {"web3_auth.record", w3_rec_rpc, web3_rpc_record_doc, 0},
+    {"web3_auth.config", w3_route_rpc_config, web3_rpc_config_doc, 0},
+    {"web3_auth.reload", w3_route_rpc_reload, web3_rpc_reload_doc, 0},
+    {"web3_auth.set_endpoints", w3_route_rpc_set_endpoints, web3_rpc_set_endpoints_doc, 0},
+    {"web3_auth.set_contract", w3_route_rpc_set_contract, web3_rpc_set_contract_doc, 0},
+    {"web3_auth.set_timeouts", w3_route_rpc_set_timeouts, web3_rpc_set_timeouts_doc, 0},
+    {0, 0, 0, 0}
+};
+
 struct module_exports exports = {
     "web3_auth",        /* module name */
     DEFAULT_DLFLAGS,    /* dlopen flags */
     cmds,               /* exported functions */
     params,             /* exported parameters */
-    0,                  /* RPC methods */
-    0,                  /* exported pseudo-variables */
+    web3_rpc_cmds,      /* RPC methods */
+    mod_pvs,            /* exported pseudo-variables */
     0,                  /* response function */
     mod_init,           /* module initialization function */
-    0,                  /* per child init function */
+    child_init,         /* per child init function */
     mod_destroy         /* destroy function */
 };
 
-// Rotate left function
-static inline uint64_t rotl64(uint64_t x, int n) {
-    return (x << n) | (x >> (64 - n));
-}
-
-// Keccak permutation
-static void keccak_f1600(uint64_t state[25]) {
-    for (int round = 0; round < KECCAK_ROUNDS; round++) {
-        // Theta step
-        uint64_t C[5];
-        for (int i = 0; i < 5; i++) {
-            C[i] = state[i] ^ state[i + 5] ^ state[i + 10] ^ state[i + 15] ^ state[i + 20];
-        }
-        
-        for (int i = 0; i < 5; i++) {
-            uint64_t D = C[(i + 4) % 5] ^ rotl64(C[(i + 1) % 5], 1);
-            for (int j = 0; j < 25; j += 5) {
-                state[j + i] ^= D;
-            }
-        }
-        
-        // Rho and Pi steps
-        uint64_t current = state[1];
-        for (int i = 0; i < 24; i++) {
-            int j = pi_offsets[i];
-            uint64_t temp = state[j];
-            state[j] = rotl64(current, rho_offsets[i]);
-            current = temp;
-        }
-        
-        // Chi step
-        for (int j = 0; j < 25; j += 5) {
-            uint64_t t[5];
-            for (int i = 0; i < 5; i++) {
-                t[i] = state[j + i];
-            }
-            for (int i = 0; i < 5; i++) {
-                state[j + i] = t[i] ^ ((~t[(i + 1) % 5]) & t[(i + 2) % 5]);
-            }
-        }
-        
-        // Iota step
-        state[0] ^= keccak_round_constants[round];
+// Pass the SIP fields of the credentials to the tenant's function; returns
+// the size of the call arguments in bytes, or -1
+static long digest_call_args(const sip_auth_t* auth, w3_abi_value_t fields[W3_CALL_FIELDS],
+        w3_abi_value_t* tuple) {
+    const char* values[W3_CALL_FIELDS] = {
+        auth->username, auth->realm, auth->method, auth->uri, auth->nonce
+    };
+    
+    for (int i = 0; i < W3_CALL_FIELDS; i++) {
+        fields[i].data = (const uint8_t*)values[i];
+        fields[i].len = strlen(values[i]);
+        fields[i].num = 0;
+        fields[i].items = NULL;
     }
-}
-
-// Keccak-256 hash function
-void keccak256(const uint8_t *input, size_t input_len, uint8_t output[32]) {
-    uint64_t state[25] = {0};
-    uint8_t *state_bytes = (uint8_t *)state;
-    
-    // Absorb phase
-    size_t rate = 136; // (1600 - 256) / 8 for Keccak-256
-    size_t offset = 0;
-    
-    while (input_len >= rate) {
-        for (size_t i = 0; i < rate; i++) {
-            state_bytes[i] ^= input[offset + i];
-        }
-        keccak_f1600(state);
-        offset += rate;
-        input_len -= rate;
-    }
-    
-    // Final block with remaining input
-    for (size_t i = 0; i < input_len; i++) {
-        state_bytes[i] ^= input[offset + i];
-    }
-    
-    // Padding
-    state_bytes[input_len] ^= 0x01;
-    state_bytes[rate - 1] ^= 0x80;
-    
-    // Final permutation
-    keccak_f1600(state);
-    
-    // Extract output
-    memcpy(output, state_bytes, 32);
-}
-
-// Calculate function selector from function signature
-char* get_function_selector(const char* function_signature) {
-    uint8_t hash[32];
-    keccak256((const uint8_t*)function_signature, strlen(function_signature), hash);
-    
-    // Take first 4 bytes and convert to hex string
-    char* selector = pkg_malloc(11); // "0x" + 8 hex chars + null terminator
-    if (!selector) return NULL;
-    
-    snprintf(selector, 11, "0x%02x%02x%02x%02x", 
-             hash[0], hash[1], hash[2], hash[3]);
-    
-    return selector;
-}
-
-// Helper function to pad string to 32-byte boundaries
-char* pad_string_data(const char* str, size_t* padded_length) {
-    size_t len = strlen(str);
-    size_t padded_len = ((len + 31) / 32) * 32; // Round up to nearest 32 bytes
-    
-    // If empty string, still need at least 32 bytes
-    if (padded_len == 0) padded_len = 32;
-    
-    char* padded = pkg_malloc(padded_len * 2 + 1); // *2 for hex, +1 for null terminator
-    
-    if (!padded) return NULL;
-    
-    // Initialize with zeros
-    memset(padded, '0', padded_len * 2);
-    padded[padded_len * 2] = '\0';
-    
-    // Convert string to hex
-    for (size_t i = 0; i < len; i++) {
-        sprintf(padded + i * 2, "%02x", (unsigned char)str[i]);
-    }
-    
-    *padded_length = padded_len;
-    return padded;
-}
-
-// Encode call data for getDigestHash(string,string,string,string,string)
-char* encode_digest_hash_call(const char* str1, const char* str2, const char* str3, const char* str4, const char* str5) {
-    char* selector = get_function_selector("getDigestHash(string,string,string,string,string)");
-    if (!selector) return NULL;
-    
-    // Calculate lengths and padding for all 5 strings
-    size_t len1 = strlen(str1), len2 = strlen(str2), len3 = strlen(str3), len4 = strlen(str4), len5 = strlen(str5);
-    size_t padded_len1, padded_len2, padded_len3, padded_len4, padded_len5;
-    
-    char* padded_str1 = pad_string_data(str1, &padded_len1);
-    char* padded_str2 = pad_string_data(str2, &padded_len2);
-    char* padded_str3 = pad_string_data(str3, &padded_len3);
-    char* padded_str4 = pad_string_data(str4, &padded_len4);
-    char* padded_str5 = pad_string_data(str5, &padded_len5);
-    
-    if (!padded_str1 || !padded_str2 || !padded_str3 || !padded_str4 || !padded_str5) {
-        if (selector) pkg_free(selector);
-        if (padded_str1) pkg_free(padded_str1); 
-        if (padded_str2) pkg_free(padded_str2); 
-        if (padded_str3) pkg_free(padded_str3); 
-        if (padded_str4) pkg_free(padded_str4); 
-        if (padded_str5) pkg_free(padded_str5);
-        return NULL;
-    }
-    
-    // Calculate offsets for 5 strings
-    size_t offset1 = 0xA0;
-    size_t offset2 = offset1 + 32 + padded_len1;
-    size_t offset3 = offset2 + 32 + padded_len2;
-    size_t offset4 = offset3 + 32 + padded_len3;
-    size_t offset5 = offset4 + 32 + padded_len4;
-    
-    // Calculate total size needed
-    size_t total_size = 8 + (64 * 5) + (64 * 5) + strlen(padded_str1) + strlen(padded_str2) + 
-                       strlen(padded_str3) + strlen(padded_str4) + strlen(padded_str5) + 1;
-    char* call_data = pkg_malloc(total_size);
-    
-    if (!call_data) {
-        pkg_free(selector);
-        pkg_free(padded_str1); pkg_free(padded_str2); pkg_free(padded_str3); 
-        pkg_free(padded_str4); pkg_free(padded_str5);
-        return NULL;
-    }
-    
-    snprintf(call_data, total_size,
-        "%s"                              // function selector
-        "%064lx"                          // offset to string 1
-        "%064lx"                          // offset to string 2
-        "%064lx"                          // offset to string 3
-        "%064lx"                          // offset to string 4
-        "%064lx"                          // offset to string 5
-        "%064lx%s"                        // length + data for string 1
-        "%064lx%s"                        // length + data for string 2
-        "%064lx%s"                        // length + data for string 3
-        "%064lx%s"                        // length + data for string 4
-        "%064lx%s",                       // length + data for string 5
-        selector + 2,                     // remove "0x" prefix
-        offset1, offset2, offset3, offset4, offset5,
-        len1, padded_str1,
-        len2, padded_str2,
-        len3, padded_str3,
-        len4, padded_str4,
-        len5, padded_str5);
-    
-    pkg_free(selector);
-    pkg_free(padded_str1); pkg_free(padded_str2); pkg_free(padded_str3); 
-    pkg_free(padded_str4); pkg_free(padded_str5);
-    
-    return call_data;
+    tuple->data = NULL;
+    tuple->items = fields;
+    tuple->len = w3_abi_count(&auth->tenant->fn.args);
+    return w3_abi_size(&auth->tenant->fn.args, tuple);
 }
 
 // Callback function to write response data
@@ -308,6 +415,30 @@ static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, str
     return realsize;
 }
 
+// POST payload over the io_uring client into response, with the outcome
+// mapped to the curl codes the failover loop acts on
+static CURLcode uring_perform(const char* url, const char* payload, size_t payload_len,
+        int timeout_ms, struct ResponseData* response, long* http_code) {
+    w3_uring_resp_t resp;
+    int rc = w3_uring_post(url, &payload, &payload_len, 1, &resp, timeout_ms);
+    
+    if (rc != 0) {
+        LM_DBG("io_uring request to %s failed: %s\n", url, w3_uring_error());
+        return rc == W3_URING_TIMEOUT ? CURLE_OPERATION_TIMEDOUT : CURLE_RECV_ERROR;
+    }
+    *http_code = resp.status;
+    if (resp.len == 0) return CURLE_OK;
+    
+    response->memory = pkg_malloc(resp.len + 1);
+    if (!response->memory) {
+        LM_ERR("Not enough memory for the response\n");
+        return CURLE_OUT_OF_MEMORY;
+    }
+    memcpy(response->memory, resp.body, resp.len + 1);
+    response->size = resp.len;
+    return CURLE_OK;
+}
+
 // Extract result from JSON response
 char *extract_result(const char *json) {
     const char *pattern = "\"result\":\"";
@@ -327,19 +458,127 @@ char *extract_result(const char *json) {
     return result;
 }
 
-// Strip trailing zeros from hash result (take first 32 hex chars)
-void strip_trailing_zeros(const char* hex_result, char* stripped, size_t stripped_size) {
-    if (!hex_result || strlen(hex_result) < 66) {
-        strcpy(stripped, "");
-        return;
+// Decode the return values of the tenant's function and take the digest
+// from the leading bytes of the one that holds it
+static int decode_return_digest(const w3_tenant_t* tenant, const uint8_t* data, size_t len,
+        uint8_t digest[W3_DIGEST_SIZE]) {
+    w3_abi_value_t ret[W3_ABI_MAX_ARGS];
+    
+    if (w3_abi_decode(&tenant->fn.returns, data, len, ret) <= tenant->digest_ret
+            || ret[tenant->digest_ret].len < W3_DIGEST_SIZE) {
+        return -1;
+    }
+    memcpy(digest, ret[tenant->digest_ret].data, W3_DIGEST_SIZE);
+    return 0;
+}
+
+// Same for the "0x.." result of eth_call
+static int decode_result_digest(const w3_tenant_t* tenant, const char* hex_result,
+        uint8_t digest[W3_DIGEST_SIZE]) {
+    size_t len = strlen(hex_result);
+    uint8_t* data;
+    int rc = -1;
+    
+    if (len < 2 || hex_result[0] != '0' || (hex_result[1] | 0x20) != 'x') return -1;
+    data = pkg_malloc(len / 2 + 1);
+    if (!data) return -1;
+    
+    if (w3_hex_decode(hex_result + 2, len - 2, data) == 0) {
+        rc = decode_return_digest(tenant, data, (len - 2) / 2, digest);
+    }
+    pkg_free(data);
+    return rc;
+}
+
+// Binary call data of the arguments encoded in args_hex, in pkg memory
+static uint8_t* call_data(const w3_tenant_t* tenant, const char* args_hex, long args_size) {
+    uint8_t* calldata = pkg_malloc(4 + args_size);
+    
+    if (!calldata) return NULL;
+    memcpy(calldata, tenant->fn.selector, 4);
+    if (w3_hex_decode(args_hex, 2 * args_size, calldata + 4) < 0) {
+        pkg_free(calldata);
+        return NULL;
+    }
+    return calldata;
+}
+
+// Run the call in args_hex against the local contract snapshot; returns
+// the W3_EVM_* outcome, with the digest in digest on W3_EVM_RETURN
+static int local_digest(const w3_tenant_t* tenant, const char* args_hex, long args_size,
+        uint8_t digest[W3_DIGEST_SIZE]) {
+    uint8_t out[1024];
+    size_t out_len;
+    uint8_t* calldata;
+    int rc;
+    
+    calldata = call_data(tenant, args_hex, args_size);
+    if (!calldata) return W3_EVM_FAULT;
+    
+    rc = w3_state_call(tenant->contract, &tenant->endpoints[0], calldata, 4 + args_size,
+            out, sizeof(out), &out_len);
+    pkg_free(calldata);
+    if (rc == W3_EVM_RETURN && (out_len > sizeof(out)
+            || decode_return_digest(tenant, out, out_len, digest) < 0)) {
+        rc = W3_EVM_FAULT;
+    }
+    return rc;
+}
+
+// Replace the call data of payload with a Sapphire envelope of the same
+// call; returns the session that opens the result, -1 without a runtime key
+static int seal_payload(const w3_tenant_t* tenant, long args_size, char** payload,
+        size_t* payload_len) {
+    size_t head_len = tenant->payload_head_len - (sizeof(tenant->selector) - 1);
+    uint8_t* calldata = call_data(tenant, *payload + tenant->payload_head_len, args_size);
+    char* sealed = NULL;
+    size_t hex_len;
+    int session = -1;
+    
+    if (!calldata) return -1;
+    sealed = pkg_malloc(head_len + 2 * (4 + args_size + W3_SAPPHIRE_OVERHEAD)
+            + W3_PAYLOAD_TAIL_LEN + 1);
+    if (sealed) {
+        memcpy(sealed, *payload, head_len);
+        session = w3_sapphire_seal(&tenant->endpoints[0], calldata, 4 + args_size,
+                sealed + head_len, &hex_len);
+    }
+    pkg_free(calldata);
+    if (session < 0) {
+        if (sealed) pkg_free(sealed);
+        return -1;
     }
     
-    // Skip "0x" prefix and take first 32 hex characters
-    size_t copy_len = 32;
-    if (copy_len >= stripped_size) copy_len = stripped_size - 1;
-    
-    memcpy(stripped, hex_result + 2, copy_len);
-    stripped[copy_len] = '\0';
+    memcpy(sealed + head_len + hex_len, W3_PAYLOAD_TAIL, W3_PAYLOAD_TAIL_LEN + 1);
+    pkg_free(*payload);
+    *payload = sealed;
+    *payload_len = head_len + hex_len + W3_PAYLOAD_TAIL_LEN;
+    return session;
+}
+
+// Decrypt the result of a sealed call into pkg memory; NULL with revert
+// filled in when the call failed or its result cannot be read
+static uint8_t* open_result(int session, const char* json, size_t* len, w3_revert_t* revert) {
+    char* result_hex = extract_result(json);
+    size_t hex_len = result_hex ? strlen(result_hex) : 0;
+    uint8_t* buf = NULL;
+    int rc = -1;
+    
+    if (hex_len >= 2 && result_hex[0] == '0' && (result_hex[1] | 0x20) == 'x') {
+        buf = pkg_malloc(hex_len / 2 + 1);
+        if (buf) rc = w3_sapphire_open(session, result_hex + 2, hex_len - 2, buf, len, revert);
+    }
+    if (result_hex) pkg_free(result_hex);
+    if (rc == 0) return buf;
+    
+    if (buf) pkg_free(buf);
+    if (rc < 0) {
+        memset(revert, 0, sizeof(*revert));
+        revert->outcome = W3_REVERT_INTERNAL;
+        revert->node_fault = 1;
+        snprintf(revert->reason, sizeof(revert->reason), "unreadable confidential result");
+    }
+    return NULL;
 }
 
 // Extract auth components from Authorization header
@@ -353,15 +592,22 @@ int extract_auth_components(struct sip_msg* msg, sip_auth_t* auth) {
         return -1;
     }
     
-    // Find Authorization header
+    // Find Authorization header, falling back to Proxy-Authorization
     for (hf = msg->headers; hf; hf = hf->next) {
         if (hf->type == HDR_AUTHORIZATION_T) {
             break;
         }
     }
+    if (!hf) {
+        for (hf = msg->headers; hf; hf = hf->next) {
+            if (hf->type == HDR_PROXYAUTH_T) {
+                break;
+            }
+        }
+    }
     
     if (!hf) {
-        LM_ERR("No Authorization header found\n");
+        LM_ERR("No Authorization or Proxy-Authorization header found\n");
         return -1;
     }
     
@@ -378,14 +624,18 @@ int extract_auth_components(struct sip_msg* msg, sip_auth_t* auth) {
     }
     
     // Extract username
-    if (cred->digest.username.s && cred->digest.username.len < MAX_FIELD_SIZE) {
-        memcpy(auth->username, cred->digest.username.s, cred->digest.username.len);
-        auth->username[cred->digest.username.len] = '\0';
+    if (cred->digest.username.whole.s && cred->digest.username.whole.len < MAX_FIELD_SIZE) {
+        memcpy(auth->username, cred->digest.username.whole.s, cred->digest.username.whole.len);
+        auth->username[cred->digest.username.whole.len] = '\0';
     } else {
         LM_ERR("Invalid or missing username\n");
         return -1;
     }
     
+    // Feed the heavy-hitter sketch before any further validation
+    w3_topk_attempt(cred->digest.username.whole.s, cred->digest.username.whole.len,
+            &msg->rcv.src_ip);
+    
     // Extract realm
     if (cred->digest.realm.s && cred->digest.realm.len < MAX_FIELD_SIZE) {
         memcpy(auth->realm, cred->digest.realm.s, cred->digest.realm.len);
@@ -394,6 +644,7 @@ int extract_auth_components(struct sip_msg* msg, sip_auth_t* auth) {
         LM_ERR("Invalid or missing realm\n");
         return -1;
     }
+    auth->tenant = w3_route_lookup(cred->digest.realm.s, cred->digest.realm.len);
     
     // Extract URI
     if (cred->digest.uri.s && cred->digest.uri.len < MAX_FIELD_SIZE) {
@@ -436,115 +687,358 @@ int extract_auth_components(struct sip_msg* msg, sip_auth_t* auth) {
     return 0;
 }
 
-// Verify authentication against blockchain
-int verify_blockchain_auth(const sip_auth_t* auth) {
+// Cache key of the contract call made for these credentials
+static uint64_t auth_cache_key(const sip_auth_t* auth) {
+    const char* fields[] = {
+        auth->username, auth->realm, auth->method, auth->uri, auth->nonce,
+        auth->tenant->contract, auth->tenant->selector
+    };
+    return w3_cache_key(auth->tenant->id, fields, sizeof(fields) / sizeof(fields[0]));
+}
+
+// Cache key of the user itself, for remembering that the contract lacks it
+static uint64_t auth_user_key(const sip_auth_t* auth) {
+    const char* fields[] = {
+        auth->username, auth->realm, auth->tenant->contract
+    };
+    return w3_cache_key(auth->tenant->id, fields, sizeof(fields) / sizeof(fields[0]));
+}
+
+// Compare the client response against the digest computed by the contract
+static int compare_digest(const sip_auth_t* auth, const uint8_t expected[W3_DIGEST_SIZE]) {
+    if (w3_digest_equal(expected, auth->digest, W3_DIGEST_SIZE)) {
+        LM_INFO("Blockchain authentication successful for user %s\n", auth->username);
+        return 1; // Success
+    }
+    LM_INFO("Blockchain authentication failed for user %s - response mismatch\n", auth->username);
+    return WEB3_AUTH_FAILED;
+}
+
+// Verify authentication against blockchain. source tells where the digest
+// came from (W3_TRACE_*), with the eth_call time in rpc_us when it went out;
+// retry_after is set when the request was shed by the quota.
+int verify_blockchain_auth(const sip_auth_t* auth, int prio, int* source, uint32_t* rpc_us,
+        int* retry_after) {
     CURL *curl;
-    CURLcode res;
+    CURLcode res = CURLE_FAILED_INIT;   // stays set when no endpoint is tried
     struct ResponseData response = {0};
-    int auth_result = -1; // Default to error
+    int auth_result = WEB3_AUTH_ERROR; // Default to error
+    long http_code = 0;
+    uint64_t start_us;
+    uint64_t cache_key, user_key, version;
+    int order[W3_MAX_ENDPOINTS];
+    int attempts, tried = 0, ok = 0;
+    uint8_t cached[W3_DIGEST_SIZE];
+    int quota_wait = 0;
+    w3_revert_t revert = {0};
+    int local = -1;
+    uint8_t local_expected[W3_DIGEST_SIZE];
+    int sealed = -1;
+    uint8_t* plain = NULL;
+    size_t plain_len = 0;
+    
+    *source = W3_TRACE_NONE;
+    *rpc_us = 0;
+    *retry_after = 0;
+    
+    // Same inputs give the same digest, reuse a recent contract answer
+    cache_key = auth_cache_key(auth);
+    if (w3_cache_get(cache_key, cached, 0)) {
+        LM_DBG("Digest for user %s served from cache\n", auth->username);
+        *source = W3_TRACE_CACHE;
+        return compare_digest(auth, cached);
+    }
+    user_key = auth_user_key(auth);
+    if (w3_cache_absent(user_key)) {
+        LM_INFO("User %s not found in blockchain contract (cached)\n", auth->username);
+        *source = W3_TRACE_CACHE_ABSENT;
+        return WEB3_AUTH_FAILED;
+    }
     
-    LM_INFO("Calling blockchain for user %s\n", auth->username);
+    // Then the cache shared across restarts and nodes, if any
+    switch (w3_l2_get(auth->tenant->id, cache_key, user_key, cached, &version)) {
+        case W3_L2_HIT:
+            LM_DBG("Digest for user %s served from L2 cache\n", auth->username);
+            w3_cache_put_at(cache_key, auth->tenant->id, cached, version);
+            *source = W3_TRACE_L2;
+            return compare_digest(auth, cached);
+        case W3_L2_ABSENT:
+            LM_INFO("User %s not found in blockchain contract (L2 cache)\n", auth->username);
+            w3_cache_put_absent_at(user_key, auth->tenant->id, version);
+            *source = W3_TRACE_L2_ABSENT;
+            return WEB3_AUTH_FAILED;
+    }
     
     // Encode call data (username, realm, method, uri, nonce)
-    char* call_data = encode_digest_hash_call(auth->username, auth->realm, auth->method, auth->uri, auth->nonce);
-    if (!call_data) {
+    const w3_tenant_t* tenant = auth->tenant;
+    const w3_route_settings_t* settings = w3_route_settings();
+    w3_abi_value_t fields[W3_CALL_FIELDS], args;
+    long args_size = digest_call_args(auth, fields, &args);
+    if (args_size < 0) {
         LM_ERR("Error encoding call data\n");
-        return -1;
+        return WEB3_AUTH_ERROR;
     }
     
-    // Initialize curl
-    curl = curl_easy_init();
-    if (!curl) {
-        LM_ERR("Failed to initialize curl\n");
-        pkg_free(call_data);
-        return -1;
-    }
-    
-    // Prepare JSON-RPC payload
-    char *payload = pkg_malloc(8192);
+    // Build the JSON-RPC payload in place around the tenant's template
+    size_t payload_len = tenant->payload_head_len + 2 * args_size + W3_PAYLOAD_TAIL_LEN;
+    char *payload = pkg_malloc(payload_len + 1);
     if (!payload) {
         LM_ERR("Failed to allocate payload memory\n");
-        curl_easy_cleanup(curl);
-        pkg_free(call_data);
-        return -1;
+        return WEB3_AUTH_ERROR;
     }
     
-    snprintf(payload, 8192,
-        "{\"jsonrpc\":\"2.0\",\"method\":\"eth_call\",\"params\":[{\"to\":\"%s\",\"data\":\"0x%s\"},\"latest\"],\"id\":1}",
-        contract_address, call_data);
+    memcpy(payload, tenant->payload_head, tenant->payload_head_len);
+    char *tail = w3_abi_encode_hex(&tenant->fn.args, &args, payload + tenant->payload_head_len);
+    memcpy(tail, W3_PAYLOAD_TAIL, W3_PAYLOAD_TAIL_LEN + 1);
+    
+    // Run the function on the local contract snapshot; when serving, only
+    // a sample of its answers still goes to eth_call for comparison
+    if (local_exec != LOCAL_EXEC_OFF) {
+        local = local_digest(tenant, payload + tenant->payload_head_len, args_size,
+                local_expected);
+        if (local_exec == LOCAL_EXEC_SERVE && local == W3_EVM_RETURN
+                && (int)fastrand_max(99) >= local_exec_sample) {
+            LM_DBG("Digest for user %s computed locally\n", auth->username);
+            pkg_free(payload);
+            w3_cache_put(cache_key, tenant->id, local_expected);
+            *source = W3_TRACE_LOCAL;
+            return compare_digest(auth, local_expected);
+        }
+    }
     
-    // Set curl options
-    curl_easy_setopt(curl, CURLOPT_URL, rpc_url);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L); // 10 second timeout
+    // Encrypt the call for Sapphire; it never goes out in plain text
+    if (confidential_calls) {
+        sealed = seal_payload(tenant, args_size, &payload, &payload_len);
+        if (sealed < 0) {
+            LM_ERR("Cannot encrypt the call for user %s, no runtime key\n", auth->username);
+            pkg_free(payload);
+            return WEB3_AUTH_ERROR;
+        }
+    }
+    
+    LM_INFO("Calling blockchain for user %s\n", auth->username);
     
-    // Set headers
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    // Wait for a slot under the adaptive concurrency limit
+    int admit = w3_limiter_acquire(prio, settings->queue_timeout_ms);
+    if (admit < 0) {
+        LM_WARN("RPC %s, shedding request for user %s\n",
+                admit == -2 ? "queue full" : "queue wait timed out", auth->username);
+        pkg_free(payload);
+        return admit == -2 ? WEB3_AUTH_QUEUE_FULL : WEB3_AUTH_SHED;
+    }
     
-    // Perform the request
-    res = curl_easy_perform(curl);
+    // Perform the request, failing over along the user's endpoint order
+    attempts = w3_shard_order(tenant->endpoints, tenant->nendpoints, rpc_sharding,
+            auth->username, strlen(auth->username), order);
+    if (attempts > rpc_failover) attempts = rpc_failover > 0 ? rpc_failover : 1;
     
-    if (res == CURLE_OK) {
+    start_us = w3_now_us();
+    for (int i = 0; i < attempts && !ok; i++) {
+        const w3_endpoint_t* ep = &tenant->endpoints[order[i]];
+        
+        // Every attempt is a call the provider counts; only admitted calls
+        // take a token, and failover stops where the quota does
+        quota_wait = w3_quota_take(auth->realm);
+        if (quota_wait > 0) {
+            w3_acct_quota_reject();
+            if (tried > 0) {
+                LM_WARN("RPC quota exhausted, not failing over for user %s\n", auth->username);
+            }
+            break;
+        }
+        tried++;
+        
+        if (response.memory) pkg_free(response.memory);
+        response.memory = NULL;
+        response.size = 0;
+        http_code = 0;
+        memset(&revert, 0, sizeof(revert));
+        
+        // Ring of this process for plain http, when configured
+        if (rpc_transport_mode == RPC_TRANSPORT_URING && w3_uring_usable(ep->url)) {
+            res = uring_perform(ep->url, payload, payload_len, settings->timeout_ms,
+                    &response, &http_code);
+            goto performed;
+        }
+        
+        // Persistent handle of this process, keeps its connection alive
+        curl = w3_http_handle(ep);
+        if (!curl) {
+            LM_ERR("Failed to initialize curl\n");
+            res = CURLE_FAILED_INIT;
+            continue;
+        }
+        curl_easy_setopt(curl, CURLOPT_URL, ep->url);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)payload_len);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)settings->timeout_ms);
+        
+        res = curl_easy_perform(curl);
+        if (res == CURLE_OK) {
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        }
+        w3_http_done(curl, ep, res);
+performed:
+        // Contract reverts are answers; throttling and node failures are not
+        if (res == CURLE_OK && response.memory) {
+            w3_revert_classify(response.memory, response.size, &revert);
+        }
+        ok = res == CURLE_OK && http_code != 429 && http_code < 500 && !revert.node_fault;
+        w3_acct_record(ep->url, payload_len, response.size, res == CURLE_OK && http_code < 400);
+        w3_shard_report(ep, ok);
+        if (!ok && i + 1 < attempts) {
+            LM_WARN("RPC endpoint %s failed (%s, HTTP %ld), failing over\n", ep->url,
+                    curl_easy_strerror(res), http_code);
+        }
+    }
+    
+    // Past the quota before the first call: prefer a local or stale answer
+    if (tried == 0) {
+        w3_limiter_cancel();
+        pkg_free(payload);
+        if (local_exec == LOCAL_EXEC_SERVE && local == W3_EVM_RETURN) {
+            LM_INFO("RPC quota exhausted, using local digest for user %s\n", auth->username);
+            *source = W3_TRACE_LOCAL;
+            return compare_digest(auth, local_expected);
+        }
+        if (quota_fallback_mode == QUOTA_FALLBACK_CACHE && w3_cache_get(cache_key, cached, 1)) {
+            LM_INFO("RPC quota exhausted, using stale digest for user %s\n", auth->username);
+            *source = W3_TRACE_STALE;
+            return compare_digest(auth, cached);
+        }
+        LM_WARN("RPC quota exhausted, shedding request for user %s\n", auth->username);
+        *retry_after = quota_wait;
+        return WEB3_AUTH_SHED;
+    }
+    *rpc_us = (uint32_t)(w3_now_us() - start_us);
+    w3_limiter_release(*rpc_us, ok);
+    *source = W3_TRACE_RPC;
+    
+    if (res == CURLE_OK && response.memory) {
         LM_DBG("Blockchain response: %s\n", response.memory);
         
-        // Check for error in response
-        if (strstr(response.memory, "\"error\"")) {
-            if (strstr(response.memory, "User not found")) {
-                LM_INFO("User %s not found in blockchain contract\n", auth->username);
-            } else {
-                LM_ERR("Error from blockchain contract\n");
+        // Confidential results hold the return data or the revert encrypted
+        if (sealed >= 0 && revert.outcome == W3_REVERT_NONE) {
+            plain = open_result(sealed, response.memory, &plain_len, &revert);
+        } else if (sealed >= 0 && revert.node_fault) {
+            w3_sapphire_stale(sealed);
+        }
+        
+        // A contract revert agrees with a local revert only
+        if ((local == W3_EVM_RETURN || local == W3_EVM_REVERT) && !revert.node_fault
+                && revert.outcome != W3_REVERT_NONE) {
+            w3_state_shadow(tenant->contract, local == W3_EVM_REVERT);
+        }
+        
+        // Act on the decoded error instead of its text
+        if (revert.outcome != W3_REVERT_NONE) {
+            switch (revert.outcome) {
+                case W3_REVERT_NOT_FOUND:
+                    LM_INFO("User %s not found in blockchain contract\n", auth->username);
+                    w3_l2_put_absent(user_key, w3_cache_put_absent(user_key, tenant->id));
+                    auth_result = WEB3_AUTH_FAILED;
+                    break;
+                case W3_REVERT_DISABLED:
+                    LM_INFO("User %s disabled in blockchain contract (%s)\n", auth->username,
+                            revert.reason);
+                    auth_result = WEB3_AUTH_FAILED;
+                    break;
+                case W3_REVERT_RATE_LIMITED:
+                    LM_WARN("RPC rate limited for user %s (%s), shedding request\n",
+                            auth->username, revert.reason);
+                    auth_result = WEB3_AUTH_SHED;
+                    break;
+                default:
+                    LM_ERR("Error from blockchain %s: %s (code %ld)\n",
+                            revert.node_fault ? "node" : "contract", revert.reason, revert.code);
+                    auth_result = WEB3_AUTH_ERROR;
+                    break;
             }
-            auth_result = -1;
         } else {
             // Extract result
-            char *result_hex = extract_result(response.memory);
-            if (result_hex) {
-                // Strip trailing zeros (take first 32 hex chars)
-                char expected_response[64];
-                strip_trailing_zeros(result_hex, expected_response, sizeof(expected_response));
-                
-                LM_INFO("Expected response: %s, Actual response: %s\n", 
-                        expected_response, auth->response);
+            char *result_hex = plain ? NULL : extract_result(response.memory);
+            uint8_t expected[W3_DIGEST_SIZE];
+            if (plain ? decode_return_digest(tenant, plain, plain_len, expected) == 0
+                    : result_hex && decode_result_digest(tenant, result_hex, expected) == 0) {
+                w3_l2_put(cache_key, expected, w3_cache_put(cache_key, tenant->id, expected));
+                if (local == W3_EVM_RETURN || local == W3_EVM_REVERT) {
+                    w3_state_shadow(tenant->contract, local == W3_EVM_RETURN
+                            && w3_digest_equal(expected, local_expected, W3_DIGEST_SIZE));
+                }
                 
                 // Compare responses
-                if (strcmp(expected_response, auth->response) == 0) {
-                    LM_INFO("Blockchain authentication successful for user %s\n", auth->username);
-                    auth_result = 1; // Success
-                } else {
-                    LM_INFO("Blockchain authentication failed for user %s - response mismatch\n", auth->username);
-                    auth_result = -1;
-                }
+                auth_result = compare_digest(auth, expected);
                 
-                pkg_free(result_hex);
+                if (result_hex) pkg_free(result_hex);
             } else {
                 LM_ERR("Could not extract result from blockchain response\n");
-                auth_result = -1;
+                if (result_hex) pkg_free(result_hex);
+                auth_result = WEB3_AUTH_ERROR;
             }
         }
         
+        if (plain) pkg_free(plain);
         if (response.memory) pkg_free(response.memory);
+    } else if (res == CURLE_OK) {
+        LM_ERR("Empty response from blockchain RPC (HTTP %ld)\n", http_code);
+        auth_result = WEB3_AUTH_ERROR;
     } else {
         LM_ERR("curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
-        auth_result = -1;
+        if (response.memory) pkg_free(response.memory);
+        auth_result = WEB3_AUTH_ERROR;
     }
     
     // Cleanup
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    pkg_free(call_data);
     pkg_free(payload);
     
     return auth_result;
 }
 
-// Main function called from Kamailio config
-static int web3_auth_check(struct sip_msg* msg, char* p1, char* p2) {
+// Priority class of the RPC call: script argument first, then SIP method
+static int get_auth_priority(struct sip_msg* msg, char* p1) {
+    str name;
+    int prio;
+    
+    if (p1) {
+        if (fixup_get_svalue(msg, (gparam_t*)p1, &name) < 0) {
+            LM_ERR("Failed to get priority parameter\n");
+        } else if ((prio = w3_limiter_prio_by_name(name.s, name.len)) >= 0) {
+            return prio;
+        } else {
+            LM_WARN("Unknown priority '%.*s', using method default\n", name.len, name.s);
+        }
+    }
+    
+    switch (msg->first_line.u.request.method_value) {
+        case METHOD_INVITE:
+            return W3_PRIO_HIGH;
+        case METHOD_REGISTER:
+            return W3_PRIO_LOW;
+        default:
+            return W3_PRIO_NORMAL;
+    }
+}
+
+// Append a finished check to the running recording, if any
+static int record_auth(const sip_auth_t* auth, uint64_t arrival_us, int prio, int source,
+        uint32_t rpc_us, int result) {
+    if (w3_rec_enabled()) {
+        w3_rec_auth(auth->username, auth->realm, auth->tenant ? auth_cache_key(auth) : 0,
+                prio, source, rpc_us, arrival_us, result);
+    }
+    return result;
+}
+
+// Authenticate msg against the pinned configuration snapshot
+static int web3_auth_run(struct sip_msg* msg, char* p1) {
     sip_auth_t auth = {0};
-    int result;
+    char src_ip[64];
+    char user_key[2 * MAX_FIELD_SIZE];
+    int result, banned, source, quota_wait, prio;
+    uint32_t rpc_us;
+    uint64_t arrival_us = w3_now_us();
     
     LM_INFO("Web3 authentication check started\n");
     
@@ -553,19 +1047,96 @@ static int web3_auth_check(struct sip_msg* msg, char* p1, char* p2) {
         LM_ERR("Failed to extract authentication components\n");
         return -1;
     }
+    prio = get_auth_priority(msg, p1);
+    
+    // Reject penalized sources and users before spending an eth_call
+    snprintf(src_ip, sizeof(src_ip), "%s", ip_addr2a(&msg->rcv.src_ip));
+    snprintf(user_key, sizeof(user_key), "%s@%s", auth.username, auth.realm);
+    banned = w3_ban_check(src_ip, user_key);
+    if (banned > 0) {
+        retry_after_msg_id = msg->id;
+        retry_after_value = banned;
+        LM_INFO("Web3 authentication rejected for user %s from %s - banned for %ds\n",
+                auth.username, src_ip, banned);
+        return record_auth(&auth, arrival_us, prio, W3_TRACE_NONE, 0, WEB3_AUTH_BANNED);
+    }
+    
+    // A malformed response can never match, reject it without an eth_call
+    if (strlen(auth.response) != 2 * W3_DIGEST_SIZE
+            || w3_hex_decode(auth.response, 2 * W3_DIGEST_SIZE, auth.digest) < 0) {
+        LM_INFO("Web3 authentication failed for user %s - malformed response\n", auth.username);
+        w3_ban_failure(src_ip, user_key);
+        return record_auth(&auth, arrival_us, prio, W3_TRACE_NONE, 0, -1);
+    }
     
     // Verify against blockchain
-    result = verify_blockchain_auth(&auth);
+    result = verify_blockchain_auth(&auth, prio, &source, &rpc_us, &quota_wait);
+    record_auth(&auth, arrival_us, prio, source, rpc_us, result);
+    if (source == W3_TRACE_RPC) {
+        w3_topk_rpc_call(auth.username, strlen(auth.username), &msg->rcv.src_ip);
+    }
     
     if (result == 1) {
         LM_INFO("Web3 authentication successful for user %s\n", auth.username);
+        w3_ban_success(src_ip, user_key);
         return 1; // Success
+    } else if (result == WEB3_AUTH_SHED || result == WEB3_AUTH_QUEUE_FULL) {
+        retry_after_msg_id = msg->id;
+        retry_after_value = quota_wait > 0 ? quota_wait
+                : w3_limiter_retry_after(retry_after_min, retry_after_max, retry_after_jitter);
+        LM_INFO("Web3 authentication shed for user %s - RPC overloaded, retry after %ds\n",
+                auth.username, retry_after_value);
+        return result;
     } else {
         LM_INFO("Web3 authentication failed for user %s\n", auth.username);
+        // Only rejected credentials count towards a ban, not RPC errors
+        if (result == WEB3_AUTH_FAILED) w3_ban_failure(src_ip, user_key);
         return -1; // Failure
     }
 }
 
+// Main function called from Kamailio config
+static int web3_auth_check(struct sip_msg* msg, char* p1, char* p2) {
+    int result;
+    
+    (void)p2;
+    // Tenants and settings used by this request must outlive a reconfiguration
+    w3_route_enter();
+    result = web3_auth_run(msg, p1);
+    w3_route_leave();
+    
+    // The worker has no other thread to keep its connections warm
+    w3_http_maintain();
+    return result;
+}
+
+// Parse $web3_auth(name)
+static int pv_parse_web3_auth_name(pv_spec_p sp, str* in) {
+    if (!in || !in->s || in->len <= 0) return -1;
+    
+    if (in->len == 11 && strncmp(in->s, "retry_after", 11) == 0) {
+        sp->pvp.pvn.u.isname.name.n = PV_WEB3_RETRY_AFTER;
+    } else {
+        LM_ERR("Unknown $web3_auth name: %.*s\n", in->len, in->s);
+        return -1;
+    }
+    
+    sp->pvp.pvn.type = PV_NAME_INTSTR;
+    sp->pvp.pvn.u.isname.type = 0;
+    return 0;
+}
+
+// Get $web3_auth(name); values are only valid for the message they were set for
+static int pv_get_web3_auth(struct sip_msg* msg, pv_param_t* param, pv_value_t* res) {
+    switch (param->pvn.u.isname.name.n) {
+        case PV_WEB3_RETRY_AFTER:
+            if (!msg || msg->id != retry_after_msg_id) return pv_get_sintval(msg, param, res, 0);
+            return pv_get_sintval(msg, param, res, retry_after_value);
+        default:
+            return pv_get_null(msg, param, res);
+    }
+}
+
 // Module initialization
 static int mod_init(void) {
     LM_INFO("Web3 Auth module initializing...\n");
@@ -578,14 +1149,239 @@ static int mod_init(void) {
         return -1;
     }
     
+    LM_INFO("Hex kernels: %s\n", w3_hex_name(w3_hex_select(W3_HEX_BEST)));
+    w3_abi_memo_enable(abi_memo);     // workers inherit it empty
+    
+    if (w3_http_init(dns_cache_ttl, keepalive_interval, max_requests_per_connection) < 0) {
+        LM_ERR("Failed to initialize shared resolver cache\n");
+        return -1;
+    }
+    
+    if (w3_shard_init(endpoint_fail_threshold, endpoint_down_time) < 0) {
+        LM_ERR("Failed to initialize endpoint health\n");
+        return -1;
+    }
+    
+    w3_route_settings_t settings = {rpc_timeout, rpc_queue_timeout};
+    if (w3_route_init(routing_file, contract_address, rpc_url, function_signature,
+            &settings) < 0) {
+        LM_ERR("Failed to load the realm routing table\n");
+        return -1;
+    }
+    if (register_timer(w3_route_timer, 0, 1) < 0) {
+        LM_ERR("Failed to register routing snapshot timer\n");
+        return -1;
+    }
+    
+    int weights[W3_PRIO_CLASSES] = {rpc_weight_high, rpc_weight_normal, rpc_weight_low};
+    if (w3_limiter_init(rpc_limit_init, rpc_limit_min, rpc_limit_max, rpc_queue_size,
+            weights, rpc_starvation_ms) < 0) {
+        LM_ERR("Failed to initialize RPC concurrency limiter\n");
+        return -1;
+    }
+    
+    if (w3_ban_init(ban_table_size, ban_threshold, ban_window, ban_time, ban_max_time) < 0) {
+        LM_ERR("Failed to initialize ban table\n");
+        return -1;
+    }
+    
+    if (w3_topk_init() < 0) {
+        LM_ERR("Failed to initialize heavy-hitter sketch\n");
+        return -1;
+    }
+    
+    if (strcasecmp(quota_fallback, "cache") == 0) {
+        quota_fallback_mode = QUOTA_FALLBACK_CACHE;
+    } else if (strcasecmp(quota_fallback, "fail") == 0) {
+        quota_fallback_mode = QUOTA_FALLBACK_FAIL;
+    } else {
+        LM_ERR("Invalid quota_fallback '%s', expected 'cache' or 'fail'\n", quota_fallback);
+        return -1;
+    }
+    
+    if (strcasecmp(rpc_transport, "curl") == 0) {
+        rpc_transport_mode = RPC_TRANSPORT_CURL;
+    } else if (strcasecmp(rpc_transport, "io_uring") == 0) {
+        rpc_transport_mode = RPC_TRANSPORT_URING;
+    } else {
+        LM_ERR("Invalid rpc_transport '%s', expected 'curl' or 'io_uring'\n", rpc_transport);
+        return -1;
+    }
+    
+    if (rpc_cpus && *rpc_cpus && w3_cpu_parse(rpc_cpus, &rpc_cpu_set) < 0) {
+        LM_ERR("Invalid rpc_cpus '%s', expected a CPU list like '0-7,16'\n", rpc_cpus);
+        return -1;
+    }
+    
+    if (w3_cache_init(cache_size, cache_ttl, cache_stale_ttl, negative_cache_ttl) < 0) {
+        LM_ERR("Failed to initialize digest cache\n");
+        return -1;
+    }
+    
+    if (w3_rec_init() < 0) {
+        LM_ERR("Failed to initialize traffic recorder\n");
+        return -1;
+    }
+    
+    if (w3_repl_init(repl_listen, repl_peers, repl_secret, repl_queue_size) < 0) {
+        LM_ERR("Failed to initialize cache replication\n");
+        return -1;
+    }
+    if (w3_repl_enabled()) register_basic_timers(1);
+    
+    if (w3_l2_init(l2_url, l2_secret, l2_timeout, l2_ttl, negative_cache_ttl,
+            l2_fail_threshold, l2_down_time) < 0) {
+        LM_ERR("Failed to initialize the L2 cache\n");
+        return -1;
+    }
+    
+    if (w3_revert_init(revert_errors) < 0) {
+        LM_ERR("Invalid revert_errors '%s'\n", revert_errors);
+        return -1;
+    }
+    
+    if (confidential_calls) {
+        if (w3_sapphire_init(confidential_key_refresh, confidential_session_ttl) < 0) {
+            LM_ERR("Failed to initialize confidential calls\n");
+            return -1;
+        }
+        // Runtime key fetches block on RPC calls as well
+        register_basic_timers(1);
+    }
+    
+    if (local_exec != LOCAL_EXEC_OFF) {
+        // Confidential storage reads back encrypted: served results would be wrong
+        if (local_exec == LOCAL_EXEC_SERVE && confidential_calls) {
+            LM_ERR("local_exec 2 cannot be used with confidential_calls\n");
+            return -1;
+        }
+        if (w3_state_init(local_exec_slots) < 0) {
+            LM_ERR("Failed to initialize contract snapshots\n");
+            return -1;
+        }
+        // Snapshot syncs block on RPC calls, keep them off the timer process
+        register_basic_timers(1);
+    }
+    
+    if (w3_quota_init(rpc_rate_limit, rpc_rate_burst, realm_rate_limit, realm_rate_burst,
+            realm_table_size) < 0) {
+        LM_ERR("Failed to initialize RPC quotas\n");
+        return -1;
+    }
+    
+    if (w3_acct_init(accounting_file) < 0) {
+        LM_ERR("Failed to initialize RPC accounting\n");
+        return -1;
+    }
+    if (accounting_file && *accounting_file && accounting_interval > 0) {
+        if (register_timer(w3_acct_timer, 0, accounting_interval) < 0) {
+            LM_ERR("Failed to register accounting timer\n");
+            return -1;
+        }
+    }
+    
     LM_INFO("Web3 Auth module initialized successfully\n");
     return 0;
 }
 
+// Pin the calling process to rpc_cpus: a worker to one CPU of the set with
+// rpc_cpu_spread (index < 0 for the whole set)
+static void pin_process(int index) {
+    int cpu;
+    
+    if (rpc_cpu_set.n == 0) return;
+    cpu = w3_cpu_pin(&rpc_cpu_set, rpc_cpu_spread ? index : -1);
+    if (cpu == -2) {
+        LM_WARN("Could not pin process %d to CPUs %s: %s\n", process_no, rpc_cpus, strerror(errno));
+    } else if (cpu >= 0) {
+        LM_DBG("Process %d pinned to CPU %d on node %d\n", process_no, cpu, w3_numa_node());
+    } else {
+        LM_DBG("Process %d pinned to CPUs %s\n", process_no, rpc_cpus);
+    }
+}
+
+// Helper processes pin themselves on their first tick, fork_basic_timer()
+// gives them no init hook of their own
+typedef struct {
+    timer_function* fn;
+} helper_t;
+
+static helper_t state_helper = {w3_state_timer};
+static helper_t repl_helper = {w3_repl_timer};
+static helper_t sapphire_helper = {w3_sapphire_timer};
+
+static void helper_timer(unsigned int ticks, void* param) {
+    static int pinned = 0;
+    
+    if (!pinned) {
+        pinned = 1;
+        pin_process(-1);
+    }
+    ((helper_t*)param)->fn(ticks, NULL);
+}
+
+// Per-process initialization
+static int child_init(int rank) {
+    w3_endpoint_t eps[W3_SHARD_MAX_HEALTH];
+    
+    if (rank == PROC_MAIN) {
+        if (local_exec != LOCAL_EXEC_OFF && fork_basic_timer(PROC_TIMER, "WEB3 STATE SYNC", 1,
+                helper_timer, &state_helper, local_exec_interval > 0 ? local_exec_interval : 1) < 0) {
+            LM_ERR("Failed to start the contract snapshot sync process\n");
+            return -1;
+        }
+        if (w3_repl_enabled() && fork_basic_utimer(PROC_TIMER, "WEB3 CACHE REPL", 1,
+                helper_timer, &repl_helper, 1000 * (repl_interval > 0 ? repl_interval : 20)) < 0) {
+            LM_ERR("Failed to start the cache replication process\n");
+            return -1;
+        }
+        if (confidential_calls && fork_basic_timer(PROC_TIMER, "WEB3 SAPPHIRE KEYS", 1,
+                helper_timer, &sapphire_helper, 1) < 0) {
+            LM_ERR("Failed to start the runtime key process\n");
+            return -1;
+        }
+        return 0;
+    }
+    if (rank == PROC_INIT || rank == PROC_TCP_MAIN) {
+        return 0;
+    }
+    
+    // Only SIP workers send lookups
+    if (rank > 0) {
+        pin_process(process_no);
+        if (prewarm_connections) {
+            int n = w3_route_endpoints(eps, W3_SHARD_MAX_HEALTH);
+            LM_DBG("Prewarmed %d of %d RPC endpoints\n", w3_http_prewarm(eps, n), n);
+        }
+        if (rpc_transport_mode == RPC_TRANSPORT_URING && w3_uring_init(numa_local) < 0) {
+            LM_WARN("io_uring unavailable (%s), using curl\n", w3_uring_error());
+        }
+    }
+    
+    return w3_topk_child_init(numa_local);
+}
+
 // Module cleanup
 static void mod_destroy(void) {
     LM_INFO("Web3 Auth module destroying...\n");
     
+    w3_limiter_destroy();
+    w3_ban_destroy();
+    w3_topk_destroy();
+    w3_cache_destroy();
+    w3_repl_destroy();
+    w3_l2_destroy();
+    w3_state_destroy();
+    w3_sapphire_destroy();
+    w3_quota_destroy();
+    w3_acct_save();
+    w3_acct_destroy();
+    w3_route_destroy();
+    w3_shard_destroy();
+    w3_http_destroy();
+    w3_uring_destroy();
+    w3_rec_destroy();
+    
     // Cleanup curl globally
     curl_global_cleanup();
     
@@ -0,0 +1,62 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Definitions shared between the module sources.
+ */
+
+#ifndef _WEB3_AUTH_H_
+#define _WEB3_AUTH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Return codes of web3_auth_check() and the internal verification path
+#define WEB3_AUTH_OK          1   // credentials verified
+#define WEB3_AUTH_FAILED     -1   // credentials rejected or lookup error
+#define WEB3_AUTH_SHED       -2   // RPC concurrency limit reached, request shed
+#define WEB3_AUTH_QUEUE_FULL -3   // pending-RPC queue full, retry later
+#define WEB3_AUTH_BANNED     -4   // source IP or user penalized after failures
+
+// Internal only: RPC or contract error, reported to the script as -1
+#define WEB3_AUTH_ERROR      -10
+
+// Binary size of a digest response (MD5)
+#define W3_DIGEST_SIZE 16
+
+// Monotonic clock in microseconds
+static inline uint64_t w3_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// Wall-clock time in milliseconds, comparable between nodes
+static inline uint64_t w3_realtime_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// FNV-1a hash used for the module's shm tables
+static inline uint32_t w3_hash32(const char* s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// 64-bit FNV-1a, chainable through the seed (start with W3_HASH64_SEED)
+#define W3_HASH64_SEED 14695981039346656037ULL
+
+static inline uint64_t w3_hash64(uint64_t h, const char* s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+#endif
@@ -0,0 +1,624 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Solidity ABI encoding driven by function signatures.
+ *
+ * A signature is parsed once, when the routing table is built, into a plan:
+ * a small array of type nodes with the head size and dynamic flag of every
+ * type worked out. Requests then only walk the plan, first to size and
+ * validate the values and then to write the encoding as hex straight into
+ * the request. Plans hold no pointers, so they are copied into shm along
+ * with the tenant that uses them.
+ *
+ * Encoding follows the contract ABI specification: a tuple is a head of
+ * one slot per component, static components inline and dynamic ones as an
+ * offset into the tail that follows the head.
+ *
+ * Most arguments repeat from call to call: the realm, method and request
+ * URI take a handful of values while only the username and nonce change.
+ * Each process therefore keeps the encoded tail segment (length slot and
+ * padded hex) of the last few values of every top-level string or bytes
+ * argument and copies it instead of encoding again. Positions whose values
+ * keep changing skip the memo, apart from an occasional probe that notices
+ * when they start repeating.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "web3_auth_abi.h"
+#include "web3_auth_hex.h"
+#include "web3_auth_keccak.h"
+
+#define ABI_MAX_FARRAY 1024
+#define ABI_MAX_ENCODING (1L << 24)
+
+#define ABI_MEMO_WAYS 4
+#define ABI_MEMO_VALUE 96       // longest value kept: realms, methods, most URIs
+#define ABI_MEMO_WINDOW 256     // calls between hit rate checks
+#define ABI_MEMO_PROBE 16       // cold positions still look up every Nth call
+
+typedef struct {
+    uint16_t len;
+    uint16_t hex_len;           // 0 marks an empty way
+    unsigned int hits;          // halved every window, the least used is replaced
+    uint8_t value[ABI_MEMO_VALUE];
+    char hex[64 + 2 * ABI_MEMO_VALUE];
+} abi_memo_way_t;
+
+// Recent values of one argument position
+typedef struct {
+    abi_memo_way_t ways[ABI_MEMO_WAYS];
+    unsigned int window;        // calls in the current window
+    unsigned int window_lookups;
+    unsigned int window_hits;
+    int hot;                    // worth looking up
+} abi_memo_slot_t;
+
+static abi_memo_slot_t abi_memo[W3_ABI_MAX_ARGS];
+static int abi_memo_on = 0;
+static unsigned long abi_memo_lookups = 0;
+static unsigned long abi_memo_hits = 0;
+
+typedef struct {
+    w3_abi_plan_t* plan;
+    const char* p;
+    char* canon;            // canonical text being built, NULL to skip
+    size_t canon_len;
+    const char* err;
+} abi_parser_t;
+
+static void abi_canon(abi_parser_t* ps, const char* s, size_t len) {
+    if (!ps->canon) return;
+    if (ps->canon_len + len >= W3_ABI_SIGNATURE_SIZE) {
+        ps->err = "signature too long";
+        return;
+    }
+    memcpy(ps->canon + ps->canon_len, s, len);
+    ps->canon_len += len;
+    ps->canon[ps->canon_len] = '\0';
+}
+
+static int abi_new_node(abi_parser_t* ps, int kind, int size) {
+    w3_abi_node_t* n;
+
+    if (ps->plan->nnodes == W3_ABI_MAX_NODES) {
+        ps->err = "too many types";
+        return -1;
+    }
+    n = &ps->plan->nodes[ps->plan->nnodes];
+    memset(n, 0, sizeof(*n));
+    n->kind = kind;
+    n->size = size;
+    n->first = -1;
+    n->next = -1;
+    return ps->plan->nnodes++;
+}
+
+// Decimal number at the parser position, or def when there is none
+static int abi_number(abi_parser_t* ps, int def) {
+    int v = 0;
+
+    if (*ps->p < '0' || *ps->p > '9') return def;
+    while (*ps->p >= '0' && *ps->p <= '9') {
+        v = v * 10 + (*ps->p++ - '0');
+        if (v > 100000) return -1;
+    }
+    return v;
+}
+
+static int abi_parse_list(abi_parser_t* ps, int tuple);
+
+static int abi_parse_type(abi_parser_t* ps) {
+    char buf[32];
+    const char* start;
+    int node, bits;
+
+    if (*ps->p == '(' || strncmp(ps->p, "tuple(", 6) == 0) {
+        if (*ps->p == 't') ps->p += 5;
+        ps->p++;
+        node = abi_new_node(ps, W3_ABI_TUPLE, 0);
+        if (node < 0) return -1;
+        abi_canon(ps, "(", 1);
+        if (abi_parse_list(ps, node) < 0) return -1;
+        abi_canon(ps, ")", 1);
+    } else {
+        start = ps->p;
+        while ((*ps->p >= 'a' && *ps->p <= 'z')) ps->p++;
+
+        if (ps->p - start == 4 && strncmp(start, "uint", 4) == 0) {
+            bits = abi_number(ps, 256);
+            node = abi_new_node(ps, W3_ABI_UINT, bits);
+            snprintf(buf, sizeof(buf), "uint%d", bits);
+        } else if (ps->p - start == 3 && strncmp(start, "int", 3) == 0) {
+            bits = abi_number(ps, 256);
+            node = abi_new_node(ps, W3_ABI_INT, bits);
+            snprintf(buf, sizeof(buf), "int%d", bits);
+        } else if (ps->p - start == 5 && strncmp(start, "bytes", 5) == 0) {
+            bits = abi_number(ps, 0);
+            if (bits == 0) {
+                node = abi_new_node(ps, W3_ABI_BYTES, 0);
+                strcpy(buf, "bytes");
+                bits = 8;
+            } else {
+                if (bits > 32) {
+                    ps->err = "bytesN needs N from 1 to 32";
+                    return -1;
+                }
+                node = abi_new_node(ps, W3_ABI_BYTESN, bits);
+                snprintf(buf, sizeof(buf), "bytes%d", bits);
+                bits = 8;
+            }
+        } else if (ps->p - start == 7 && strncmp(start, "address", 7) == 0) {
+            node = abi_new_node(ps, W3_ABI_ADDRESS, 160);
+            strcpy(buf, "address");
+            bits = 8;
+        } else if (ps->p - start == 4 && strncmp(start, "bool", 4) == 0) {
+            node = abi_new_node(ps, W3_ABI_BOOL, 8);
+            strcpy(buf, "bool");
+            bits = 8;
+        } else if (ps->p - start == 6 && strncmp(start, "string", 6) == 0) {
+            node = abi_new_node(ps, W3_ABI_STRING, 0);
+            strcpy(buf, "string");
+            bits = 8;
+        } else {
+            ps->err = "unknown type";
+            return -1;
+        }
+        if (node < 0) return -1;
+        if (bits < 8 || bits > 256 || bits % 8) {
+            ps->err = "integer size must be a multiple of 8 up to 256";
+            return -1;
+        }
+        abi_canon(ps, buf, strlen(buf));
+    }
+
+    // Array suffixes wrap the type parsed so far
+    while (*ps->p == '[') {
+        int k, arr;
+
+        ps->p++;
+        k = abi_number(ps, 0);
+        if (*ps->p != ']' || k < 0 || k > ABI_MAX_FARRAY) {
+            ps->err = "bad array size";
+            return -1;
+        }
+        ps->p++;
+        arr = abi_new_node(ps, k ? W3_ABI_FARRAY : W3_ABI_ARRAY, k);
+        if (arr < 0) return -1;
+        ps->plan->nodes[arr].first = node;
+        node = arr;
+        if (k) snprintf(buf, sizeof(buf), "[%d]", k);
+        else strcpy(buf, "[]");
+        abi_canon(ps, buf, strlen(buf));
+    }
+    return ps->err ? -1 : node;
+}
+
+// Components up to the closing parenthesis, linked under tuple
+static int abi_parse_list(abi_parser_t* ps, int tuple) {
+    int last = -1;
+
+    if (*ps->p == ')') {
+        ps->p++;
+        return 0;
+    }
+    for (;;) {
+        int node = abi_parse_type(ps);
+        if (node < 0) return -1;
+
+        if (last < 0) ps->plan->nodes[tuple].first = node;
+        else ps->plan->nodes[last].next = node;
+        last = node;
+        ps->plan->nodes[tuple].size++;
+
+        if (*ps->p == ',') {
+            ps->p++;
+            abi_canon(ps, ",", 1);
+        } else if (*ps->p == ')') {
+            ps->p++;
+            return 0;
+        } else {
+            ps->err = "expected ',' or ')'";
+            return -1;
+        }
+    }
+}
+
+// Work out dynamic flags and head sizes bottom-up
+static int abi_layout(w3_abi_plan_t* plan, int idx) {
+    w3_abi_node_t* n = &plan->nodes[idx];
+    long head = 32;
+
+    n->dynamic = 0;
+    switch (n->kind) {
+        case W3_ABI_BYTES:
+        case W3_ABI_STRING:
+        case W3_ABI_ARRAY:
+            if (n->kind == W3_ABI_ARRAY && abi_layout(plan, n->first) < 0) return -1;
+            n->dynamic = 1;
+            break;
+        case W3_ABI_FARRAY:
+            if (abi_layout(plan, n->first) < 0) return -1;
+            n->dynamic = plan->nodes[(int)n->first].dynamic;
+            if (!n->dynamic) head = (long)n->size * plan->nodes[(int)n->first].head;
+            break;
+        case W3_ABI_TUPLE:
+            head = 0;
+            for (int c = n->first; c >= 0; c = plan->nodes[c].next) {
+                if (abi_layout(plan, c) < 0) return -1;
+                n->dynamic |= plan->nodes[c].dynamic;
+                head += plan->nodes[c].head;
+            }
+            if (n->dynamic) head = 32;
+            break;
+    }
+    if (head > 0xffff) return -1;
+    n->head = (uint16_t)head;
+    return 0;
+}
+
+static int abi_compile_list(abi_parser_t* ps, w3_abi_plan_t* plan) {
+    ps->plan = plan;
+    plan->nnodes = 0;
+    if (abi_new_node(ps, W3_ABI_TUPLE, 0) < 0) return -1;
+    if (*ps->p != '(') {
+        ps->err = "expected '('";
+        return -1;
+    }
+    ps->p++;
+    abi_canon(ps, "(", 1);
+    if (abi_parse_list(ps, 0) < 0) return -1;
+    abi_canon(ps, ")", 1);
+    if (abi_layout(plan, 0) < 0) {
+        ps->err = "static types too large";
+        return -1;
+    }
+    return ps->err ? -1 : 0;
+}
+
+int w3_abi_compile(const char* signature, w3_abi_fn_t* fn, const char** err) {
+    char text[W3_ABI_SIGNATURE_SIZE];
+    abi_parser_t ps;
+    uint8_t hash[32];
+    size_t n = 0;
+
+    // Whitespace carries no meaning in signatures
+    for (const char* s = signature; *s; s++) {
+        if (*s == ' ' || *s == '\t') continue;
+        if (n + 1 >= sizeof(text)) {
+            *err = "signature too long";
+            return -1;
+        }
+        text[n++] = *s;
+    }
+    text[n] = '\0';
+
+    memset(fn, 0, sizeof(*fn));
+    memset(&ps, 0, sizeof(ps));
+    ps.p = text;
+    while ((*ps.p >= 'a' && *ps.p <= 'z') || (*ps.p >= 'A' && *ps.p <= 'Z')
+            || (*ps.p >= '0' && *ps.p <= '9') || *ps.p == '_' || *ps.p == '$') {
+        ps.p++;
+    }
+    if (ps.p == text || *ps.p != '(') {
+        *err = "missing function name";
+        return -1;
+    }
+    memcpy(fn->canonical, text, ps.p - text);
+    ps.canon = fn->canonical;
+    ps.canon_len = ps.p - text;
+
+    if (abi_compile_list(&ps, &fn->args) < 0) {
+        *err = ps.err;
+        return -1;
+    }
+
+    ps.canon = NULL;
+    if (*ps.p == '\0') ps.p = "(bytes32)";
+    if (abi_compile_list(&ps, &fn->returns) < 0 || *ps.p != '\0') {
+        *err = ps.err ? ps.err : "unexpected text after the return types";
+        return -1;
+    }
+
+    keccak256((const uint8_t*)fn->canonical, strlen(fn->canonical), hash);
+    memcpy(fn->selector, hash, 4);
+    return 0;
+}
+
+const w3_abi_node_t* w3_abi_component(const w3_abi_plan_t* plan, int i) {
+    int c = plan->nodes[0].first;
+
+    while (c >= 0 && i-- > 0) c = plan->nodes[c].next;
+    return c >= 0 ? &plan->nodes[c] : NULL;
+}
+
+static long abi_size(const w3_abi_plan_t* plan, int idx, const w3_abi_value_t* v);
+
+// Size of count components starting at node idx, or of count elements of
+// type idx when same is set
+static long abi_seq_size(const w3_abi_plan_t* plan, int idx, int same,
+        const w3_abi_value_t* items, size_t count) {
+    long total = 0;
+
+    if (count && !items) return -1;
+    for (size_t i = 0; i < count; i++) {
+        const w3_abi_node_t* n = &plan->nodes[idx];
+        long s = abi_size(plan, idx, &items[i]);
+
+        if (s < 0) return -1;
+        total += n->head + (n->dynamic ? s : 0);
+        if (total > ABI_MAX_ENCODING) return -1;
+        if (!same) idx = n->next;
+    }
+    return total;
+}
+
+// Size of the complete encoding of v, after checking it fits type idx
+static long abi_size(const w3_abi_plan_t* plan, int idx, const w3_abi_value_t* v) {
+    const w3_abi_node_t* n = &plan->nodes[idx];
+    long s;
+
+    switch (n->kind) {
+        case W3_ABI_UINT:
+            if (v->data) return v->len <= (size_t)n->size / 8 ? 32 : -1;
+            return n->size >= 64 || (v->num >> n->size) == 0 ? 32 : -1;
+        case W3_ABI_INT:
+            if (v->data) return v->len <= (size_t)n->size / 8 ? 32 : -1;
+            if (n->size >= 64) return 32;
+            s = (int64_t)v->num >> (n->size - 1);
+            return s == 0 || s == -1 ? 32 : -1;
+        case W3_ABI_ADDRESS:
+            return !v->data || v->len == 20 ? 32 : -1;
+        case W3_ABI_BOOL:
+            if (v->data) return v->len <= 1 ? 32 : -1;
+            return v->num <= 1 ? 32 : -1;
+        case W3_ABI_BYTESN:
+            return v->len <= n->size && (v->data || !v->len) ? 32 : -1;
+        case W3_ABI_BYTES:
+        case W3_ABI_STRING:
+            if (v->len && !v->data) return -1;
+            if (v->len > ABI_MAX_ENCODING) return -1;
+            return 32 + (long)((v->len + 31) & ~(size_t)31);
+        case W3_ABI_ARRAY:
+            s = abi_seq_size(plan, n->first, 1, v->items, v->len);
+            return s < 0 ? -1 : 32 + s;
+        case W3_ABI_FARRAY:
+            if (v->len != n->size) return -1;
+            return abi_seq_size(plan, n->first, 1, v->items, v->len);
+        case W3_ABI_TUPLE:
+            if (v->len != n->size) return -1;
+            return abi_seq_size(plan, n->first, 0, v->items, v->len);
+    }
+    return -1;
+}
+
+long w3_abi_size(const w3_abi_plan_t* plan, const w3_abi_value_t* tuple) {
+    return abi_size(plan, 0, tuple);
+}
+
+// One slot holding v right-aligned, sign-extended for negative ints.
+// Offsets and lengths are small, so only their few digits are written.
+static inline char* abi_write_word(char* out, uint64_t v, char fill) {
+    static const char digits[16] = "0123456789abcdef";
+
+    memset(out, fill, 64);
+    for (char* p = out + 63; v; v >>= 4) *p-- = digits[v & 0x0f];
+    return out + 64;
+}
+
+static char* abi_write_number(char* out, const w3_abi_node_t* n, const w3_abi_value_t* v) {
+    char fill = '0';
+
+    if (!v->data) {
+        if (n->kind == W3_ABI_INT && (int64_t)v->num < 0) fill = 'f';
+        return abi_write_word(out, v->num, fill);
+    }
+    if (n->kind == W3_ABI_INT && v->len && (v->data[0] & 0x80)) fill = 'f';
+    memset(out, fill, 64 - 2 * v->len);
+    w3_hex_encode(v->data, v->len, out + 64 - 2 * v->len);
+    return out + 64;
+}
+
+// Length slot and zero-padded contents of a string or bytes value
+static char* abi_write_string(const w3_abi_value_t* v, char* out) {
+    size_t pad = ((v->len + 31) & ~(size_t)31) - v->len;
+
+    out = abi_write_word(out, v->len, '0');
+    w3_hex_encode(v->data, v->len, out);
+    out += 2 * v->len;
+    memset(out, '0', 2 * pad);
+    return out + 2 * pad;
+}
+
+// abi_write_string() through the memo of top-level argument pos
+static char* abi_write_memo(int pos, const w3_abi_value_t* v, char* out) {
+    abi_memo_slot_t* slot = &abi_memo[pos];
+    abi_memo_way_t* w;
+    abi_memo_way_t* victim;
+    char* end;
+
+    if (v->len > ABI_MEMO_VALUE) return abi_write_string(v, out);
+
+    if (++slot->window == ABI_MEMO_WINDOW) {
+        slot->hot = slot->window_hits * 4 >= slot->window_lookups;
+        slot->window = 0;
+        slot->window_lookups = 0;
+        slot->window_hits = 0;
+        for (int i = 0; i < ABI_MEMO_WAYS; i++) slot->ways[i].hits >>= 1;
+    }
+    if (!slot->hot && slot->window % ABI_MEMO_PROBE) return abi_write_string(v, out);
+
+    abi_memo_lookups++;
+    slot->window_lookups++;
+
+    victim = &slot->ways[0];
+    for (int i = 0; i < ABI_MEMO_WAYS; i++) {
+        w = &slot->ways[i];
+        if (w->hex_len && w->len == v->len && memcmp(w->value, v->data, v->len) == 0) {
+            memcpy(out, w->hex, w->hex_len);
+            w->hits++;
+            abi_memo_hits++;
+            slot->window_hits++;
+            return out + w->hex_len;
+        }
+        // Fill empty ways first, then replace the least used
+        if (victim->hex_len && (!w->hex_len || w->hits < victim->hits)) victim = w;
+    }
+
+    end = abi_write_string(v, out);
+    victim->hits = 0;
+    victim->len = (uint16_t)v->len;
+    memcpy(victim->value, v->data, v->len);
+    victim->hex_len = (uint16_t)(end - out);
+    memcpy(victim->hex, out, victim->hex_len);
+    return end;
+}
+
+static char* abi_write(const w3_abi_plan_t* plan, int idx, const w3_abi_value_t* v, char* out);
+
+// Write count components starting at node idx, or count elements of type
+// idx when same is set; memo marks the top-level tuple
+static char* abi_seq_write(const w3_abi_plan_t* plan, int idx, int same, int memo,
+        const w3_abi_value_t* items, size_t count, char* out) {
+    char* head = out;
+    char* tail;
+    size_t head_bytes = 0;
+
+    for (int i = 0, c = idx; (size_t)i < count; i++) {
+        head_bytes += plan->nodes[c].head;
+        if (!same) c = plan->nodes[c].next;
+    }
+    tail = out + 2 * head_bytes;
+
+    for (size_t i = 0; i < count; i++) {
+        const w3_abi_node_t* n = &plan->nodes[idx];
+
+        if (n->dynamic) {
+            head = abi_write_word(head, (uint64_t)(tail - out) / 2, '0');
+            if (memo && (n->kind == W3_ABI_STRING || n->kind == W3_ABI_BYTES)) {
+                tail = abi_write_memo(i, &items[i], tail);
+            } else {
+                tail = abi_write(plan, idx, &items[i], tail);
+            }
+        } else {
+            head = abi_write(plan, idx, &items[i], head);
+        }
+        if (!same) idx = n->next;
+    }
+    return tail;
+}
+
+static char* abi_write(const w3_abi_plan_t* plan, int idx, const w3_abi_value_t* v, char* out) {
+    const w3_abi_node_t* n = &plan->nodes[idx];
+
+    switch (n->kind) {
+        case W3_ABI_UINT:
+        case W3_ABI_INT:
+        case W3_ABI_ADDRESS:
+        case W3_ABI_BOOL:
+            return abi_write_number(out, n, v);
+        case W3_ABI_BYTESN:
+            w3_hex_encode(v->data, v->len, out);
+            memset(out + 2 * v->len, '0', 64 - 2 * v->len);
+            return out + 64;
+        case W3_ABI_BYTES:
+        case W3_ABI_STRING:
+            return abi_write_string(v, out);
+        case W3_ABI_ARRAY:
+            out = abi_write_word(out, v->len, '0');
+            return abi_seq_write(plan, n->first, 1, 0, v->items, v->len, out);
+        case W3_ABI_FARRAY:
+            return abi_seq_write(plan, n->first, 1, 0, v->items, v->len, out);
+        case W3_ABI_TUPLE:
+            return abi_seq_write(plan, n->first, 0, 0, v->items, v->len, out);
+    }
+    return out;
+}
+
+char* w3_abi_encode_hex(const w3_abi_plan_t* plan, const w3_abi_value_t* tuple, char* out) {
+    return abi_seq_write(plan, plan->nodes[0].first, 0, abi_memo_on, tuple->items, tuple->len, out);
+}
+
+void w3_abi_memo_enable(int on) {
+    memset(abi_memo, 0, sizeof(abi_memo));
+    for (int i = 0; i < W3_ABI_MAX_ARGS; i++) abi_memo[i].hot = 1;
+    abi_memo_on = on;
+    abi_memo_lookups = 0;
+    abi_memo_hits = 0;
+}
+
+void w3_abi_memo_stats(unsigned long* lookups, unsigned long* hits) {
+    *lookups = abi_memo_lookups;
+    *hits = abi_memo_hits;
+}
+
+// Slot as an offset or length; -1 when it is implausibly large
+static long abi_read_offset(const uint8_t* word) {
+    uint64_t v = 0;
+
+    for (int i = 0; i < 24; i++) {
+        if (word[i]) return -1;
+    }
+    for (int i = 24; i < 32; i++) v = v << 8 | word[i];
+    return v > ABI_MAX_ENCODING ? -1 : (long)v;
+}
+
+int w3_abi_decode(const w3_abi_plan_t* plan, const uint8_t* data, size_t len,
+        w3_abi_value_t out[W3_ABI_MAX_ARGS]) {
+    size_t h = 0;
+    int count = 0;
+
+    for (int c = plan->nodes[0].first; c >= 0; c = plan->nodes[c].next) {
+        const w3_abi_node_t* n = &plan->nodes[c];
+        w3_abi_value_t* v = &out[count];
+        size_t at = h;
+        long off, items;
+
+        if (count == W3_ABI_MAX_ARGS || h + n->head > len) return -1;
+        memset(v, 0, sizeof(*v));
+
+        if (n->dynamic) {
+            off = abi_read_offset(data + h);
+            if (off < 0 || (size_t)off + 32 > len) return -1;
+            at = off;
+        }
+
+        switch (n->kind) {
+            case W3_ABI_UINT:
+            case W3_ABI_INT:
+            case W3_ABI_ADDRESS:
+            case W3_ABI_BOOL:
+                v->len = n->size / 8;
+                v->data = data + at + 32 - v->len;
+                for (int i = 24; i < 32; i++) v->num = v->num << 8 | data[at + i];
+                break;
+            case W3_ABI_BYTESN:
+                v->data = data + at;
+                v->len = n->size;
+                break;
+            case W3_ABI_BYTES:
+            case W3_ABI_STRING:
+            case W3_ABI_ARRAY:
+                items = abi_read_offset(data + at);
+                if (items < 0) return -1;
+                if (n->kind == W3_ABI_ARRAY) {
+                    const w3_abi_node_t* e = &plan->nodes[(int)n->first];
+                    if (at + 32 + (size_t)items * e->head > len) return -1;
+                } else if (at + 32 + (size_t)items > len) {
+                    return -1;
+                }
+                v->data = data + at + 32;
+                v->len = items;
+                break;
+            default:
+                // Nested tuples and fixed arrays are left encoded
+                v->data = data + at;
+                v->len = n->size;
+                break;
+        }
+        h += n->head;
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,96 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Solidity ABI encoding driven by function signatures.
+ */
+
+#ifndef _WEB3_AUTH_ABI_H_
+#define _WEB3_AUTH_ABI_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define W3_ABI_MAX_NODES 32
+#define W3_ABI_MAX_ARGS 16
+#define W3_ABI_SIGNATURE_SIZE 192
+
+// Type kinds
+#define W3_ABI_UINT    1
+#define W3_ABI_INT     2
+#define W3_ABI_ADDRESS 3
+#define W3_ABI_BOOL    4
+#define W3_ABI_BYTESN  5    // bytes1 .. bytes32
+#define W3_ABI_BYTES   6
+#define W3_ABI_STRING  7
+#define W3_ABI_TUPLE   8
+#define W3_ABI_ARRAY   9    // T[]
+#define W3_ABI_FARRAY  10   // T[k]
+
+// One type of a plan; children are referenced by node index
+typedef struct w3_abi_node {
+    uint8_t kind;
+    uint8_t dynamic;    // encoded in the tail behind an offset
+    uint16_t size;      // bits of (u)intN, N of bytesN, k of T[k], components of tuples
+    int8_t first;       // element type of arrays, first component of tuples, or -1
+    int8_t next;        // next component of the enclosing tuple, or -1
+    uint16_t head;      // bytes taken in the head of the enclosing encoding
+} w3_abi_node_t;
+
+// Compiled type list: node 0 is the tuple of the arguments or return values
+typedef struct w3_abi_plan {
+    int nnodes;
+    w3_abi_node_t nodes[W3_ABI_MAX_NODES];
+} w3_abi_plan_t;
+
+// Compiled function; plain data, so it can be copied into shm
+typedef struct w3_abi_fn {
+    char canonical[W3_ABI_SIGNATURE_SIZE];  // name(types) the selector hashes
+    uint8_t selector[4];
+    w3_abi_plan_t args;
+    w3_abi_plan_t returns;                  // (bytes32) when not given
+} w3_abi_fn_t;
+
+// A value to encode or a decoded one. Strings and bytes point to their
+// contents; numbers, addresses and bytesN to big-endian bytes, or use num
+// when data is NULL (int values are sign-extended from 64 bits). Tuples
+// and arrays list their components or elements in items; decoded nested
+// tuples and arrays point data at their encoding instead.
+typedef struct w3_abi_value {
+    const uint8_t* data;
+    size_t len;                     // bytes in data, or components/elements
+    uint64_t num;
+    const struct w3_abi_value* items;
+} w3_abi_value_t;
+
+// Compile "name(types)" or "name(types)(return types)", as written by cast
+// and ethers; uint and int stand for uint256 and int256. -1 with the reason
+// in err when the signature is malformed or too complex.
+int w3_abi_compile(const char* signature, w3_abi_fn_t* fn, const char** err);
+
+// Components of the top-level tuple of plan
+static inline int w3_abi_count(const w3_abi_plan_t* plan) {
+    return plan->nodes[0].size;
+}
+
+// Type of the i-th top-level component, or NULL
+const w3_abi_node_t* w3_abi_component(const w3_abi_plan_t* plan, int i);
+
+// Encoded size in bytes of the top-level tuple, or -1 when the values do
+// not match the plan
+long w3_abi_size(const w3_abi_plan_t* plan, const w3_abi_value_t* tuple);
+
+// Write the encoding as hex to out, which must hold 2 * w3_abi_size()
+// characters; the values must have passed w3_abi_size(). Returns the end.
+char* w3_abi_encode_hex(const w3_abi_plan_t* plan, const w3_abi_value_t* tuple, char* out);
+
+// Reuse the encodings of recent values of top-level string and bytes
+// arguments in this process; starts empty, off until enabled
+void w3_abi_memo_enable(int on);
+void w3_abi_memo_stats(unsigned long* lookups, unsigned long* hits);
+
+// Decode the top-level components of data into out; returns their number,
+// or -1 when an offset or length points outside data
+int w3_abi_decode(const w3_abi_plan_t* plan, const uint8_t* data, size_t len,
+        w3_abi_value_t out[W3_ABI_MAX_ARGS]);
+
+#endif
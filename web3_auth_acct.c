@@ -0,0 +1,229 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Accounting of RPC calls and bytes per endpoint.
+ *
+ * Providers bill per request and per byte, so the module keeps running
+ * totals per endpoint URL in shm and persists them to a text file, one line
+ * per endpoint: "<calls> <errors> <bytes sent> <bytes received> <url>". The
+ * file is rewritten from a timer and on shutdown, and its totals are loaded
+ * back on startup so the counters survive restarts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../core/dprint.h"
+#include "../../core/locking.h"
+#include "../../core/mem/shm_mem.h"
+
+#include "web3_auth.h"
+#include "web3_auth_acct.h"
+
+#define ACCT_MAX_ENDPOINTS 32
+#define ACCT_URL_SIZE 256
+
+typedef struct {
+    char url[ACCT_URL_SIZE];
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t sent;
+    uint64_t received;
+} acct_endpoint_t;
+
+typedef struct {
+    gen_lock_t lock;
+    time_t since;
+    uint64_t quota_rejects;
+    int count;
+    acct_endpoint_t endpoints[ACCT_MAX_ENDPOINTS];
+} acct_table_t;
+
+static acct_table_t* acct = NULL;
+static char* acct_file = NULL;
+
+// Find or add the counters of an endpoint; called with the lock held
+static acct_endpoint_t* acct_endpoint(const char* url) {
+    acct_endpoint_t* e;
+
+    for (int i = 0; i < acct->count; i++) {
+        if (strncmp(acct->endpoints[i].url, url, ACCT_URL_SIZE - 1) == 0) {
+            return &acct->endpoints[i];
+        }
+    }
+    if (acct->count == ACCT_MAX_ENDPOINTS) return NULL;
+
+    e = &acct->endpoints[acct->count++];
+    strncpy(e->url, url, ACCT_URL_SIZE - 1);
+    return e;
+}
+
+static void acct_load(const char* file) {
+    char line[ACCT_URL_SIZE + 128];
+    unsigned long long calls, errors, sent, received;
+    char url[ACCT_URL_SIZE];
+    long long since;
+    acct_endpoint_t* e;
+    FILE* f;
+
+    f = fopen(file, "r");
+    if (!f) {
+        LM_INFO("No accounting totals in %s yet\n", file);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "# since %lld", &since) == 1) {
+            acct->since = (time_t)since;
+        } else if (sscanf(line, "# quota_rejects %llu", &calls) == 1) {
+            acct->quota_rejects = calls;
+        } else if (line[0] != '#' && sscanf(line, "%llu %llu %llu %llu %255s",
+                &calls, &errors, &sent, &received, url) == 5) {
+            e = acct_endpoint(url);
+            if (!e) break;
+            e->calls = calls;
+            e->errors = errors;
+            e->sent = sent;
+            e->received = received;
+        }
+    }
+    fclose(f);
+
+    LM_INFO("Loaded accounting totals of %d endpoint(s) from %s\n", acct->count, file);
+}
+
+int w3_acct_init(const char* file) {
+    acct = shm_malloc(sizeof(acct_table_t));
+    if (!acct) {
+        LM_ERR("Not enough shared memory for RPC accounting\n");
+        return -1;
+    }
+    memset(acct, 0, sizeof(acct_table_t));
+
+    if (!lock_init(&acct->lock)) {
+        LM_ERR("Failed to initialize RPC accounting lock\n");
+        shm_free(acct);
+        acct = NULL;
+        return -1;
+    }
+    acct->since = time(NULL);
+
+    if (file && *file) {
+        acct_file = (char*)file;
+        acct_load(file);
+    }
+    return 0;
+}
+
+void w3_acct_destroy(void) {
+    if (!acct) return;
+    lock_destroy(&acct->lock);
+    shm_free(acct);
+    acct = NULL;
+}
+
+void w3_acct_record(const char* endpoint, size_t sent, size_t received, int ok) {
+    acct_endpoint_t* e;
+
+    if (!acct || !endpoint) return;
+
+    lock_get(&acct->lock);
+    e = acct_endpoint(endpoint);
+    if (e) {
+        e->calls++;
+        if (!ok) e->errors++;
+        e->sent += sent;
+        e->received += received;
+    }
+    lock_release(&acct->lock);
+}
+
+void w3_acct_quota_reject(void) {
+    if (!acct) return;
+    lock_get(&acct->lock);
+    acct->quota_rejects++;
+    lock_release(&acct->lock);
+}
+
+int w3_acct_save(void) {
+    acct_table_t snap;
+    char tmp[1024];
+    FILE* f;
+
+    if (!acct || !acct_file) return 0;
+
+    lock_get(&acct->lock);
+    memcpy(&snap, acct, sizeof(snap));
+    lock_release(&acct->lock);
+
+    // Write next to the target and rename, so readers never see half a file
+    snprintf(tmp, sizeof(tmp), "%s.tmp", acct_file);
+    f = fopen(tmp, "w");
+    if (!f) {
+        LM_ERR("Cannot write accounting file %s\n", tmp);
+        return -1;
+    }
+    fprintf(f, "# since %lld\n", (long long)snap.since);
+    fprintf(f, "# quota_rejects %llu\n", (unsigned long long)snap.quota_rejects);
+    fprintf(f, "# calls errors bytes_sent bytes_received endpoint\n");
+    for (int i = 0; i < snap.count; i++) {
+        acct_endpoint_t* e = &snap.endpoints[i];
+        fprintf(f, "%llu %llu %llu %llu %s\n",
+                (unsigned long long)e->calls, (unsigned long long)e->errors,
+                (unsigned long long)e->sent, (unsigned long long)e->received, e->url);
+    }
+    if (fclose(f) != 0 || rename(tmp, acct_file) != 0) {
+        LM_ERR("Cannot update accounting file %s\n", acct_file);
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+void w3_acct_timer(unsigned int ticks, void* param) {
+    (void)ticks;
+    (void)param;
+    w3_acct_save();
+}
+
+void w3_acct_rpc_stats(rpc_t* rpc, void* ctx) {
+    acct_endpoint_t e;
+    uint64_t rejects;
+    int count;
+    void* th;
+
+    if (!acct) {
+        rpc->fault(ctx, 500, "RPC accounting not initialized");
+        return;
+    }
+
+    lock_get(&acct->lock);
+    rejects = acct->quota_rejects;
+    count = acct->count;
+    lock_release(&acct->lock);
+
+    if (rpc->add(ctx, "{", &th) < 0) {
+        rpc->fault(ctx, 500, "Internal error creating structure");
+        return;
+    }
+    rpc->struct_add(th, "du",
+            "since", (int)acct->since,
+            "quota_rejects", (unsigned int)rejects);
+
+    for (int i = 0; i < count; i++) {
+        lock_get(&acct->lock);
+        memcpy(&e, &acct->endpoints[i], sizeof(e));
+        lock_release(&acct->lock);
+
+        if (rpc->add(ctx, "{", &th) < 0) return;
+        // Byte totals can exceed 32 bits, report them in KiB
+        rpc->struct_add(th, "suuuu",
+                "endpoint", e.url,
+                "calls", (unsigned int)e.calls,
+                "errors", (unsigned int)e.errors,
+                "sent_kb", (unsigned int)(e.sent / 1024),
+                "received_kb", (unsigned int)(e.received / 1024));
+    }
+}
@@ -0,0 +1,31 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Accounting of RPC calls and bytes per endpoint.
+ */
+
+#ifndef _WEB3_AUTH_ACCT_H_
+#define _WEB3_AUTH_ACCT_H_
+
+#include <stddef.h>
+
+#include "../../core/rpc.h"
+
+// Allocate the counters and load the totals persisted in file (may be NULL);
+// must run in mod_init (before fork)
+int w3_acct_init(const char* file);
+void w3_acct_destroy(void);
+
+// Account one RPC request to endpoint; ok is 0 for transport or HTTP errors
+void w3_acct_record(const char* endpoint, size_t sent, size_t received, int ok);
+
+// Account an eth_call that was not sent because the quota was exhausted
+void w3_acct_quota_reject(void);
+
+// Write the totals to the accounting file
+int w3_acct_save(void);
+void w3_acct_timer(unsigned int ticks, void* param);
+
+void w3_acct_rpc_stats(rpc_t* rpc, void* ctx);
+
+#endif
@@ -0,0 +1,275 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Failed-authentication ban table keyed by source IP and by user.
+ *
+ * Every failed lookup costs an eth_call, so repeated failures from one source
+ * address or for one user put that key in a penalty window during which
+ * web3_auth_check() rejects it without touching the network. Each repeated
+ * ban doubles the window. The table is a fixed-size set-associative array in
+ * shm: a key hashes to a set of BAN_WAYS entries and, when the set is full,
+ * the least recently failed entry that is not banned is replaced.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../core/dprint.h"
+#include "../../core/locking.h"
+#include "../../core/mem/shm_mem.h"
+
+#include "web3_auth.h"
+#include "web3_auth_ban.h"
+
+#define BAN_WAYS 8
+#define BAN_KEY_SIZE 96
+
+#define BAN_KEY_IP 1
+#define BAN_KEY_USER 2
+
+typedef struct {
+    uint32_t hash;      // 0 marks a free entry
+    uint8_t type;
+    uint8_t level;      // number of bans in a row
+    uint16_t failures;  // failures in the current window
+    uint64_t window_start_us;
+    uint64_t last_failure_us;
+    uint64_t banned_until_us;
+    char key[BAN_KEY_SIZE];
+} ban_entry_t;
+
+typedef struct {
+    gen_lock_t lock;
+    int threshold;
+    uint64_t window_us;
+    uint64_t base_us;
+    uint64_t max_us;
+    unsigned int sets;
+    ban_entry_t entries[];
+} ban_table_t;
+
+static ban_table_t* bans = NULL;
+
+int w3_ban_init(int size, int threshold, int window_s, int base_s, int max_s) {
+    unsigned int sets;
+    size_t bytes;
+
+    if (threshold <= 0) {
+        LM_INFO("Failed-auth ban table disabled\n");
+        return 0;
+    }
+    if (size < BAN_WAYS) size = BAN_WAYS;
+    sets = (size + BAN_WAYS - 1) / BAN_WAYS;
+
+    bytes = sizeof(ban_table_t) + (size_t)sets * BAN_WAYS * sizeof(ban_entry_t);
+    bans = shm_malloc(bytes);
+    if (!bans) {
+        LM_ERR("Not enough shared memory for the ban table\n");
+        return -1;
+    }
+    memset(bans, 0, bytes);
+
+    if (!lock_init(&bans->lock)) {
+        LM_ERR("Failed to initialize ban table lock\n");
+        shm_free(bans);
+        bans = NULL;
+        return -1;
+    }
+
+    bans->threshold = threshold;
+    bans->window_us = (uint64_t)window_s * 1000000;
+    bans->base_us = (uint64_t)base_s * 1000000;
+    bans->max_us = (uint64_t)(max_s > base_s ? max_s : base_s) * 1000000;
+    bans->sets = sets;
+
+    LM_INFO("Ban table: %u entries, %d failures in %ds ban for %d..%ds\n",
+            sets * BAN_WAYS, threshold, window_s, base_s, max_s);
+    return 0;
+}
+
+void w3_ban_destroy(void) {
+    if (!bans) return;
+    lock_destroy(&bans->lock);
+    shm_free(bans);
+    bans = NULL;
+}
+
+static uint32_t ban_hash(int type, const char* key) {
+    uint32_t h = w3_hash32(key, strlen(key)) ^ (uint32_t)type;
+    return h ? h : 1;
+}
+
+// Find the entry of a key, optionally claiming one; called with the lock held
+static ban_entry_t* ban_lookup(int type, const char* key, int create, uint64_t now) {
+    uint32_t h = ban_hash(type, key);
+    ban_entry_t* set = &bans->entries[(h % bans->sets) * BAN_WAYS];
+    ban_entry_t* victim = NULL;
+
+    for (int i = 0; i < BAN_WAYS; i++) {
+        ban_entry_t* e = &set[i];
+        if (e->hash == h && e->type == type && strncmp(e->key, key, BAN_KEY_SIZE - 1) == 0) {
+            return e;
+        }
+        if (!create) continue;
+        if (!e->hash) {
+            if (!victim || victim->hash) victim = e;
+        } else if (e->banned_until_us <= now && (!victim
+                || (victim->hash && e->last_failure_us < victim->last_failure_us))) {
+            victim = e;
+        }
+    }
+    if (!victim) return NULL;
+
+    memset(victim, 0, sizeof(*victim));
+    victim->hash = h;
+    victim->type = type;
+    strncpy(victim->key, key, BAN_KEY_SIZE - 1);
+    return victim;
+}
+
+static uint64_t ban_remaining(int type, const char* key, uint64_t now) {
+    ban_entry_t* e;
+
+    if (!key || !*key) return 0;
+    e = ban_lookup(type, key, 0, now);
+    if (!e || e->banned_until_us <= now) return 0;
+    return e->banned_until_us - now;
+}
+
+int w3_ban_check(const char* ip, const char* user) {
+    uint64_t now, left, l;
+
+    if (!bans) return 0;
+
+    now = w3_now_us();
+    lock_get(&bans->lock);
+    left = ban_remaining(BAN_KEY_IP, ip, now);
+    l = ban_remaining(BAN_KEY_USER, user, now);
+    if (l > left) left = l;
+    lock_release(&bans->lock);
+
+    return left ? (int)((left + 999999) / 1000000) : 0;
+}
+
+static void ban_record_failure(int type, const char* key, uint64_t now) {
+    ban_entry_t* e;
+    uint64_t penalty;
+
+    if (!key || !*key) return;
+    e = ban_lookup(type, key, 1, now);
+    if (!e) return;
+
+    // Forget earlier bans once the key behaved for the longest ban period
+    if (e->level && now - e->last_failure_us > bans->max_us) e->level = 0;
+    e->last_failure_us = now;
+
+    if (e->banned_until_us > now) return;
+
+    if (!e->failures || now - e->window_start_us > bans->window_us) {
+        e->window_start_us = now;
+        e->failures = 0;
+    }
+    if (++e->failures < bans->threshold) return;
+
+    penalty = bans->base_us << (e->level < 16 ? e->level : 16);
+    if (penalty > bans->max_us) penalty = bans->max_us;
+    e->banned_until_us = now + penalty;
+    if (e->level < 255) e->level++;
+    e->failures = 0;
+
+    LM_NOTICE("Banning %s %s for %us after repeated authentication failures\n",
+            type == BAN_KEY_IP ? "source" : "user", e->key, (unsigned int)(penalty / 1000000));
+}
+
+void w3_ban_failure(const char* ip, const char* user) {
+    uint64_t now;
+
+    if (!bans) return;
+
+    now = w3_now_us();
+    lock_get(&bans->lock);
+    ban_record_failure(BAN_KEY_IP, ip, now);
+    ban_record_failure(BAN_KEY_USER, user, now);
+    lock_release(&bans->lock);
+}
+
+void w3_ban_success(const char* ip, const char* user) {
+    ban_entry_t* e;
+    uint64_t now;
+
+    if (!bans) return;
+
+    now = w3_now_us();
+    lock_get(&bans->lock);
+    if (ip && (e = ban_lookup(BAN_KEY_IP, ip, 0, now))) e->hash = 0;
+    if (user && (e = ban_lookup(BAN_KEY_USER, user, 0, now))) e->hash = 0;
+    lock_release(&bans->lock);
+}
+
+void w3_ban_rpc_list(rpc_t* rpc, void* ctx) {
+    ban_entry_t e;
+    uint64_t now;
+    void* th;
+
+    if (!bans) {
+        rpc->fault(ctx, 500, "Ban table disabled");
+        return;
+    }
+
+    now = w3_now_us();
+    for (unsigned int i = 0; i < bans->sets * BAN_WAYS; i++) {
+        lock_get(&bans->lock);
+        memcpy(&e, &bans->entries[i], sizeof(e));
+        lock_release(&bans->lock);
+
+        if (!e.hash) continue;
+        if (rpc->add(ctx, "{", &th) < 0) {
+            rpc->fault(ctx, 500, "Internal error creating structure");
+            return;
+        }
+        rpc->struct_add(th, "ssddd",
+                "type", e.type == BAN_KEY_IP ? "ip" : "user",
+                "key", e.key,
+                "failures", (int)e.failures,
+                "level", (int)e.level,
+                "banned_for", e.banned_until_us > now
+                        ? (int)((e.banned_until_us - now + 999999) / 1000000) : 0);
+    }
+}
+
+void w3_ban_rpc_clear(rpc_t* rpc, void* ctx) {
+    char* type = NULL;
+    char* key = NULL;
+    ban_entry_t* e;
+    int n, cleared = 0;
+
+    if (!bans) {
+        rpc->fault(ctx, 500, "Ban table disabled");
+        return;
+    }
+
+    // No arguments clears everything, otherwise "ip <addr>" or "user <user@realm>"
+    n = rpc->scan(ctx, "*ss", &type, &key);
+    if (n < 0) return;          // scan has replied with a fault
+    if (n == 1 || (n == 2 && strcmp(type, "ip") != 0 && strcmp(type, "user") != 0)) {
+        rpc->fault(ctx, 400, "Expected ip <address> or user <user@realm>");
+        return;
+    }
+    lock_get(&bans->lock);
+    if (n == 0) {
+        for (unsigned int i = 0; i < bans->sets * BAN_WAYS; i++) {
+            if (bans->entries[i].hash) cleared++;
+            bans->entries[i].hash = 0;
+        }
+    } else {
+        e = ban_lookup(strcmp(type, "ip") == 0 ? BAN_KEY_IP : BAN_KEY_USER, key, 0, w3_now_us());
+        if (e) {
+            e->hash = 0;
+            cleared = 1;
+        }
+    }
+    lock_release(&bans->lock);
+
+    rpc->add(ctx, "d", cleared);
+}
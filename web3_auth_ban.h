@@ -0,0 +1,30 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Failed-authentication ban table keyed by source IP and by user.
+ */
+
+#ifndef _WEB3_AUTH_BAN_H_
+#define _WEB3_AUTH_BAN_H_
+
+#include "../../core/rpc.h"
+
+// Allocate the shared ban table; must run in mod_init (before fork).
+// threshold failures within window_s seconds ban a key for base_s seconds,
+// doubling on every repeated ban up to max_s.
+int w3_ban_init(int size, int threshold, int window_s, int base_s, int max_s);
+void w3_ban_destroy(void);
+
+// Seconds left on the longest ban of ip or user, 0 when neither is banned
+int w3_ban_check(const char* ip, const char* user);
+
+// Record a failed authentication for both keys
+void w3_ban_failure(const char* ip, const char* user);
+
+// Forget the failure history of both keys after a successful authentication
+void w3_ban_success(const char* ip, const char* user);
+
+void w3_ban_rpc_list(rpc_t* rpc, void* ctx);
+void w3_ban_rpc_clear(rpc_t* rpc, void* ctx);
+
+#endif
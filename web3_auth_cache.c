@@ -0,0 +1,358 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Shared cache of digests returned by the contract.
+ *
+ * The contract answer only depends on the call inputs (username, realm,
+ * method, URI, nonce and the contract itself) and on the stored credentials,
+ * so a digest can be reused for a short TTL, e.g. for retransmissions and
+ * for re-registrations within the nonce lifetime. Entries stay around for a
+ * stale window after the TTL; those are only served when the RPC quota is
+ * exhausted. The table is set-associative with CACHE_WAYS entries per set,
+ * sets are spread over a lock set. Each tenant of the routing table has its
+ * own partition: its id is part of the key and of the entry, so one tenant
+ * can be flushed without touching the others.
+ *
+ * Users the contract does not know get an absent entry keyed by the user
+ * alone, so their retries with fresh nonces are rejected without a call
+ * until it expires.
+ *
+ * Every entry carries the wall-clock time at which the node that asked the
+ * contract stored it. Changes are handed to replication, and those of
+ * peers only replace older entries, expiring as they would on their origin,
+ * so applying a record again or out of order changes nothing. Answers found
+ * in the L2 cache keep the time they were given too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../core/dprint.h"
+#include "../../core/locking.h"
+#include "../../core/atomic_ops.h"
+#include "../../core/mem/shm_mem.h"
+
+#include "web3_auth.h"
+#include "web3_auth_cache.h"
+#include "web3_auth_l2.h"
+#include "web3_auth_repl.h"
+#include "web3_auth_route.h"
+
+#define CACHE_WAYS 4
+#define CACHE_LOCKS 64
+
+typedef struct {
+    uint64_t key;          // 0 marks a free entry
+    uint64_t fresh_until_us;
+    uint64_t stale_until_us;
+    uint64_t version;      // wall-clock ms of the contract answer
+    unsigned int partition;
+    int absent;            // negative entry, no digest
+    uint8_t digest[W3_DIGEST_SIZE];
+} cache_entry_t;
+
+typedef struct {
+    unsigned int sets;
+    uint64_t ttl_us;
+    uint64_t stale_us;
+    uint64_t absent_us;
+    volatile long hits;
+    volatile long stale_hits;
+    volatile long misses;
+    volatile long inserts;
+    volatile long absent_hits;
+    cache_entry_t entries[];
+} cache_table_t;
+
+static cache_table_t* cache = NULL;
+static gen_lock_set_t* cache_locks = NULL;
+
+int w3_cache_init(int size, int ttl_s, int stale_s, int absent_s) {
+    unsigned int sets;
+    size_t bytes;
+
+    if (ttl_s <= 0 || size <= 0) {
+        LM_INFO("Digest cache disabled\n");
+        return 0;
+    }
+    sets = (size + CACHE_WAYS - 1) / CACHE_WAYS;
+
+    bytes = sizeof(cache_table_t) + (size_t)sets * CACHE_WAYS * sizeof(cache_entry_t);
+    cache = shm_malloc(bytes);
+    if (!cache) {
+        LM_ERR("Not enough shared memory for the digest cache\n");
+        return -1;
+    }
+    memset(cache, 0, bytes);
+    cache->sets = sets;
+    cache->ttl_us = (uint64_t)ttl_s * 1000000;
+    cache->stale_us = (uint64_t)(stale_s > 0 ? stale_s : 0) * 1000000;
+    cache->absent_us = (uint64_t)(absent_s > 0 ? absent_s : 0) * 1000000;
+
+    cache_locks = lock_set_alloc(CACHE_LOCKS);
+    if (!cache_locks || !lock_set_init(cache_locks)) {
+        LM_ERR("Failed to initialize digest cache locks\n");
+        if (cache_locks) lock_set_dealloc(cache_locks);
+        cache_locks = NULL;
+        shm_free(cache);
+        cache = NULL;
+        return -1;
+    }
+
+    LM_INFO("Digest cache: %u entries, ttl %ds, stale window %ds, absent users %ds\n",
+            sets * CACHE_WAYS, ttl_s, stale_s, absent_s);
+    return 0;
+}
+
+void w3_cache_destroy(void) {
+    if (cache_locks) {
+        lock_set_destroy(cache_locks);
+        lock_set_dealloc(cache_locks);
+        cache_locks = NULL;
+    }
+    if (cache) {
+        shm_free(cache);
+        cache = NULL;
+    }
+}
+
+uint64_t w3_cache_key(unsigned int partition, const char* const fields[], int nfields) {
+    uint64_t h = w3_hash64(W3_HASH64_SEED, (const char*)&partition, sizeof(partition));
+
+    for (int i = 0; i < nfields; i++) {
+        h = w3_hash64(h, fields[i], strlen(fields[i]) + 1);
+    }
+    return h ? h : 1;
+}
+
+int w3_cache_get(uint64_t key, uint8_t digest[W3_DIGEST_SIZE], int allow_stale) {
+    unsigned int set;
+    cache_entry_t* e;
+    uint64_t now;
+    int hit = 0;
+
+    if (!cache) return 0;
+
+    set = key % cache->sets;
+    now = w3_now_us();
+    lock_set_get(cache_locks, set % CACHE_LOCKS);
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        e = &cache->entries[set * CACHE_WAYS + i];
+        if (e->key != key) continue;
+        if (e->absent) break;
+        if (now < e->fresh_until_us) {
+            hit = 1;
+        } else if (allow_stale && now < e->stale_until_us) {
+            hit = 2;
+        }
+        if (hit) memcpy(digest, e->digest, W3_DIGEST_SIZE);
+        break;
+    }
+    lock_set_release(cache_locks, set % CACHE_LOCKS);
+
+    if (hit == 1) atomic_inc_long(&cache->hits);
+    else if (hit == 2) atomic_inc_long(&cache->stale_hits);
+    else atomic_inc_long(&cache->misses);
+    return hit ? 1 : 0;
+}
+
+// Insert or refresh the entry of key; digest is NULL for an absent entry.
+// ttl_us and stale_us count from the answer, which is age_us old; answers
+// of peers (age_us > 0) do not replace newer ones. Returns 1 when stored.
+static int cache_store(uint64_t key, unsigned int partition, const uint8_t* digest,
+        uint64_t ttl_us, uint64_t stale_us, uint64_t version, uint64_t age_us) {
+    unsigned int set;
+    cache_entry_t* e;
+    cache_entry_t* victim = NULL;
+    uint64_t now;
+    int stored = 0;
+
+    set = key % cache->sets;
+    now = w3_now_us();
+    lock_set_get(cache_locks, set % CACHE_LOCKS);
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        e = &cache->entries[set * CACHE_WAYS + i];
+        if (e->key == key) {
+            victim = !age_us || e->version < version ? e : NULL;
+            break;
+        }
+        // Replace the entry that runs out first
+        if (!victim || e->stale_until_us < victim->stale_until_us) victim = e;
+    }
+    if (victim) {
+        victim->key = key;
+        victim->partition = partition;
+        victim->version = version;
+        victim->fresh_until_us = now + (ttl_us > age_us ? ttl_us - age_us : 0);
+        victim->stale_until_us = now + ttl_us + stale_us - age_us;
+        victim->absent = digest == NULL;
+        if (digest) memcpy(victim->digest, digest, W3_DIGEST_SIZE);
+        stored = 1;
+    }
+    lock_set_release(cache_locks, set % CACHE_LOCKS);
+
+    if (stored) atomic_inc_long(&cache->inserts);
+    return stored;
+}
+
+uint64_t w3_cache_put(uint64_t key, unsigned int partition,
+        const uint8_t digest[W3_DIGEST_SIZE]) {
+    uint64_t version = w3_realtime_ms();
+
+    if (!cache) return version;
+    cache_store(key, partition, digest, cache->ttl_us, cache->stale_us, version, 0);
+    w3_repl_record(W3_REPL_PUT, partition, key, version, digest);
+    return version;
+}
+
+int w3_cache_put_at(uint64_t key, unsigned int partition, const uint8_t digest[W3_DIGEST_SIZE],
+        uint64_t version) {
+    if (!w3_cache_apply(W3_REPL_PUT, partition, key, version, digest)) return 0;
+    w3_repl_record(W3_REPL_PUT, partition, key, version, digest);
+    return 1;
+}
+
+int w3_cache_absent(uint64_t key) {
+    unsigned int set;
+    cache_entry_t* e;
+    int hit = 0;
+
+    if (!cache || !cache->absent_us) return 0;
+
+    set = key % cache->sets;
+    lock_set_get(cache_locks, set % CACHE_LOCKS);
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        e = &cache->entries[set * CACHE_WAYS + i];
+        if (e->key != key) continue;
+        hit = e->absent && w3_now_us() < e->fresh_until_us;
+        break;
+    }
+    lock_set_release(cache_locks, set % CACHE_LOCKS);
+
+    if (hit) atomic_inc_long(&cache->absent_hits);
+    return hit;
+}
+
+uint64_t w3_cache_put_absent(uint64_t key, unsigned int partition) {
+    uint64_t version = w3_realtime_ms();
+
+    if (!cache || !cache->absent_us) return version;
+    cache_store(key, partition, NULL, cache->absent_us, 0, version, 0);
+    w3_repl_record(W3_REPL_ABSENT, partition, key, version, NULL);
+    return version;
+}
+
+int w3_cache_put_absent_at(uint64_t key, unsigned int partition, uint64_t version) {
+    if (!w3_cache_apply(W3_REPL_ABSENT, partition, key, version, NULL)) return 0;
+    w3_repl_record(W3_REPL_ABSENT, partition, key, version, NULL);
+    return 1;
+}
+
+// Drop the entries of partition, or all with W3_REPL_ALL, that are not
+// newer than version
+static int cache_flush(unsigned int partition, uint64_t version) {
+    int flushed = 0;
+
+    for (unsigned int set = 0; set < cache->sets; set++) {
+        lock_set_get(cache_locks, set % CACHE_LOCKS);
+        for (int i = 0; i < CACHE_WAYS; i++) {
+            cache_entry_t* e = &cache->entries[set * CACHE_WAYS + i];
+            if (!e->key || e->version > version
+                    || (partition != W3_REPL_ALL && e->partition != partition)) {
+                continue;
+            }
+            memset(e, 0, sizeof(*e));
+            flushed++;
+        }
+        lock_set_release(cache_locks, set % CACHE_LOCKS);
+    }
+    return flushed;
+}
+
+int w3_cache_apply(int type, unsigned int partition, uint64_t key, uint64_t version,
+        const uint8_t* digest) {
+    uint64_t now = w3_realtime_ms();
+    uint64_t age_us = now > version ? (now - version) * 1000 : 1;
+
+    if (!cache) return 0;
+    // An answer from the future would never be replaced by a real newer one
+    if (version > now + W3_REPL_MAX_AGE_MS) return 0;
+    switch (type) {
+        case W3_REPL_PUT:
+            if (!digest || age_us >= cache->ttl_us + cache->stale_us) return 0;
+            return cache_store(key, partition, digest, cache->ttl_us, cache->stale_us, version,
+                    age_us);
+        case W3_REPL_ABSENT:
+            if (age_us >= cache->absent_us) return 0;
+            return cache_store(key, partition, NULL, cache->absent_us, 0, version, age_us);
+        case W3_REPL_FLUSH:
+            return cache_flush(partition, version) > 0;
+    }
+    return 0;
+}
+
+void w3_cache_rpc_stats(rpc_t* rpc, void* ctx) {
+    void* th;
+    unsigned int used = 0;
+    uint64_t now = w3_now_us();
+
+    if (!cache) {
+        rpc->fault(ctx, 500, "Digest cache disabled");
+        return;
+    }
+
+    for (unsigned int i = 0; i < cache->sets * CACHE_WAYS; i++) {
+        if (cache->entries[i].key && cache->entries[i].stale_until_us > now) used++;
+    }
+
+    if (rpc->add(ctx, "{", &th) < 0) {
+        rpc->fault(ctx, 500, "Internal error creating structure");
+        return;
+    }
+    rpc->struct_add(th, "uuuuuuu",
+            "size", cache->sets * CACHE_WAYS,
+            "entries", used,
+            "hits", (unsigned int)cache->hits,
+            "stale_hits", (unsigned int)cache->stale_hits,
+            "absent_hits", (unsigned int)cache->absent_hits,
+            "misses", (unsigned int)cache->misses,
+            "inserts", (unsigned int)cache->inserts);
+}
+
+// RPC: web3_auth.cache_flush [realm]
+void w3_cache_rpc_flush(rpc_t* rpc, void* ctx) {
+    char* realm = NULL;
+    const w3_tenant_t* t;
+    unsigned int partition = W3_REPL_ALL;
+    uint64_t version;
+    int flushed;
+
+    if (!cache) {
+        rpc->fault(ctx, 500, "Digest cache disabled");
+        return;
+    }
+
+    if (rpc->scan(ctx, "*s", &realm) == 1) {
+        // The tenant is only valid while the snapshot is pinned
+        w3_route_enter();
+        t = w3_route_lookup(realm, strlen(realm));
+        if (t && (t->id != 0 || *realm == '*')) partition = t->id;
+        w3_route_leave();
+        if (partition == W3_REPL_ALL) {
+            rpc->fault(ctx, 404, "Realm not in the routing table, use '*' for the default tenant");
+            return;
+        }
+    }
+
+    version = w3_realtime_ms();
+    flushed = cache_flush(partition, version);
+    w3_repl_record(W3_REPL_FLUSH, partition, 0, version, NULL);
+    // Otherwise the next lookup would bring the flushed digests back
+    if (w3_l2_flush(partition, version) < 0) {
+        rpc->fault(ctx, 500, "Flushed locally, but not in the L2 cache");
+        return;
+    }
+
+    rpc->add(ctx, "d", flushed);
+}
@@ -0,0 +1,53 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Shared cache of digests returned by the contract.
+ */
+
+#ifndef _WEB3_AUTH_CACHE_H_
+#define _WEB3_AUTH_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../../core/rpc.h"
+
+#include "web3_auth.h"
+
+// Allocate the cache; must run in mod_init (before fork). Entries are fresh
+// for ttl_s seconds and kept stale for stale_s more seconds; absent users
+// are remembered for absent_s seconds, 0 disables that.
+int w3_cache_init(int size, int ttl_s, int stale_s, int absent_s);
+void w3_cache_destroy(void);
+
+// Key of a lookup: hash of the call inputs within a tenant partition,
+// separated so that fields cannot run into each other
+uint64_t w3_cache_key(unsigned int partition, const char* const fields[], int nfields);
+
+// 1 and the cached binary digest on a hit, 0 on a miss. With allow_stale,
+// entries past their TTL but within the stale window also hit. Puts stamp
+// the contract answer with the wall clock and return that version.
+int w3_cache_get(uint64_t key, uint8_t digest[W3_DIGEST_SIZE], int allow_stale);
+uint64_t w3_cache_put(uint64_t key, unsigned int partition,
+        const uint8_t digest[W3_DIGEST_SIZE]);
+
+// 1 when key was recently marked absent, i.e. the contract does not know it
+int w3_cache_absent(uint64_t key);
+uint64_t w3_cache_put_absent(uint64_t key, unsigned int partition);
+
+// Insert an answer given at version, e.g. one found in the L2 cache, as a
+// record of a peer would be, and replicate it with that version; returns 1
+// when stored
+int w3_cache_put_at(uint64_t key, unsigned int partition, const uint8_t digest[W3_DIGEST_SIZE],
+        uint64_t version);
+int w3_cache_put_absent_at(uint64_t key, unsigned int partition, uint64_t version);
+
+// Apply a W3_REPL_* record of a peer; returns 1 when the cache changed.
+// Records dated more than W3_REPL_MAX_AGE_MS ahead of this node are ignored.
+int w3_cache_apply(int type, unsigned int partition, uint64_t key, uint64_t version,
+        const uint8_t* digest);
+
+void w3_cache_rpc_stats(rpc_t* rpc, void* ctx);
+void w3_cache_rpc_flush(rpc_t* rpc, void* ctx);
+
+#endif
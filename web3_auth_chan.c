@@ -0,0 +1,205 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Completion channel between processes: shm ring with futex wakeups.
+ *
+ * Handing a lookup from a SIP worker to an RPC process and its result back
+ * should cost microseconds on top of the eth_call. A pipe costs two system
+ * calls per item and a copy through the kernel; here items are copied into
+ * a bounded ring in shared memory (sequence numbered cells, so producers in
+ * any number of processes claim slots with one compare-and-swap) and the
+ * only system call is the wakeup. The consumer announces that it is about
+ * to sleep in a futex word; producers publish first and then wake it only
+ * when that word is set, so a consumer that is still draining costs them
+ * nothing, and a batch of items put together costs one wakeup. The
+ * consumer takes everything queued per call.
+ *
+ * The futex is a shared one, the word living in the shm segment every
+ * process maps; no descriptor has to be inherited or passed around. A
+ * producer killed between claiming a slot and filling it stalls the
+ * consumer at that slot, as a crashed worker would stall its lookups
+ * anyway.
+ */
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "web3_auth.h"
+#include "web3_auth_chan.h"
+
+#define CHAN_LINE 64
+
+typedef struct chan_cell {
+    unsigned long seq;          // position + 1 when filled, + slots when free
+    uint8_t item[];
+} chan_cell_t;
+
+struct w3_chan {
+    uint32_t sleeping;          // futex word, 1 while the consumer waits
+    uint8_t pad0[CHAN_LINE - sizeof(uint32_t)];
+    unsigned long tail;         // next position producers claim
+    uint8_t pad1[CHAN_LINE - sizeof(unsigned long)];
+    unsigned long head;         // next position the consumer reads
+    uint8_t pad2[CHAN_LINE - sizeof(unsigned long)];
+    unsigned long puts;
+    unsigned long full;
+    unsigned long wakes;
+    unsigned long sleeps;
+    unsigned long mask;
+    size_t item_size;
+    size_t cell_size;
+    uint8_t pad3[CHAN_LINE - 7 * sizeof(unsigned long)];
+    uint8_t cells[];
+};
+
+static unsigned int chan_slots(unsigned int slots) {
+    unsigned int n = 2;
+
+    while (n < slots && n < (1u << 30)) n <<= 1;
+    return n;
+}
+
+static size_t chan_cell_size(size_t item_size) {
+    return (sizeof(chan_cell_t) + item_size + 7) & ~(size_t)7;
+}
+
+static inline chan_cell_t* chan_cell(const w3_chan_t* ch, unsigned long pos) {
+    return (chan_cell_t*)(ch->cells + (pos & ch->mask) * ch->cell_size);
+}
+
+size_t w3_chan_size(unsigned int slots, size_t item_size) {
+    return sizeof(w3_chan_t) + (size_t)chan_slots(slots) * chan_cell_size(item_size);
+}
+
+w3_chan_t* w3_chan_init(void* mem, unsigned int slots, size_t item_size) {
+    w3_chan_t* ch = mem;
+    unsigned long n = chan_slots(slots);
+
+    if (!mem || item_size == 0) return NULL;
+    memset(ch, 0, sizeof(*ch));
+    ch->mask = n - 1;
+    ch->item_size = item_size;
+    ch->cell_size = chan_cell_size(item_size);
+    for (unsigned long i = 0; i < n; i++) chan_cell(ch, i)->seq = i;
+    return ch;
+}
+
+static int chan_futex(uint32_t* word, int op, uint32_t val, const struct timespec* ts) {
+    return syscall(SYS_futex, word, op, val, ts, NULL, 0);
+}
+
+int w3_chan_put(w3_chan_t* ch, const void* items, int n) {
+    const uint8_t* in = items;
+    int queued = 0;
+
+    while (queued < n) {
+        unsigned long pos = __atomic_load_n(&ch->tail, __ATOMIC_RELAXED);
+        chan_cell_t* cell;
+
+        for (;;) {
+            long dif;
+
+            cell = chan_cell(ch, pos);
+            dif = (long)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+            if (dif == 0) {
+                if (__atomic_compare_exchange_n(&ch->tail, &pos, pos + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+            } else if (dif < 0) {
+                cell = NULL;    // the consumer has not freed this slot yet
+                break;
+            } else {
+                pos = __atomic_load_n(&ch->tail, __ATOMIC_RELAXED);
+            }
+        }
+        if (!cell) break;
+        memcpy(cell->item, in + (size_t)queued * ch->item_size, ch->item_size);
+        __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+        queued++;
+    }
+
+    if (queued < n) __atomic_add_fetch(&ch->full, n - queued, __ATOMIC_RELAXED);
+    if (queued == 0) return 0;
+    __atomic_add_fetch(&ch->puts, queued, __ATOMIC_RELAXED);
+
+    // Pairs with the fence in w3_chan_get(): either the consumer sees the
+    // items before sleeping or we see it asleep
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ch->sleeping, __ATOMIC_RELAXED)
+            && __atomic_exchange_n(&ch->sleeping, 0, __ATOMIC_RELAXED)) {
+        chan_futex(&ch->sleeping, FUTEX_WAKE, 1, NULL);
+        __atomic_add_fetch(&ch->wakes, 1, __ATOMIC_RELAXED);
+    }
+    return queued;
+}
+
+static int chan_drain(w3_chan_t* ch, uint8_t* out, int max) {
+    int n = 0;
+
+    while (n < max) {
+        chan_cell_t* cell = chan_cell(ch, ch->head);
+
+        if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != ch->head + 1) break;
+        memcpy(out + (size_t)n * ch->item_size, cell->item, ch->item_size);
+        __atomic_store_n(&cell->seq, ch->head + ch->mask + 1, __ATOMIC_RELEASE);
+        ch->head++;
+        n++;
+    }
+    return n;
+}
+
+int w3_chan_get(w3_chan_t* ch, void* items, int max, int timeout_ms) {
+    uint64_t deadline = timeout_ms > 0 ? w3_now_us() + (uint64_t)timeout_ms * 1000 : 0;
+    int n, yielded = 0;
+
+    for (;;) {
+        struct timespec ts;
+        uint64_t now;
+
+        n = chan_drain(ch, items, max);
+        if (n > 0 || timeout_ms == 0) return n;
+
+        // Producers woke us while running; let them finish their batch
+        // before paying for another sleep and wakeup
+        if (!yielded) {
+            yielded = 1;
+            sched_yield();
+            continue;
+        }
+        yielded = 0;
+        __atomic_store_n(&ch->sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        n = chan_drain(ch, items, max);
+        if (n > 0) {
+            __atomic_store_n(&ch->sleeping, 0, __ATOMIC_RELAXED);
+            return n;
+        }
+
+        if (timeout_ms > 0) {
+            now = w3_now_us();
+            if (now >= deadline) {
+                __atomic_store_n(&ch->sleeping, 0, __ATOMIC_RELAXED);
+                return 0;
+            }
+            ts.tv_sec = (deadline - now) / 1000000;
+            ts.tv_nsec = (deadline - now) % 1000000 * 1000;
+        }
+        // Returns at once when a producer cleared the word in between
+        if (chan_futex(&ch->sleeping, FUTEX_WAIT, 1, timeout_ms > 0 ? &ts : NULL) == 0
+                || errno != EAGAIN) {
+            __atomic_add_fetch(&ch->sleeps, 1, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&ch->sleeping, 0, __ATOMIC_RELAXED);
+    }
+}
+
+void w3_chan_stats(const w3_chan_t* ch, w3_chan_stats_t* st) {
+    st->puts = __atomic_load_n(&ch->puts, __ATOMIC_RELAXED);
+    st->full = __atomic_load_n(&ch->full, __ATOMIC_RELAXED);
+    st->wakes = __atomic_load_n(&ch->wakes, __ATOMIC_RELAXED);
+    st->sleeps = __atomic_load_n(&ch->sleeps, __ATOMIC_RELAXED);
+}
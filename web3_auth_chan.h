@@ -0,0 +1,41 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Completion channel between processes: shm ring with futex wakeups.
+ */
+
+#ifndef _WEB3_AUTH_CHAN_H_
+#define _WEB3_AUTH_CHAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct w3_chan w3_chan_t;
+
+typedef struct w3_chan_stats {
+    unsigned long puts;         // items queued
+    unsigned long full;         // puts refused, ring full
+    unsigned long wakes;        // futex wake calls by producers
+    unsigned long sleeps;       // futex waits by the consumer
+} w3_chan_stats_t;
+
+// Bytes of shared memory for a channel of slots items of item_size bytes;
+// slots is rounded up to a power of two
+size_t w3_chan_size(unsigned int slots, size_t item_size);
+
+// Set up a channel in mem, which must be shared between the processes (shm
+// or MAP_SHARED) and hold w3_chan_size() bytes; must run before fork
+w3_chan_t* w3_chan_init(void* mem, unsigned int slots, size_t item_size);
+
+// Queue n items from any process and wake the consumer once if it sleeps.
+// Returns the items queued, fewer than n when the ring filled up.
+int w3_chan_put(w3_chan_t* ch, const void* items, int n);
+
+// Consumer only, one process per channel: move up to max queued items to
+// items, sleeping up to timeout_ms (-1 forever) for the first one. Returns
+// the items taken, 0 on timeout.
+int w3_chan_get(w3_chan_t* ch, void* items, int max, int timeout_ms);
+
+void w3_chan_stats(const w3_chan_t* ch, w3_chan_stats_t* st);
+
+#endif
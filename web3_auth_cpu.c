@@ -0,0 +1,128 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * CPU pinning and NUMA placement of worker processes.
+ *
+ * On machines with several sockets the scheduler moves a worker between
+ * nodes, and the memory it first touched stays behind: every lookup then
+ * reads its buffers and queues over the interconnect. Pinning workers to a
+ * CPU set keeps them on the node of the NIC and the RPC endpoints, and the
+ * memory each worker owns can be bound to the node it runs on. Everything
+ * goes through the system calls and sysfs, there is no libnuma dependency.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "web3_auth_cpu.h"
+
+#define CPU_WORDS (W3_CPU_MAX / (8 * sizeof(unsigned long)))
+#define NUMA_SYSFS "/sys/devices/system/node"
+
+int w3_cpu_parse(const char* list, w3_cpus_t* set) {
+    unsigned long bits[CPU_WORDS] = {0};
+    const char* p = list;
+
+    set->n = 0;
+    while (*p) {
+        char* end;
+        long lo, hi;
+
+        while (*p == ' ' || *p == ',' || *p == '\n') p++;
+        if (!*p) break;
+        lo = strtol(p, &end, 10);
+        if (end == p || lo < 0) return -1;
+        hi = lo;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p || hi < lo) return -1;
+        }
+        if (hi >= W3_CPU_MAX) return -1;
+        for (long c = lo; c <= hi; c++) bits[c / (8 * sizeof(long))] |= 1UL << (c % (8 * sizeof(long)));
+        p = end;
+        if (*p && *p != ',' && *p != ' ' && *p != '\n') return -1;
+    }
+    for (int c = 0; c < W3_CPU_MAX; c++) {
+        if (bits[c / (8 * sizeof(long))] & 1UL << (c % (8 * sizeof(long)))) set->cpu[set->n++] = c;
+    }
+    return set->n > 0 ? set->n : -1;
+}
+
+int w3_cpu_pin(const w3_cpus_t* set, int index) {
+    unsigned long mask[CPU_WORDS] = {0};
+    int cpu = -1;
+
+    if (set->n <= 0) {
+        errno = EINVAL;
+        return -2;
+    }
+    if (index >= 0) {
+        cpu = set->cpu[index % set->n];
+        mask[cpu / (8 * sizeof(long))] = 1UL << (cpu % (8 * sizeof(long)));
+    } else {
+        for (int i = 0; i < set->n; i++) {
+            mask[set->cpu[i] / (8 * sizeof(long))] |= 1UL << (set->cpu[i] % (8 * sizeof(long)));
+        }
+    }
+    if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) < 0) return -2;
+    return cpu;
+}
+
+static int numa_list(const char* path, w3_cpus_t* set) {
+    char buf[4096];
+    FILE* f = fopen(path, "r");
+    size_t n;
+
+    if (!f) return -1;
+    n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    return w3_cpu_parse(buf, set);
+}
+
+int w3_numa_nodes(void) {
+    static w3_cpus_t nodes;
+
+    if (numa_list(NUMA_SYSFS "/online", &nodes) <= 0) return 1;
+    return nodes.cpu[nodes.n - 1] + 1;
+}
+
+int w3_numa_cpus(int node, w3_cpus_t* set) {
+    char path[64];
+
+    snprintf(path, sizeof(path), NUMA_SYSFS "/node%d/cpulist", node);
+    return numa_list(path, set);
+}
+
+int w3_numa_node(void) {
+    unsigned int cpu, node;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0) return 0;
+    return (int)node;
+}
+
+int w3_numa_bind(void* mem, size_t len, int node) {
+    unsigned long nodemask[CPU_WORDS] = {0};
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)mem + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)mem + len) & ~(page - 1);
+
+    if (node < 0 || node >= W3_CPU_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (end <= start || w3_numa_nodes() < 2) return 0;
+    nodemask[node / (8 * sizeof(long))] = 1UL << (node % (8 * sizeof(long)));
+    if (syscall(SYS_mbind, (void*)start, end - start, MPOL_PREFERRED, nodemask,
+            8 * sizeof(nodemask), MPOL_MF_MOVE) < 0) {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * CPU pinning and NUMA placement of worker processes.
+ */
+
+#ifndef _WEB3_AUTH_CPU_H_
+#define _WEB3_AUTH_CPU_H_
+
+#include <stddef.h>
+
+#define W3_CPU_MAX 1024
+
+typedef struct w3_cpus {
+    int n;                              // CPUs in the set, 0 when empty
+    unsigned short cpu[W3_CPU_MAX];     // ascending
+} w3_cpus_t;
+
+// Parse a CPU list like "0-7,16-23" or "3"; -1 on syntax errors or CPUs
+// beyond W3_CPU_MAX
+int w3_cpu_parse(const char* list, w3_cpus_t* set);
+
+// Pin the calling process to CPU index (modulo the set size) of set, or to
+// the whole set when index < 0. Returns the CPU, -1 for the whole set, or
+// -2 with errno set when the kernel refused.
+int w3_cpu_pin(const w3_cpus_t* set, int index);
+
+// Memory nodes of the machine, 1 without NUMA
+int w3_numa_nodes(void);
+// CPUs of a memory node; -1 when it has none or does not exist
+int w3_numa_cpus(int node, w3_cpus_t* set);
+// Node the calling process runs on now
+int w3_numa_node(void);
+
+// Place the whole pages of [mem, mem + len) on node and move those already
+// faulted in by this process. Pages shared with other processes keep their
+// place. 0 also on machines with a single node.
+int w3_numa_bind(void* mem, size_t len, int node);
+
+#endif
@@ -0,0 +1,264 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Deoxys-II-256-128 authenticated encryption, the cipher of Sapphire calls.
+ *
+ * The block cipher is Deoxys-BC-384: sixteen full AES rounds whose round
+ * keys mix the 128-bit tweak with the 256-bit key. The key part of every
+ * round key is derived once per session key; the tweak part changes per
+ * block and is a byte permutation away from the previous round, a single
+ * shuffle on x86. With AES-NI each round is one instruction; elsewhere a
+ * table-driven round is used, which is slower and not constant-time.
+ *
+ * Deoxys-II is the nonce-misuse resistant mode: a first pass over the
+ * associated data and the message yields the tag, a second pass encrypts
+ * the message in counter mode with the tag as part of the tweak.
+ */
+
+#include <string.h>
+
+#include "web3_auth_deoxys.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DEOXYS_X86 1
+#include <immintrin.h>
+#endif
+
+#define DEOXYS_ROUNDS 16
+
+// Tweak prefixes, top nibble of the first tweak byte
+#define PREFIX_AD_BLOCK  0x2
+#define PREFIX_AD_FINAL  0x6
+#define PREFIX_MSG_BLOCK 0x0
+#define PREFIX_MSG_FINAL 0x4
+#define PREFIX_TAG       0x1
+
+static const uint8_t rcon[DEOXYS_ROUNDS + 1] = {
+    0x2f, 0x5e, 0xbc, 0x63, 0xc6, 0x97, 0x35, 0x6a, 0xd4,
+    0xb3, 0x7d, 0xfa, 0xef, 0xc5, 0x91, 0x39, 0x72
+};
+
+// Tweakey permutation h: byte i of the next round is byte h[i] of this one
+static const uint8_t h_perm[16] = {
+    1, 6, 11, 12, 5, 10, 15, 0, 9, 14, 3, 4, 13, 2, 7, 8
+};
+
+static const uint8_t aes_sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+static inline uint8_t lfsr2(uint8_t x) {
+    return (uint8_t)(x << 1 | ((x >> 7) ^ ((x >> 5) & 1)));
+}
+
+static inline uint8_t lfsr3(uint8_t x) {
+    return (uint8_t)(x >> 1 | ((x ^ (x >> 6)) & 1) << 7);
+}
+
+static inline void h_apply(uint8_t t[16]) {
+    uint8_t tmp[16];
+    for (int i = 0; i < 16; i++) tmp[i] = t[h_perm[i]];
+    memcpy(t, tmp, sizeof(tmp));
+}
+
+static inline uint8_t xtime(uint8_t x) {
+    return (uint8_t)(x << 1 ^ ((x >> 7) * 0x1b));
+}
+
+// One AES encryption round (SubBytes, ShiftRows, MixColumns, AddRoundKey),
+// what AESENC does
+static void aes_round(uint8_t s[16], const uint8_t rk[16]) {
+    uint8_t t[16];
+    for (int c = 0; c < 4; c++)
+        for (int r = 0; r < 4; r++) t[4 * c + r] = aes_sbox[s[4 * ((c + r) & 3) + r]];
+    for (int c = 0; c < 4; c++) {
+        uint8_t* col = t + 4 * c;
+        uint8_t all = col[0] ^ col[1] ^ col[2] ^ col[3];
+        s[4 * c + 0] = col[0] ^ all ^ xtime(col[0] ^ col[1]) ^ rk[4 * c + 0];
+        s[4 * c + 1] = col[1] ^ all ^ xtime(col[1] ^ col[2]) ^ rk[4 * c + 1];
+        s[4 * c + 2] = col[2] ^ all ^ xtime(col[2] ^ col[3]) ^ rk[4 * c + 2];
+        s[4 * c + 3] = col[3] ^ all ^ xtime(col[3] ^ col[0]) ^ rk[4 * c + 3];
+    }
+}
+
+static void bc_encrypt_portable(const w3_deoxys_t* ctx, const uint8_t tweak[16],
+        const uint8_t in[16], uint8_t out[16]) {
+    uint8_t tk1[16], s[16], rk[16];
+
+    memcpy(tk1, tweak, sizeof(tk1));
+    for (int i = 0; i < 16; i++) s[i] = in[i] ^ ctx->stk[0][i] ^ tk1[i];
+    for (int r = 1; r <= DEOXYS_ROUNDS; r++) {
+        h_apply(tk1);
+        for (int i = 0; i < 16; i++) rk[i] = ctx->stk[r][i] ^ tk1[i];
+        aes_round(s, rk);
+    }
+    memcpy(out, s, sizeof(s));
+}
+
+#ifdef DEOXYS_X86
+
+__attribute__((target("aes,ssse3")))
+static void bc_encrypt_aesni(const w3_deoxys_t* ctx, const uint8_t tweak[16],
+        const uint8_t in[16], uint8_t out[16]) {
+    const __m128i h = _mm_loadu_si128((const __m128i*)h_perm);
+    __m128i tk1 = _mm_loadu_si128((const __m128i*)tweak);
+    __m128i s = _mm_loadu_si128((const __m128i*)in);
+
+    s = _mm_xor_si128(s, _mm_xor_si128(tk1, _mm_loadu_si128((const __m128i*)ctx->stk[0])));
+    for (int r = 1; r <= DEOXYS_ROUNDS; r++) {
+        tk1 = _mm_shuffle_epi8(tk1, h);
+        s = _mm_aesenc_si128(s,
+                _mm_xor_si128(tk1, _mm_loadu_si128((const __m128i*)ctx->stk[r])));
+    }
+    _mm_storeu_si128((__m128i*)out, s);
+}
+
+#endif
+
+static void (*bc_encrypt)(const w3_deoxys_t*, const uint8_t*, const uint8_t*, uint8_t*) =
+        bc_encrypt_portable;
+
+const char* w3_deoxys_select(void) {
+#ifdef DEOXYS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("aes") && __builtin_cpu_supports("ssse3")) {
+        bc_encrypt = bc_encrypt_aesni;
+        return "aesni";
+    }
+#endif
+    bc_encrypt = bc_encrypt_portable;
+    return "portable";
+}
+
+void w3_deoxys_init(w3_deoxys_t* ctx, const uint8_t key[W3_DEOXYS_KEY_SIZE]) {
+    uint8_t tk2[16], tk3[16];
+
+    memcpy(tk2, key + 16, sizeof(tk2));
+    memcpy(tk3, key, sizeof(tk3));
+    for (int r = 0; r <= DEOXYS_ROUNDS; r++) {
+        if (r > 0) {
+            for (int i = 0; i < 16; i++) {
+                tk2[i] = lfsr2(tk2[i]);
+                tk3[i] = lfsr3(tk3[i]);
+            }
+            h_apply(tk2);
+            h_apply(tk3);
+        }
+        for (int i = 0; i < 16; i++) ctx->stk[r][i] = tk2[i] ^ tk3[i];
+        // Round constant: 1, 2, 4, 8 down the first column, rcon the second
+        ctx->stk[r][0] ^= 1;
+        ctx->stk[r][1] ^= 2;
+        ctx->stk[r][2] ^= 4;
+        ctx->stk[r][3] ^= 8;
+        for (int i = 4; i < 8; i++) ctx->stk[r][i] ^= rcon[r];
+    }
+    memset(tk2, 0, sizeof(tk2));
+    memset(tk3, 0, sizeof(tk3));
+}
+
+static inline void tag_tweak(uint8_t tweak[16], int prefix, uint64_t block) {
+    memset(tweak, 0, 8);
+    tweak[0] = (uint8_t)(prefix << 4);
+    for (int i = 0; i < 8; i++) tweak[8 + i] = (uint8_t)(block >> (56 - 8 * i));
+}
+
+static inline void xor16(uint8_t* acc, const uint8_t* x) {
+    for (int i = 0; i < 16; i++) acc[i] ^= x[i];
+}
+
+// Absorb data into auth with the given full and final-block prefixes
+static void auth_pass(const w3_deoxys_t* ctx, uint8_t auth[16], const uint8_t* data, size_t len,
+        int prefix, int prefix_final) {
+    uint8_t tweak[16], block[16];
+    uint64_t n = 0;
+
+    for (; len >= 16; data += 16, len -= 16, n++) {
+        tag_tweak(tweak, prefix, n);
+        bc_encrypt(ctx, tweak, data, block);
+        xor16(auth, block);
+    }
+    if (len > 0) {
+        uint8_t pad[16];
+        memset(pad, 0, sizeof(pad));
+        memcpy(pad, data, len);
+        pad[len] = 0x80;
+        tag_tweak(tweak, prefix_final, n);
+        bc_encrypt(ctx, tweak, pad, block);
+        xor16(auth, block);
+    }
+}
+
+static void compute_tag(const w3_deoxys_t* ctx, const uint8_t nonce[W3_DEOXYS_NONCE_SIZE],
+        const uint8_t* ad, size_t ad_len, const uint8_t* msg, size_t msg_len, uint8_t tag[16]) {
+    uint8_t auth[16], tweak[16];
+
+    memset(auth, 0, sizeof(auth));
+    auth_pass(ctx, auth, ad, ad_len, PREFIX_AD_BLOCK, PREFIX_AD_FINAL);
+    auth_pass(ctx, auth, msg, msg_len, PREFIX_MSG_BLOCK, PREFIX_MSG_FINAL);
+
+    tweak[0] = PREFIX_TAG << 4;
+    memcpy(tweak + 1, nonce, W3_DEOXYS_NONCE_SIZE);
+    bc_encrypt(ctx, tweak, auth, tag);
+}
+
+// Counter mode keyed by the tag; in and out may be the same buffer
+static void ctr_pass(const w3_deoxys_t* ctx, const uint8_t nonce[W3_DEOXYS_NONCE_SIZE],
+        const uint8_t tag[16], const uint8_t* in, size_t len, uint8_t* out) {
+    uint8_t block[16], tweak[16], ks[16];
+
+    block[0] = 0;
+    memcpy(block + 1, nonce, W3_DEOXYS_NONCE_SIZE);
+    for (uint64_t n = 0; len > 0; n++) {
+        size_t take = len < 16 ? len : 16;
+        memcpy(tweak, tag, 16);
+        tweak[0] |= 0x80;
+        for (int i = 0; i < 8; i++) tweak[8 + i] ^= (uint8_t)(n >> (56 - 8 * i));
+        bc_encrypt(ctx, tweak, block, ks);
+        for (size_t i = 0; i < take; i++) out[i] = in[i] ^ ks[i];
+        in += take;
+        out += take;
+        len -= take;
+    }
+}
+
+void w3_deoxys_seal(const w3_deoxys_t* ctx, const uint8_t nonce[W3_DEOXYS_NONCE_SIZE],
+        const uint8_t* ad, size_t ad_len, const uint8_t* msg, size_t msg_len, uint8_t* out) {
+    uint8_t tag[16];
+
+    compute_tag(ctx, nonce, ad, ad_len, msg, msg_len, tag);
+    ctr_pass(ctx, nonce, tag, msg, msg_len, out);
+    memcpy(out + msg_len, tag, sizeof(tag));
+}
+
+int w3_deoxys_open(const w3_deoxys_t* ctx, const uint8_t nonce[W3_DEOXYS_NONCE_SIZE],
+        const uint8_t* ad, size_t ad_len, const uint8_t* in, size_t in_len, uint8_t* out) {
+    uint8_t tag[16];
+    size_t len;
+    uint8_t diff = 0;
+
+    if (in_len < W3_DEOXYS_TAG_SIZE) return -1;
+    len = in_len - W3_DEOXYS_TAG_SIZE;
+    ctr_pass(ctx, nonce, in + len, in, len, out);
+    compute_tag(ctx, nonce, ad, ad_len, out, len, tag);
+    for (int i = 0; i < W3_DEOXYS_TAG_SIZE; i++) diff |= tag[i] ^ in[len + i];
+    if (diff) {
+        memset(out, 0, len);
+        return -1;
+    }
+    return 0;
+}
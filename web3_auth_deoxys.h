@@ -0,0 +1,38 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Deoxys-II-256-128 authenticated encryption, the cipher of Sapphire calls.
+ */
+
+#ifndef _WEB3_AUTH_DEOXYS_H_
+#define _WEB3_AUTH_DEOXYS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define W3_DEOXYS_KEY_SIZE   32
+#define W3_DEOXYS_NONCE_SIZE 15
+#define W3_DEOXYS_TAG_SIZE   16
+
+// Key-dependent half of the round subkeys, derived once per key
+typedef struct w3_deoxys {
+    uint8_t stk[17][16];
+} w3_deoxys_t;
+
+// Pick the AES-NI kernel when the CPU has it; returns its name
+const char* w3_deoxys_select(void);
+
+void w3_deoxys_init(w3_deoxys_t* ctx, const uint8_t key[W3_DEOXYS_KEY_SIZE]);
+
+// out receives msg_len bytes of ciphertext followed by the tag; out may
+// not overlap msg
+void w3_deoxys_seal(const w3_deoxys_t* ctx, const uint8_t nonce[W3_DEOXYS_NONCE_SIZE],
+        const uint8_t* ad, size_t ad_len, const uint8_t* msg, size_t msg_len, uint8_t* out);
+
+// in holds ciphertext and tag (in_len >= W3_DEOXYS_TAG_SIZE); out receives
+// in_len - W3_DEOXYS_TAG_SIZE bytes and may be in itself. Returns -1 when
+// the tag does not match, with out cleared.
+int w3_deoxys_open(const w3_deoxys_t* ctx, const uint8_t nonce[W3_DEOXYS_NONCE_SIZE],
+        const uint8_t* ad, size_t ad_len, const uint8_t* in, size_t in_len, uint8_t* out);
+
+#endif
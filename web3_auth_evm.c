@@ -0,0 +1,655 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Minimal EVM interpreter for view functions.
+ *
+ * Runs the digest function of a non-confidential contract against a local
+ * snapshot of its code and storage instead of asking a node. Only what a
+ * view function compiled by solc needs is implemented: arithmetic and
+ * logic on 256-bit words, memory, calldata, code, storage reads,
+ * KECCAK256, control flow, RETURN and REVERT, and STATICCALL to the
+ * identity precompile that older compilers copy memory with. Anything
+ * else, including writes, calls and most block properties, stops with
+ * W3_EVM_UNSUPPORTED and the caller falls back to eth_call. Gas is not
+ * metered; a step limit bounds the work instead.
+ */
+
+#include <string.h>
+
+#include "web3_auth_evm.h"
+#include "web3_auth_keccak.h"
+
+#define EVM_STACK 1024
+#define EVM_GAS_LEFT 50000000ULL    // what GAS reports, the usual eth_call cap
+
+// 256-bit word, least significant limb first
+typedef struct {
+    uint64_t w[4];
+} evm_word_t;
+
+static evm_word_t evm_stack[EVM_STACK];
+static uint8_t evm_memory[W3_EVM_MAX_MEMORY];
+static uint8_t evm_returndata[W3_EVM_MAX_MEMORY];
+
+static const char* evm_names[] = {
+    "return", "revert", "missing storage", "unsupported opcode", "fault"
+};
+
+const char* w3_evm_name(int outcome) {
+    if (outcome < 0 || outcome > W3_EVM_FAULT) return "unknown";
+    return evm_names[outcome];
+}
+
+static inline int w_zero(const evm_word_t* a) {
+    return !(a->w[0] | a->w[1] | a->w[2] | a->w[3]);
+}
+
+static inline void w_set(evm_word_t* a, uint64_t v) {
+    a->w[0] = v;
+    a->w[1] = a->w[2] = a->w[3] = 0;
+}
+
+// Value of a when it fits in 64 bits, otherwise UINT64_MAX
+static inline uint64_t w_small(const evm_word_t* a) {
+    return a->w[1] | a->w[2] | a->w[3] ? UINT64_MAX : a->w[0];
+}
+
+static inline int w_neg_sign(const evm_word_t* a) {
+    return a->w[3] >> 63;
+}
+
+static void w_load(evm_word_t* a, const uint8_t* be) {
+    for (int i = 0; i < 4; i++) {
+        uint64_t v = 0;
+        for (int j = 0; j < 8; j++) v = v << 8 | be[(3 - i) * 8 + j];
+        a->w[i] = v;
+    }
+}
+
+static void w_store(const evm_word_t* a, uint8_t* be) {
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 8; j++) be[(3 - i) * 8 + j] = a->w[i] >> (56 - 8 * j);
+    }
+}
+
+static inline int w_cmp(const evm_word_t* a, const evm_word_t* b) {
+    for (int i = 3; i >= 0; i--) {
+        if (a->w[i] != b->w[i]) return a->w[i] < b->w[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+// Signed comparison: flip the sign bits and compare unsigned
+static inline int w_scmp(const evm_word_t* a, const evm_word_t* b) {
+    evm_word_t x = *a, y = *b;
+    x.w[3] ^= 1ULL << 63;
+    y.w[3] ^= 1ULL << 63;
+    return w_cmp(&x, &y);
+}
+
+// r = a + b, returns the carry out
+static inline int w_add(evm_word_t* r, const evm_word_t* a, const evm_word_t* b) {
+    unsigned __int128 c = 0;
+    for (int i = 0; i < 4; i++) {
+        c += (unsigned __int128)a->w[i] + b->w[i];
+        r->w[i] = (uint64_t)c;
+        c >>= 64;
+    }
+    return (int)c;
+}
+
+static inline void w_sub(evm_word_t* r, const evm_word_t* a, const evm_word_t* b) {
+    uint64_t borrow = 0;
+    for (int i = 0; i < 4; i++) {
+        uint64_t x = a->w[i], y = b->w[i];
+        uint64_t d = x - y - borrow;
+        borrow = (x < y) | ((x == y) & borrow);
+        r->w[i] = d;
+    }
+}
+
+static inline void w_negate(evm_word_t* a) {
+    evm_word_t zero = {{0, 0, 0, 0}};
+    w_sub(a, &zero, a);
+}
+
+static void w_mul(evm_word_t* r, const evm_word_t* a, const evm_word_t* b) {
+    uint64_t out[4] = {0, 0, 0, 0};
+
+    for (int i = 0; i < 4; i++) {
+        unsigned __int128 carry = 0;
+        for (int j = 0; i + j < 4; j++) {
+            carry += (unsigned __int128)a->w[i] * b->w[j] + out[i + j];
+            out[i + j] = (uint64_t)carry;
+            carry >>= 64;
+        }
+    }
+    memcpy(r->w, out, sizeof(out));
+}
+
+static void w_shl(evm_word_t* r, const evm_word_t* a, unsigned int n) {
+    evm_word_t t = {{0, 0, 0, 0}};
+    unsigned int limbs = n / 64, bits = n % 64;
+
+    for (int i = 3; i >= (int)limbs; i--) {
+        t.w[i] = a->w[i - limbs] << bits;
+        if (bits && i - (int)limbs - 1 >= 0) t.w[i] |= a->w[i - limbs - 1] >> (64 - bits);
+    }
+    *r = t;
+}
+
+static void w_shr(evm_word_t* r, const evm_word_t* a, unsigned int n) {
+    evm_word_t t = {{0, 0, 0, 0}};
+    unsigned int limbs = n / 64, bits = n % 64;
+
+    for (int i = 0; i + (int)limbs < 4; i++) {
+        t.w[i] = a->w[i + limbs] >> bits;
+        if (bits && i + limbs + 1 < 4) t.w[i] |= a->w[i + limbs + 1] << (64 - bits);
+    }
+    *r = t;
+}
+
+static inline int w_bits(const evm_word_t* a) {
+    for (int i = 3; i >= 0; i--) {
+        if (a->w[i]) return 64 * i + 64 - __builtin_clzll(a->w[i]);
+    }
+    return 0;
+}
+
+// Unsigned division; q and r may be NULL, division by zero gives zero
+static void w_divmod(const evm_word_t* a, const evm_word_t* b, evm_word_t* q, evm_word_t* r) {
+    evm_word_t quot = {{0, 0, 0, 0}}, rem = {{0, 0, 0, 0}};
+
+    if (w_zero(b)) {
+        // both stay zero
+    } else if (w_small(b) != UINT64_MAX) {
+        // One-limb divisor, the common case: long division by limbs
+        unsigned __int128 cur = 0;
+        for (int i = 3; i >= 0; i--) {
+            cur = cur << 64 | a->w[i];
+            quot.w[i] = (uint64_t)(cur / b->w[0]);
+            cur %= b->w[0];
+        }
+        rem.w[0] = (uint64_t)cur;
+    } else if (w_cmp(a, b) >= 0) {
+        for (int i = w_bits(a) - 1; i >= 0; i--) {
+            w_shl(&rem, &rem, 1);
+            rem.w[0] |= (a->w[i / 64] >> (i % 64)) & 1;
+            if (w_cmp(&rem, b) >= 0) {
+                w_sub(&rem, &rem, b);
+                quot.w[i / 64] |= 1ULL << (i % 64);
+            }
+        }
+    } else {
+        rem = *a;
+    }
+    if (q) *q = quot;
+    if (r) *r = rem;
+}
+
+// (a + b) mod m with a, b < m, keeping the carry out of 256 bits
+static inline void w_addmod_reduced(evm_word_t* r, const evm_word_t* a, const evm_word_t* b,
+        const evm_word_t* m) {
+    int carry = w_add(r, a, b);
+    if (carry || w_cmp(r, m) >= 0) w_sub(r, r, m);
+}
+
+static void w_addmod(evm_word_t* r, const evm_word_t* a, const evm_word_t* b, const evm_word_t* m) {
+    evm_word_t x, y, mod = *m;     // r may be m
+
+    if (w_zero(&mod)) {
+        w_set(r, 0);
+        return;
+    }
+    w_divmod(a, &mod, NULL, &x);
+    w_divmod(b, &mod, NULL, &y);
+    w_addmod_reduced(r, &x, &y, &mod);
+}
+
+// a * b mod m over the full 512-bit product, reduced bit by bit
+static void w_mulmod(evm_word_t* r, const evm_word_t* a, const evm_word_t* b, const evm_word_t* m) {
+    uint64_t prod[8] = {0};
+    evm_word_t rem = {{0, 0, 0, 0}}, bit;
+    int top;
+
+    if (w_zero(m)) {
+        w_set(r, 0);
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        unsigned __int128 carry = 0;
+        for (int j = 0; j < 4; j++) {
+            carry += (unsigned __int128)a->w[i] * b->w[j] + prod[i + j];
+            prod[i + j] = (uint64_t)carry;
+            carry >>= 64;
+        }
+        prod[i + 4] = (uint64_t)carry;
+    }
+
+    for (top = 511; top >= 0 && !((prod[top / 64] >> (top % 64)) & 1); top--);
+    for (int i = top; i >= 0; i--) {
+        w_set(&bit, (prod[i / 64] >> (i % 64)) & 1);
+        w_addmod_reduced(&rem, &rem, &rem, m);
+        w_addmod_reduced(&rem, &rem, &bit, m);
+    }
+    *r = rem;
+}
+
+static void w_exp(evm_word_t* r, const evm_word_t* base, const evm_word_t* e) {
+    evm_word_t result, b = *base;
+    int bits = w_bits(e);
+
+    w_set(&result, 1);
+    for (int i = 0; i < bits; i++) {
+        if ((e->w[i / 64] >> (i % 64)) & 1) w_mul(&result, &result, &b);
+        if (i + 1 < bits) w_mul(&b, &b, &b);
+    }
+    *r = result;
+}
+
+void w3_evm_analyze(const uint8_t* code, size_t code_len, uint8_t* jumpdests) {
+    memset(jumpdests, 0, (code_len + 7) / 8);
+    for (size_t pc = 0; pc < code_len; pc++) {
+        uint8_t op = code[pc];
+        if (op == 0x5b) jumpdests[pc / 8] |= 1 << (pc % 8);
+        else if (op >= 0x60 && op <= 0x7f) pc += op - 0x5f;  // skip push data
+    }
+}
+
+// Offset and size of a memory range taken from the stack, growing the
+// memory to cover it; -1 when it does not fit
+static int evm_range(const evm_word_t* off, const evm_word_t* len, size_t* msize,
+        size_t* o, size_t* l) {
+    uint64_t start = w_small(off), size = w_small(len), end;
+
+    if (size == 0) {
+        *o = *l = 0;
+        return 0;
+    }
+    if (start > W3_EVM_MAX_MEMORY || size > W3_EVM_MAX_MEMORY) return -1;
+    end = start + size;
+    if (end > W3_EVM_MAX_MEMORY) return -1;
+    end = (end + 31) & ~31ULL;
+    if (end > *msize) {
+        memset(evm_memory + *msize, 0, end - *msize);
+        *msize = end;
+    }
+    *o = start;
+    *l = size;
+    return 0;
+}
+
+// Copy len bytes of src from offset off into memory at dst, padding with zeros
+static void evm_copy(size_t dst, const uint8_t* src, size_t src_len, const evm_word_t* off,
+        size_t len) {
+    uint64_t start = w_small(off);
+    size_t n = 0;
+
+    if (start < src_len) n = src_len - start < len ? src_len - start : len;
+    if (n) memcpy(evm_memory + dst, src + start, n);
+    memset(evm_memory + dst + n, 0, len - n);
+}
+
+int w3_evm_run(const w3_evm_env_t* env, uint8_t* out, size_t out_size, size_t* out_len) {
+    const uint8_t* code = env->code;
+    evm_word_t* st = evm_stack;
+    evm_word_t a, b, c;
+    size_t pc = 0, sp = 0, msize = 0, returndata_len = 0, o, l, o2, l2;
+    uint8_t buf[32];
+    uint64_t steps = 0, n;
+    uint8_t op;
+
+    *out_len = 0;
+
+// Operands are popped from the top, results pushed back
+#define NEED(k) do { if (sp < (k)) return W3_EVM_FAULT; } while (0)
+#define ROOM(k) do { if (sp + (k) > EVM_STACK) return W3_EVM_FAULT; } while (0)
+#define TOP(i) (st[sp - 1 - (i)])
+
+    for (;;) {
+        if (++steps > W3_EVM_MAX_STEPS) return W3_EVM_FAULT;
+        op = pc < env->code_len ? code[pc] : 0x00;
+
+        // PUSH1..PUSH32, DUP1..16, SWAP1..16
+        if (op >= 0x60 && op <= 0x7f) {
+            size_t k = op - 0x5f;
+            ROOM(1);
+            memset(buf, 0, sizeof(buf));
+            for (size_t i = 0; i < k; i++) {
+                buf[32 - k + i] = pc + 1 + i < env->code_len ? code[pc + 1 + i] : 0;
+            }
+            w_load(&st[sp++], buf);
+            pc += k + 1;
+            continue;
+        }
+        if (op >= 0x80 && op <= 0x8f) {
+            NEED(op - 0x7fu);
+            ROOM(1);
+            st[sp] = TOP(op - 0x80);
+            sp++;
+            pc++;
+            continue;
+        }
+        if (op >= 0x90 && op <= 0x9f) {
+            NEED(op - 0x8eu);
+            a = TOP(0);
+            TOP(0) = TOP(op - 0x8f);
+            TOP(op - 0x8f) = a;
+            pc++;
+            continue;
+        }
+
+        switch (op) {
+            case 0x00:  // STOP
+                return W3_EVM_RETURN;
+
+            case 0x01:  // ADD
+                NEED(2);
+                w_add(&TOP(1), &TOP(0), &TOP(1));
+                sp--;
+                break;
+            case 0x02:  // MUL
+                NEED(2);
+                w_mul(&TOP(1), &TOP(0), &TOP(1));
+                sp--;
+                break;
+            case 0x03:  // SUB
+                NEED(2);
+                w_sub(&TOP(1), &TOP(0), &TOP(1));
+                sp--;
+                break;
+            case 0x04:  // DIV
+                NEED(2);
+                w_divmod(&TOP(0), &TOP(1), &TOP(1), NULL);
+                sp--;
+                break;
+            case 0x06:  // MOD
+                NEED(2);
+                w_divmod(&TOP(0), &TOP(1), NULL, &TOP(1));
+                sp--;
+                break;
+            case 0x05:  // SDIV
+            case 0x07:  // SMOD
+                NEED(2);
+                a = TOP(0);
+                b = TOP(1);
+                {
+                    int na = w_neg_sign(&a), nb = w_neg_sign(&b);
+                    if (na) w_negate(&a);
+                    if (nb) w_negate(&b);
+                    if (op == 0x05) {
+                        w_divmod(&a, &b, &c, NULL);
+                        if (na != nb) w_negate(&c);
+                    } else {
+                        w_divmod(&a, &b, NULL, &c);
+                        if (na) w_negate(&c);
+                    }
+                }
+                TOP(1) = c;
+                sp--;
+                break;
+            case 0x08:  // ADDMOD
+                NEED(3);
+                w_addmod(&TOP(2), &TOP(0), &TOP(1), &TOP(2));
+                sp -= 2;
+                break;
+            case 0x09:  // MULMOD
+                NEED(3);
+                w_mulmod(&TOP(2), &TOP(0), &TOP(1), &TOP(2));
+                sp -= 2;
+                break;
+            case 0x0a:  // EXP
+                NEED(2);
+                w_exp(&TOP(1), &TOP(0), &TOP(1));
+                sp--;
+                break;
+            case 0x0b:  // SIGNEXTEND
+                NEED(2);
+                n = w_small(&TOP(0));
+                if (n < 31) {
+                    unsigned int bit = 8 * n + 7;
+                    int neg = (TOP(1).w[bit / 64] >> (bit % 64)) & 1;
+                    for (unsigned int i = bit + 1; i < 256; i++) {
+                        if (neg) TOP(1).w[i / 64] |= 1ULL << (i % 64);
+                        else TOP(1).w[i / 64] &= ~(1ULL << (i % 64));
+                    }
+                }
+                sp--;
+                break;
+
+            case 0x10:  // LT
+            case 0x11:  // GT
+            case 0x12:  // SLT
+            case 0x13:  // SGT
+            case 0x14:  // EQ
+                NEED(2);
+                {
+                    int cmp = op == 0x12 || op == 0x13 ? w_scmp(&TOP(0), &TOP(1))
+                            : w_cmp(&TOP(0), &TOP(1));
+                    int res = op == 0x14 ? cmp == 0 : (op == 0x10 || op == 0x12) ? cmp < 0 : cmp > 0;
+                    w_set(&TOP(1), res);
+                }
+                sp--;
+                break;
+            case 0x15:  // ISZERO
+                NEED(1);
+                w_set(&TOP(0), w_zero(&TOP(0)));
+                break;
+            case 0x16:  // AND
+            case 0x17:  // OR
+            case 0x18:  // XOR
+                NEED(2);
+                for (int i = 0; i < 4; i++) {
+                    TOP(1).w[i] = op == 0x16 ? TOP(0).w[i] & TOP(1).w[i]
+                            : op == 0x17 ? TOP(0).w[i] | TOP(1).w[i] : TOP(0).w[i] ^ TOP(1).w[i];
+                }
+                sp--;
+                break;
+            case 0x19:  // NOT
+                NEED(1);
+                for (int i = 0; i < 4; i++) TOP(0).w[i] = ~TOP(0).w[i];
+                break;
+            case 0x1a:  // BYTE
+                NEED(2);
+                n = w_small(&TOP(0));
+                if (n < 32) {
+                    w_store(&TOP(1), buf);
+                    w_set(&TOP(1), buf[n]);
+                } else {
+                    w_set(&TOP(1), 0);
+                }
+                sp--;
+                break;
+            case 0x1b:  // SHL
+            case 0x1c:  // SHR
+                NEED(2);
+                n = w_small(&TOP(0));
+                if (n >= 256) w_set(&TOP(1), 0);
+                else if (op == 0x1b) w_shl(&TOP(1), &TOP(1), n);
+                else w_shr(&TOP(1), &TOP(1), n);
+                sp--;
+                break;
+            case 0x1d:  // SAR
+                NEED(2);
+                n = w_small(&TOP(0));
+                {
+                    int neg = w_neg_sign(&TOP(1));
+                    if (neg) for (int i = 0; i < 4; i++) TOP(1).w[i] = ~TOP(1).w[i];
+                    if (n >= 256) w_set(&TOP(1), 0);
+                    else w_shr(&TOP(1), &TOP(1), n);
+                    if (neg) for (int i = 0; i < 4; i++) TOP(1).w[i] = ~TOP(1).w[i];
+                }
+                sp--;
+                break;
+
+            case 0x20:  // KECCAK256
+                NEED(2);
+                if (evm_range(&TOP(0), &TOP(1), &msize, &o, &l) < 0) return W3_EVM_FAULT;
+                keccak256(evm_memory + o, l, buf);
+                w_load(&TOP(1), buf);
+                sp--;
+                break;
+
+            case 0x30:  // ADDRESS
+                ROOM(1);
+                memset(buf, 0, 12);
+                memcpy(buf + 12, env->address, 20);
+                w_load(&st[sp++], buf);
+                break;
+            case 0x32:  // ORIGIN
+            case 0x33:  // CALLER
+            case 0x34:  // CALLVALUE
+            case 0x3a:  // GASPRICE
+                ROOM(1);
+                w_set(&st[sp++], 0);
+                break;
+            case 0x35:  // CALLDATALOAD
+                NEED(1);
+                n = w_small(&TOP(0));
+                memset(buf, 0, sizeof(buf));
+                for (int i = 0; i < 32 && n < env->calldata_len && n + i < env->calldata_len; i++) {
+                    buf[i] = env->calldata[n + i];
+                }
+                w_load(&TOP(0), buf);
+                break;
+            case 0x36:  // CALLDATASIZE
+                ROOM(1);
+                w_set(&st[sp++], env->calldata_len);
+                break;
+            case 0x37:  // CALLDATACOPY
+            case 0x39:  // CODECOPY
+            case 0x3e:  // RETURNDATACOPY
+                NEED(3);
+                if (evm_range(&TOP(0), &TOP(2), &msize, &o, &l) < 0) return W3_EVM_FAULT;
+                if (op == 0x3e) {
+                    n = w_small(&TOP(1));
+                    if (n > returndata_len || l > returndata_len - n) return W3_EVM_FAULT;
+                    memcpy(evm_memory + o, evm_returndata + n, l);
+                } else if (l) {
+                    evm_copy(o, op == 0x37 ? env->calldata : code,
+                            op == 0x37 ? env->calldata_len : env->code_len, &TOP(1), l);
+                }
+                sp -= 3;
+                break;
+            case 0x38:  // CODESIZE
+                ROOM(1);
+                w_set(&st[sp++], env->code_len);
+                break;
+            case 0x3d:  // RETURNDATASIZE
+                ROOM(1);
+                w_set(&st[sp++], returndata_len);
+                break;
+
+            case 0x43:  // NUMBER
+                ROOM(1);
+                w_set(&st[sp++], env->number);
+                break;
+            case 0x46:  // CHAINID
+                if (!env->chain_id) return W3_EVM_UNSUPPORTED;
+                ROOM(1);
+                w_set(&st[sp++], env->chain_id);
+                break;
+
+            case 0x50:  // POP
+                NEED(1);
+                sp--;
+                break;
+            case 0x51:  // MLOAD
+                NEED(1);
+                w_set(&a, 32);
+                if (evm_range(&TOP(0), &a, &msize, &o, &l) < 0) return W3_EVM_FAULT;
+                w_load(&TOP(0), evm_memory + o);
+                break;
+            case 0x52:  // MSTORE
+            case 0x53:  // MSTORE8
+                NEED(2);
+                w_set(&a, op == 0x52 ? 32 : 1);
+                if (evm_range(&TOP(0), &a, &msize, &o, &l) < 0) return W3_EVM_FAULT;
+                if (op == 0x52) w_store(&TOP(1), evm_memory + o);
+                else evm_memory[o] = (uint8_t)TOP(1).w[0];
+                sp -= 2;
+                break;
+            case 0x54:  // SLOAD
+                NEED(1);
+                w_store(&TOP(0), buf);
+                if (!env->sload || env->sload(env->ctx, buf, buf) < 0) return W3_EVM_MISSING;
+                w_load(&TOP(0), buf);
+                break;
+            case 0x56:  // JUMP
+            case 0x57:  // JUMPI
+                NEED(op == 0x56 ? 1 : 2);
+                n = w_small(&TOP(0));
+                if (op == 0x57 && w_zero(&TOP(1))) {
+                    sp -= 2;
+                    break;
+                }
+                if (n >= env->code_len || !(env->jumpdests[n / 8] & (1 << (n % 8)))) {
+                    return W3_EVM_FAULT;
+                }
+                sp -= op == 0x56 ? 1 : 2;
+                pc = n;
+                continue;
+            case 0x58:  // PC
+                ROOM(1);
+                w_set(&st[sp++], pc);
+                break;
+            case 0x59:  // MSIZE
+                ROOM(1);
+                w_set(&st[sp++], msize);
+                break;
+            case 0x5a:  // GAS
+                ROOM(1);
+                w_set(&st[sp++], EVM_GAS_LEFT);
+                break;
+            case 0x5b:  // JUMPDEST
+                break;
+            case 0x5e:  // MCOPY
+                NEED(3);
+                // Grow for both ranges before copying
+                if (evm_range(&TOP(0), &TOP(2), &msize, &o, &l) < 0
+                        || evm_range(&TOP(1), &TOP(2), &msize, &o2, &l2) < 0) {
+                    return W3_EVM_FAULT;
+                }
+                if (l) memmove(evm_memory + o, evm_memory + o2, l);
+                sp -= 3;
+                break;
+            case 0x5f:  // PUSH0
+                ROOM(1);
+                w_set(&st[sp++], 0);
+                break;
+
+            case 0xfa:  // STATICCALL, only to the identity precompile
+                NEED(6);
+                if (w_small(&TOP(1)) != 4) return W3_EVM_UNSUPPORTED;
+                if (evm_range(&TOP(2), &TOP(3), &msize, &o, &l) < 0
+                        || evm_range(&TOP(4), &TOP(5), &msize, &o2, &l2) < 0) {
+                    return W3_EVM_FAULT;
+                }
+                memcpy(evm_returndata, evm_memory + o, l);
+                returndata_len = l;
+                memmove(evm_memory + o2, evm_returndata, l < l2 ? l : l2);
+                sp -= 5;
+                w_set(&TOP(0), 1);
+                break;
+
+            case 0xf3:  // RETURN
+            case 0xfd:  // REVERT
+                NEED(2);
+                if (evm_range(&TOP(0), &TOP(1), &msize, &o, &l) < 0) return W3_EVM_FAULT;
+                memcpy(out, evm_memory + o, l < out_size ? l : out_size);
+                *out_len = l;
+                return op == 0xf3 ? W3_EVM_RETURN : W3_EVM_REVERT;
+
+            case 0xfe:  // INVALID
+                return W3_EVM_FAULT;
+
+            default:
+                return W3_EVM_UNSUPPORTED;
+        }
+        pc++;
+    }
+
+#undef NEED
+#undef ROOM
+#undef TOP
+}
@@ -0,0 +1,50 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Minimal EVM interpreter for view functions.
+ */
+
+#ifndef _WEB3_AUTH_EVM_H_
+#define _WEB3_AUTH_EVM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define W3_EVM_MAX_CODE 24576       // EIP-170 contract size limit
+#define W3_EVM_MAX_MEMORY 65536
+#define W3_EVM_MAX_STEPS 2000000
+
+// Outcomes of w3_evm_run()
+#define W3_EVM_RETURN      0
+#define W3_EVM_REVERT      1
+#define W3_EVM_MISSING     2    // a storage slot is not in the snapshot
+#define W3_EVM_UNSUPPORTED 3    // opcode outside the view-function subset
+#define W3_EVM_FAULT       4    // bad jump, stack or memory, INVALID, step limit
+
+// Call context; storage is read through sload, which returns 0 with the
+// big-endian value, or -1 when the slot is not available
+typedef struct w3_evm_env {
+    const uint8_t* code;
+    size_t code_len;
+    const uint8_t* jumpdests;       // w3_evm_analyze() bitmap of code
+    const uint8_t* calldata;
+    size_t calldata_len;
+    uint8_t address[20];
+    uint64_t number;                // block the storage snapshot is from
+    uint64_t chain_id;              // 0 when unknown
+    int (*sload)(void* ctx, const uint8_t slot[32], uint8_t value[32]);
+    void* ctx;
+} w3_evm_env_t;
+
+// Mark the valid jump destinations of code in jumpdests, which must hold
+// (code_len + 7) / 8 bytes
+void w3_evm_analyze(const uint8_t* code, size_t code_len, uint8_t* jumpdests);
+
+// Execute a call without value from the zero address. The returned or
+// revert data is copied to out, up to out_size bytes, and its full length
+// stored in out_len. Not reentrant: memory and stack are per process.
+int w3_evm_run(const w3_evm_env_t* env, uint8_t* out, size_t out_size, size_t* out_len);
+
+const char* w3_evm_name(int outcome);
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Hex conversion and digest comparison.
+ *
+ * Every eth_call carries its arguments as hex and every result comes back
+ * as hex, so conversion runs on each byte of the pipeline. The kernels
+ * convert 16 or 32 bytes per step with SSE or AVX2 and are picked once at
+ * startup from what the CPU supports; tails and other architectures use
+ * the scalar loops.
+ *
+ * Digests are compared in binary: both the contract result and the client
+ * response are decoded, which accepts either case, and then compared
+ * without an early exit so the time taken does not reveal how many leading
+ * bytes of a guessed response were right.
+ */
+
+#include "web3_auth_hex.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HEX_X86 1
+#include <immintrin.h>
+#endif
+
+static const char hex_digits[16] = "0123456789abcdef";
+
+// Value of a hex digit, or -1
+static inline int hex_value(unsigned char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static void hex_encode_scalar(const uint8_t* in, size_t len, char* out) {
+    for (size_t i = 0; i < len; i++) {
+        out[2 * i] = hex_digits[in[i] >> 4];
+        out[2 * i + 1] = hex_digits[in[i] & 0x0f];
+    }
+}
+
+static int hex_decode_scalar(const char* hex, size_t len, uint8_t* out) {
+    for (size_t i = 0; i < len; i += 2) {
+        int hi = hex_value((unsigned char)hex[i]);
+        int lo = hex_value((unsigned char)hex[i + 1]);
+        if (hi < 0 || lo < 0) return -1;
+        out[i / 2] = (uint8_t)(hi << 4 | lo);
+    }
+    return 0;
+}
+
+#ifdef HEX_X86
+
+// Helpers are inlined into both kernel levels: calling legacy SSE code
+// from AVX code with dirty upper halves costs a state transition
+
+// 16 bytes to 32 digits
+__attribute__((always_inline, target("ssse3")))
+static inline void hex_encode16(const uint8_t* in, char* out) {
+    const __m128i lut = _mm_loadu_si128((const __m128i*)hex_digits);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i v = _mm_loadu_si128((const __m128i*)in);
+    __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+    __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, mask));
+
+    _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i*)(out + 16), _mm_unpackhi_epi8(hi, lo));
+}
+
+__attribute__((target("ssse3")))
+static void hex_encode_ssse3(const uint8_t* in, size_t len, char* out) {
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        hex_encode16(in + i, out + 2 * i);
+    }
+    hex_encode_scalar(in + i, len - i, out + 2 * i);
+}
+
+__attribute__((target("avx2")))
+static void hex_encode_avx2(const uint8_t* in, size_t len, char* out) {
+    const __m256i lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)hex_digits));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+        __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, mask));
+        // Unpacking works within 128-bit lanes, put the halves back in order
+        __m256i a = _mm256_unpacklo_epi8(hi, lo);
+        __m256i b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i*)(out + 2 * i), _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i*)(out + 2 * i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    if (i + 16 <= len) {
+        hex_encode16(in + i, out + 2 * i);
+        i += 16;
+    }
+    hex_encode_scalar(in + i, len - i, out + 2 * i);
+}
+
+// Nibble values of 16 digits, each 16-bit lane packed to the byte value
+// of its digit pair; -1 when a character is not a hex digit
+__attribute__((always_inline, target("sse2")))
+static inline int hex_decode16(const char* hex, __m128i* pairs) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)hex);
+    const __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    const __m128i l = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    // Signed compares: characters past 0x7f land on either side of the range
+    const __m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(d, _mm_set1_epi8(-1)),
+            _mm_cmplt_epi8(d, _mm_set1_epi8(10)));
+    const __m128i is_alpha = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8(-1)),
+            _mm_cmplt_epi8(l, _mm_set1_epi8(6)));
+    __m128i nib;
+
+    if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha)) != 0xffff) return -1;
+
+    nib = _mm_or_si128(_mm_and_si128(is_digit, d),
+            _mm_and_si128(is_alpha, _mm_add_epi8(l, _mm_set1_epi8(10))));
+    // Little endian: the high nibble is the low byte of each lane
+    *pairs = _mm_or_si128(
+            _mm_slli_epi16(_mm_and_si128(nib, _mm_set1_epi16(0x00ff)), 4),
+            _mm_srli_epi16(nib, 8));
+    return 0;
+}
+
+__attribute__((target("sse2")))
+static int hex_decode_sse2(const char* hex, size_t len, uint8_t* out) {
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m128i a, b;
+        if (hex_decode16(hex + i, &a) < 0 || hex_decode16(hex + i + 16, &b) < 0) return -1;
+        _mm_storeu_si128((__m128i*)(out + i / 2), _mm_packus_epi16(a, b));
+    }
+    if (i + 16 <= len) {
+        __m128i a;
+        if (hex_decode16(hex + i, &a) < 0) return -1;
+        _mm_storel_epi64((__m128i*)(out + i / 2), _mm_packus_epi16(a, a));
+        i += 16;
+    }
+    return hex_decode_scalar(hex + i, len - i, out + i / 2);
+}
+
+__attribute__((target("avx2")))
+static int hex_decode_avx2(const char* hex, size_t len, uint8_t* out) {
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i a_lower = _mm256_set1_epi8('a');
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(hex + i));
+        __m256i d = _mm256_sub_epi8(v, zero);
+        __m256i l = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), a_lower);
+        __m256i is_digit = _mm256_and_si256(_mm256_cmpgt_epi8(d, _mm256_set1_epi8(-1)),
+                _mm256_cmpgt_epi8(_mm256_set1_epi8(10), d));
+        __m256i is_alpha = _mm256_and_si256(_mm256_cmpgt_epi8(l, _mm256_set1_epi8(-1)),
+                _mm256_cmpgt_epi8(_mm256_set1_epi8(6), l));
+        __m256i nib, pairs;
+
+        if ((unsigned int)_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_alpha)) != 0xffffffffu) {
+            return -1;
+        }
+        nib = _mm256_or_si256(_mm256_and_si256(is_digit, d),
+                _mm256_and_si256(is_alpha, _mm256_add_epi8(l, _mm256_set1_epi8(10))));
+        pairs = _mm256_or_si256(
+                _mm256_slli_epi16(_mm256_and_si256(nib, _mm256_set1_epi16(0x00ff)), 4),
+                _mm256_srli_epi16(nib, 8));
+        // Packing also works per lane: bytes land in quadwords 0 and 2
+        pairs = _mm256_permute4x64_epi64(_mm256_packus_epi16(pairs, pairs), 0x08);
+        _mm_storeu_si128((__m128i*)(out + i / 2), _mm256_castsi256_si128(pairs));
+    }
+    if (i + 16 <= len) {
+        __m128i a;
+        if (hex_decode16(hex + i, &a) < 0) return -1;
+        _mm_storel_epi64((__m128i*)(out + i / 2), _mm_packus_epi16(a, a));
+        i += 16;
+    }
+    return hex_decode_scalar(hex + i, len - i, out + i / 2);
+}
+
+#endif
+
+static void (*hex_encode_impl)(const uint8_t*, size_t, char*) = hex_encode_scalar;
+static int (*hex_decode_impl)(const char*, size_t, uint8_t*) = hex_decode_scalar;
+
+int w3_hex_select(int level) {
+    hex_encode_impl = hex_encode_scalar;
+    hex_decode_impl = hex_decode_scalar;
+
+#ifdef HEX_X86
+    __builtin_cpu_init();
+    if (level >= W3_HEX_AVX2 && __builtin_cpu_supports("avx2")) {
+        hex_encode_impl = hex_encode_avx2;
+        hex_decode_impl = hex_decode_avx2;
+        return W3_HEX_AVX2;
+    }
+    if (level >= W3_HEX_SSE && __builtin_cpu_supports("ssse3")) {
+        hex_encode_impl = hex_encode_ssse3;
+        hex_decode_impl = hex_decode_sse2;
+        return W3_HEX_SSE;
+    }
+#endif
+    return W3_HEX_SCALAR;
+}
+
+const char* w3_hex_name(int level) {
+    switch (level) {
+        case W3_HEX_AVX2: return "avx2";
+        case W3_HEX_SSE: return "sse";
+        default: return "scalar";
+    }
+}
+
+void w3_hex_encode(const uint8_t* in, size_t len, char* out) {
+    hex_encode_impl(in, len, out);
+}
+
+int w3_hex_decode(const char* hex, size_t len, uint8_t* out) {
+    if (len & 1) return -1;
+    return hex_decode_impl(hex, len, out);
+}
+
+int w3_digest_equal(const uint8_t* a, const uint8_t* b, size_t len) {
+    volatile uint8_t diff = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Hex conversion and digest comparison.
+ */
+
+#ifndef _WEB3_AUTH_HEX_H_
+#define _WEB3_AUTH_HEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Kernel levels, from portable to widest
+#define W3_HEX_SCALAR 0
+#define W3_HEX_SSE    1     // 16 bytes per step, SSE2 decode and SSSE3 encode
+#define W3_HEX_AVX2   2     // 32 bytes per step
+#define W3_HEX_BEST   W3_HEX_AVX2
+
+// Use the widest kernels up to level that this CPU supports; returns the
+// level selected. Scalar kernels are used until this is called.
+int w3_hex_select(int level);
+const char* w3_hex_name(int level);
+
+// Encode len bytes as 2 * len lowercase hex digits, not terminated
+void w3_hex_encode(const uint8_t* in, size_t len, char* out);
+
+// Decode len hex digits of either case into len / 2 bytes; -1 when len is
+// odd or a character is not a hex digit
+int w3_hex_decode(const char* hex, size_t len, uint8_t* out);
+
+// 1 when a and b are equal; the time taken does not depend on their content
+int w3_digest_equal(const uint8_t* a, const uint8_t* b, size_t len);
+
+#endif
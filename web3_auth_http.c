@@ -0,0 +1,461 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Persistent HTTP handles and resolver results shared between processes.
+ *
+ * Every process keeps one curl handle per RPC endpoint for its lifetime, so
+ * connections and TLS sessions survive between lookups. The handles of a
+ * process are tied together by a curl share object guarded by pthread
+ * mutexes, which shares DNS results, TLS sessions and the connection pool
+ * between them.
+ *
+ * curl handles and share objects live in process memory and cannot be
+ * placed in shm, so between processes only resolver results are shared: a
+ * small shm table maps host:port to the address the last successful
+ * request connected to, and it is fed to the other processes through
+ * CURLOPT_RESOLVE. A cold process then skips the DNS lookup. TLS sessions
+ * cannot be exported from libcurl, so each process still pays one full
+ * handshake per endpoint, after which the persistent connection is reused.
+ *
+ * Workers pay that handshake in child_init instead of on their first
+ * lookup, and keep the connections warm themselves after their checks: a
+ * worker sends a cheap eth_chainId on one handle idle long enough for a
+ * provider to close it, or replaces one connection nearing the server's
+ * limit of requests per connection, at most once a second. Kamailio
+ * processes are single-threaded, so maintenance never races a lookup.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../../core/dprint.h"
+#include "../../core/locking.h"
+#include "../../core/mem/shm_mem.h"
+
+#include "web3_auth.h"
+#include "web3_auth_acct.h"
+#include "web3_auth_http.h"
+
+#define HTTP_DNS_SIZE 64
+#define HTTP_HOST_SIZE 128
+#define HTTP_ADDR_SIZE 64
+#define HTTP_PING_TIMEOUT_MS 5000          // endpoint validation at startup
+#define HTTP_KEEPALIVE_TIMEOUT_MS 1000     // the check just done waits for this ping
+#define HTTP_MAINTAIN_INTERVAL_US 1000000  // at most one maintenance step per second
+#define HTTP_PING "{\"jsonrpc\":\"2.0\",\"method\":\"eth_chainId\",\"params\":[],\"id\":1}"
+// Handle 0 serves endpoints without a health slot
+#define HTTP_MAX_HANDLES (W3_SHARD_MAX_HEALTH + 1)
+
+typedef struct {
+    char host[HTTP_HOST_SIZE];  // empty marks a free entry
+    int port;
+    char addr[HTTP_ADDR_SIZE];
+    uint64_t expires_us;
+    unsigned long hits;         // lookups that used this address
+} http_dns_entry_t;
+
+typedef struct {
+    gen_lock_t lock;
+    uint64_t ttl_us;
+    http_dns_entry_t entries[HTTP_DNS_SIZE];
+} http_dns_t;
+
+// Per-process state of one endpoint handle
+typedef struct {
+    CURL* curl;
+    struct curl_slist* resolve;     // must outlive the requests using it
+    char resolved[HTTP_HOST_SIZE + HTTP_ADDR_SIZE + 16];
+    w3_endpoint_t ep;               // endpoint last served, for pings
+    uint64_t last_used_us;
+    unsigned int conn_requests;     // requests on the current connection
+} http_conn_t;
+
+// Body of a ping response, kept out of pkg memory
+typedef struct {
+    char data[256];
+    size_t len;
+} http_ping_body_t;
+
+static http_dns_t* http_dns = NULL;
+
+static CURLSH* http_share = NULL;
+static pthread_mutex_t http_locks[CURL_LOCK_DATA_LAST];
+static struct curl_slist* http_headers = NULL;
+static http_conn_t http_conns[HTTP_MAX_HANDLES];
+static uint64_t http_maintained_us = 0;
+
+static uint64_t http_keepalive_us = 0;
+static unsigned int http_max_requests = 0;
+
+int w3_http_init(int dns_ttl_s, int keepalive_s, int max_requests) {
+    http_keepalive_us = (uint64_t)(keepalive_s > 0 ? keepalive_s : 0) * 1000000;
+    http_max_requests = max_requests > 0 ? (unsigned int)max_requests : 0;
+
+    if (dns_ttl_s <= 0) {
+        LM_INFO("Shared resolver cache disabled\n");
+        return 0;
+    }
+
+    http_dns = shm_malloc(sizeof(http_dns_t));
+    if (!http_dns) {
+        LM_ERR("Not enough shared memory for the resolver cache\n");
+        return -1;
+    }
+    memset(http_dns, 0, sizeof(http_dns_t));
+
+    if (!lock_init(&http_dns->lock)) {
+        LM_ERR("Failed to initialize resolver cache lock\n");
+        shm_free(http_dns);
+        http_dns = NULL;
+        return -1;
+    }
+    http_dns->ttl_us = (uint64_t)dns_ttl_s * 1000000;
+    return 0;
+}
+
+void w3_http_destroy(void) {
+    if (!http_dns) return;
+    lock_destroy(&http_dns->lock);
+    shm_free(http_dns);
+    http_dns = NULL;
+}
+
+static void http_lock(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr) {
+    (void)handle;
+    (void)access;
+    (void)userptr;
+    pthread_mutex_lock(&http_locks[data]);
+}
+
+static void http_unlock(CURL* handle, curl_lock_data data, void* userptr) {
+    (void)handle;
+    (void)userptr;
+    pthread_mutex_unlock(&http_locks[data]);
+}
+
+// Share object of this process, created on first use
+static CURLSH* http_get_share(void) {
+    if (http_share) return http_share;
+
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&http_locks[i], NULL);
+    }
+    http_share = curl_share_init();
+    if (!http_share) return NULL;
+
+    curl_share_setopt(http_share, CURLSHOPT_LOCKFUNC, http_lock);
+    curl_share_setopt(http_share, CURLSHOPT_UNLOCKFUNC, http_unlock);
+    curl_share_setopt(http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    return http_share;
+}
+
+// Host and port of an http(s) URL; -1 for URLs the resolver cache skips
+static int http_parse_url(const char* url, char host[HTTP_HOST_SIZE], int* port) {
+    const char* p;
+    size_t len;
+
+    if (strncmp(url, "https://", 8) == 0) {
+        p = url + 8;
+        *port = 443;
+    } else if (strncmp(url, "http://", 7) == 0) {
+        p = url + 7;
+        *port = 80;
+    } else {
+        return -1;
+    }
+
+    // IPv6 literals and user info need no resolving or are rare enough
+    if (*p == '[') return -1;
+    len = strcspn(p, ":/?#@");
+    if (p[len] == '@' || len == 0 || len >= HTTP_HOST_SIZE) return -1;
+    memcpy(host, p, len);
+    host[len] = '\0';
+    if (p[len] == ':') *port = atoi(p + len + 1);
+    return 0;
+}
+
+// Shared address of host:port, or an empty string
+static void http_dns_get(const char* host, int port, char addr[HTTP_ADDR_SIZE]) {
+    uint64_t now = w3_now_us();
+
+    addr[0] = '\0';
+    lock_get(&http_dns->lock);
+    for (int i = 0; i < HTTP_DNS_SIZE; i++) {
+        http_dns_entry_t* e = &http_dns->entries[i];
+        if (e->port == port && e->expires_us > now && strcmp(e->host, host) == 0) {
+            memcpy(addr, e->addr, HTTP_ADDR_SIZE);
+            e->hits++;
+            break;
+        }
+    }
+    lock_release(&http_dns->lock);
+}
+
+// Apply the shared address of the endpoint host to the handle
+static void http_apply_resolve(http_conn_t* c, const w3_endpoint_t* ep) {
+    char host[HTTP_HOST_SIZE];
+    char addr[HTTP_ADDR_SIZE];
+    char entry[sizeof(c->resolved)];
+    int port;
+
+    if (!http_dns || http_parse_url(ep->url, host, &port) < 0) return;
+
+    http_dns_get(host, port, addr);
+    if (!addr[0]) {
+        entry[0] = '\0';
+    } else if (strchr(addr, ':')) {
+        snprintf(entry, sizeof(entry), "+%s:%d:[%s]", host, port, addr);
+    } else {
+        snprintf(entry, sizeof(entry), "+%s:%d:%s", host, port, addr);
+    }
+    if (strcmp(entry, c->resolved) == 0) return;
+
+    // Entries with '+' expire from curl's DNS cache like resolved ones
+    curl_easy_setopt(c->curl, CURLOPT_RESOLVE, NULL);
+    if (c->resolve) curl_slist_free_all(c->resolve);
+    c->resolve = entry[0] ? curl_slist_append(NULL, entry) : NULL;
+    if (c->resolve) curl_easy_setopt(c->curl, CURLOPT_RESOLVE, c->resolve);
+    strcpy(c->resolved, c->resolve ? entry : "");
+}
+
+static inline http_conn_t* http_conn(const w3_endpoint_t* ep) {
+    return &http_conns[ep->health >= 0 ? ep->health + 1 : 0];
+}
+
+// Create the handle of c if needed and point it at ep
+static CURL* http_prepare(http_conn_t* c, const w3_endpoint_t* ep) {
+    if (!c->curl) {
+        if (!http_headers) {
+            http_headers = curl_slist_append(NULL, "Content-Type: application/json");
+            if (!http_headers) return NULL;
+        }
+        c->curl = curl_easy_init();
+        if (!c->curl) return NULL;
+
+        if (http_get_share()) curl_easy_setopt(c->curl, CURLOPT_SHARE, http_share);
+        curl_easy_setopt(c->curl, CURLOPT_HTTPHEADER, http_headers);
+        curl_easy_setopt(c->curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(c->curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        if (http_dns) {
+            curl_easy_setopt(c->curl, CURLOPT_DNS_CACHE_TIMEOUT,
+                    (long)(http_dns->ttl_us / 1000000));
+        }
+    }
+
+    c->ep = *ep;
+    http_apply_resolve(c, ep);
+    return c->curl;
+}
+
+CURL* w3_http_handle(const w3_endpoint_t* ep) {
+    http_conn_t* c;
+    CURL* curl;
+
+    c = http_conn(ep);
+    curl = http_prepare(c, ep);
+    if (!curl) return NULL;
+
+    // Close the connection after its last allowed request rather than
+    // letting the server cut it under a later one
+    curl_easy_setopt(curl, CURLOPT_FORBID_REUSE,
+            http_max_requests && c->conn_requests + 1 >= http_max_requests ? 1L : 0L);
+    return curl;
+}
+
+// Count the request on the connection it used
+static void http_count(http_conn_t* c, CURLcode res) {
+    long connects = 0;
+
+    c->last_used_us = w3_now_us();
+    if (res != CURLE_OK) {
+        c->conn_requests = 0;
+        return;
+    }
+    curl_easy_getinfo(c->curl, CURLINFO_NUM_CONNECTS, &connects);
+    c->conn_requests = connects > 0 ? 1 : c->conn_requests + 1;
+    if (http_max_requests && c->conn_requests >= http_max_requests) c->conn_requests = 0;
+}
+
+// Publish the address curl connected to, or forget it on connect failures
+static void http_learn(CURL* curl, const w3_endpoint_t* ep, CURLcode res) {
+    char host[HTTP_HOST_SIZE];
+    char* ip = NULL;
+    long ip_port = 0;
+    int port, slot = -1, free_slot = -1, oldest = 0;
+    uint64_t now;
+
+    if (!http_dns || http_parse_url(ep->url, host, &port) < 0) return;
+
+    if (res == CURLE_OK) {
+        if (curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &ip) != CURLE_OK || !ip || !*ip) return;
+        curl_easy_getinfo(curl, CURLINFO_PRIMARY_PORT, &ip_port);
+        // Behind a proxy the peer is not the endpoint host
+        if (ip_port != port || strlen(ip) >= HTTP_ADDR_SIZE) return;
+    } else if (res != CURLE_COULDNT_CONNECT && res != CURLE_COULDNT_RESOLVE_HOST) {
+        return;
+    }
+
+    now = w3_now_us();
+    lock_get(&http_dns->lock);
+    for (int i = 0; i < HTTP_DNS_SIZE; i++) {
+        http_dns_entry_t* e = &http_dns->entries[i];
+        if (e->port == port && strcmp(e->host, host) == 0) {
+            slot = i;
+            break;
+        }
+        if (!e->host[0]) {
+            if (free_slot < 0) free_slot = i;
+        } else if (e->expires_us < http_dns->entries[oldest].expires_us) {
+            oldest = i;
+        }
+    }
+
+    if (res != CURLE_OK) {
+        // Let the next request resolve again instead of retrying a dead address
+        if (slot >= 0) http_dns->entries[slot].expires_us = 0;
+    } else if (slot < 0) {
+        http_dns_entry_t* e = &http_dns->entries[free_slot >= 0 ? free_slot : oldest];
+        strcpy(e->host, host);
+        e->port = port;
+        strcpy(e->addr, ip);
+        e->expires_us = now + http_dns->ttl_us;
+        e->hits = 0;
+    } else {
+        http_dns_entry_t* e = &http_dns->entries[slot];
+        strcpy(e->addr, ip);
+        e->expires_us = now + http_dns->ttl_us;
+    }
+    lock_release(&http_dns->lock);
+}
+
+void w3_http_done(CURL* curl, const w3_endpoint_t* ep, CURLcode res) {
+    http_conn_t* c = http_conn(ep);
+
+    http_count(c, res);
+    http_learn(curl, ep, res);
+}
+
+static size_t http_ping_write(void* contents, size_t size, size_t nmemb, void* userp) {
+    http_ping_body_t* body = (http_ping_body_t*)userp;
+    size_t n = size * nmemb;
+    size_t room = sizeof(body->data) - 1 - body->len;
+
+    memcpy(body->data + body->len, contents, n < room ? n : room);
+    body->len += n < room ? n : room;
+    body->data[body->len] = '\0';
+    return n;
+}
+
+// Send eth_chainId on the handle of c; 0 when the endpoint answered with a
+// JSON-RPC result within timeout_ms
+static int http_ping(http_conn_t* c, int last, long timeout_ms, CURLcode* res) {
+    http_ping_body_t body;
+    long code = 0;
+
+    body.len = 0;
+    body.data[0] = '\0';
+    curl_easy_setopt(c->curl, CURLOPT_URL, c->ep.url);
+    curl_easy_setopt(c->curl, CURLOPT_POSTFIELDS, HTTP_PING);
+    curl_easy_setopt(c->curl, CURLOPT_POSTFIELDSIZE, (long)(sizeof(HTTP_PING) - 1));
+    curl_easy_setopt(c->curl, CURLOPT_WRITEFUNCTION, http_ping_write);
+    curl_easy_setopt(c->curl, CURLOPT_WRITEDATA, &body);
+    curl_easy_setopt(c->curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+    curl_easy_setopt(c->curl, CURLOPT_FORBID_REUSE, last ? 1L : 0L);
+
+    *res = curl_easy_perform(c->curl);
+    if (*res == CURLE_OK) curl_easy_getinfo(c->curl, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_setopt(c->curl, CURLOPT_FORBID_REUSE, 0L);
+    http_count(c, *res);
+    http_learn(c->curl, &c->ep, *res);
+    w3_acct_record(c->ep.url, sizeof(HTTP_PING) - 1, body.len, *res == CURLE_OK && code < 400);
+
+    return *res == CURLE_OK && code == 200 && strstr(body.data, "\"result\"") ? 0 : -1;
+}
+
+int w3_http_prewarm(const w3_endpoint_t* eps, int n) {
+    CURLcode res;
+    int warm = 0;
+
+    for (int i = 0; i < n; i++) {
+        http_conn_t* c = http_conn(&eps[i]);
+
+        if (!http_prepare(c, &eps[i])) {
+            LM_ERR("Failed to initialize curl for %s\n", eps[i].url);
+            continue;
+        }
+        if (http_ping(c, 0, HTTP_PING_TIMEOUT_MS, &res) == 0) {
+            warm++;
+            w3_shard_report(&eps[i], 1);
+        } else {
+            LM_WARN("RPC endpoint %s failed validation (%s)\n", eps[i].url,
+                    res == CURLE_OK ? "no JSON-RPC result" : curl_easy_strerror(res));
+            w3_shard_report(&eps[i], 0);
+        }
+    }
+    return warm;
+}
+
+void w3_http_maintain(void) {
+    // Rotate at 90% of the limit so lookups never hit it
+    unsigned int rotate_at = http_max_requests - http_max_requests / 10;
+    uint64_t now = w3_now_us();
+    CURLcode res;
+
+    if ((!http_keepalive_us && !http_max_requests)
+            || now - http_maintained_us < HTTP_MAINTAIN_INTERVAL_US) {
+        return;
+    }
+    http_maintained_us = now;
+
+    // One connection per call bounds the delay to one or two pings
+    for (int i = 0; i < HTTP_MAX_HANDLES; i++) {
+        http_conn_t* c = &http_conns[i];
+
+        if (!c->curl) continue;
+        if (http_max_requests && c->conn_requests >= rotate_at) {
+            // Retire the old connection, then open its replacement
+            http_ping(c, 1, HTTP_KEEPALIVE_TIMEOUT_MS, &res);
+            http_ping(c, 0, HTTP_KEEPALIVE_TIMEOUT_MS, &res);
+            return;
+        }
+        if (http_keepalive_us && now - c->last_used_us >= http_keepalive_us) {
+            http_ping(c, 0, HTTP_KEEPALIVE_TIMEOUT_MS, &res);
+            return;
+        }
+    }
+}
+
+void w3_http_rpc_dns(rpc_t* rpc, void* ctx) {
+    http_dns_entry_t e;
+    uint64_t now;
+    void* th;
+
+    if (!http_dns) {
+        rpc->fault(ctx, 500, "Shared resolver cache disabled");
+        return;
+    }
+
+    now = w3_now_us();
+    for (int i = 0; i < HTTP_DNS_SIZE; i++) {
+        lock_get(&http_dns->lock);
+        memcpy(&e, &http_dns->entries[i], sizeof(e));
+        lock_release(&http_dns->lock);
+
+        if (!e.host[0]) continue;
+        if (rpc->add(ctx, "{", &th) < 0) {
+            rpc->fault(ctx, 500, "Internal error creating structure");
+            return;
+        }
+        rpc->struct_add(th, "sdsdu",
+                "host", e.host,
+                "port", e.port,
+                "address", e.addr,
+                "ttl", e.expires_us > now ? (int)((e.expires_us - now) / 1000000) : 0,
+                "hits", (unsigned int)e.hits);
+    }
+}
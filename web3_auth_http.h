@@ -0,0 +1,44 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Persistent HTTP handles and resolver results shared between processes.
+ */
+
+#ifndef _WEB3_AUTH_HTTP_H_
+#define _WEB3_AUTH_HTTP_H_
+
+#include <curl/curl.h>
+
+#include "../../core/rpc.h"
+
+#include "web3_auth_shard.h"
+
+// Allocate the shared resolver table; must run in mod_init (before fork).
+// Addresses learned by one process are used by all for dns_ttl_s seconds.
+// Connections idle for keepalive_s seconds get a keep-alive call, and are
+// replaced before carrying max_requests requests (0 disables either).
+int w3_http_init(int dns_ttl_s, int keepalive_s, int max_requests);
+void w3_http_destroy(void);
+
+// Open and validate a connection to each endpoint with eth_chainId;
+// returns the number of endpoints that answered
+int w3_http_prewarm(const w3_endpoint_t* eps, int n);
+
+// Keep the handles of this process warm: ping one idle for the keep-alive
+// interval or replace one nearing its request limit, at most once a
+// second. Called by SIP workers after a check, as they have no other thread.
+void w3_http_maintain(void);
+
+// Persistent handle of this process for ep, with the shared addresses of
+// its host applied. The handle keeps its connection between requests and
+// must not be cleaned up by the caller. It is reserved for the caller
+// until passed to w3_http_done().
+CURL* w3_http_handle(const w3_endpoint_t* ep);
+
+// Publish the address a finished request connected to, or forget it when
+// the connection failed, and release the handle
+void w3_http_done(CURL* curl, const w3_endpoint_t* ep, CURLcode res);
+
+void w3_http_rpc_dns(rpc_t* rpc, void* ctx);
+
+#endif
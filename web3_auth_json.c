@@ -0,0 +1,60 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Minimal scanning of JSON-RPC answers.
+ *
+ * The module only needs a few members of answers whose layout is fixed by
+ * the JSON-RPC methods it calls, so values are located in place instead of
+ * building a document tree.
+ */
+
+#include <string.h>
+#include <ctype.h>
+
+#include "web3_auth_json.h"
+
+const char* w3_json_member(const char* p, const char* end, const char* key) {
+    size_t klen = strlen(key);
+    const char* v;
+
+    for (; p + klen + 2 < end; p++) {
+        if (*p != '"' || p[klen + 1] != '"' || memcmp(p + 1, key, klen) != 0) continue;
+        v = p + klen + 2;
+        while (v < end && isspace((unsigned char)*v)) v++;
+        if (v == end || *v != ':') continue;
+        v++;
+        while (v < end && isspace((unsigned char)*v)) v++;
+        return v < end ? v : NULL;
+    }
+    return NULL;
+}
+
+const char* w3_json_skip(const char* p, const char* end) {
+    int depth = 0, in_string = 0;
+
+    for (; p < end; p++) {
+        if (in_string) {
+            if (*p == '\\') p++;
+            else if (*p == '"' && --in_string == 0 && depth == 0) return p + 1;
+        } else if (*p == '"') {
+            in_string = 1;
+        } else if (*p == '{' || *p == '[') {
+            depth++;
+        } else if ((*p == '}' || *p == ']') && --depth == 0) {
+            return p + 1;
+        }
+    }
+    return end;
+}
+
+long w3_json_hex(const char* p, const char* end, const char** hex) {
+    const char* q;
+
+    if (end - p < 4 || p[0] != '"' || p[1] != '0' || (p[2] | 0x20) != 'x') return -1;
+    for (q = p + 3; q < end && *q != '"'; q++) {
+        if (!isxdigit((unsigned char)*q)) return -1;
+    }
+    if (q == end) return -1;
+    *hex = p + 3;
+    return q - *hex;
+}
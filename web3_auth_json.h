@@ -0,0 +1,23 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Minimal scanning of JSON-RPC answers.
+ */
+
+#ifndef _WEB3_AUTH_JSON_H_
+#define _WEB3_AUTH_JSON_H_
+
+#include <stddef.h>
+
+// Value of member key in the JSON text [p, end), or NULL. Searches nested
+// values too; callers narrow [p, end) to the object they mean.
+const char* w3_json_member(const char* p, const char* end, const char* key);
+
+// Past the end of the string, object or array starting at p
+const char* w3_json_skip(const char* p, const char* end);
+
+// Digits of the "0x.." string at p, without the prefix: their number, or
+// -1 when p is not such a string
+long w3_json_hex(const char* p, const char* end, const char** hex);
+
+#endif
@@ -0,0 +1,16 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Keccak-256, the hash behind function selectors and Ethereum state.
+ */
+
+#ifndef _WEB3_AUTH_KECCAK_H_
+#define _WEB3_AUTH_KECCAK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Keccak-256 as used by Ethereum (original padding, not SHA3-256)
+void keccak256(const uint8_t* input, size_t input_len, uint8_t output[32]);
+
+#endif
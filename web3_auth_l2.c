@@ -0,0 +1,685 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Second-level digest cache in Redis or memcached.
+ *
+ * The shm cache dies with the process group and is local to one node. A
+ * Redis or memcached server behind it keeps digests across restarts and
+ * shares them across a fleet. It is asked after a shm miss and before the
+ * eth_call: one request looks up both the digest of the call and the
+ * absent mark of the user (MGET, or a multi-key get). Stores go out without
+ * waiting; Redis replies to them are read before the next lookup on the
+ * same connection. Every lookup has a deadline of a few milliseconds, and
+ * a breaker shared by all processes stops asking a server that failed
+ * several times in a row, so a slow or dead server costs at most one
+ * timeout per process and breaker period.
+ *
+ * Keys are "w3a:" and the 64-bit cache key in hex; values are the digest
+ * in hex, or "-" for a user the contract does not know, then the version of
+ * the contract answer (wall-clock ms, in hex) and a MAC, the first 16 bytes
+ * of keccak256(l2_secret | key | value), all separated by ':'. Whoever can
+ * write to the server can then only delete digests, not plant them. A flush
+ * stores "w3a:f:" and the partition in hex (ffffffff for all) with the
+ * version of the flush; each lookup fetches the marks of its partition and
+ * of all partitions along and takes only values newer than both.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "../../core/dprint.h"
+#include "../../core/atomic_ops.h"
+#include "../../core/mem/shm_mem.h"
+
+#include "web3_auth.h"
+#include "web3_auth_hex.h"
+#include "web3_auth_keccak.h"
+#include "web3_auth_l2.h"
+#include "web3_auth_repl.h"
+
+#define L2_REDIS 1
+#define L2_MEMCACHED 2
+
+#define L2_BUF_SIZE 4096
+#define L2_MAX_PENDING 64           // unread Redis store replies
+#define L2_KEY_SIZE 21              // "w3a:" and 16 hex digits
+#define L2_VALUE_SIZE 96            // digest, version and MAC in hex
+#define L2_MAC_SIZE 16
+#define L2_SECRET_SIZE 64
+#define L2_SECRET_MIN 16
+
+// Keys fetched by a lookup, in this order
+#define L2_DIGEST 0
+#define L2_ABSENT 1
+#define L2_FLUSHED 2                // of the partition
+#define L2_FLUSHED_ALL 3
+#define L2_GET_KEYS 4
+
+typedef struct {
+    volatile int failures;          // in a row
+    volatile uint64_t open_until_us;
+    volatile long lookups;
+    volatile long hits;
+    volatile long absent_hits;
+    volatile long misses;
+    volatile long rejected;         // MAC does not match
+    volatile long errors;
+    volatile long skipped;          // breaker open
+    volatile long writes;
+} l2_shared_t;
+
+static l2_shared_t* l2 = NULL;
+static int l2_proto = 0;
+static struct sockaddr_storage l2_addr;
+static socklen_t l2_addr_len;
+static char l2_name[160];             // host:port
+static char l2_password[128];
+static uint8_t l2_secret[L2_SECRET_SIZE];
+static size_t l2_secret_len;
+static int l2_db = 0;
+static int l2_timeout_ms;
+static int l2_ttl_s;
+static int l2_absent_ttl_s;
+static int l2_fail_threshold;
+static uint64_t l2_down_us;
+
+// Connection of this process
+static int l2_fd = -1;
+static int l2_pending = 0;
+static char l2_buf[L2_BUF_SIZE];
+static size_t l2_len = 0;
+
+int w3_l2_init(const char* url, const char* secret, int timeout_ms, int ttl_s,
+        int absent_ttl_s, int fail_threshold, int down_s) {
+    char host[128], port[8];
+    const char* p;
+    const char* at;
+    const char* colon;
+    const char* slash;
+    struct addrinfo hints, *res;
+    size_t len;
+    int err;
+
+    if (!url || !*url) return 0;
+    // Whoever can write to the server could otherwise plant a digest
+    if (!secret || strlen(secret) < L2_SECRET_MIN) {
+        LM_ERR("l2_url needs an l2_secret of at least %d bytes\n", L2_SECRET_MIN);
+        return -1;
+    }
+    if (strlen(secret) > L2_SECRET_SIZE) {
+        LM_ERR("l2_secret longer than %d bytes\n", L2_SECRET_SIZE);
+        return -1;
+    }
+    l2_secret_len = strlen(secret);
+    memcpy(l2_secret, secret, l2_secret_len);
+
+    if (strncasecmp(url, "redis://", 8) == 0) {
+        l2_proto = L2_REDIS;
+        p = url + 8;
+    } else if (strncasecmp(url, "memcached://", 12) == 0) {
+        l2_proto = L2_MEMCACHED;
+        p = url + 12;
+    } else {
+        LM_ERR("l2_url must start with redis:// or memcached://\n");
+        return -1;
+    }
+
+    // [:password@]host:port[/db]
+    at = strchr(p, '@');
+    if (at) {
+        if (l2_proto != L2_REDIS || *p != ':' || (size_t)(at - p - 1) >= sizeof(l2_password)) {
+            LM_ERR("Invalid credentials in l2_url\n");
+            return -1;
+        }
+        memcpy(l2_password, p + 1, at - p - 1);
+        l2_password[at - p - 1] = '\0';
+        p = at + 1;
+    }
+    slash = strchr(p, '/');
+    if (slash) {
+        if (l2_proto != L2_REDIS) {
+            LM_ERR("memcached l2_url takes no database\n");
+            return -1;
+        }
+        l2_db = atoi(slash + 1);
+    }
+    len = slash ? (size_t)(slash - p) : strlen(p);
+    colon = memchr(p, ':', len);
+    if (!colon || colon == p || (size_t)(colon - p) >= sizeof(host)
+            || len - (colon - p) - 1 >= sizeof(port) || len - (colon - p) - 1 == 0) {
+        LM_ERR("l2_url needs host:port\n");
+        return -1;
+    }
+    memcpy(host, p, colon - p);
+    host[colon - p] = '\0';
+    memcpy(port, colon + 1, len - (colon - p) - 1);
+    port[len - (colon - p) - 1] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    if ((err = getaddrinfo(host, port, &hints, &res)) != 0) {
+        LM_ERR("Cannot resolve L2 cache host '%s': %s\n", host, gai_strerror(err));
+        return -1;
+    }
+    memcpy(&l2_addr, res->ai_addr, res->ai_addrlen);
+    l2_addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    snprintf(l2_name, sizeof(l2_name), "%s:%s", host, port);
+
+    l2 = shm_malloc(sizeof(*l2));
+    if (!l2) {
+        LM_ERR("Not enough shared memory for the L2 cache state\n");
+        return -1;
+    }
+    memset(l2, 0, sizeof(*l2));
+
+    l2_timeout_ms = timeout_ms > 0 ? timeout_ms : 20;
+    l2_ttl_s = ttl_s > 0 ? ttl_s : 60;
+    l2_absent_ttl_s = absent_ttl_s;
+    l2_fail_threshold = fail_threshold > 0 ? fail_threshold : 1;
+    l2_down_us = (uint64_t)(down_s > 0 ? down_s : 1) * 1000000;
+
+    LM_INFO("L2 cache: %s at %s, timeout %dms, ttl %ds\n",
+            l2_proto == L2_REDIS ? "redis" : "memcached", l2_name, l2_timeout_ms, l2_ttl_s);
+    return 0;
+}
+
+void w3_l2_destroy(void) {
+    if (l2_fd >= 0) {
+        close(l2_fd);
+        l2_fd = -1;
+    }
+    if (l2) {
+        shm_free(l2);
+        l2 = NULL;
+    }
+}
+
+// Whether the breaker lets a request through
+static int l2_allowed(void) {
+    if (l2->failures >= l2_fail_threshold && w3_now_us() < l2->open_until_us) {
+        atomic_inc_long(&l2->skipped);
+        return 0;
+    }
+    return 1;
+}
+
+static void l2_failed(const char* what) {
+    if (l2_fd >= 0) close(l2_fd);
+    l2_fd = -1;
+    l2_pending = 0;
+    l2_len = 0;
+    atomic_inc_long(&l2->errors);
+
+    // Past the threshold every failure, e.g. of a probe, reopens the breaker
+    atomic_inc_int(&l2->failures);
+    if (l2->failures >= l2_fail_threshold) {
+        l2->open_until_us = w3_now_us() + l2_down_us;
+        if (l2->failures == l2_fail_threshold) {
+            LM_WARN("L2 cache %s failing (%s), bypassed for %llus\n", l2_name, what,
+                    (unsigned long long)(l2_down_us / 1000000));
+        }
+    }
+}
+
+// Milliseconds left until deadline, -1 when passed
+static int l2_left_ms(uint64_t deadline) {
+    uint64_t now = w3_now_us();
+    return now < deadline ? (int)((deadline - now + 999) / 1000) : -1;
+}
+
+static int l2_wait(short events, uint64_t deadline) {
+    struct pollfd pfd = {l2_fd, events, 0};
+    int left, rc;
+
+    for (;;) {
+        if ((left = l2_left_ms(deadline)) < 0) return -1;
+        rc = poll(&pfd, 1, left);
+        if (rc > 0) return 0;
+        if (rc == 0 || errno != EINTR) return -1;
+    }
+}
+
+static int l2_send(const char* data, size_t len, uint64_t deadline) {
+    ssize_t n;
+
+    while (len) {
+        n = send(l2_fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            data += n;
+            len -= n;
+        } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            return -1;
+        } else if (l2_wait(POLLOUT, deadline) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Read more of the answer into the buffer
+static int l2_recv(uint64_t deadline) {
+    ssize_t n;
+
+    if (l2_len == sizeof(l2_buf)) return -1;
+    for (;;) {
+        n = recv(l2_fd, l2_buf + l2_len, sizeof(l2_buf) - l2_len, MSG_DONTWAIT);
+        if (n > 0) {
+            l2_len += n;
+            return 0;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) return -1;
+        if (l2_wait(POLLIN, deadline) < 0) return -1;
+    }
+}
+
+static void l2_consume(size_t n) {
+    memmove(l2_buf, l2_buf + n, l2_len - n);
+    l2_len -= n;
+}
+
+static const char* l2_eol(size_t pos) {
+    for (size_t i = pos; i + 1 < l2_len; i++) {
+        if (l2_buf[i] == '\r' && l2_buf[i + 1] == '\n') return l2_buf + i;
+    }
+    return NULL;
+}
+
+// Bulk length or element count after a RESP type byte; nothing that fits
+// the buffer is larger than it, so bigger values are malformed
+static int resp_count(const char* p, long* n) {
+    char* end;
+
+    errno = 0;
+    *n = strtol(p, &end, 10);
+    return end == p || errno == ERANGE || *n < -1 || *n > L2_BUF_SIZE ? -1 : 0;
+}
+
+// Length of the complete RESP reply at pos, 0 while incomplete, -1 when
+// malformed
+static long resp_length(size_t pos) {
+    const char* eol;
+    long n, head, total, part;
+
+    if (pos >= l2_len || !(eol = l2_eol(pos))) return 0;
+    head = eol - (l2_buf + pos) + 2;
+
+    switch (l2_buf[pos]) {
+        case '+':
+        case '-':
+        case ':':
+            return head;
+        case '$':
+            if (resp_count(l2_buf + pos + 1, &n) < 0) return -1;
+            if (n < 0) return head;
+            return l2_len - pos >= (size_t)(head + n + 2) ? head + n + 2 : 0;
+        case '*':
+            if (resp_count(l2_buf + pos + 1, &n) < 0) return -1;
+            for (total = head; n-- > 0; total += part) {
+                if ((part = resp_length(pos + total)) <= 0) return part;
+            }
+            return total;
+    }
+    return -1;
+}
+
+// Wait for the complete reply at the start of the buffer; its length
+static long resp_reply(uint64_t deadline) {
+    long len;
+
+    while ((len = resp_length(0)) == 0) {
+        if (l2_recv(deadline) < 0) return -1;
+    }
+    return len;
+}
+
+static int l2_connect(uint64_t deadline) {
+    char cmd[256];
+    int one = 1, err = 0;
+    socklen_t len = sizeof(err);
+    size_t n = 0;
+
+    l2_fd = socket(l2_addr.ss_family, SOCK_STREAM, 0);
+    if (l2_fd < 0) return -1;
+    fcntl(l2_fd, F_SETFL, fcntl(l2_fd, F_GETFL) | O_NONBLOCK);
+    setsockopt(l2_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(l2_fd, (struct sockaddr*)&l2_addr, l2_addr_len) < 0) {
+        if (errno != EINPROGRESS || l2_wait(POLLOUT, deadline) < 0
+                || getsockopt(l2_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+            return -1;
+        }
+    }
+
+    // Session setup rides along with the first request
+    if (l2_proto == L2_REDIS && *l2_password) {
+        n += snprintf(cmd + n, sizeof(cmd) - n, "*2\r\n$4\r\nAUTH\r\n$%zu\r\n%s\r\n",
+                strlen(l2_password), l2_password);
+        l2_pending++;
+    }
+    if (l2_proto == L2_REDIS && l2_db) {
+        n += snprintf(cmd + n, sizeof(cmd) - n, "SELECT %d\r\n", l2_db);
+        l2_pending++;
+    }
+    return n ? l2_send(cmd, n, deadline) : 0;
+}
+
+// Read the replies of earlier stores; an error reply means a bad setup
+static int resp_drain(uint64_t deadline) {
+    long len;
+
+    while (l2_pending > 0) {
+        if ((len = resp_reply(deadline)) < 0 || l2_buf[0] == '-') return -1;
+        l2_consume(len);
+        l2_pending--;
+    }
+    return 0;
+}
+
+static void l2_key(char key[L2_KEY_SIZE], uint64_t k) {
+    snprintf(key, L2_KEY_SIZE, "w3a:%016llx", (unsigned long long)k);
+}
+
+static void l2_flush_key(char key[L2_KEY_SIZE], unsigned int partition) {
+    snprintf(key, L2_KEY_SIZE, "w3a:f:%08x", partition);
+}
+
+static void l2_mac(const char* key, const char* value, size_t vlen, uint8_t mac[L2_MAC_SIZE]) {
+    uint8_t buf[L2_SECRET_SIZE + L2_KEY_SIZE + L2_VALUE_SIZE];
+    uint8_t hash[32];
+    size_t klen = strlen(key);
+
+    memcpy(buf, l2_secret, l2_secret_len);
+    memcpy(buf + l2_secret_len, key, klen);
+    memcpy(buf + l2_secret_len + klen, value, vlen);
+    keccak256(buf, l2_secret_len + klen + vlen, hash);
+    memcpy(mac, hash, L2_MAC_SIZE);
+}
+
+// What a lookup found; a version is 0 where no valid value is stored
+typedef struct {
+    const char* keys[L2_GET_KEYS];
+    uint8_t* digest;
+    uint64_t versions[L2_GET_KEYS];
+} l2_found_t;
+
+static uint64_t l2_version(const char* hex) {
+    uint8_t b[8];
+    uint64_t v = 0;
+
+    if (w3_hex_decode(hex, 16, b) < 0) return 0;
+    for (int i = 0; i < 8; i++) v = v << 8 | b[i];
+    return v;
+}
+
+// Take the stored value of keys[i] when its MAC matches
+static void l2_value(l2_found_t* f, int i, const char* v, long len) {
+    uint8_t mac[L2_MAC_SIZE], want[L2_MAC_SIZE];
+    long body = len - 2 * L2_MAC_SIZE - 1;     // up to the ':' before the MAC
+    long head = i == L2_DIGEST ? 2 * W3_DIGEST_SIZE + 1 : i == L2_ABSENT ? 2 : 0;
+
+    if (body != head + 16 || v[body] != ':' || (head && v[head - 1] != ':')
+            || (i == L2_ABSENT && *v != '-')
+            || w3_hex_decode(v + body + 1, 2 * L2_MAC_SIZE, mac) < 0) {
+        return;
+    }
+    l2_mac(f->keys[i], v, body, want);
+    if (!w3_digest_equal(mac, want, L2_MAC_SIZE)) {
+        atomic_inc_long(&l2->rejected);
+        return;
+    }
+    if (i == L2_DIGEST && w3_hex_decode(v, 2 * W3_DIGEST_SIZE, f->digest) < 0) return;
+    f->versions[i] = l2_version(v + head);
+}
+
+// Values not newer than the last flush of their partition were flushed
+static int l2_outcome(const l2_found_t* f, uint64_t* version) {
+    uint64_t flushed = f->versions[L2_FLUSHED] > f->versions[L2_FLUSHED_ALL]
+            ? f->versions[L2_FLUSHED] : f->versions[L2_FLUSHED_ALL];
+
+    if (f->versions[L2_DIGEST] > flushed) {
+        *version = f->versions[L2_DIGEST];
+        return W3_L2_HIT;
+    }
+    if (f->versions[L2_ABSENT] > flushed) {
+        *version = f->versions[L2_ABSENT];
+        return W3_L2_ABSENT;
+    }
+    return W3_L2_MISS;
+}
+
+static int redis_get(l2_found_t* f, uint64_t deadline) {
+    char cmd[192];
+    const char* p;
+    long len, n, vlen;
+
+    n = snprintf(cmd, sizeof(cmd), "*%d\r\n$4\r\nMGET\r\n", L2_GET_KEYS + 1);
+    for (int i = 0; i < L2_GET_KEYS; i++) {
+        n += snprintf(cmd + n, sizeof(cmd) - n, "$%zu\r\n%s\r\n", strlen(f->keys[i]),
+                f->keys[i]);
+    }
+    if (l2_send(cmd, n, deadline) < 0 || resp_drain(deadline) < 0) return -1;
+    if ((len = resp_reply(deadline)) < 0 || l2_buf[0] != '*') return -1;
+
+    // resp_length() checked that the values lie within the reply
+    if (resp_count(l2_buf + 1, &n) < 0 || n != L2_GET_KEYS) return -1;
+    p = strchr(l2_buf, '\n') + 1;
+    for (int i = 0; i < L2_GET_KEYS; i++) {
+        if (*p != '$') return -1;
+        vlen = strtol(p + 1, NULL, 10);
+        p = strchr(p, '\n') + 1;
+        if (vlen < 0) continue;
+        l2_value(f, i, p, vlen);
+        p += vlen + 2;
+    }
+    l2_consume(len);
+    return 0;
+}
+
+// Complete memcached get answer: its length, or 0 while incomplete, -1 on
+// an error; takes the values found into f once complete
+static long mc_answer(l2_found_t* f) {
+    char key[64];
+    const char* eol;
+    size_t pos = 0;
+    unsigned long bytes;
+    unsigned int flags;
+
+    for (;;) {
+        if (!(eol = l2_eol(pos))) return 0;
+        if (eol - l2_buf - pos == 3 && memcmp(l2_buf + pos, "END", 3) == 0) {
+            return eol - l2_buf + 2;
+        }
+        if (sscanf(l2_buf + pos, "VALUE %63s %u %lu", key, &flags, &bytes) != 3
+                || bytes > L2_BUF_SIZE) {
+            return -1;
+        }
+        pos = eol - l2_buf + 2;
+        if (l2_len - pos < bytes + 2) return 0;
+        for (int i = 0; f && i < L2_GET_KEYS; i++) {
+            if (strcmp(key, f->keys[i]) == 0) l2_value(f, i, l2_buf + pos, bytes);
+        }
+        pos += bytes + 2;
+    }
+}
+
+static int mc_get(l2_found_t* f, uint64_t deadline) {
+    char cmd[128];
+    long len;
+    int n;
+
+    n = snprintf(cmd, sizeof(cmd), "get");
+    for (int i = 0; i < L2_GET_KEYS; i++) {
+        n += snprintf(cmd + n, sizeof(cmd) - n, " %s", f->keys[i]);
+    }
+    n += snprintf(cmd + n, sizeof(cmd) - n, "\r\n");
+    if (l2_send(cmd, n, deadline) < 0) return -1;
+    while ((len = mc_answer(NULL)) == 0) {
+        if (l2_recv(deadline) < 0) return -1;
+    }
+    if (len < 0) return -1;
+    mc_answer(f);
+    l2_consume(len);
+    return 0;
+}
+
+int w3_l2_get(unsigned int partition, uint64_t key, uint64_t user_key,
+        uint8_t digest[W3_DIGEST_SIZE], uint64_t* version) {
+    char keys[L2_GET_KEYS][L2_KEY_SIZE];
+    l2_found_t f = {.digest = digest};
+    uint64_t deadline;
+    int rc;
+
+    if (!l2 || !l2_allowed()) return W3_L2_MISS;
+
+    atomic_inc_long(&l2->lookups);
+    l2_key(keys[L2_DIGEST], key);
+    l2_key(keys[L2_ABSENT], user_key);
+    l2_flush_key(keys[L2_FLUSHED], partition);
+    l2_flush_key(keys[L2_FLUSHED_ALL], W3_REPL_ALL);
+    for (int i = 0; i < L2_GET_KEYS; i++) f.keys[i] = keys[i];
+    deadline = w3_now_us() + (uint64_t)l2_timeout_ms * 1000;
+
+    if (l2_fd < 0 && l2_connect(deadline) < 0) {
+        l2_failed("connect");
+        return W3_L2_MISS;
+    }
+    rc = l2_proto == L2_REDIS ? redis_get(&f, deadline) : mc_get(&f, deadline);
+    if (rc < 0) {
+        l2_failed("lookup");
+        return W3_L2_MISS;
+    }
+
+    l2->failures = 0;
+    rc = l2_outcome(&f, version);
+    if (rc == W3_L2_HIT) atomic_inc_long(&l2->hits);
+    else if (rc == W3_L2_ABSENT) atomic_inc_long(&l2->absent_hits);
+    else atomic_inc_long(&l2->misses);
+    return rc;
+}
+
+// Wait for the answer of a memcached set without noreply
+static int mc_stored(uint64_t deadline) {
+    const char* eol;
+
+    while (!(eol = l2_eol(0))) {
+        if (l2_recv(deadline) < 0) return -1;
+    }
+    if (eol - l2_buf != 6 || memcmp(l2_buf, "STORED", 6) != 0) return -1;
+    l2_consume(8);
+    return 0;
+}
+
+// Store value and its MAC under key; without wait the answer is not
+// awaited and errors only show on later requests
+static int l2_store(const char* key, const char* value, size_t vlen, int ttl_s, int wait) {
+    char cmd[256], data[L2_VALUE_SIZE], ttl[12];
+    uint8_t mac[L2_MAC_SIZE];
+    uint64_t deadline;
+    int n, rc;
+
+    if (!l2 || ttl_s <= 0 || !l2_allowed()) return -1;
+
+    memcpy(data, value, vlen);
+    data[vlen] = ':';
+    l2_mac(key, value, vlen, mac);
+    w3_hex_encode(mac, L2_MAC_SIZE, data + vlen + 1);
+    vlen += 1 + 2 * L2_MAC_SIZE;
+
+    deadline = w3_now_us() + (uint64_t)l2_timeout_ms * 1000;
+    if (l2_fd < 0 && l2_connect(deadline) < 0) {
+        l2_failed("connect");
+        return -1;
+    }
+
+    if (l2_proto == L2_REDIS) {
+        n = snprintf(ttl, sizeof(ttl), "%d", ttl_s);
+        n = snprintf(cmd, sizeof(cmd),
+                "*5\r\n$3\r\nSET\r\n$%zu\r\n%s\r\n$%zu\r\n%.*s\r\n$2\r\nEX\r\n$%d\r\n%s\r\n",
+                strlen(key), key, vlen, (int)vlen, data, n, ttl);
+        l2_pending++;
+    } else {
+        n = snprintf(cmd, sizeof(cmd), "set %s 0 %d %zu%s\r\n%.*s\r\n", key, ttl_s, vlen,
+                wait ? "" : " noreply", (int)vlen, data);
+    }
+    if (l2_send(cmd, n, deadline) < 0) {
+        rc = -1;
+    } else if (l2_proto == L2_REDIS) {
+        rc = wait || l2_pending > L2_MAX_PENDING ? resp_drain(deadline) : 0;
+    } else {
+        rc = wait ? mc_stored(deadline) : 0;
+    }
+    if (rc < 0) {
+        l2_failed("store");
+        return -1;
+    }
+    atomic_inc_long(&l2->writes);
+    return 0;
+}
+
+void w3_l2_put(uint64_t key, const uint8_t digest[W3_DIGEST_SIZE], uint64_t version) {
+    char k[L2_KEY_SIZE], value[L2_VALUE_SIZE];
+
+    if (!l2) return;
+    l2_key(k, key);
+    w3_hex_encode(digest, W3_DIGEST_SIZE, value);
+    snprintf(value + 2 * W3_DIGEST_SIZE, sizeof(value) - 2 * W3_DIGEST_SIZE, ":%016llx",
+            (unsigned long long)version);
+    l2_store(k, value, 2 * W3_DIGEST_SIZE + 17, l2_ttl_s, 0);
+}
+
+void w3_l2_put_absent(uint64_t user_key, uint64_t version) {
+    char k[L2_KEY_SIZE], value[20];
+
+    if (!l2) return;
+    l2_key(k, user_key);
+    snprintf(value, sizeof(value), "-:%016llx", (unsigned long long)version);
+    l2_store(k, value, 18, l2_absent_ttl_s, 0);
+}
+
+int w3_l2_flush(unsigned int partition, uint64_t version) {
+    char k[L2_KEY_SIZE], value[17];
+
+    if (!l2) return 0;
+    l2_flush_key(k, partition);
+    snprintf(value, sizeof(value), "%016llx", (unsigned long long)version);
+    // The mark outlives every value it hides
+    return l2_store(k, value, 16, l2_ttl_s > l2_absent_ttl_s ? l2_ttl_s : l2_absent_ttl_s, 1);
+}
+
+void w3_l2_rpc_stats(rpc_t* rpc, void* ctx) {
+    void* th;
+
+    if (!l2) {
+        rpc->fault(ctx, 500, "L2 cache disabled");
+        return;
+    }
+    if (rpc->add(ctx, "{", &th) < 0) {
+        rpc->fault(ctx, 500, "Internal error creating structure");
+        return;
+    }
+    rpc->struct_add(th, "ssduuuuuuuu",
+            "server", l2_name,
+            "breaker", l2->failures >= l2_fail_threshold && w3_now_us() < l2->open_until_us
+                    ? "open" : "closed",
+            "failures", l2->failures,
+            "lookups", (unsigned int)l2->lookups,
+            "hits", (unsigned int)l2->hits,
+            "absent_hits", (unsigned int)l2->absent_hits,
+            "misses", (unsigned int)l2->misses,
+            "rejected", (unsigned int)l2->rejected,
+            "errors", (unsigned int)l2->errors,
+            "skipped", (unsigned int)l2->skipped,
+            "writes", (unsigned int)l2->writes);
+}
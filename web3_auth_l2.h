@@ -0,0 +1,47 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Second-level digest cache in Redis or memcached.
+ */
+
+#ifndef _WEB3_AUTH_L2_H_
+#define _WEB3_AUTH_L2_H_
+
+#include <stdint.h>
+
+#include "../../core/rpc.h"
+
+#include "web3_auth.h"
+
+// Outcomes of w3_l2_get()
+#define W3_L2_MISS   0      // also errors, timeouts and an open breaker
+#define W3_L2_HIT    1
+#define W3_L2_ABSENT 2
+
+// Parse url ("redis://[:password@]host:port[/db]" or "memcached://host:port")
+// and allocate the shared breaker state; must run in mod_init (before
+// fork). Without url the tier stays off; with it, secret (16 to 64 bytes)
+// authenticates every value. Every exchange has timeout_ms; fail_threshold
+// failures in a row keep the tier off for down_s seconds.
+int w3_l2_init(const char* url, const char* secret, int timeout_ms, int ttl_s,
+        int absent_ttl_s, int fail_threshold, int down_s);
+void w3_l2_destroy(void);
+
+// Look up the digest of key and whether user_key is absent, in one round
+// trip, along with the flushes of partition; version is set to the time of
+// the contract answer found
+int w3_l2_get(unsigned int partition, uint64_t key, uint64_t user_key,
+        uint8_t digest[W3_DIGEST_SIZE], uint64_t* version);
+
+// Store without waiting for the answer; version is the time of the
+// contract answer, as in the shm cache
+void w3_l2_put(uint64_t key, const uint8_t digest[W3_DIGEST_SIZE], uint64_t version);
+void w3_l2_put_absent(uint64_t user_key, uint64_t version);
+
+// Hide the values of partition, or all with W3_REPL_ALL, that are not newer
+// than version; waits for the server, -1 when it did not store the flush
+int w3_l2_flush(unsigned int partition, uint64_t version);
+
+void w3_l2_rpc_stats(rpc_t* rpc, void* ctx);
+
+#endif
@@ -0,0 +1,505 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Adaptive concurrency limiter for outstanding eth_call requests.
+ *
+ * All SIP worker processes share one limit kept in shm. The limit follows a
+ * Vegas-style rule driven by the RTTs measured in verify_blockchain_auth():
+ * while the estimated provider-side queue (limit * (1 - min_rtt / srtt)) stays
+ * small the limit grows, when it builds up the limit shrinks, and transport
+ * failures cut it multiplicatively. Calls above the limit wait in a bounded
+ * FIFO queue and are shed when the queue is full or their wait times out.
+ *
+ * The service rate is estimated from the limit and the smoothed RTT (Little's
+ * law) and from observed completions. Callers that would not get a slot
+ * within their wait budget are rejected up front, and the backlog drain time
+ * gives the Retry-After value handed back to the script.
+ *
+ * Queued callers belong to a priority class. Whenever slots free up, the
+ * process freeing them grants each one to a waiter, picked by smooth weighted
+ * round-robin over the non-empty classes (FIFO inside a class), except that
+ * a caller queued for longer than the starvation threshold is served first.
+ * The slot is reserved for the waiter until it notices on its next poll; a
+ * grant left unclaimed for LIMITER_GRANT_TIMEOUT, e.g. by a process that
+ * died, is taken back. When the queue is full, a caller may take the place
+ * of the newest waiter of a lower class.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "../../core/dprint.h"
+#include "../../core/locking.h"
+#include "../../core/mem/shm_mem.h"
+#include "../../core/rand/fastrand.h"
+
+#include "web3_auth.h"
+#include "web3_auth_limiter.h"
+
+#define LIMITER_VEGAS_ALPHA 3.0          // grow while fewer calls queue at the provider
+#define LIMITER_VEGAS_BETA 6.0           // shrink once more calls queue at the provider
+#define LIMITER_ERROR_BACKOFF 0.9        // multiplicative decrease on transport errors
+#define LIMITER_MIN_RTT_WINDOW 30000000  // re-probe the base RTT every 30s
+#define LIMITER_POLL_MIN_US 100
+#define LIMITER_POLL_MAX_US 1000
+#define LIMITER_RATE_WINDOW 1000000      // completions are sampled per second
+#define LIMITER_GRANT_TIMEOUT 100000     // a granted waiter polls well within 100ms
+
+static const char* limiter_class_names[W3_PRIO_CLASSES] = {"high", "normal", "low"};
+
+// A queued caller waiting for a slot; ticket 0 marks a free entry
+typedef struct {
+    unsigned int ticket;
+    int prio;
+    uint64_t since_us;
+    uint64_t granted_us;    // when a slot was reserved for it, 0 while waiting
+} limiter_waiter_t;
+
+typedef struct {
+    int weight;
+    int current;   // smooth weighted round-robin state
+    int queued;
+    unsigned long admitted;
+    unsigned long shed;
+    unsigned long rejected;
+    unsigned long evicted;
+    uint64_t max_wait_us;
+} limiter_class_t;
+
+typedef struct {
+    gen_lock_t lock;
+    double limit;
+    int min_limit;
+    int max_limit;
+    int inflight;
+    int queued;
+    unsigned int next_ticket;
+    uint64_t starvation_us;
+    limiter_class_t classes[W3_PRIO_CLASSES];
+    uint64_t min_rtt_us;
+    uint64_t min_rtt_since_us;
+    uint64_t srtt_us;
+    uint64_t rate_since_us;
+    unsigned int rate_count;
+    double completion_rate;
+    unsigned long admitted;
+    unsigned long waited;
+    unsigned long shed;
+    unsigned long rejected;
+    unsigned long errors;
+    int queue_size;
+    limiter_waiter_t waiters[];
+} w3_limiter_t;
+
+static w3_limiter_t* limiter = NULL;
+
+int w3_limiter_init(int init_limit, int min_limit, int max_limit, int queue_size,
+        const int weights[W3_PRIO_CLASSES], int starvation_ms) {
+    size_t size;
+
+    if (min_limit < 1) min_limit = 1;
+    if (max_limit < min_limit) max_limit = min_limit;
+    if (init_limit < min_limit) init_limit = min_limit;
+    if (init_limit > max_limit) init_limit = max_limit;
+    if (queue_size < 0) queue_size = 0;
+
+    size = sizeof(w3_limiter_t) + queue_size * sizeof(limiter_waiter_t);
+    limiter = shm_malloc(size);
+    if (!limiter) {
+        LM_ERR("Not enough shared memory for the RPC limiter\n");
+        return -1;
+    }
+    memset(limiter, 0, size);
+
+    if (!lock_init(&limiter->lock)) {
+        LM_ERR("Failed to initialize RPC limiter lock\n");
+        shm_free(limiter);
+        limiter = NULL;
+        return -1;
+    }
+
+    limiter->limit = init_limit;
+    limiter->min_limit = min_limit;
+    limiter->max_limit = max_limit;
+    limiter->queue_size = queue_size;
+    limiter->next_ticket = 1;
+    limiter->rate_since_us = w3_now_us();
+    limiter->starvation_us = (uint64_t)(starvation_ms > 0 ? starvation_ms : 0) * 1000;
+    for (int c = 0; c < W3_PRIO_CLASSES; c++) {
+        limiter->classes[c].weight = weights[c] > 0 ? weights[c] : 1;
+    }
+
+    LM_INFO("RPC limiter: initial limit %d (min %d, max %d), queue size %d, weights %d/%d/%d\n",
+            init_limit, min_limit, max_limit, queue_size, limiter->classes[W3_PRIO_HIGH].weight,
+            limiter->classes[W3_PRIO_NORMAL].weight, limiter->classes[W3_PRIO_LOW].weight);
+    return 0;
+}
+
+void w3_limiter_destroy(void) {
+    if (!limiter) return;
+    lock_destroy(&limiter->lock);
+    shm_free(limiter);
+    limiter = NULL;
+}
+
+// Calls per second the provider currently absorbs; called with the lock held
+static double limiter_service_rate(void) {
+    double rate = 0;
+
+    if (limiter->srtt_us > 0) {
+        rate = (double)(int)limiter->limit * 1000000.0 / (double)limiter->srtt_us;
+    }
+    // While calls are queued the observed completion rate is the better measure
+    if (limiter->queued > 0 && limiter->completion_rate > 0) {
+        rate = limiter->completion_rate;
+    }
+    return rate;
+}
+
+int w3_limiter_prio_by_name(const char* name, int len) {
+    for (int c = 0; c < W3_PRIO_CLASSES; c++) {
+        if ((int)strlen(limiter_class_names[c]) == len
+                && strncasecmp(limiter_class_names[c], name, len) == 0) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+// Oldest waiter without a grant of a class, or of any class when prio is -1
+static limiter_waiter_t* limiter_oldest(int prio) {
+    limiter_waiter_t* best = NULL;
+
+    for (int i = 0; i < limiter->queue_size; i++) {
+        limiter_waiter_t* w = &limiter->waiters[i];
+        if (!w->ticket || w->granted_us || (prio >= 0 && w->prio != prio)) continue;
+        if (!best || (int)(w->ticket - best->ticket) < 0) best = w;
+    }
+    return best;
+}
+
+// Pick the waiter for the next free slot; called with the lock held
+static limiter_waiter_t* limiter_schedule(uint64_t now) {
+    limiter_waiter_t* w;
+    int total = 0, pick = -1;
+
+    // Starvation guard: a caller waiting too long goes first, whatever its class
+    w = limiter_oldest(-1);
+    if (!w) return NULL;
+    if (limiter->starvation_us && now - w->since_us >= limiter->starvation_us) {
+        return w;
+    }
+
+    // Smooth weighted round-robin over the classes that have waiters
+    for (int c = 0; c < W3_PRIO_CLASSES; c++) {
+        limiter_class_t* cl = &limiter->classes[c];
+        if (!cl->queued) continue;
+        cl->current += cl->weight;
+        total += cl->weight;
+        if (pick < 0 || cl->current > limiter->classes[pick].current) pick = c;
+    }
+    if (pick < 0) return NULL;
+    limiter->classes[pick].current -= total;
+
+    return limiter_oldest(pick);
+}
+
+// Take back grants nobody claimed, then reserve every free slot for a
+// waiter; called with the lock held
+static void limiter_dispatch(uint64_t now) {
+    limiter_waiter_t* w;
+
+    for (int i = 0; i < limiter->queue_size; i++) {
+        w = &limiter->waiters[i];
+        if (w->ticket && w->granted_us && now - w->granted_us > LIMITER_GRANT_TIMEOUT) {
+            // the caller, if still alive, notices the ticket change on its next poll
+            w->ticket = 0;
+            limiter->inflight--;
+            limiter->shed++;
+            limiter->classes[w->prio].shed++;
+            LM_WARN("RPC slot granted to a %s request not claimed, taken back\n",
+                    limiter_class_names[w->prio]);
+        }
+    }
+
+    while (limiter->queued > 0 && limiter->inflight < (int)limiter->limit) {
+        w = limiter_schedule(now);
+        if (!w) break;
+        w->granted_us = now;
+        limiter->queued--;
+        limiter->classes[w->prio].queued--;
+        limiter->inflight++;
+    }
+}
+
+// Take the place of the newest waiter of a class below prio; called with the lock held
+static limiter_waiter_t* limiter_evict(int prio) {
+    limiter_waiter_t* victim = NULL;
+
+    for (int i = 0; i < limiter->queue_size; i++) {
+        limiter_waiter_t* w = &limiter->waiters[i];
+        if (!w->ticket || w->prio <= prio || w->granted_us) continue;
+        if (!victim || w->prio > victim->prio
+                || (w->prio == victim->prio && (int)(w->ticket - victim->ticket) > 0)) {
+            victim = w;
+        }
+    }
+    if (victim) {
+        limiter->classes[victim->prio].queued--;
+        limiter->classes[victim->prio].evicted++;
+        limiter->queued--;
+        // the evicted caller notices the ticket change on its next poll
+        victim->ticket = 0;
+    }
+    return victim;
+}
+
+// Expected wait in ms for a new caller of class prio; called with the lock held
+static double limiter_expected_wait_ms(int prio) {
+    double rate = limiter_service_rate();
+    int weights = 0;
+
+    if (rate <= 0) return 0;
+    for (int c = 0; c < W3_PRIO_CLASSES; c++) {
+        if (limiter->classes[c].queued || c == prio) weights += limiter->classes[c].weight;
+    }
+    // The class gets its weighted share of the dispatches
+    rate = rate * limiter->classes[prio].weight / weights;
+    return (limiter->classes[prio].queued + 1) * 1000.0 / rate;
+}
+
+int w3_limiter_acquire(int prio, unsigned int timeout_ms) {
+    limiter_waiter_t* slot = NULL;
+    limiter_class_t* cl;
+    unsigned int ticket;
+    unsigned int poll_us = LIMITER_POLL_MIN_US;
+    uint64_t now, deadline;
+
+    if (!limiter) return 0;
+    if (prio < 0 || prio >= W3_PRIO_CLASSES) prio = W3_PRIO_NORMAL;
+    cl = &limiter->classes[prio];
+
+    lock_get(&limiter->lock);
+
+    // Fast path: nobody is waiting and the limit has room
+    if (limiter->queued == 0 && limiter->inflight < (int)limiter->limit) {
+        limiter->inflight++;
+        limiter->admitted++;
+        cl->admitted++;
+        lock_release(&limiter->lock);
+        return 0;
+    }
+
+    // Reject now instead of letting the caller time out at the back of the queue
+    if (limiter_expected_wait_ms(prio) > timeout_ms) {
+        limiter->rejected++;
+        cl->rejected++;
+        lock_release(&limiter->lock);
+        LM_DBG("RPC queue drain time exceeds %u ms, rejecting %s request\n",
+                timeout_ms, limiter_class_names[prio]);
+        return -2;
+    }
+
+    for (int i = 0; i < limiter->queue_size; i++) {
+        if (limiter->waiters[i].ticket == 0) {
+            slot = &limiter->waiters[i];
+            break;
+        }
+    }
+    if (!slot) slot = limiter_evict(prio);
+    if (!slot) {
+        limiter->rejected++;
+        cl->rejected++;
+        lock_release(&limiter->lock);
+        LM_DBG("RPC queue full, rejecting %s request\n", limiter_class_names[prio]);
+        return -2;
+    }
+
+    now = w3_now_us();
+    deadline = now + (uint64_t)timeout_ms * 1000;
+    ticket = limiter->next_ticket++;
+    if (limiter->next_ticket == 0) limiter->next_ticket = 1;
+    slot->ticket = ticket;
+    slot->prio = prio;
+    slot->since_us = now;
+    slot->granted_us = 0;
+    limiter->queued++;
+    cl->queued++;
+    limiter_dispatch(now);
+    lock_release(&limiter->lock);
+
+    for (;;) {
+        usleep(poll_us);
+        if (poll_us < LIMITER_POLL_MAX_US) poll_us *= 2;
+
+        lock_get(&limiter->lock);
+        if (slot->ticket != ticket) {
+            // A higher priority caller took our place, or we claimed too late
+            lock_release(&limiter->lock);
+            LM_DBG("Evicted from the RPC queue by a higher priority request\n");
+            return -2;
+        }
+        now = w3_now_us();
+        // Slots freed by release() are granted there; this catches grants
+        // to expire and room left by a grown limit
+        if (!slot->granted_us) limiter_dispatch(now);
+        if (slot->granted_us) {
+            // The slot was counted in flight when it was granted
+            slot->ticket = 0;
+            limiter->admitted++;
+            limiter->waited++;
+            cl->admitted++;
+            if (now - slot->since_us > cl->max_wait_us) cl->max_wait_us = now - slot->since_us;
+            lock_release(&limiter->lock);
+            return 0;
+        }
+        if (now >= deadline) {
+            slot->ticket = 0;
+            limiter->queued--;
+            limiter->shed++;
+            cl->queued--;
+            cl->shed++;
+            lock_release(&limiter->lock);
+            LM_DBG("RPC queue wait timed out after %u ms, shedding %s request\n",
+                    timeout_ms, limiter_class_names[prio]);
+            return -1;
+        }
+        lock_release(&limiter->lock);
+    }
+}
+
+void w3_limiter_release(uint64_t rtt_us, int ok) {
+    double queue_est;
+    int used;
+    uint64_t now;
+
+    if (!limiter) return;
+
+    lock_get(&limiter->lock);
+
+    used = limiter->inflight;
+    if (limiter->inflight > 0) limiter->inflight--;
+
+    now = w3_now_us();
+    limiter->rate_count++;
+    if (now - limiter->rate_since_us >= LIMITER_RATE_WINDOW) {
+        double sample = limiter->rate_count * 1000000.0 / (double)(now - limiter->rate_since_us);
+        limiter->completion_rate = limiter->completion_rate > 0
+                ? limiter->completion_rate * 0.7 + sample * 0.3 : sample;
+        limiter->rate_since_us = now;
+        limiter->rate_count = 0;
+    }
+
+    if (!ok) {
+        limiter->errors++;
+        limiter->limit *= LIMITER_ERROR_BACKOFF;
+    } else if (rtt_us > 0) {
+        limiter->srtt_us = limiter->srtt_us ? (limiter->srtt_us * 7 + rtt_us) / 8 : rtt_us;
+
+        // Let the base RTT float up again after a while, e.g. after a route change
+        if (now - limiter->min_rtt_since_us > LIMITER_MIN_RTT_WINDOW) {
+            limiter->min_rtt_us = limiter->srtt_us;
+            limiter->min_rtt_since_us = now;
+        }
+        if (limiter->min_rtt_us == 0 || rtt_us < limiter->min_rtt_us) {
+            limiter->min_rtt_us = rtt_us;
+        }
+
+        queue_est = limiter->limit * (1.0 - (double)limiter->min_rtt_us / (double)limiter->srtt_us);
+        if (queue_est < LIMITER_VEGAS_ALPHA) {
+            // Only grow when the current limit is actually being used
+            if (used * 2 >= (int)limiter->limit) limiter->limit += 1.0;
+        } else if (queue_est > LIMITER_VEGAS_BETA) {
+            limiter->limit -= 1.0;
+        }
+    }
+
+    if (limiter->limit < limiter->min_limit) limiter->limit = limiter->min_limit;
+    if (limiter->limit > limiter->max_limit) limiter->limit = limiter->max_limit;
+
+    limiter_dispatch(now);
+    lock_release(&limiter->lock);
+}
+
+void w3_limiter_cancel(void) {
+    if (!limiter) return;
+
+    lock_get(&limiter->lock);
+    if (limiter->inflight > 0) limiter->inflight--;
+    limiter_dispatch(w3_now_us());
+    lock_release(&limiter->lock);
+}
+
+int w3_limiter_retry_after(int min_s, int max_s, int jitter_pct) {
+    double rate, backlog;
+    int secs;
+
+    if (!limiter) return min_s;
+
+    lock_get(&limiter->lock);
+    rate = limiter_service_rate();
+    backlog = limiter->queued + limiter->inflight;
+    lock_release(&limiter->lock);
+
+    // Before the first round trip there is no rate to go by, and sending
+    // everyone away for max_s would be a long outage at a cold start
+    secs = rate > 0 ? (int)(backlog / rate + 0.999) : min_s;
+    if (secs < min_s) secs = min_s;
+    if (jitter_pct > 0 && secs > 0) {
+        // Spread the retries so a shed wave does not come back in lockstep
+        secs += fastrand_max(secs * jitter_pct / 100 + 1);
+    }
+    if (secs > max_s) secs = max_s;
+    return secs;
+}
+
+void w3_limiter_rpc_stats(rpc_t* rpc, void* ctx) {
+    void* th;
+    w3_limiter_t snap;
+
+    if (!limiter) {
+        rpc->fault(ctx, 500, "Limiter not initialized");
+        return;
+    }
+
+    lock_get(&limiter->lock);
+    memcpy(&snap, limiter, sizeof(snap));
+    lock_release(&limiter->lock);
+
+    if (rpc->add(ctx, "{", &th) < 0) {
+        rpc->fault(ctx, 500, "Internal error creating structure");
+        return;
+    }
+    rpc->struct_add(th, "dddddduufuuuuu",
+            "limit", (int)snap.limit,
+            "min_limit", snap.min_limit,
+            "max_limit", snap.max_limit,
+            "inflight", snap.inflight,
+            "queued", snap.queued,
+            "queue_size", snap.queue_size,
+            "min_rtt_us", (unsigned int)snap.min_rtt_us,
+            "srtt_us", (unsigned int)snap.srtt_us,
+            "completion_rate", snap.completion_rate,
+            "admitted", (unsigned int)snap.admitted,
+            "waited", (unsigned int)snap.waited,
+            "shed", (unsigned int)snap.shed,
+            "rejected", (unsigned int)snap.rejected,
+            "errors", (unsigned int)snap.errors);
+
+    for (int c = 0; c < W3_PRIO_CLASSES; c++) {
+        void* ch;
+        limiter_class_t* cl = &snap.classes[c];
+        if (rpc->struct_add(th, "{", limiter_class_names[c], &ch) < 0) continue;
+        rpc->struct_add(ch, "dduuuuu",
+                "weight", cl->weight,
+                "queued", cl->queued,
+                "admitted", (unsigned int)cl->admitted,
+                "shed", (unsigned int)cl->shed,
+                "rejected", (unsigned int)cl->rejected,
+                "evicted", (unsigned int)cl->evicted,
+                "max_wait_us", (unsigned int)cl->max_wait_us);
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Adaptive concurrency limiter for outstanding eth_call requests.
+ */
+
+#ifndef _WEB3_AUTH_LIMITER_H_
+#define _WEB3_AUTH_LIMITER_H_
+
+#include <stdint.h>
+
+#include "../../core/rpc.h"
+
+// Priority classes of queued calls, highest first
+#define W3_PRIO_HIGH 0
+#define W3_PRIO_NORMAL 1
+#define W3_PRIO_LOW 2
+#define W3_PRIO_CLASSES 3
+
+// Allocate the shared limiter state; must run in mod_init (before fork)
+int w3_limiter_init(int init_limit, int min_limit, int max_limit, int queue_size,
+        const int weights[W3_PRIO_CLASSES], int starvation_ms);
+void w3_limiter_destroy(void);
+
+// Map "high", "normal" or "low" to a priority class, -1 if unknown
+int w3_limiter_prio_by_name(const char* name, int len);
+
+// Wait for an RPC slot for at most timeout_ms. Returns 0 when admitted, -1
+// when the wait timed out and -2 when the queue is full (or the caller was
+// displaced by a higher class) or would not drain within timeout_ms.
+int w3_limiter_acquire(int prio, unsigned int timeout_ms);
+
+// Return a slot taken by w3_limiter_acquire() and feed the measured RTT.
+// ok is 0 when the call failed at transport level (timeout, HTTP error).
+void w3_limiter_release(uint64_t rtt_us, int ok);
+
+// Return a slot taken by w3_limiter_acquire() without having made the call
+void w3_limiter_cancel(void);
+
+// Seconds until the current backlog should have drained, min_s before the
+// first round trip, plus random jitter of up to jitter_pct percent, clamped
+// to [min_s, max_s]
+int w3_limiter_retry_after(int min_s, int max_s, int jitter_pct);
+
+void w3_limiter_rpc_stats(rpc_t* rpc, void* ctx);
+
+#endif
@@ -0,0 +1,314 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * RLP decoding and Merkle-Patricia proofs of accounts and storage.
+ *
+ * Ethereum state is a Merkle-Patricia trie keyed by keccak256(address);
+ * every account holds the root of its own storage trie, keyed by
+ * keccak256(slot). eth_getProof returns the trie nodes on the path to an
+ * account and to some of its slots, each node RLP-encoded and referenced
+ * from its parent by its keccak256 hash, or embedded when shorter than 32
+ * bytes. Walking that path from a trusted state root proves the values
+ * without trusting whoever served them, so credential slots read in bulk
+ * through any RPC provider or caching proxy can be checked locally.
+ */
+
+#include <string.h>
+
+#include "web3_auth_hex.h"
+#include "web3_auth_json.h"
+#include "web3_auth_keccak.h"
+#include "web3_auth_proof.h"
+
+// keccak256(rlp("")), the root of a trie without entries
+static const uint8_t empty_trie_root[32] = {
+    0x56, 0xe8, 0x1f, 0x17, 0x1b, 0xcc, 0x55, 0xa6, 0xff, 0x83, 0x45, 0xe6, 0x92, 0xc0, 0xf8, 0x6e,
+    0x5b, 0x48, 0xe0, 0x1b, 0x99, 0x6c, 0xad, 0xc0, 0x01, 0x62, 0x2f, 0xb5, 0xe3, 0x63, 0xb4, 0x21
+};
+
+// keccak256(""), the code hash of accounts without code
+static const uint8_t empty_code_hash[32] = {
+    0xc5, 0xd2, 0x46, 0x01, 0x86, 0xf7, 0x23, 0x3c, 0x92, 0x7e, 0x7d, 0xb2, 0xdc, 0xc7, 0x03, 0xc0,
+    0xe5, 0x00, 0xb6, 0x53, 0xca, 0x82, 0x27, 0x3b, 0x7b, 0xfa, 0xd8, 0x04, 0x5d, 0x85, 0xa4, 0x70
+};
+
+long w3_rlp_item(const uint8_t* in, size_t len, w3_rlp_t* item) {
+    size_t head = 1, size = 0, lenlen;
+    uint8_t b;
+
+    if (len == 0) return -1;
+    b = in[0];
+
+    if (b < 0x80) {
+        item->data = in;
+        item->len = 1;
+        item->list = 0;
+        return 1;
+    }
+
+    item->list = b >= 0xc0;
+    if (b >= 0xc0) b -= 0x40;   // same layout for lists, 0x40 higher
+
+    if (b <= 0xb7) {
+        size = b - 0x80;
+    } else {
+        lenlen = b - 0xb7;
+        if (lenlen > sizeof(size_t) || 1 + lenlen > len || in[1] == 0) return -1;
+        for (size_t i = 0; i < lenlen; i++) size = size << 8 | in[1 + i];
+        if (size < 56) return -1;
+        head += lenlen;
+    }
+    if (size > len - head) return -1;
+
+    // A single byte below 0x80 encodes as itself, never as a string of one
+    if (!item->list && size == 1 && in[head] < 0x80) return -1;
+
+    item->data = in + head;
+    item->len = size;
+    return (long)(head + size);
+}
+
+int w3_rlp_list(const w3_rlp_t* list, w3_rlp_t* items, int max) {
+    size_t pos = 0;
+    long used;
+    int n = 0;
+
+    if (!list->list) return -1;
+    while (pos < list->len) {
+        if (n == max) return -1;
+        used = w3_rlp_item(list->data + pos, list->len - pos, &items[n++]);
+        if (used < 0) return -1;
+        pos += used;
+    }
+    return n;
+}
+
+static inline int nibble(const uint8_t* bytes, int i) {
+    return i & 1 ? bytes[i / 2] & 0x0f : bytes[i / 2] >> 4;
+}
+
+int w3_mpt_verify(const uint8_t root[32], const uint8_t* key, size_t key_len,
+        const w3_rlp_t* nodes, int nnodes, w3_rlp_t* value) {
+    uint8_t path[32], hash[32];
+    w3_rlp_t items[17], node, ref;
+    int pos = 0, next = 0, n, flag, plen;
+
+    if (memcmp(root, empty_trie_root, 32) == 0) return 0;
+    keccak256(key, key_len, path);
+
+    ref.data = root;
+    ref.len = 32;
+    ref.list = 0;
+    for (;;) {
+        // Resolve the reference: the next proof node by hash, or embedded
+        if (ref.list) {
+            node = ref;
+        } else if (ref.len == 0) {
+            return 0;
+        } else if (ref.len == 32) {
+            if (next == nnodes) return -1;
+            keccak256(nodes[next].data, nodes[next].len, hash);
+            if (memcmp(hash, ref.data, 32) != 0) return -1;
+            if (w3_rlp_item(nodes[next].data, nodes[next].len, &node) != (long)nodes[next].len
+                    || !node.list) {
+                return -1;
+            }
+            next++;
+        } else {
+            return -1;
+        }
+
+        n = w3_rlp_list(&node, items, 17);
+        if (n == 17) {
+            // Branch: one child per nibble and a value ending here
+            if (pos == 64) {
+                if (items[16].list) return -1;
+                if (items[16].len == 0) return 0;
+                *value = items[16];
+                return 1;
+            }
+            ref = items[nibble(path, pos++)];
+            continue;
+        }
+        if (n != 2 || items[0].list || items[0].len == 0) return -1;
+
+        // Leaf or extension: hex-prefix encoded path, flag in the first nibble
+        flag = items[0].data[0] >> 4;
+        if (flag > 3 || (!(flag & 1) && (items[0].data[0] & 0x0f))) return -1;
+        plen = 2 * (int)items[0].len - 2 + (flag & 1);
+        for (int i = 0; i < plen; i++) {
+            if (pos + i == 64 || nibble(items[0].data, i + 2 - (flag & 1)) != nibble(path, pos + i)) {
+                return 0;
+            }
+        }
+        pos += plen;
+
+        if (flag & 2) {
+            if (pos != 64) return 0;
+            if (items[1].list) return -1;
+            *value = items[1];
+            return 1;
+        }
+        if (plen == 0) return -1;
+        ref = items[1];
+    }
+}
+
+// Big-endian integer of at most size bytes, right-aligned into out
+static int rlp_uint(const w3_rlp_t* item, uint8_t* out, size_t size) {
+    if (item->list || item->len > size || (item->len && item->data[0] == 0)) return -1;
+    memset(out, 0, size);
+    memcpy(out + size - item->len, item->data, item->len);
+    return 0;
+}
+
+int w3_proof_account(const uint8_t state_root[32], const uint8_t address[20],
+        const w3_rlp_t* nodes, int nnodes, w3_account_t* account) {
+    w3_rlp_t leaf, body, fields[4];
+    uint8_t nonce[8];
+    int rc;
+
+    memset(account, 0, sizeof(*account));
+    memcpy(account->storage_root, empty_trie_root, 32);
+    memcpy(account->code_hash, empty_code_hash, 32);
+
+    rc = w3_mpt_verify(state_root, address, 20, nodes, nnodes, &leaf);
+    if (rc <= 0) return rc;
+
+    // The leaf holds rlp([nonce, balance, storageRoot, codeHash])
+    if (w3_rlp_item(leaf.data, leaf.len, &body) != (long)leaf.len
+            || w3_rlp_list(&body, fields, 4) != 4
+            || rlp_uint(&fields[0], nonce, sizeof(nonce)) < 0
+            || rlp_uint(&fields[1], account->balance, 32) < 0
+            || fields[2].list || fields[2].len != 32 || fields[3].list || fields[3].len != 32) {
+        return -1;
+    }
+    account->exists = 1;
+    for (int i = 0; i < 8; i++) account->nonce = account->nonce << 8 | nonce[i];
+    memcpy(account->storage_root, fields[2].data, 32);
+    memcpy(account->code_hash, fields[3].data, 32);
+    return 0;
+}
+
+int w3_proof_storage(const uint8_t storage_root[32], const uint8_t slot[32],
+        const w3_rlp_t* nodes, int nnodes, uint8_t value[32]) {
+    w3_rlp_t leaf, word;
+    int rc;
+
+    memset(value, 0, 32);
+    rc = w3_mpt_verify(storage_root, slot, 32, nodes, nnodes, &leaf);
+    if (rc <= 0) return rc;
+
+    // The leaf holds the RLP of the word without leading zeros; zero
+    // words are deleted from the trie rather than stored
+    if (w3_rlp_item(leaf.data, leaf.len, &word) != (long)leaf.len || word.len == 0
+            || rlp_uint(&word, value, 32) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int w3_proof_mapping_slot(const uint8_t* key, size_t key_len, uint64_t slot, uint8_t out[32]) {
+    uint8_t in[W3_PROOF_MAX_KEY + 32];
+
+    if (key_len > W3_PROOF_MAX_KEY) return -1;
+    // Solidity hashes the key unpadded followed by the slot as a word
+    memcpy(in, key, key_len);
+    memset(in + key_len, 0, 24);
+    for (int i = 0; i < 8; i++) in[key_len + 24 + i] = slot >> (56 - 8 * i);
+    keccak256(in, key_len + 32, out);
+    return 0;
+}
+
+// Decode the array of "0x.." node strings at p into nodes, hex into *scratch
+static int proof_nodes(const char* p, const char* end, w3_rlp_t* nodes, uint8_t** scratch) {
+    const char* hex;
+    long digits;
+    int n = 0;
+
+    if (*p != '[') return -1;
+    end = w3_json_skip(p, end);
+    for (p++; p < end; ) {
+        if (*p != '"') {
+            if (*p == ']') return n;
+            p++;
+            continue;
+        }
+        digits = w3_json_hex(p, end, &hex);
+        if (digits <= 0 || n == W3_PROOF_MAX_NODES || w3_hex_decode(hex, digits, *scratch) < 0) {
+            return -1;
+        }
+        nodes[n].data = *scratch;
+        nodes[n].len = digits / 2;
+        nodes[n].list = 0;
+        *scratch += digits / 2;
+        n++;
+        p = w3_json_skip(p, end);
+    }
+    return -1;
+}
+
+// Storage key of a proof entry; nodes echo the requested form, which may
+// drop leading zeros
+static int proof_slot_key(const char* p, const char* end, uint8_t key[32]) {
+    char padded[64];
+    const char* hex;
+    long digits = w3_json_hex(p, end, &hex);
+
+    if (digits <= 0 || digits > 64) return -1;
+    memset(padded, '0', sizeof(padded));
+    memcpy(padded + 64 - digits, hex, digits);
+    return w3_hex_decode(padded, 64, key);
+}
+
+int w3_proof_verify_response(const char* json, size_t len, const uint8_t state_root[32],
+        const uint8_t address[20], const uint8_t (*slots)[32], int nslots,
+        w3_account_t* account, uint8_t (*values)[32], uint8_t* scratch) {
+    const char* end = json + len;
+    const char* result = w3_json_member(json, end, "result");
+    const char* result_end;
+    const char* v;
+    const char* p;
+    const char* entry_end;
+    w3_rlp_t nodes[W3_PROOF_MAX_NODES];
+    uint8_t key[32];
+    int n, found = 0;
+    uint32_t seen = 0;
+
+    if (!result || *result != '{' || nslots > W3_PROOF_MAX_SLOTS) return -1;
+    result_end = w3_json_skip(result, end);
+
+    v = w3_json_member(result + 1, result_end, "accountProof");
+    if (!v || (n = proof_nodes(v, result_end, nodes, &scratch)) < 0
+            || w3_proof_account(state_root, address, nodes, n, account) < 0) {
+        return -1;
+    }
+
+    v = w3_json_member(result + 1, result_end, "storageProof");
+    if (!v || *v != '[') return -1;
+    end = w3_json_skip(v, result_end);
+
+    // One object per slot: {"key": .., "value": .., "proof": [..]}
+    for (p = v + 1; p < end && found < nslots; p = entry_end) {
+        if (*p != '{') {
+            entry_end = p + 1;
+            continue;
+        }
+        entry_end = w3_json_skip(p, end);
+        v = w3_json_member(p + 1, entry_end, "key");
+        if (!v || proof_slot_key(v, entry_end, key) < 0) return -1;
+
+        for (int i = 0; i < nslots; i++) {
+            if ((seen & (1u << i)) || memcmp(key, slots[i], 32) != 0) continue;
+            v = w3_json_member(p + 1, entry_end, "proof");
+            if (!v || (n = proof_nodes(v, entry_end, nodes, &scratch)) < 0
+                    || w3_proof_storage(account->storage_root, slots[i], nodes, n, values[i]) < 0) {
+                return -1;
+            }
+            seen |= 1u << i;
+            found++;
+            break;
+        }
+    }
+    return found == nslots ? 0 : -1;
+}
@@ -0,0 +1,67 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * RLP decoding and Merkle-Patricia proofs of accounts and storage.
+ */
+
+#ifndef _WEB3_AUTH_PROOF_H_
+#define _WEB3_AUTH_PROOF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define W3_PROOF_MAX_NODES 64       // trie nodes per proof, far above real depths
+#define W3_PROOF_MAX_SLOTS 16       // storage slots verified per answer
+#define W3_PROOF_MAX_KEY 256        // bytes of a mapping key, e.g. a username
+
+// An RLP item: a byte string, or the payload of a list
+typedef struct w3_rlp {
+    const uint8_t* data;
+    size_t len;
+    int list;
+} w3_rlp_t;
+
+// Decode the item at the start of in; returns the bytes it takes, or -1
+// when it is malformed, runs past len or is not canonically encoded
+long w3_rlp_item(const uint8_t* in, size_t len, w3_rlp_t* item);
+
+// Items of a list; returns their number, -1 when malformed or more than max
+int w3_rlp_list(const w3_rlp_t* list, w3_rlp_t* items, int max);
+
+// Walk the proof, RLP trie nodes from the root down, along keccak256(key).
+// 1 and the leaf value when the key is in the trie, 0 when the proof shows
+// it is not, -1 when the proof does not match root.
+int w3_mpt_verify(const uint8_t root[32], const uint8_t* key, size_t key_len,
+        const w3_rlp_t* nodes, int nnodes, w3_rlp_t* value);
+
+typedef struct w3_account {
+    int exists;
+    uint64_t nonce;
+    uint8_t balance[32];            // big-endian
+    uint8_t storage_root[32];
+    uint8_t code_hash[32];
+} w3_account_t;
+
+// Account of address under a trusted state root; 0 or -1 as w3_mpt_verify()
+int w3_proof_account(const uint8_t state_root[32], const uint8_t address[20],
+        const w3_rlp_t* nodes, int nnodes, w3_account_t* account);
+
+// Value of a storage slot as a big-endian word, zero when unset; 0 or -1
+// as w3_mpt_verify()
+int w3_proof_storage(const uint8_t storage_root[32], const uint8_t slot[32],
+        const w3_rlp_t* nodes, int nnodes, uint8_t value[32]);
+
+// Slot of mapping entry key in the mapping declared at slot, for string
+// and bytes keys: keccak256(key . uint256(slot)). Returns 0, or -1 for
+// keys longer than W3_PROOF_MAX_KEY.
+int w3_proof_mapping_slot(const uint8_t* key, size_t key_len, uint64_t slot, uint8_t out[32]);
+
+// Verify an eth_getProof answer for address against state_root and read
+// the requested slots from it. Hex is decoded into scratch, which must
+// hold half the length of json. Returns 0, or -1 when the answer is
+// malformed, lacks a slot or any proof fails.
+int w3_proof_verify_response(const char* json, size_t len, const uint8_t state_root[32],
+        const uint8_t address[20], const uint8_t (*slots)[32], int nslots,
+        w3_account_t* account, uint8_t (*values)[32], uint8_t* scratch);
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Token-bucket quotas on eth_call requests, globally and per realm.
+ *
+ * Providers enforce per-second request limits and bill per request, so every
+ * eth_call first takes a token from the global bucket and from the bucket of
+ * its realm. Realm buckets live in a small set-associative table; a realm
+ * that is not tracked yet starts with a full bucket and evicts the least
+ * recently used one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../core/dprint.h"
+#include "../../core/locking.h"
+#include "../../core/mem/shm_mem.h"
+
+#include "web3_auth.h"
+#include "web3_auth_quota.h"
+
+#define QUOTA_WAYS 4
+#define QUOTA_REALM_SIZE 64
+
+typedef struct {
+    double rate;      // tokens per second, 0 when disabled
+    double burst;
+    double tokens;
+    uint64_t refill_us;
+    unsigned long taken;
+    unsigned long rejected;
+} quota_bucket_t;
+
+typedef struct {
+    uint32_t hash;    // 0 marks a free entry
+    char realm[QUOTA_REALM_SIZE];
+    quota_bucket_t bucket;
+} quota_realm_t;
+
+typedef struct {
+    gen_lock_t lock;
+    quota_bucket_t global;
+    double realm_rate;
+    double realm_burst;
+    unsigned int sets;
+    quota_realm_t realms[];
+} quota_table_t;
+
+static quota_table_t* quota = NULL;
+
+int w3_quota_init(int global_rate, int global_burst, int realm_rate, int realm_burst,
+        int realm_slots) {
+    unsigned int sets = 0;
+    size_t bytes;
+
+    if (global_rate <= 0 && realm_rate <= 0) {
+        LM_INFO("RPC quotas disabled\n");
+        return 0;
+    }
+    if (realm_rate > 0) {
+        if (realm_slots < QUOTA_WAYS) realm_slots = QUOTA_WAYS;
+        sets = (realm_slots + QUOTA_WAYS - 1) / QUOTA_WAYS;
+    }
+
+    bytes = sizeof(quota_table_t) + (size_t)sets * QUOTA_WAYS * sizeof(quota_realm_t);
+    quota = shm_malloc(bytes);
+    if (!quota) {
+        LM_ERR("Not enough shared memory for the RPC quotas\n");
+        return -1;
+    }
+    memset(quota, 0, bytes);
+
+    if (!lock_init(&quota->lock)) {
+        LM_ERR("Failed to initialize RPC quota lock\n");
+        shm_free(quota);
+        quota = NULL;
+        return -1;
+    }
+
+    if (global_rate > 0) {
+        quota->global.rate = global_rate;
+        quota->global.burst = global_burst > 0 ? global_burst : global_rate;
+        quota->global.tokens = quota->global.burst;
+        quota->global.refill_us = w3_now_us();
+    }
+    if (realm_rate > 0) {
+        quota->realm_rate = realm_rate;
+        quota->realm_burst = realm_burst > 0 ? realm_burst : realm_rate;
+    }
+    quota->sets = sets;
+
+    LM_INFO("RPC quotas: global %d/s (burst %d), per realm %d/s (burst %d)\n",
+            global_rate, (int)quota->global.burst, realm_rate, (int)quota->realm_burst);
+    return 0;
+}
+
+void w3_quota_destroy(void) {
+    if (!quota) return;
+    lock_destroy(&quota->lock);
+    shm_free(quota);
+    quota = NULL;
+}
+
+static void quota_refill(quota_bucket_t* b, uint64_t now) {
+    if (now > b->refill_us) {
+        b->tokens += (double)(now - b->refill_us) * b->rate / 1000000.0;
+        if (b->tokens > b->burst) b->tokens = b->burst;
+    }
+    b->refill_us = now;
+}
+
+// Seconds until the bucket holds a whole token again
+static int quota_wait_s(quota_bucket_t* b) {
+    if (b->tokens >= 1.0) return 0;
+    return (int)((1.0 - b->tokens) / b->rate) + 1;
+}
+
+// Find or claim the bucket of a realm; called with the lock held
+static quota_bucket_t* quota_realm_bucket(const char* realm, uint64_t now) {
+    uint32_t h = w3_hash32(realm, strlen(realm));
+    quota_realm_t* set;
+    quota_realm_t* victim = NULL;
+
+    if (!h) h = 1;
+    set = &quota->realms[(h % quota->sets) * QUOTA_WAYS];
+    for (int i = 0; i < QUOTA_WAYS; i++) {
+        quota_realm_t* r = &set[i];
+        if (r->hash == h && strncmp(r->realm, realm, QUOTA_REALM_SIZE - 1) == 0) {
+            return &r->bucket;
+        }
+        if (!r->hash) {
+            if (!victim || victim->hash) victim = r;
+        } else if (!victim
+                || (victim->hash && r->bucket.refill_us < victim->bucket.refill_us)) {
+            victim = r;
+        }
+    }
+
+    memset(victim, 0, sizeof(*victim));
+    victim->hash = h;
+    strncpy(victim->realm, realm, QUOTA_REALM_SIZE - 1);
+    victim->bucket.rate = quota->realm_rate;
+    victim->bucket.burst = quota->realm_burst;
+    victim->bucket.tokens = quota->realm_burst;
+    victim->bucket.refill_us = now;
+    return &victim->bucket;
+}
+
+int w3_quota_take(const char* realm) {
+    quota_bucket_t* rb = NULL;
+    uint64_t now;
+    int wait = 0, w;
+
+    if (!quota) return 0;
+
+    now = w3_now_us();
+    lock_get(&quota->lock);
+
+    if (quota->global.rate > 0) {
+        quota_refill(&quota->global, now);
+        wait = quota_wait_s(&quota->global);
+    }
+    if (quota->sets && realm && *realm) {
+        rb = quota_realm_bucket(realm, now);
+        quota_refill(rb, now);
+        w = quota_wait_s(rb);
+        if (w > wait) wait = w;
+    }
+
+    if (wait) {
+        if (quota->global.rate > 0) quota->global.rejected++;
+        if (rb) rb->rejected++;
+    } else {
+        if (quota->global.rate > 0) {
+            quota->global.tokens -= 1.0;
+            quota->global.taken++;
+        }
+        if (rb) {
+            rb->tokens -= 1.0;
+            rb->taken++;
+        }
+    }
+
+    lock_release(&quota->lock);
+    return wait;
+}
+
+static void quota_rpc_bucket(rpc_t* rpc, void* th, const char* name, quota_bucket_t* b) {
+    rpc->struct_add(th, "sdddduu",
+            "name", name,
+            "rate", (int)b->rate,
+            "burst", (int)b->burst,
+            "tokens", (int)b->tokens,
+            "wait_s", quota_wait_s(b),
+            "taken", (unsigned int)b->taken,
+            "rejected", (unsigned int)b->rejected);
+}
+
+void w3_quota_rpc_stats(rpc_t* rpc, void* ctx) {
+    quota_bucket_t b;
+    char realm[QUOTA_REALM_SIZE];
+    void* th;
+    uint64_t now = w3_now_us();
+
+    if (!quota) {
+        rpc->fault(ctx, 500, "RPC quotas disabled");
+        return;
+    }
+
+    if (quota->global.rate > 0) {
+        lock_get(&quota->lock);
+        quota_refill(&quota->global, now);
+        b = quota->global;
+        lock_release(&quota->lock);
+        if (rpc->add(ctx, "{", &th) < 0) return;
+        quota_rpc_bucket(rpc, th, "global", &b);
+    }
+
+    for (unsigned int i = 0; i < quota->sets * QUOTA_WAYS; i++) {
+        lock_get(&quota->lock);
+        if (!quota->realms[i].hash) {
+            lock_release(&quota->lock);
+            continue;
+        }
+        quota_refill(&quota->realms[i].bucket, now);
+        b = quota->realms[i].bucket;
+        memcpy(realm, quota->realms[i].realm, QUOTA_REALM_SIZE);
+        lock_release(&quota->lock);
+        if (rpc->add(ctx, "{", &th) < 0) return;
+        quota_rpc_bucket(rpc, th, realm, &b);
+    }
+}
@@ -0,0 +1,24 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Token-bucket quotas on eth_call requests, globally and per realm.
+ */
+
+#ifndef _WEB3_AUTH_QUOTA_H_
+#define _WEB3_AUTH_QUOTA_H_
+
+#include "../../core/rpc.h"
+
+// Allocate the buckets; must run in mod_init (before fork). A rate of 0
+// disables the respective bucket, burst defaults to the rate.
+int w3_quota_init(int global_rate, int global_burst, int realm_rate, int realm_burst,
+        int realm_slots);
+void w3_quota_destroy(void);
+
+// Take one token from the global and the realm bucket. Returns 0 on success,
+// otherwise the seconds until both buckets can serve a call again.
+int w3_quota_take(const char* realm);
+
+void w3_quota_rpc_stats(rpc_t* rpc, void* ctx);
+
+#endif
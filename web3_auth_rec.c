@@ -0,0 +1,244 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Recorder of authentication traffic, started and stopped over RPC.
+ *
+ * Cache sizes, batching windows and worker counts are best judged against
+ * the real shape of the traffic: which users come back how often, how
+ * bursty arrivals are and how long the node takes. While a recording runs,
+ * every finished check is appended to a trace file as one fixed-size record
+ * (see web3_auth_trace.h) that bench_replay plays back. The RPC command
+ * writes the header and publishes the file in shm; each worker notices the
+ * new generation on its next check, opens the file for appending and writes
+ * its records with one write() each, which O_APPEND keeps whole. Names are
+ * hashed with keccak256 under a key drawn per recording and kept in shm
+ * only. Outside a recording a check costs one shm read.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+#include "../../core/dprint.h"
+#include "../../core/locking.h"
+#include "../../core/atomic_ops.h"
+#include "../../core/mem/shm_mem.h"
+#include "../../core/pt.h"
+
+#include "web3_auth.h"
+#include "web3_auth_rec.h"
+#include "web3_auth_keccak.h"
+
+#define REC_FILE_SIZE 256
+#define REC_KEY_SIZE 32
+#define REC_NAME_SIZE 256
+
+typedef struct {
+    gen_lock_t lock;                // start and stop
+    volatile int active;
+    volatile unsigned int generation; // changes on every start and stop
+    uint64_t start_us;
+    uint64_t started_ms;
+    uint8_t key[REC_KEY_SIZE];
+    char file[REC_FILE_SIZE];
+    long records;
+    long errors;
+} rec_state_t;
+
+static rec_state_t* rec = NULL;
+static int rec_fd = -1;             // this process' descriptor of the trace
+static unsigned int rec_generation = 0;
+
+int w3_rec_init(void) {
+    rec = shm_malloc(sizeof(rec_state_t));
+    if (!rec) {
+        LM_ERR("Not enough shared memory for the traffic recorder\n");
+        return -1;
+    }
+    memset(rec, 0, sizeof(rec_state_t));
+
+    if (!lock_init(&rec->lock)) {
+        LM_ERR("Failed to initialize traffic recorder lock\n");
+        shm_free(rec);
+        rec = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void w3_rec_destroy(void) {
+    if (rec_fd >= 0) close(rec_fd);
+    rec_fd = -1;
+    if (!rec) return;
+    lock_destroy(&rec->lock);
+    shm_free(rec);
+    rec = NULL;
+}
+
+int w3_rec_enabled(void) {
+    return rec && rec->active;
+}
+
+// Keyed hash of a value and optionally a name after a separator
+static uint64_t rec_hash(const void* a, size_t alen, const char* b) {
+    uint8_t buf[REC_KEY_SIZE + 2 * REC_NAME_SIZE + 1];
+    uint8_t hash[32];
+    size_t len = REC_KEY_SIZE;
+    uint64_t h;
+
+    if (alen > REC_NAME_SIZE) alen = REC_NAME_SIZE;
+
+    memcpy(buf, rec->key, REC_KEY_SIZE);
+    memcpy(buf + len, a, alen);
+    len += alen;
+    if (b) {
+        size_t blen = strnlen(b, REC_NAME_SIZE);
+
+        buf[len++] = '@';
+        memcpy(buf + len, b, blen);
+        len += blen;
+    }
+    keccak256(buf, len, hash);
+    memcpy(&h, hash, sizeof(h));
+    return h;
+}
+
+// Follow starts and stops published by the RPC command
+static void rec_follow(void) {
+    unsigned int generation = rec->generation;
+
+    if (generation == rec_generation) return;
+    membar_read();
+    if (rec_fd >= 0) close(rec_fd);
+    rec_fd = -1;
+    rec_generation = generation;
+    if (!rec->active) return;
+
+    rec_fd = open(rec->file, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (rec_fd < 0) {
+        LM_ERR("Cannot append to trace %s: %s\n", rec->file, strerror(errno));
+    }
+}
+
+void w3_rec_auth(const char* user, const char* realm, uint64_t key, int prio, int source,
+        uint32_t rpc_us, uint64_t arrival_us, int result) {
+    w3_trace_rec_t r = {0};
+
+    if (!rec) return;
+    rec_follow();
+    if (rec_fd < 0 || !rec->active) return;
+
+    r.t_us = arrival_us > rec->start_us ? arrival_us - rec->start_us : 0;
+    r.key = rec_hash(&key, sizeof(key), NULL);
+    r.user = rec_hash(user, strlen(user), realm);
+    r.realm = (uint32_t)rec_hash(realm, strlen(realm), NULL);
+    r.rpc_us = rpc_us;
+    r.total_us = (uint32_t)(w3_now_us() - arrival_us);
+    r.proc = (uint16_t)process_no;
+    r.prio = (uint8_t)prio;
+    r.source = (uint8_t)source;
+    r.result = (int8_t)result;
+
+    if (write(rec_fd, &r, sizeof(r)) == (ssize_t)sizeof(r)) {
+        atomic_inc_long(&rec->records);
+    } else {
+        atomic_inc_long(&rec->errors);
+    }
+}
+
+// Create the trace with its header and publish it; never overwrites a file,
+// so a mistyped path cannot destroy one. Called with the lock held
+static int rec_start(const char* file) {
+    w3_trace_header_t h;
+    int fd;
+
+    if (strlen(file) >= REC_FILE_SIZE) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (getrandom(rec->key, REC_KEY_SIZE, 0) != REC_KEY_SIZE) return -1;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, W3_TRACE_MAGIC, sizeof(h.magic));
+    h.started_ms = w3_realtime_ms();
+    h.record_size = sizeof(w3_trace_rec_t);
+    fd = open(file, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0640);
+    if (fd < 0) return -1;
+    if (write(fd, &h, sizeof(h)) != (ssize_t)sizeof(h)) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    strcpy(rec->file, file);
+    rec->start_us = w3_now_us();
+    rec->started_ms = h.started_ms;
+    rec->records = 0;
+    rec->errors = 0;
+    membar_write();
+    rec->active = 1;
+    rec->generation++;
+    return 0;
+}
+
+// RPC: web3_auth.record [start <file> | stop]
+void w3_rec_rpc(rpc_t* rpc, void* ctx) {
+    char* cmd = NULL;
+    char* file = NULL;
+    void* th;
+    int n;
+
+    if (!rec) {
+        rpc->fault(ctx, 500, "Traffic recorder not initialized");
+        return;
+    }
+
+    n = rpc->scan(ctx, "*ss", &cmd, &file);
+    if (n >= 1 && strcmp(cmd, "start") == 0) {
+        if (n < 2) {
+            rpc->fault(ctx, 400, "Missing trace file");
+            return;
+        }
+        lock_get(&rec->lock);
+        if (rec->active) {
+            lock_release(&rec->lock);
+            rpc->fault(ctx, 409, "Already recording, stop first");
+            return;
+        }
+        if (rec_start(file) < 0) {
+            lock_release(&rec->lock);
+            rpc->fault(ctx, errno == EEXIST ? 409 : 500, errno == EEXIST
+                    ? "Trace file exists" : "Cannot create trace file");
+            LM_ERR("Cannot create trace %s: %s\n", file, strerror(errno));
+            return;
+        }
+        lock_release(&rec->lock);
+        LM_INFO("Recording authentication traffic to %s\n", file);
+    } else if (n >= 1 && strcmp(cmd, "stop") == 0) {
+        lock_get(&rec->lock);
+        if (rec->active) {
+            rec->active = 0;
+            rec->generation++;
+            LM_INFO("Stopped recording to %s, %ld records\n", rec->file, rec->records);
+        }
+        lock_release(&rec->lock);
+    } else if (n >= 1) {
+        rpc->fault(ctx, 400, "Expected start <file> or stop");
+        return;
+    }
+
+    if (rpc->add(ctx, "{", &th) < 0) {
+        rpc->fault(ctx, 500, "Internal error creating structure");
+        return;
+    }
+    rpc->struct_add(th, "dsuud",
+            "active", rec->active,
+            "file", rec->file,
+            "records", (unsigned int)rec->records,
+            "errors", (unsigned int)rec->errors,
+            "seconds", rec->active ? (int)((w3_now_us() - rec->start_us) / 1000000) : 0);
+}
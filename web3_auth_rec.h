@@ -0,0 +1,30 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Recorder of authentication traffic, started and stopped over RPC.
+ */
+
+#ifndef _WEB3_AUTH_REC_H_
+#define _WEB3_AUTH_REC_H_
+
+#include <stdint.h>
+
+#include "../../core/rpc.h"
+
+#include "web3_auth_trace.h"
+
+// Allocate the recorder state; must run in mod_init (before fork)
+int w3_rec_init(void);
+void w3_rec_destroy(void);
+
+// 1 while a recording runs, so callers skip collecting what it needs
+int w3_rec_enabled(void);
+
+// Append one finished check; arrival_us is w3_now_us() when it started
+void w3_rec_auth(const char* user, const char* realm, uint64_t key, int prio, int source,
+        uint32_t rpc_us, uint64_t arrival_us, int result);
+
+// RPC: web3_auth.record [start <file> | stop]
+void w3_rec_rpc(rpc_t* rpc, void* ctx);
+
+#endif
@@ -0,0 +1,403 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Replication of digest cache changes between nodes.
+ *
+ * A phone that fails over to another node of the cluster would otherwise
+ * cost that node a fresh contract lookup. Workers queue every cache insert,
+ * absent user and flush in a shm ring; the replication process sends the
+ * queue in UDP datagrams to each peer and applies the datagrams of the
+ * peers to the local cache. Records carry the wall-clock time of the
+ * contract answer at its origin: receivers keep the newer of two answers
+ * and let replicated ones expire when they would on their origin, so lost,
+ * duplicated or reordered datagrams leave the caches consistent. Nodes
+ * need synchronized clocks and the same routing file, whose tenant ids
+ * are the cache partitions.
+ *
+ * Datagram: header, records, MAC.
+ *   header  "W3R" 1 | node id (4) | records (2) | 0 (2) | sent at, ms (8)
+ *   record  type (1) | 0 (3) | partition (4) | key (8) | version (8) | digest (16)
+ *   MAC     first 16 bytes of keccak256(secret | header | records)
+ * Integers are big-endian. Datagrams more than W3_REPL_MAX_AGE_MS old are
+ * ignored, which bounds replays to the cache lifetime anyway.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "../../core/dprint.h"
+#include "../../core/locking.h"
+#include "../../core/atomic_ops.h"
+#include "../../core/mem/shm_mem.h"
+
+#include "web3_auth.h"
+#include "web3_auth_cache.h"
+#include "web3_auth_hex.h"
+#include "web3_auth_keccak.h"
+#include "web3_auth_repl.h"
+
+#define REPL_MAX_PEERS 16
+#define REPL_SECRET_SIZE 64
+#define REPL_SECRET_MIN 16
+#define REPL_MTU 1400
+#define REPL_HEADER_SIZE 20
+#define REPL_RECORD_SIZE 40
+#define REPL_MAC_SIZE 16
+#define REPL_BATCH ((REPL_MTU - REPL_HEADER_SIZE - REPL_MAC_SIZE) / REPL_RECORD_SIZE)
+#define REPL_RECV_BUDGET 256    // datagrams handled per tick
+
+typedef struct {
+    uint8_t type;
+    unsigned int partition;
+    uint64_t key;
+    uint64_t version;
+    uint8_t digest[W3_DIGEST_SIZE];
+} repl_record_t;
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t len;
+    char name[64];
+} repl_addr_t;
+
+typedef struct {
+    gen_lock_t lock;                // queue
+    unsigned int node;
+    repl_addr_t listen;
+    repl_addr_t peers[REPL_MAX_PEERS];
+    int npeers;
+    size_t secret_len;
+    uint8_t secret[REPL_SECRET_SIZE];
+    volatile long records_sent;
+    volatile long datagrams_sent;
+    volatile long send_errors;
+    volatile long datagrams_received;
+    volatile long records_applied;
+    volatile long records_ignored;  // older than what the cache holds
+    volatile long rejected;         // bad MAC, format or age
+    volatile long dropped;          // queue full
+    unsigned int size;
+    unsigned int head;              // next record to send
+    unsigned int count;
+    repl_record_t queue[];
+} repl_t;
+
+static repl_t* repl = NULL;
+static int repl_fd = -1;            // replication process only
+
+static void put_u16(uint8_t* p, unsigned int v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+    put_u16(p, v >> 16);
+    put_u16(p + 2, v & 0xffff);
+}
+
+static void put_u64(uint8_t* p, uint64_t v) {
+    put_u32(p, v >> 32);
+    put_u32(p + 4, (uint32_t)v);
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint64_t get_u64(const uint8_t* p) {
+    return (uint64_t)get_u32(p) << 32 | get_u32(p + 4);
+}
+
+// "host:port" or "[v6]:port" into addr
+static int repl_parse_addr(const char* s, size_t len, repl_addr_t* addr) {
+    char host[64];
+    const char* colon;
+    const char* port;
+    struct addrinfo hints, *res;
+    int err;
+
+    while (len && (*s == ' ' || *s == '\t')) s++, len--;
+    while (len && (s[len - 1] == ' ' || s[len - 1] == '\t')) len--;
+    if (len == 0 || len >= sizeof(addr->name)) return -1;
+    memcpy(addr->name, s, len);
+    addr->name[len] = '\0';
+
+    colon = strrchr(addr->name, ':');
+    if (!colon || colon == addr->name) return -1;
+    port = colon + 1;
+    if (addr->name[0] == '[') {
+        if (colon[-1] != ']') return -1;
+        len = colon - addr->name - 2;
+        memcpy(host, addr->name + 1, len);
+    } else {
+        len = colon - addr->name;
+        memcpy(host, addr->name, len);
+    }
+    host[len] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    if ((err = getaddrinfo(host, port, &hints, &res)) != 0) {
+        LM_ERR("Cannot resolve replication address '%s': %s\n", addr->name, gai_strerror(err));
+        return -1;
+    }
+    memcpy(&addr->addr, res->ai_addr, res->ai_addrlen);
+    addr->len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+int w3_repl_init(const char* listen, const char* peers, const char* secret, int queue_size) {
+    const char* p;
+    const char* comma;
+    size_t bytes;
+
+    if (!listen || !*listen) return 0;
+    if (!peers || !*peers) {
+        LM_ERR("repl_listen set without repl_peers\n");
+        return -1;
+    }
+    if (queue_size <= 0) queue_size = 1024;
+    // Whoever can send an accepted datagram can plant a digest for any user
+    if (!secret || strlen(secret) < REPL_SECRET_MIN) {
+        LM_ERR("repl_listen needs a repl_secret of at least %d bytes\n", REPL_SECRET_MIN);
+        return -1;
+    }
+    if (strlen(secret) > REPL_SECRET_SIZE) {
+        LM_ERR("repl_secret longer than %d bytes\n", REPL_SECRET_SIZE);
+        return -1;
+    }
+
+    bytes = sizeof(repl_t) + (size_t)queue_size * sizeof(repl_record_t);
+    repl = shm_malloc(bytes);
+    if (!repl) {
+        LM_ERR("Not enough shared memory for the replication queue\n");
+        return -1;
+    }
+    memset(repl, 0, bytes);
+    repl->size = queue_size;
+    if (!lock_init(&repl->lock)) goto error;
+
+    if (repl_parse_addr(listen, strlen(listen), &repl->listen) < 0) goto error;
+    for (p = peers; *p; p = *comma ? comma + 1 : comma) {
+        comma = strchr(p, ',');
+        if (!comma) comma = p + strlen(p);
+        if (comma == p) continue;
+        if (repl->npeers == REPL_MAX_PEERS) {
+            LM_ERR("More than %d replication peers\n", REPL_MAX_PEERS);
+            goto error;
+        }
+        if (repl_parse_addr(p, comma - p, &repl->peers[repl->npeers]) < 0) goto error;
+        if (repl->peers[repl->npeers].addr.ss_family != repl->listen.addr.ss_family) {
+            LM_ERR("Replication peer %s is not of the address family of repl_listen\n",
+                    repl->peers[repl->npeers].name);
+            goto error;
+        }
+        repl->npeers++;
+    }
+
+    repl->secret_len = strlen(secret);
+    memcpy(repl->secret, secret, repl->secret_len);
+
+    // Tells our own datagrams apart when a node lists itself as a peer
+    repl->node = w3_hash32(repl->listen.name, strlen(repl->listen.name))
+            ^ (uint32_t)getpid() ^ (uint32_t)w3_now_us();
+
+    LM_INFO("Cache replication: %s to %d peers, queue of %d records\n", repl->listen.name,
+            repl->npeers, queue_size);
+    return 0;
+
+error:
+    shm_free(repl);
+    repl = NULL;
+    return -1;
+}
+
+void w3_repl_destroy(void) {
+    if (repl) {
+        lock_destroy(&repl->lock);
+        shm_free(repl);
+        repl = NULL;
+    }
+}
+
+int w3_repl_enabled(void) {
+    return repl != NULL;
+}
+
+void w3_repl_record(int type, unsigned int partition, uint64_t key, uint64_t version,
+        const uint8_t* digest) {
+    repl_record_t* r;
+
+    if (!repl) return;
+
+    lock_get(&repl->lock);
+    if (repl->count == repl->size) {
+        lock_release(&repl->lock);
+        atomic_inc_long(&repl->dropped);
+        return;
+    }
+    r = &repl->queue[(repl->head + repl->count) % repl->size];
+    r->type = type;
+    r->partition = partition;
+    r->key = key;
+    r->version = version;
+    if (digest) memcpy(r->digest, digest, W3_DIGEST_SIZE);
+    else memset(r->digest, 0, W3_DIGEST_SIZE);
+    repl->count++;
+    lock_release(&repl->lock);
+}
+
+static void repl_mac(const uint8_t* data, size_t len, uint8_t mac[REPL_MAC_SIZE]) {
+    uint8_t buf[REPL_SECRET_SIZE + REPL_MTU];
+    uint8_t hash[32];
+
+    memcpy(buf, repl->secret, repl->secret_len);
+    memcpy(buf + repl->secret_len, data, len);
+    keccak256(buf, repl->secret_len + len, hash);
+    memcpy(mac, hash, REPL_MAC_SIZE);
+}
+
+static int repl_open(void) {
+    int fd = socket(repl->listen.addr.ss_family, SOCK_DGRAM, 0);
+    int on = 1;
+
+    if (fd < 0) {
+        LM_ERR("Cannot create the replication socket: %s\n", strerror(errno));
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr*)&repl->listen.addr, repl->listen.len) < 0) {
+        LM_ERR("Cannot bind the replication socket to %s: %s\n", repl->listen.name,
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Send up to REPL_BATCH queued records to every peer; returns their number
+static int repl_send_batch(void) {
+    uint8_t pkt[REPL_MTU];
+    uint8_t* p = pkt + REPL_HEADER_SIZE;
+    repl_record_t* r;
+    int n = 0;
+
+    lock_get(&repl->lock);
+    while (repl->count && n < REPL_BATCH) {
+        r = &repl->queue[repl->head];
+        p[0] = r->type;
+        p[1] = p[2] = p[3] = 0;
+        put_u32(p + 4, r->partition);
+        put_u64(p + 8, r->key);
+        put_u64(p + 16, r->version);
+        memcpy(p + 24, r->digest, W3_DIGEST_SIZE);
+        p += REPL_RECORD_SIZE;
+        repl->head = (repl->head + 1) % repl->size;
+        repl->count--;
+        n++;
+    }
+    lock_release(&repl->lock);
+    if (n == 0) return 0;
+
+    memcpy(pkt, "W3R\1", 4);
+    put_u32(pkt + 4, repl->node);
+    put_u16(pkt + 8, n);
+    put_u16(pkt + 10, 0);
+    put_u64(pkt + 12, w3_realtime_ms());
+    repl_mac(pkt, p - pkt, p);
+    p += REPL_MAC_SIZE;
+
+    for (int i = 0; i < repl->npeers; i++) {
+        if (sendto(repl_fd, pkt, p - pkt, 0, (struct sockaddr*)&repl->peers[i].addr,
+                repl->peers[i].len) < 0) {
+            atomic_inc_long(&repl->send_errors);
+            LM_DBG("Replication to %s failed: %s\n", repl->peers[i].name, strerror(errno));
+        } else {
+            atomic_inc_long(&repl->datagrams_sent);
+        }
+    }
+    atomic_add_long(&repl->records_sent, n);
+    return n;
+}
+
+static void repl_receive(const uint8_t* pkt, size_t len) {
+    uint8_t mac[REPL_MAC_SIZE];
+    const uint8_t* p;
+    uint64_t sent, now;
+    unsigned int n;
+
+    if (len < REPL_HEADER_SIZE + REPL_MAC_SIZE || memcmp(pkt, "W3R\1", 4) != 0) goto reject;
+    n = pkt[8] << 8 | pkt[9];
+    if (len != REPL_HEADER_SIZE + n * REPL_RECORD_SIZE + REPL_MAC_SIZE) goto reject;
+    repl_mac(pkt, len - REPL_MAC_SIZE, mac);
+    if (!w3_digest_equal(mac, pkt + len - REPL_MAC_SIZE, REPL_MAC_SIZE)) goto reject;
+    if (get_u32(pkt + 4) == repl->node) return;
+
+    sent = get_u64(pkt + 12);
+    now = w3_realtime_ms();
+    if (sent + W3_REPL_MAX_AGE_MS < now || sent > now + W3_REPL_MAX_AGE_MS) goto reject;
+
+    atomic_inc_long(&repl->datagrams_received);
+    for (p = pkt + REPL_HEADER_SIZE; n--; p += REPL_RECORD_SIZE) {
+        if (w3_cache_apply(p[0], get_u32(p + 4), get_u64(p + 8), get_u64(p + 16), p + 24)) {
+            atomic_inc_long(&repl->records_applied);
+        } else {
+            atomic_inc_long(&repl->records_ignored);
+        }
+    }
+    return;
+
+reject:
+    atomic_inc_long(&repl->rejected);
+}
+
+void w3_repl_timer(unsigned int ticks, void* param) {
+    uint8_t pkt[REPL_MTU];
+    ssize_t len;
+
+    (void)ticks;
+    (void)param;
+    if (!repl) return;
+    if (repl_fd < 0 && (repl_fd = repl_open()) < 0) return;
+
+    while (repl_send_batch() == REPL_BATCH);
+
+    for (int i = 0; i < REPL_RECV_BUDGET; i++) {
+        len = recv(repl_fd, pkt, sizeof(pkt), MSG_DONTWAIT);
+        if (len < 0) break;
+        repl_receive(pkt, len);
+    }
+}
+
+void w3_repl_rpc_stats(rpc_t* rpc, void* ctx) {
+    void* th;
+
+    if (!repl) {
+        rpc->fault(ctx, 500, "Cache replication disabled");
+        return;
+    }
+    if (rpc->add(ctx, "{", &th) < 0) {
+        rpc->fault(ctx, 500, "Internal error creating structure");
+        return;
+    }
+    rpc->struct_add(th, "sduuuuuuuuu",
+            "listen", repl->listen.name,
+            "peers", repl->npeers,
+            "queued", repl->count,
+            "records_sent", (unsigned int)repl->records_sent,
+            "datagrams_sent", (unsigned int)repl->datagrams_sent,
+            "send_errors", (unsigned int)repl->send_errors,
+            "datagrams_received", (unsigned int)repl->datagrams_received,
+            "records_applied", (unsigned int)repl->records_applied,
+            "records_ignored", (unsigned int)repl->records_ignored,
+            "rejected", (unsigned int)repl->rejected,
+            "dropped", (unsigned int)repl->dropped);
+}
@@ -0,0 +1,42 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Replication of digest cache changes between nodes.
+ */
+
+#ifndef _WEB3_AUTH_REPL_H_
+#define _WEB3_AUTH_REPL_H_
+
+#include <stdint.h>
+
+#include "../../core/rpc.h"
+
+// Record types
+#define W3_REPL_PUT    1    // digest of a lookup key
+#define W3_REPL_ABSENT 2    // user unknown to the contract
+#define W3_REPL_FLUSH  3    // drop a partition, or all of them
+
+#define W3_REPL_ALL 0xffffffffu    // partition of a flush of every tenant
+
+// Clock difference between nodes tolerated in datagrams and record versions
+#define W3_REPL_MAX_AGE_MS 60000
+
+// Parse the listen address and the comma-separated peers ("host:port",
+// "[v6]:port") and allocate the outgoing queue; must run in mod_init
+// (before fork). Without a listen address replication stays off.
+int w3_repl_init(const char* listen, const char* peers, const char* secret, int queue_size);
+void w3_repl_destroy(void);
+int w3_repl_enabled(void);
+
+// Queue a cache change for the peers. version is the wall-clock time of
+// the change in ms at the node that made it; digest is NULL unless PUT.
+void w3_repl_record(int type, unsigned int partition, uint64_t key, uint64_t version,
+        const uint8_t* digest);
+
+// Replication process: send the queued records in batches and apply those
+// of the peers
+void w3_repl_timer(unsigned int ticks, void* param);
+
+void w3_repl_rpc_stats(rpc_t* rpc, void* ctx);
+
+#endif
@@ -0,0 +1,354 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Classification of JSON-RPC errors and contract reverts.
+ *
+ * A failed eth_call answers with an error object whose data member holds
+ * the revert payload: a 4-byte selector followed by ABI-encoded arguments.
+ * Error(string) carries a message, Panic(uint256) a compiler check code,
+ * and any other selector names a custom error of the contract. The table
+ * loaded at startup maps custom errors and exact messages to outcomes that
+ * decide what the module does: unknown users are negatively cached,
+ * throttling moves on to another endpoint, anything else is an error.
+ * Errors without revert data come from the node, not from the contract.
+ * Confidential calls report a revert inside their encrypted result, with
+ * the payload base64-encoded in the message, and go through the same
+ * decoding once decrypted.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "../../core/dprint.h"
+
+#include "web3_auth_abi.h"
+#include "web3_auth_hex.h"
+#include "web3_auth_json.h"
+#include "web3_auth_revert.h"
+
+#define REVERT_MAX_ERRORS 32
+#define REVERT_MAX_DATA 1024    // longer payloads only have their selector read
+
+#define REVERT_BY_SELECTOR 0
+#define REVERT_BY_MESSAGE 1
+
+// JSON-RPC codes of requests the node rejected as malformed
+#define RPC_PARSE_ERROR -32700
+#define RPC_INVALID_REQUEST -32600
+#define RPC_INVALID_PARAMS -32602
+#define RPC_LIMIT_EXCEEDED -32005  // EIP-1474
+
+typedef struct {
+    int match;
+    uint8_t selector[4];
+    char text[W3_ABI_SIGNATURE_SIZE];   // error name or message
+    int outcome;
+} revert_error_t;
+
+static revert_error_t revert_errors[REVERT_MAX_ERRORS];
+static int revert_nerrors = 0;
+static w3_abi_fn_t revert_error_fn;     // Error(string)
+static w3_abi_fn_t revert_panic_fn;     // Panic(uint256)
+
+static const char* revert_names[] = {
+    "none", "not_found", "disabled", "rate_limited", "internal"
+};
+
+const char* w3_revert_name(int outcome) {
+    if (outcome < 0 || outcome > W3_REVERT_INTERNAL) return "unknown";
+    return revert_names[outcome];
+}
+
+// Add one "key=outcome" entry of the table
+static int revert_add(const char* key, size_t klen, const char* outcome, size_t olen) {
+    revert_error_t* e;
+    w3_abi_fn_t fn;
+    const char* err;
+    char sig[W3_ABI_SIGNATURE_SIZE];
+
+    if (revert_nerrors == REVERT_MAX_ERRORS) {
+        LM_ERR("More than %d revert errors\n", REVERT_MAX_ERRORS);
+        return -1;
+    }
+    e = &revert_errors[revert_nerrors];
+    memset(e, 0, sizeof(*e));
+
+    for (e->outcome = W3_REVERT_NOT_FOUND; e->outcome <= W3_REVERT_INTERNAL; e->outcome++) {
+        if (strlen(revert_names[e->outcome]) == olen
+                && strncmp(revert_names[e->outcome], outcome, olen) == 0) break;
+    }
+    if (e->outcome > W3_REVERT_INTERNAL) {
+        LM_ERR("Unknown revert outcome '%.*s'\n", (int)olen, outcome);
+        return -1;
+    }
+
+    if (klen >= 2 && key[0] == '\'' && key[klen - 1] == '\'') {
+        if (klen - 2 >= sizeof(e->text)) {
+            LM_ERR("Revert message too long: %.*s\n", (int)klen, key);
+            return -1;
+        }
+        e->match = REVERT_BY_MESSAGE;
+        memcpy(e->text, key + 1, klen - 2);
+    } else {
+        if (klen >= sizeof(sig)) {
+            LM_ERR("Error signature too long: %.*s\n", (int)klen, key);
+            return -1;
+        }
+        memcpy(sig, key, klen);
+        sig[klen] = '\0';
+        if (w3_abi_compile(sig, &fn, &err) < 0) {
+            LM_ERR("Bad error signature %s: %s\n", sig, err);
+            return -1;
+        }
+        e->match = REVERT_BY_SELECTOR;
+        memcpy(e->selector, fn.selector, 4);
+        snprintf(e->text, sizeof(e->text), "%s", fn.canonical);
+    }
+    revert_nerrors++;
+    return 0;
+}
+
+int w3_revert_init(const char* spec) {
+    const char* err;
+    const char* p = spec;
+    const char* end;
+    const char* eq;
+
+    if (w3_abi_compile("Error(string)", &revert_error_fn, &err) < 0
+            || w3_abi_compile("Panic(uint256)", &revert_panic_fn, &err) < 0) {
+        LM_ERR("Failed to compile the standard errors: %s\n", err);
+        return -1;
+    }
+
+    revert_nerrors = 0;
+    while (p && *p) {
+        while (*p == ';' || isspace((unsigned char)*p)) p++;
+        if (!*p) break;
+
+        // Messages may contain ';' and '=', so quoted keys end at the quote
+        if (*p == '\'') {
+            eq = strchr(p + 1, '\'');
+            if (!eq) {
+                LM_ERR("Unterminated revert message in '%s'\n", spec);
+                return -1;
+            }
+            eq++;
+        } else {
+            eq = p;
+            while (*eq && *eq != '=' && *eq != ';') eq++;
+        }
+        end = eq;
+        while (*end && *end != ';') end++;
+        if (*eq != '=') {
+            LM_ERR("Revert error '%.*s' has no outcome\n", (int)(end - p), p);
+            return -1;
+        }
+
+        if (revert_add(p, eq - p, eq + 1, end - eq - 1) < 0) return -1;
+        p = end;
+    }
+
+    LM_INFO("Revert errors: %d mapped\n", revert_nerrors);
+    return 0;
+}
+
+// Revert payload in the data member of the error object, which nodes give
+// as "0x..", "Reverted 0x.." or an object with its own data member.
+// Returns the number of hex digits, -1 when there is none.
+static long revert_hex(const char* p, const char* end, const char** hex) {
+    const char* v = w3_json_member(p, end, "data");
+    const char* q;
+
+    if (!v) return -1;
+    if (*v == '{') return revert_hex(v + 1, w3_json_skip(v, end), hex);
+    if (*v != '"') return -1;
+
+    q = w3_json_skip(v, end) - 1;
+    for (v++; v + 1 < q; v++) {
+        if (v[0] == '0' && (v[1] | 0x20) == 'x') {
+            *hex = v + 2;
+            return q - *hex;
+        }
+    }
+    return -1;
+}
+
+// Copy a message for logs, without quotes and control characters
+static void revert_reason(w3_revert_t* out, const char* s, size_t len) {
+    size_t n = len < sizeof(out->reason) - 1 ? len : sizeof(out->reason) - 1;
+
+    for (size_t i = 0; i < n; i++) {
+        out->reason[i] = isprint((unsigned char)s[i]) && s[i] != '"' ? s[i] : '?';
+    }
+    out->reason[n] = '\0';
+}
+
+static int revert_by_message(const char* msg, size_t len) {
+    for (int i = 0; i < revert_nerrors; i++) {
+        if (revert_errors[i].match == REVERT_BY_MESSAGE && strlen(revert_errors[i].text) == len
+                && memcmp(revert_errors[i].text, msg, len) == 0) {
+            return revert_errors[i].outcome;
+        }
+    }
+    return W3_REVERT_INTERNAL;
+}
+
+// Decode a revert payload of the contract
+static int revert_decode(const uint8_t* data, size_t len, int truncated, w3_revert_t* out) {
+    w3_abi_value_t args[W3_ABI_MAX_ARGS];
+    uint64_t code = 0;
+    char selector[9];
+
+    if (len < 4) {
+        snprintf(out->reason, sizeof(out->reason), "revert without reason");
+        return W3_REVERT_INTERNAL;
+    }
+
+    if (memcmp(data, revert_error_fn.selector, 4) == 0) {
+        if (truncated || w3_abi_decode(&revert_error_fn.args, data + 4, len - 4, args) != 1) {
+            snprintf(out->reason, sizeof(out->reason), "malformed Error(string)");
+            return W3_REVERT_INTERNAL;
+        }
+        revert_reason(out, (const char*)args[0].data, args[0].len);
+        return revert_by_message((const char*)args[0].data, args[0].len);
+    }
+
+    if (memcmp(data, revert_panic_fn.selector, 4) == 0) {
+        if (!truncated && w3_abi_decode(&revert_panic_fn.args, data + 4, len - 4, args) == 1) {
+            for (int i = 24; i < 32; i++) code = code << 8 | args[0].data[i];
+        }
+        snprintf(out->reason, sizeof(out->reason), "Panic(0x%02llx)", (unsigned long long)code);
+        return W3_REVERT_INTERNAL;
+    }
+
+    for (int i = 0; i < revert_nerrors; i++) {
+        if (revert_errors[i].match == REVERT_BY_SELECTOR
+                && memcmp(revert_errors[i].selector, data, 4) == 0) {
+            revert_reason(out, revert_errors[i].text, strlen(revert_errors[i].text));
+            return revert_errors[i].outcome;
+        }
+    }
+
+    w3_hex_encode(data, 4, selector);
+    selector[8] = '\0';
+    snprintf(out->reason, sizeof(out->reason), "custom error 0x%s", selector);
+    return W3_REVERT_INTERNAL;
+}
+
+// Standard base64 with optional padding; returns the decoded length, -1 on
+// characters outside the alphabet
+static long revert_base64(const char* s, size_t len, uint8_t* out, size_t out_size) {
+    uint32_t acc = 0;
+    int bits = 0;
+    size_t n = 0;
+
+    for (size_t i = 0; i < len && s[i] != '='; i++) {
+        char c = s[i];
+        int v;
+        if (c >= 'A' && c <= 'Z') v = c - 'A';
+        else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') v = c - '0' + 52;
+        else if (c == '+') v = 62;
+        else if (c == '/') v = 63;
+        else return -1;
+        acc = acc << 6 | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (n < out_size) out[n] = (uint8_t)(acc >> bits);
+            n++;
+        }
+    }
+    return n;
+}
+
+int w3_revert_failure(const char* module, size_t module_len, long code,
+        const char* msg, size_t msg_len, w3_revert_t* out) {
+    static const char reverted[] = "reverted: ";
+    uint8_t data[REVERT_MAX_DATA];
+    long n;
+
+    memset(out, 0, sizeof(*out));
+    out->code = code;
+
+    // Failures of other modules mean the node rejected the call itself
+    if (module_len != 3 || memcmp(module, "evm", 3) != 0) {
+        revert_reason(out, msg, msg_len);
+        out->node_fault = 1;
+        return out->outcome = W3_REVERT_INTERNAL;
+    }
+
+    if (msg_len >= sizeof(reverted) - 1 && memcmp(msg, reverted, sizeof(reverted) - 1) == 0) {
+        msg += sizeof(reverted) - 1;
+        msg_len -= sizeof(reverted) - 1;
+        // A payload is a selector and whole words; plain text that happens
+        // to be valid base64 rarely decodes to that
+        n = msg_len % 4 == 0 ? revert_base64(msg, msg_len, data, sizeof(data)) : -1;
+        if (n == 0 || (n >= 4 && (n - 4) % 32 == 0)) {
+            return out->outcome = revert_decode(data, (size_t)n < sizeof(data) ? (size_t)n
+                    : sizeof(data), (size_t)n > sizeof(data), out);
+        }
+        // Older nodes give the message of Error(string) as is
+        revert_reason(out, msg, msg_len);
+        return out->outcome = revert_by_message(msg, msg_len);
+    }
+
+    revert_reason(out, msg, msg_len);
+    return out->outcome = W3_REVERT_INTERNAL;
+}
+
+int w3_revert_classify(const char* json, size_t len, w3_revert_t* out) {
+    static const char reverted[] = "execution reverted";
+    const char* end = json + len;
+    const char* err = w3_json_member(json, end, "error");
+    const char* err_end;
+    const char* v;
+    const char* hex;
+    uint8_t data[REVERT_MAX_DATA];
+    long hex_len;
+    size_t n;
+
+    memset(out, 0, sizeof(*out));
+    if (!err || *err != '{') return out->outcome = W3_REVERT_NONE;
+    err_end = w3_json_skip(err, end);
+
+    v = w3_json_member(err + 1, err_end, "code");
+    if (v) out->code = strtol(v, NULL, 10);
+
+    // Revert payload of the contract
+    hex_len = revert_hex(err + 1, err_end, &hex);
+    if (hex_len >= 0) {
+        n = hex_len / 2 < REVERT_MAX_DATA ? hex_len / 2 : REVERT_MAX_DATA;
+        if (w3_hex_decode(hex, 2 * n, data) == 0) {
+            return out->outcome = revert_decode(data, n, (size_t)hex_len > 2 * n, out);
+        }
+    }
+
+    // No payload: either a revert the node summarized in its message...
+    v = w3_json_member(err + 1, err_end, "message");
+    if (v && *v == '"') {
+        const char* msg = v + 1;
+        size_t msg_len = w3_json_skip(v, err_end) - 1 - msg;
+
+        revert_reason(out, msg, msg_len);
+        if (msg_len >= sizeof(reverted) - 1 && memcmp(msg, reverted, sizeof(reverted) - 1) == 0) {
+            msg += sizeof(reverted) - 1;
+            msg_len -= sizeof(reverted) - 1;
+            if (msg_len >= 2 && msg[0] == ':' && msg[1] == ' ') {
+                return out->outcome = revert_by_message(msg + 2, msg_len - 2);
+            }
+            return out->outcome = W3_REVERT_INTERNAL;
+        }
+    }
+
+    // ...or a failure of the node
+    if (out->code == RPC_LIMIT_EXCEEDED || out->code == 429) {
+        out->node_fault = 1;
+        return out->outcome = W3_REVERT_RATE_LIMITED;
+    }
+    out->node_fault = out->code != RPC_PARSE_ERROR && out->code != RPC_INVALID_REQUEST
+            && out->code != RPC_INVALID_PARAMS;
+    return out->outcome = W3_REVERT_INTERNAL;
+}
@@ -0,0 +1,46 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Classification of JSON-RPC errors and contract reverts.
+ */
+
+#ifndef _WEB3_AUTH_REVERT_H_
+#define _WEB3_AUTH_REVERT_H_
+
+#include <stddef.h>
+
+// Outcomes of a call that returned an error
+#define W3_REVERT_NONE         0    // no error, the result holds the answer
+#define W3_REVERT_NOT_FOUND    1    // the contract does not know the user
+#define W3_REVERT_DISABLED     2    // the user exists but may not log in
+#define W3_REVERT_RATE_LIMITED 3    // the provider or contract throttles us
+#define W3_REVERT_INTERNAL     4    // panic, unknown revert or node failure
+
+#define W3_REVERT_REASON_SIZE 128
+
+typedef struct w3_revert {
+    int outcome;
+    int node_fault;         // raised by the node itself, not by the contract
+    long code;              // JSON-RPC error code
+    char reason[W3_REVERT_REASON_SIZE];  // revert message or error name, for logs
+} w3_revert_t;
+
+// Load the error table from "key=outcome;..." where a key is a custom error
+// signature such as UserNotFound(address) or an Error(string) message in
+// single quotes, and outcome is not_found, disabled, rate_limited or
+// internal. Must run in mod_init; -1 when spec is malformed.
+int w3_revert_init(const char* spec);
+
+// Classify the JSON-RPC response json of len bytes into out; returns the
+// outcome, W3_REVERT_NONE when it carries no error
+int w3_revert_classify(const char* json, size_t len, w3_revert_t* out);
+
+// Classify the failure of a confidential call, decrypted from its result:
+// module and code of the failing runtime module and its message, where an
+// EVM revert carries its payload as "reverted: <base64>"
+int w3_revert_failure(const char* module, size_t module_len, long code,
+        const char* msg, size_t msg_len, w3_revert_t* out);
+
+const char* w3_revert_name(int outcome);
+
+#endif
@@ -0,0 +1,669 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Per-realm routing of lookups to contracts and RPC endpoints.
+ *
+ * Tenants keep their credentials in different contracts, possibly behind
+ * different RPC providers. The routing file maps a realm to its contract,
+ * endpoint and optionally the contract function, one tenant per line:
+ *
+ *   <realm> <contract> <rpc_url>[,<rpc_url>...] [<function signature>]
+ *
+ * The file is parsed once into a single shm block: the tenants, each with
+ * its compiled function signature and the eth_call request rendered up to
+ * the encoded arguments, followed by an open-addressing hash index over the
+ * realms.
+ * Realms that are not listed use the default tenant built from the
+ * contract_address and rpc_url parameters.
+ *
+ * The table, together with the RPC timeouts, forms one immutable snapshot
+ * and can be replaced at runtime through RPC commands. Updates are RCU
+ * style: a new snapshot is built from the changed inputs and published by
+ * swapping the shared pointer, readers only pin the version they started
+ * with, and a replaced snapshot is freed by a timer once no process pins
+ * that version or an older one anymore.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "../../core/dprint.h"
+#include "../../core/locking.h"
+#include "../../core/mem/mem.h"
+#include "../../core/mem/shm_mem.h"
+#include "../../core/atomic_ops.h"
+#include "../../core/pt.h"
+
+#include "web3_auth.h"
+#include "web3_auth_hex.h"
+#include "web3_auth_route.h"
+
+#define ROUTE_MAX_TENANTS 4096
+#define ROUTE_LINE_SIZE 1024
+#define ROUTE_PATH_SIZE 256
+#define ROUTE_MAX_RETIRED 16
+#define ROUTE_MAX_PROCS 1024
+
+typedef struct {
+    unsigned int version;
+    w3_route_settings_t settings;
+    unsigned int count;     // tenants, including the default one at index 0
+    unsigned int mask;      // index buckets - 1
+    uint32_t* index;        // tenant number + 1, 0 marks a free bucket
+    w3_tenant_t tenants[];
+} route_table_t;
+
+// Inputs a snapshot is built from; updates change a copy and rebuild
+typedef struct {
+    char file[ROUTE_PATH_SIZE];
+    char contract[W3_CONTRACT_SIZE];
+    char rpc_url[W3_MAX_ENDPOINTS * W3_URL_SIZE];
+    char signature[W3_SIGNATURE_SIZE];
+    w3_route_settings_t settings;
+} route_src_t;
+
+typedef struct {
+    gen_lock_t lock;                        // serializes updates and reclaim
+    route_table_t* volatile current;
+    volatile unsigned int version;
+    unsigned int next_id;                   // next unused cache partition
+    route_src_t src;
+    int nretired;
+    route_table_t* retired[ROUTE_MAX_RETIRED];
+    volatile unsigned int readers[ROUTE_MAX_PROCS]; // pinned version, 0 when idle
+} route_root_t;
+
+static route_root_t* root = NULL;
+
+// Snapshot pinned by this process between w3_route_enter() and w3_route_leave()
+static route_table_t* held = NULL;
+static int held_depth = 0;
+
+// Compile the signature, fill selector and request template; -1 when the
+// function cannot take the SIP fields or the template does not fit
+static int route_render(w3_tenant_t* t) {
+    const w3_abi_node_t* c;
+    const char* err = NULL;
+    int n, nargs;
+
+    if (w3_abi_compile(t->signature, &t->fn, &err) < 0) {
+        LM_ERR("Bad function signature %s: %s\n", t->signature, err);
+        return -1;
+    }
+
+    // Arguments take the SIP fields in order, whatever the function is named
+    nargs = w3_abi_count(&t->fn.args);
+    if (nargs < 1 || nargs > W3_CALL_FIELDS) {
+        LM_ERR("Function %s must take 1 to %d arguments\n", t->signature, W3_CALL_FIELDS);
+        return -1;
+    }
+    for (int i = 0; i < nargs; i++) {
+        c = w3_abi_component(&t->fn.args, i);
+        if (c->kind != W3_ABI_STRING && c->kind != W3_ABI_BYTES) {
+            LM_ERR("Function %s must take string or bytes arguments\n", t->signature);
+            return -1;
+        }
+    }
+
+    // The digest is the first return value that can hold one
+    t->digest_ret = -1;
+    for (int i = 0; (c = w3_abi_component(&t->fn.returns, i)) != NULL; i++) {
+        if (c->kind == W3_ABI_BYTES || (c->kind == W3_ABI_BYTESN && c->size >= W3_DIGEST_SIZE)) {
+            t->digest_ret = i;
+            break;
+        }
+    }
+    if (t->digest_ret < 0) {
+        LM_ERR("Function %s returns no bytes or bytes16..bytes32 value\n", t->signature);
+        return -1;
+    }
+
+    w3_hex_encode(t->fn.selector, sizeof(t->fn.selector), t->selector);
+    t->selector[8] = '\0';
+
+    n = snprintf(t->payload_head, W3_TEMPLATE_SIZE,
+            "{\"jsonrpc\":\"2.0\",\"method\":\"eth_call\",\"params\":[{\"to\":\"%s\",\"data\":\"0x%s",
+            t->contract, t->selector);
+    if (n < 0 || n >= W3_TEMPLATE_SIZE) return -1;
+    t->payload_head_len = n;
+    return 0;
+}
+
+// Split a comma-separated endpoint list into the tenant
+static int route_set_endpoints(w3_tenant_t* t, const char* rpc_url) {
+    const char* p = rpc_url;
+    const char* end;
+    size_t len;
+
+    t->nendpoints = 0;
+    while (*p) {
+        end = strchr(p, ',');
+        len = end ? (size_t)(end - p) : strlen(p);
+        if (len > 0) {
+            if (t->nendpoints == W3_MAX_ENDPOINTS || len >= W3_URL_SIZE) {
+                LM_ERR("Too many or too long RPC endpoints in '%s'\n", rpc_url);
+                return -1;
+            }
+            w3_endpoint_t* ep = &t->endpoints[t->nendpoints++];
+            memcpy(ep->url, p, len);
+            ep->url[len] = '\0';
+            ep->health = -1;        // registered once the snapshot is complete
+        }
+        if (!end) break;
+        p = end + 1;
+    }
+    if (t->nendpoints == 0) {
+        LM_ERR("No RPC endpoint for realm '%s'\n", t->realm);
+        return -1;
+    }
+    return 0;
+}
+
+static int route_set(w3_tenant_t* t, const char* realm, const char* contract,
+        const char* rpc_url, const char* signature) {
+    if (strlen(realm) >= W3_REALM_SIZE || strlen(contract) >= W3_CONTRACT_SIZE
+            || strlen(signature) >= W3_SIGNATURE_SIZE) {
+        LM_ERR("Routing entry for realm '%s' too long\n", realm);
+        return -1;
+    }
+    strcpy(t->realm, realm);
+    strcpy(t->contract, contract);
+    strcpy(t->signature, signature);
+    if (route_set_endpoints(t, rpc_url) < 0) return -1;
+    return route_render(t);
+}
+
+// Parse the routing file into a pkg array; returns the number of tenants or -1
+static int route_parse(const char* file, w3_tenant_t** out) {
+    char line[ROUTE_LINE_SIZE];
+    char realm[ROUTE_LINE_SIZE], contract[ROUTE_LINE_SIZE];
+    char url[ROUTE_LINE_SIZE], sig[ROUTE_LINE_SIZE];
+    w3_tenant_t* list = NULL;
+    int n = 0, cap = 0, lineno = 0, fields;
+    FILE* f;
+
+    f = fopen(file, "r");
+    if (!f) {
+        LM_ERR("Cannot open routing file %s\n", file);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        fields = sscanf(line, "%1023s %1023s %1023s %1023s", realm, contract, url, sig);
+        if (fields <= 0 || realm[0] == '#') continue;
+        if (fields < 3) {
+            LM_ERR("%s:%d: expected <realm> <contract> <rpc_url> [<signature>]\n", file, lineno);
+            goto error;
+        }
+        if (n == ROUTE_MAX_TENANTS) {
+            LM_ERR("%s: more than %d tenants\n", file, ROUTE_MAX_TENANTS);
+            goto error;
+        }
+        if (n == cap) {
+            w3_tenant_t* grown;
+            cap = cap ? cap * 2 : 16;
+            grown = pkg_realloc(list, cap * sizeof(w3_tenant_t));
+            if (!grown) {
+                LM_ERR("Not enough memory for the routing table\n");
+                goto error;
+            }
+            list = grown;
+        }
+        memset(&list[n], 0, sizeof(w3_tenant_t));
+        if (route_set(&list[n], realm, contract, url, fields == 4 ? sig : W3_DEFAULT_SIGNATURE) < 0) {
+            LM_ERR("%s:%d: invalid routing entry\n", file, lineno);
+            goto error;
+        }
+        n++;
+    }
+    fclose(f);
+    *out = list;
+    return n;
+
+error:
+    fclose(f);
+    if (list) pkg_free(list);
+    return -1;
+}
+
+static uint32_t route_hash(const char* realm, int len) {
+    uint32_t h = 2166136261u;
+
+    // Realms compare case-insensitively
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)tolower((unsigned char)realm[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static const w3_tenant_t* route_find(const route_table_t* rt, const char* realm, int len) {
+    uint32_t b, slot;
+
+    if (rt->count > 1 && len > 0 && len < W3_REALM_SIZE) {
+        b = route_hash(realm, len) & rt->mask;
+        while ((slot = rt->index[b])) {
+            const w3_tenant_t* t = &rt->tenants[slot - 1];
+            if (strncasecmp(t->realm, realm, len) == 0 && t->realm[len] == '\0') return t;
+            b = (b + 1) & rt->mask;
+        }
+    }
+    return &rt->tenants[0];
+}
+
+// Take or drop the health slots of the endpoints of a snapshot
+static void route_register(route_table_t* rt, int on) {
+    for (unsigned int i = 0; i < rt->count; i++) {
+        w3_tenant_t* t = &rt->tenants[i];
+        for (int e = 0; e < t->nendpoints; e++) {
+            if (on) w3_shard_register(&t->endpoints[e]);
+            else w3_shard_unregister(&t->endpoints[e]);
+        }
+    }
+}
+
+static void route_free(route_table_t* rt) {
+    route_register(rt, 0);
+    shm_free(rt);
+}
+
+// Build a snapshot from src; tenants already in prev keep their cache partition
+static route_table_t* route_build(const route_src_t* src, const route_table_t* prev) {
+    w3_tenant_t* parsed = NULL;
+    route_table_t* rt;
+    unsigned int count, buckets = 1;
+    size_t bytes;
+    int n = 0;
+
+    if (src->file[0]) {
+        n = route_parse(src->file, &parsed);
+        if (n < 0) return NULL;
+    }
+    count = n + 1;
+    while (buckets < 2 * count) buckets <<= 1;
+
+    bytes = sizeof(route_table_t) + count * sizeof(w3_tenant_t) + buckets * sizeof(uint32_t);
+    rt = shm_malloc(bytes);
+    if (!rt) {
+        LM_ERR("Not enough shared memory for the routing table\n");
+        if (parsed) pkg_free(parsed);
+        return NULL;
+    }
+    memset(rt, 0, bytes);
+    rt->settings = src->settings;
+    rt->count = count;
+    rt->mask = buckets - 1;
+    rt->index = (uint32_t*)&rt->tenants[count];
+
+    if (route_set(&rt->tenants[0], "", src->contract, src->rpc_url, src->signature) < 0) {
+        LM_ERR("Invalid default contract_address, rpc_url or function_signature\n");
+        goto error;
+    }
+    if (n > 0) memcpy(&rt->tenants[1], parsed, n * sizeof(w3_tenant_t));
+
+    for (unsigned int i = 1; i < count; i++) {
+        w3_tenant_t* t = &rt->tenants[i];
+        const w3_tenant_t* old;
+        uint32_t b = route_hash(t->realm, strlen(t->realm)) & rt->mask;
+
+        old = prev ? route_find(prev, t->realm, strlen(t->realm)) : NULL;
+        t->id = old && old->id ? old->id : root->next_id++;
+        while (rt->index[b]) {
+            if (strcasecmp(rt->tenants[rt->index[b] - 1].realm, t->realm) == 0) {
+                LM_ERR("Realm %s listed twice in %s\n", t->realm, src->file);
+                goto error;
+            }
+            b = (b + 1) & rt->mask;
+        }
+        rt->index[b] = i + 1;
+    }
+
+    if (parsed) pkg_free(parsed);
+    route_register(rt, 1);
+    return rt;
+
+error:
+    if (parsed) pkg_free(parsed);
+    shm_free(rt);
+    return NULL;
+}
+
+// Free replaced snapshots no process can still be reading; lock held
+static void route_reclaim(void) {
+    unsigned int oldest = 0;
+    int kept = 0;
+
+    for (int p = 0; p < ROUTE_MAX_PROCS; p++) {
+        unsigned int v = root->readers[p];
+        if (v && (!oldest || v < oldest)) oldest = v;
+    }
+
+    // A reader pinned at version v holds snapshot v or a newer one
+    for (int i = 0; i < root->nretired; i++) {
+        if (!oldest || root->retired[i]->version < oldest) {
+            LM_DBG("Freeing routing snapshot version %u\n", root->retired[i]->version);
+            route_free(root->retired[i]);
+        } else {
+            root->retired[kept++] = root->retired[i];
+        }
+    }
+    root->nretired = kept;
+}
+
+// Build and publish a snapshot from src; lock held. Returns the new version
+// or -1, in which case the current snapshot stays in place.
+static int route_publish(const route_src_t* src) {
+    route_table_t* rt;
+    route_table_t* old = root->current;
+
+    route_reclaim();
+    if (old && root->nretired == ROUTE_MAX_RETIRED) {
+        LM_ERR("Too many routing snapshots still in use, try again later\n");
+        return -1;
+    }
+
+    rt = route_build(src, old);
+    if (!rt) return -1;
+    rt->version = root->version + 1;
+
+    membar_write();
+    root->current = rt;
+    root->version = rt->version;
+    membar();
+
+    root->src = *src;
+    if (old) root->retired[root->nretired++] = old;
+    LM_INFO("Routing snapshot version %u: %u tenant(s) besides the default\n",
+            rt->version, rt->count - 1);
+    return rt->version;
+}
+
+static int route_src_set(route_src_t* src, const char* file, const char* contract,
+        const char* rpc_url, const char* signature) {
+    if ((file && strlen(file) >= sizeof(src->file))
+            || (contract && strlen(contract) >= sizeof(src->contract))
+            || (rpc_url && strlen(rpc_url) >= sizeof(src->rpc_url))
+            || (signature && strlen(signature) >= sizeof(src->signature))) {
+        LM_ERR("Routing parameter too long\n");
+        return -1;
+    }
+    if (file) strcpy(src->file, file);
+    if (contract) strcpy(src->contract, contract);
+    if (rpc_url) strcpy(src->rpc_url, rpc_url);
+    if (signature) strcpy(src->signature, signature);
+    return 0;
+}
+
+int w3_route_init(const char* file, const char* contract, const char* rpc_url,
+        const char* signature, const w3_route_settings_t* settings) {
+    route_src_t src;
+
+    root = shm_malloc(sizeof(route_root_t));
+    if (!root) {
+        LM_ERR("Not enough shared memory for the routing table\n");
+        return -1;
+    }
+    memset(root, 0, sizeof(route_root_t));
+    root->next_id = 1;
+
+    if (!lock_init(&root->lock)) {
+        LM_ERR("Failed to initialize routing table lock\n");
+        shm_free(root);
+        root = NULL;
+        return -1;
+    }
+
+    memset(&src, 0, sizeof(src));
+    src.settings = *settings;
+    if (route_src_set(&src, file ? file : "", contract, rpc_url, signature) < 0
+            || route_publish(&src) < 0) {
+        w3_route_destroy();
+        return -1;
+    }
+    return 0;
+}
+
+void w3_route_destroy(void) {
+    if (!root) return;
+    for (int i = 0; i < root->nretired; i++) route_free(root->retired[i]);
+    if (root->current) route_free(root->current);
+    lock_destroy(&root->lock);
+    shm_free(root);
+    root = NULL;
+}
+
+void w3_route_enter(void) {
+    if (!root || held_depth++ > 0) return;
+
+    // Pin before loading the pointer, so reclaim either sees the pin or the
+    // load returns a snapshot published after the scan
+    if (process_no >= 0 && process_no < ROUTE_MAX_PROCS) {
+        root->readers[process_no] = root->version;
+        membar();
+    }
+    held = root->current;
+}
+
+void w3_route_leave(void) {
+    if (!root || held_depth == 0 || --held_depth > 0) return;
+
+    held = NULL;
+    membar();
+    if (process_no >= 0 && process_no < ROUTE_MAX_PROCS) root->readers[process_no] = 0;
+}
+
+const w3_tenant_t* w3_route_lookup(const char* realm, int len) {
+    if (!root) return NULL;
+    return route_find(held ? held : root->current, realm, len);
+}
+
+const w3_route_settings_t* w3_route_settings(void) {
+    return &(held ? held : root->current)->settings;
+}
+
+int w3_route_endpoints(w3_endpoint_t* out, int max) {
+    route_table_t* rt;
+    int n = 0;
+
+    if (!root) return 0;
+
+    w3_route_enter();
+    rt = held ? held : root->current;
+    for (unsigned int i = 0; i < rt->count && n < max; i++) {
+        const w3_tenant_t* t = &rt->tenants[i];
+        for (int e = 0; e < t->nendpoints && n < max; e++) {
+            int j;
+            for (j = 0; j < n; j++) {
+                if (strcmp(out[j].url, t->endpoints[e].url) == 0) break;
+            }
+            if (j == n) out[n++] = t->endpoints[e];
+        }
+    }
+    w3_route_leave();
+    return n;
+}
+
+void w3_route_timer(unsigned int ticks, void* param) {
+    (void)ticks;
+    (void)param;
+    if (!root || root->nretired == 0) return;
+    lock_get(&root->lock);
+    route_reclaim();
+    lock_release(&root->lock);
+}
+
+// Publish src and report the outcome to the RPC caller
+static void route_rpc_publish(rpc_t* rpc, void* ctx, const route_src_t* src) {
+    int version = route_publish(src);
+
+    if (version < 0) {
+        rpc->fault(ctx, 500, "Configuration rejected, see the log");
+        return;
+    }
+    rpc->add(ctx, "d", version);
+}
+
+// RPC: web3_auth.reload [file]
+void w3_route_rpc_reload(rpc_t* rpc, void* ctx) {
+    char* file = NULL;
+    route_src_t src;
+
+    if (!root) {
+        rpc->fault(ctx, 500, "Routing table not initialized");
+        return;
+    }
+    rpc->scan(ctx, "*s", &file);
+
+    lock_get(&root->lock);
+    src = root->src;
+    if (route_src_set(&src, file, NULL, NULL, NULL) < 0) {
+        rpc->fault(ctx, 400, "File name too long");
+    } else {
+        route_rpc_publish(rpc, ctx, &src);
+    }
+    lock_release(&root->lock);
+}
+
+// RPC: web3_auth.set_endpoints <rpc_url[,rpc_url...]>
+void w3_route_rpc_set_endpoints(rpc_t* rpc, void* ctx) {
+    char* rpc_url = NULL;
+    route_src_t src;
+
+    if (!root) {
+        rpc->fault(ctx, 500, "Routing table not initialized");
+        return;
+    }
+    if (rpc->scan(ctx, "s", &rpc_url) < 1) {
+        rpc->fault(ctx, 400, "Expected the endpoint list");
+        return;
+    }
+
+    lock_get(&root->lock);
+    src = root->src;
+    if (route_src_set(&src, NULL, NULL, rpc_url, NULL) < 0) {
+        rpc->fault(ctx, 400, "Endpoint list too long");
+    } else {
+        route_rpc_publish(rpc, ctx, &src);
+    }
+    lock_release(&root->lock);
+}
+
+// RPC: web3_auth.set_contract <address> [signature]
+void w3_route_rpc_set_contract(rpc_t* rpc, void* ctx) {
+    char* contract = NULL;
+    char* signature = NULL;
+    route_src_t src;
+
+    if (!root) {
+        rpc->fault(ctx, 500, "Routing table not initialized");
+        return;
+    }
+    if (rpc->scan(ctx, "s*s", &contract, &signature) < 1) {
+        rpc->fault(ctx, 400, "Expected the contract address");
+        return;
+    }
+
+    lock_get(&root->lock);
+    src = root->src;
+    if (route_src_set(&src, NULL, contract, NULL, signature) < 0) {
+        rpc->fault(ctx, 400, "Contract or signature too long");
+    } else {
+        route_rpc_publish(rpc, ctx, &src);
+    }
+    lock_release(&root->lock);
+}
+
+// RPC: web3_auth.set_timeouts <rpc_timeout_ms> [queue_timeout_ms]
+void w3_route_rpc_set_timeouts(rpc_t* rpc, void* ctx) {
+    int timeout_ms = 0;
+    int queue_timeout_ms = -1;
+    route_src_t src;
+
+    if (!root) {
+        rpc->fault(ctx, 500, "Routing table not initialized");
+        return;
+    }
+    if (rpc->scan(ctx, "d*d", &timeout_ms, &queue_timeout_ms) < 1 || timeout_ms <= 0) {
+        rpc->fault(ctx, 400, "Expected a positive RPC timeout in ms");
+        return;
+    }
+
+    lock_get(&root->lock);
+    src = root->src;
+    src.settings.timeout_ms = timeout_ms;
+    if (queue_timeout_ms >= 0) src.settings.queue_timeout_ms = queue_timeout_ms;
+    route_rpc_publish(rpc, ctx, &src);
+    lock_release(&root->lock);
+}
+
+// RPC: web3_auth.config
+void w3_route_rpc_config(rpc_t* rpc, void* ctx) {
+    route_src_t src;
+    unsigned int version;
+    int retired;
+    void* th;
+
+    if (!root) {
+        rpc->fault(ctx, 500, "Routing table not initialized");
+        return;
+    }
+
+    lock_get(&root->lock);
+    src = root->src;
+    version = root->version;
+    retired = root->nretired;
+    lock_release(&root->lock);
+
+    if (rpc->add(ctx, "{", &th) < 0) {
+        rpc->fault(ctx, 500, "Internal error creating structure");
+        return;
+    }
+    rpc->struct_add(th, "ddsssssdd",
+            "version", (int)version,
+            "retired", retired,
+            "routing_file", src.file,
+            "contract_address", src.contract,
+            "rpc_url", src.rpc_url,
+            "function_signature", src.signature,
+            "rpc_timeout", src.settings.timeout_ms,
+            "rpc_queue_timeout", src.settings.queue_timeout_ms);
+}
+
+void w3_route_rpc_list(rpc_t* rpc, void* ctx) {
+    char urls[W3_MAX_ENDPOINTS * W3_URL_SIZE];
+    route_table_t* rt;
+    void* th;
+
+    if (!root) {
+        rpc->fault(ctx, 500, "Routing table not initialized");
+        return;
+    }
+
+    w3_route_enter();
+    rt = held ? held : root->current;
+    for (unsigned int i = 0; i < rt->count; i++) {
+        w3_tenant_t* t = &rt->tenants[i];
+        int len = 0;
+
+        urls[0] = '\0';
+        for (int e = 0; e < t->nendpoints; e++) {
+            len += snprintf(urls + len, sizeof(urls) - len, "%s%s", e ? "," : "",
+                    t->endpoints[e].url);
+        }
+        if (rpc->add(ctx, "{", &th) < 0) {
+            rpc->fault(ctx, 500, "Internal error creating structure");
+            break;
+        }
+        rpc->struct_add(th, "dssss",
+                "id", (int)t->id,
+                "realm", t->id ? t->realm : "*",
+                "contract", t->contract,
+                "rpc_url", urls,
+                "signature", t->signature);
+    }
+    w3_route_leave();
+}
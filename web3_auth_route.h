@@ -0,0 +1,80 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Per-realm routing of lookups to contracts and RPC endpoints.
+ */
+
+#ifndef _WEB3_AUTH_ROUTE_H_
+#define _WEB3_AUTH_ROUTE_H_
+
+#include "../../core/rpc.h"
+
+#include "web3_auth_shard.h"
+#include "web3_auth_abi.h"
+
+#define W3_REALM_SIZE 128
+#define W3_CONTRACT_SIZE 64
+#define W3_SIGNATURE_SIZE 128
+#define W3_TEMPLATE_SIZE 512
+
+#define W3_DEFAULT_SIGNATURE "getDigestHash(string,string,string,string,string)"
+
+// SIP fields passed to the contract, in order: username, realm, method,
+// uri and nonce
+#define W3_CALL_FIELDS 5
+
+// One tenant: where and how its credentials are looked up
+typedef struct w3_tenant {
+    unsigned int id;                    // cache partition, 0 is the default tenant
+    char realm[W3_REALM_SIZE];          // empty for the default tenant
+    char contract[W3_CONTRACT_SIZE];
+    w3_endpoint_t endpoints[W3_MAX_ENDPOINTS];
+    int nendpoints;
+    char signature[W3_SIGNATURE_SIZE];
+    w3_abi_fn_t fn;                     // compiled signature
+    int digest_ret;                     // return value holding the digest
+    char selector[9];                   // 4-byte selector in hex, no 0x
+    // eth_call request up to the encoded arguments, and what follows them
+    char payload_head[W3_TEMPLATE_SIZE];
+    int payload_head_len;
+} w3_tenant_t;
+
+// RPC settings that can be changed at runtime along with the routes
+typedef struct w3_route_settings {
+    int timeout_ms;         // whole eth_call request
+    int queue_timeout_ms;   // wait for a concurrency slot
+} w3_route_settings_t;
+
+#define W3_PAYLOAD_TAIL "\"},\"latest\"],\"id\":1}"
+#define W3_PAYLOAD_TAIL_LEN (sizeof(W3_PAYLOAD_TAIL) - 1)
+
+// Build the routing table in shm from file (may be NULL); realms not listed
+// use the default tenant. rpc_url may list several endpoints separated by
+// commas. Must run in mod_init (before fork), after w3_shard_init().
+int w3_route_init(const char* file, const char* contract, const char* rpc_url,
+        const char* signature, const w3_route_settings_t* settings);
+void w3_route_destroy(void);
+
+// Pin the current snapshot for this process. Tenants and settings returned
+// in between stay valid until the matching w3_route_leave(); calls nest.
+void w3_route_enter(void);
+void w3_route_leave(void);
+
+// Tenant serving realm, never NULL after a successful init
+const w3_tenant_t* w3_route_lookup(const char* realm, int len);
+const w3_route_settings_t* w3_route_settings(void);
+
+// Copy the distinct endpoints of all tenants to out; returns their number
+int w3_route_endpoints(w3_endpoint_t* out, int max);
+
+// Free replaced snapshots that are no longer pinned
+void w3_route_timer(unsigned int ticks, void* param);
+
+void w3_route_rpc_list(rpc_t* rpc, void* ctx);
+void w3_route_rpc_config(rpc_t* rpc, void* ctx);
+void w3_route_rpc_reload(rpc_t* rpc, void* ctx);
+void w3_route_rpc_set_endpoints(rpc_t* rpc, void* ctx);
+void w3_route_rpc_set_contract(rpc_t* rpc, void* ctx);
+void w3_route_rpc_set_timeouts(rpc_t* rpc, void* ctx);
+
+#endif
@@ -0,0 +1,607 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Confidential eth_call for Oasis Sapphire.
+ *
+ * A plain eth_call shows usernames and nonces to every relay and node log
+ * on the way. Sapphire accepts call data encrypted to an ephemeral key of
+ * the runtime: the caller agrees on a key with X25519 against that public
+ * key, derives the symmetric key with HMAC-SHA512/256 and seals a CBOR
+ * envelope with Deoxys-II; the node seals the result with the same key.
+ *
+ * The runtime key changes every epoch. It is fetched once per runtime
+ * (keyed by the first endpoint of a tenant) with oasis_callDataPublicKey,
+ * kept in shm and refreshed by a dedicated process on an interval, or
+ * sooner when a result cannot be decrypted. Each process derives its own
+ * session from a random key pair and reuses it for every call until the
+ * runtime key changes or the session ages out, so a call costs a few
+ * Deoxys blocks instead of a key agreement, and never an extra round trip.
+ *
+ * Results must come back encrypted; only failures may be plain, which is
+ * how the node reports an envelope it could not open.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+
+#include <curl/curl.h>
+
+#include "../../core/dprint.h"
+#include "../../core/locking.h"
+#include "../../core/atomic_ops.h"
+#include "../../core/mem/mem.h"
+#include "../../core/mem/shm_mem.h"
+
+#include "web3_auth.h"
+#include "web3_auth_acct.h"
+#include "web3_auth_deoxys.h"
+#include "web3_auth_hex.h"
+#include "web3_auth_http.h"
+#include "web3_auth_json.h"
+#include "web3_auth_sapphire.h"
+#include "web3_auth_sha512.h"
+#include "web3_auth_x25519.h"
+
+#define SAPPHIRE_TIMEOUT_MS 5000
+#define SAPPHIRE_FORMAT 1               // X25519 + Deoxys-II envelope
+#define SAPPHIRE_NONCE_RANDOM 7         // random nonce prefix, then a counter
+#define SAPPHIRE_CBOR_DEPTH 8
+
+static const char sapphire_kdf_label[] = "MRAE_Box_Deoxys-II-256-128";
+
+typedef struct {
+    w3_endpoint_t ep;                   // keys are fetched through it
+    uint8_t key[32];
+    uint64_t epoch;
+    volatile int generation;            // bumped on a new key, 0 before the first
+    volatile int stale;                 // fetch again on the next tick
+    uint64_t next_fetch_us;
+    uint64_t fetched_ms;                // wall clock, for the stats
+    volatile long seals;
+    volatile long opens;
+    volatile long failures;             // calls that reported a failure
+    volatile long open_errors;          // results that could not be read
+    volatile long sessions;             // key agreements of all processes
+    volatile long fetches;
+    volatile long fetch_errors;
+} sapphire_runtime_t;
+
+typedef struct {
+    gen_lock_t lock;                    // adding runtimes, writing keys
+    volatile int nruntimes;
+    sapphire_runtime_t runtimes[W3_SAPPHIRE_MAX_RUNTIMES];
+} sapphire_t;
+
+// Session of this process with one runtime
+typedef struct {
+    int generation;                     // of the runtime key it was derived from
+    uint64_t expires_us;
+    uint64_t epoch;
+    uint8_t pk[32];
+    uint8_t nonce[W3_DEOXYS_NONCE_SIZE];
+    uint64_t counter;
+    w3_deoxys_t aead;
+} sapphire_session_t;
+
+typedef struct {
+    char* data;
+    size_t len;
+} sapphire_body_t;
+
+// Cursor over CBOR input
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* end;
+} cbor_t;
+
+static sapphire_t* sapphire = NULL;
+static sapphire_session_t sessions[W3_SAPPHIRE_MAX_RUNTIMES];
+static uint64_t refresh_us = 0;
+static uint64_t session_us = 0;
+
+int w3_sapphire_init(int refresh_s, int session_s) {
+    const char* impl;
+
+    sapphire = shm_malloc(sizeof(sapphire_t));
+    if (!sapphire) {
+        LM_ERR("Not enough shared memory for Sapphire runtime keys\n");
+        return -1;
+    }
+    memset(sapphire, 0, sizeof(sapphire_t));
+    if (!lock_init(&sapphire->lock)) {
+        LM_ERR("Failed to initialize Sapphire key lock\n");
+        shm_free(sapphire);
+        sapphire = NULL;
+        return -1;
+    }
+
+    refresh_us = (uint64_t)(refresh_s > 0 ? refresh_s : 1) * 1000000ULL;
+    session_us = (uint64_t)(session_s > 0 ? session_s : 1) * 1000000ULL;
+    impl = w3_deoxys_select();
+    LM_INFO("Confidential calls: Deoxys-II %s, key refresh %ds, sessions %ds\n", impl,
+            refresh_s, session_s);
+    return 0;
+}
+
+void w3_sapphire_destroy(void) {
+    if (sapphire) {
+        lock_destroy(&sapphire->lock);
+        shm_free(sapphire);
+        sapphire = NULL;
+    }
+}
+
+// Index of the runtime behind ep, added when missing; -1 when full
+static int sapphire_runtime(const w3_endpoint_t* ep) {
+    int n = sapphire->nruntimes;
+    int i;
+
+    membar_read();
+    for (i = 0; i < n; i++) {
+        if (strcmp(sapphire->runtimes[i].ep.url, ep->url) == 0) return i;
+    }
+
+    lock_get(&sapphire->lock);
+    for (i = 0; i < sapphire->nruntimes; i++) {
+        if (strcmp(sapphire->runtimes[i].ep.url, ep->url) == 0) break;
+    }
+    if (i == sapphire->nruntimes && i < W3_SAPPHIRE_MAX_RUNTIMES) {
+        sapphire->runtimes[i].ep = *ep;
+        membar_write();
+        sapphire->nruntimes = i + 1;
+    }
+    lock_release(&sapphire->lock);
+    return i < W3_SAPPHIRE_MAX_RUNTIMES ? i : -1;
+}
+
+static size_t sapphire_write(void* contents, size_t size, size_t nmemb, void* userp) {
+    sapphire_body_t* body = (sapphire_body_t*)userp;
+    size_t n = size * nmemb;
+    char* p = pkg_realloc(body->data, body->len + n + 1);
+
+    if (!p) return 0;
+    body->data = p;
+    memcpy(body->data + body->len, contents, n);
+    body->len += n;
+    body->data[body->len] = '\0';
+    return n;
+}
+
+// Fetch the current public key of runtime i; a different key or epoch
+// starts a new generation
+static int sapphire_fetch(int i) {
+    static const char request[] =
+            "{\"jsonrpc\":\"2.0\",\"method\":\"oasis_callDataPublicKey\",\"params\":[],\"id\":1}";
+    sapphire_runtime_t* rt = &sapphire->runtimes[i];
+    sapphire_body_t body = {0};
+    CURL* curl;
+    CURLcode res;
+    long code = 0;
+    const char* end;
+    const char* result;
+    const char* result_end;
+    const char* v;
+    const char* hex;
+    uint8_t key[32];
+    uint64_t epoch = 0;
+    int rc = -1;
+
+    atomic_inc_long(&rt->fetches);
+    rt->next_fetch_us = w3_now_us() + refresh_us;
+
+    curl = w3_http_handle(&rt->ep);
+    if (!curl) goto done;
+    curl_easy_setopt(curl, CURLOPT_URL, rt->ep.url);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)(sizeof(request) - 1));
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, sapphire_write);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)SAPPHIRE_TIMEOUT_MS);
+
+    res = curl_easy_perform(curl);
+    if (res == CURLE_OK) curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    w3_http_done(curl, &rt->ep, res);
+    w3_acct_record(rt->ep.url, sizeof(request) - 1, body.len, res == CURLE_OK && code < 400);
+    if (res != CURLE_OK || code != 200 || !body.data) {
+        LM_WARN("Confidential calls: key request to %s failed (%s, HTTP %ld)\n", rt->ep.url,
+                curl_easy_strerror(res), code);
+        goto done;
+    }
+
+    end = body.data + body.len;
+    result = w3_json_member(body.data, end, "result");
+    if (!result || *result != '{') goto malformed;
+    result_end = w3_json_skip(result, end);
+
+    v = w3_json_member(result + 1, result_end, "key");
+    if (!v || w3_json_hex(v, result_end, &hex) != 64 || w3_hex_decode(hex, 64, key) < 0) {
+        goto malformed;
+    }
+    v = w3_json_member(result + 1, result_end, "epoch");
+    if (v && *v == '"') {
+        if (w3_json_hex(v, result_end, &hex) > 0) epoch = strtoull(hex, NULL, 16);
+    } else if (v) {
+        epoch = strtoull(v, NULL, 10);
+    }
+
+    lock_get(&sapphire->lock);
+    if (rt->generation == 0 || memcmp(rt->key, key, sizeof(key)) != 0 || rt->epoch != epoch) {
+        memcpy(rt->key, key, sizeof(key));
+        rt->epoch = epoch;
+        membar_write();
+        rt->generation = rt->generation + 1 > 0 ? rt->generation + 1 : 1;
+        LM_INFO("Confidential calls: runtime key of %s for epoch %llu\n", rt->ep.url,
+                (unsigned long long)epoch);
+    }
+    rt->fetched_ms = w3_realtime_ms();
+    rt->stale = 0;
+    lock_release(&sapphire->lock);
+    rc = 0;
+    goto done;
+
+malformed:
+    LM_WARN("Confidential calls: malformed key response from %s\n", rt->ep.url);
+done:
+    if (rc < 0) atomic_inc_long(&rt->fetch_errors);
+    if (body.data) pkg_free(body.data);
+    return rc;
+}
+
+// Derive a session with runtime i unless the current one is still valid
+static int sapphire_session(int i) {
+    sapphire_runtime_t* rt = &sapphire->runtimes[i];
+    sapphire_session_t* s = &sessions[i];
+    uint8_t sk[32], peer[32], shared[32], key[32];
+    uint64_t now = w3_now_us();
+    uint64_t epoch;
+    uint8_t nonzero = 0;
+    int generation;
+
+    if (s->generation != 0 && s->generation == rt->generation && now < s->expires_us) return 0;
+
+    lock_get(&sapphire->lock);
+    generation = rt->generation;
+    memcpy(peer, rt->key, sizeof(peer));
+    epoch = rt->epoch;
+    lock_release(&sapphire->lock);
+    if (generation == 0) return -1;
+
+    if (getrandom(sk, sizeof(sk), 0) != sizeof(sk)
+            || getrandom(s->nonce, SAPPHIRE_NONCE_RANDOM, 0) != SAPPHIRE_NONCE_RANDOM) {
+        LM_ERR("Confidential calls: no randomness for a session key\n");
+        return -1;
+    }
+    x25519_base(s->pk, sk);
+    x25519(shared, sk, peer);
+    for (size_t k = 0; k < sizeof(shared); k++) nonzero |= shared[k];
+    if (!nonzero) {
+        LM_ERR("Confidential calls: runtime key of %s is a low-order point\n", rt->ep.url);
+        memset(sk, 0, sizeof(sk));
+        return -1;
+    }
+    hmac_sha512_256((const uint8_t*)sapphire_kdf_label, sizeof(sapphire_kdf_label) - 1,
+            shared, sizeof(shared), key);
+    w3_deoxys_init(&s->aead, key);
+    memset(sk, 0, sizeof(sk));
+    memset(shared, 0, sizeof(shared));
+    memset(key, 0, sizeof(key));
+
+    s->generation = generation;
+    s->epoch = epoch;
+    s->counter = 0;
+    s->expires_us = now + session_us;
+    atomic_inc_long(&rt->sessions);
+    return 0;
+}
+
+// CBOR head of major type major with argument v
+static uint8_t* cbor_head(uint8_t* p, int major, uint64_t v) {
+    int n;
+
+    if (v < 24) {
+        *p++ = (uint8_t)(major << 5 | v);
+        return p;
+    }
+    n = v < 0x100 ? 1 : v < 0x10000 ? 2 : v < 0x100000000ULL ? 4 : 8;
+    *p++ = (uint8_t)(major << 5 | (n == 1 ? 24 : n == 2 ? 25 : n == 4 ? 26 : 27));
+    for (int k = n - 1; k >= 0; k--) *p++ = (uint8_t)(v >> (8 * k));
+    return p;
+}
+
+static uint8_t* cbor_text(uint8_t* p, const char* s) {
+    size_t len = strlen(s);
+    p = cbor_head(p, 3, len);
+    memcpy(p, s, len);
+    return p + len;
+}
+
+static uint8_t* cbor_bytes(uint8_t* p, const uint8_t* data, size_t len) {
+    p = cbor_head(p, 2, len);
+    memcpy(p, data, len);
+    return p + len;
+}
+
+// Read the head of the next item; -1 when truncated or of indefinite length
+static int cbor_read(cbor_t* c, int* major, uint64_t* v) {
+    int info, n;
+
+    if (c->p >= c->end) return -1;
+    *major = *c->p >> 5;
+    info = *c->p++ & 31;
+    if (info < 24) {
+        *v = info;
+        return 0;
+    }
+    if (info > 27) return -1;
+    n = 1 << (info - 24);
+    if (c->end - c->p < n) return -1;
+    *v = 0;
+    while (n--) *v = *v << 8 | *c->p++;
+    return 0;
+}
+
+static int cbor_skip(cbor_t* c, int depth) {
+    int major;
+    uint64_t v;
+
+    if (depth > SAPPHIRE_CBOR_DEPTH || cbor_read(c, &major, &v) < 0) return -1;
+    switch (major) {
+        case 2: case 3:
+            if ((uint64_t)(c->end - c->p) < v) return -1;
+            c->p += v;
+            return 0;
+        case 4: case 5:
+            if (major == 5) {
+                if (v > (uint64_t)(c->end - c->p)) return -1;
+                v *= 2;
+            }
+            while (v--) {
+                if (cbor_skip(c, depth + 1) < 0) return -1;
+            }
+            return 0;
+        case 6:
+            return cbor_skip(c, depth + 1);
+        default:
+            return 0;
+    }
+}
+
+// Position value at member key of the map with n entries starting at map
+static int cbor_member(const cbor_t* map, uint64_t n, const char* key, cbor_t* value) {
+    cbor_t c = *map;
+    size_t klen = strlen(key);
+    int major;
+    uint64_t v;
+
+    for (uint64_t k = 0; k < n; k++) {
+        cbor_t at = c;
+        if (cbor_read(&at, &major, &v) < 0) return -1;
+        if (major == 3 && v == klen && (uint64_t)(at.end - at.p) >= v
+                && memcmp(at.p, key, klen) == 0) {
+            value->p = at.p + klen;
+            value->end = c.end;
+            return 0;
+        }
+        if (cbor_skip(&c, 1) < 0 || cbor_skip(&c, 1) < 0) return -1;
+    }
+    return -1;
+}
+
+// Typed reads: the string of major type major, or the entries of a map
+static int cbor_string(cbor_t* c, int major, const uint8_t** data, size_t* len) {
+    int m;
+    uint64_t v;
+
+    if (cbor_read(c, &m, &v) < 0 || m != major || (uint64_t)(c->end - c->p) < v) return -1;
+    *data = c->p;
+    *len = v;
+    c->p += v;
+    return 0;
+}
+
+static int cbor_map(cbor_t* c, uint64_t* n) {
+    int m;
+
+    return cbor_read(c, &m, n) < 0 || m != 5 ? -1 : 0;
+}
+
+int w3_sapphire_seal(const w3_endpoint_t* ep, const uint8_t* calldata, size_t len,
+        char* out, size_t* out_len) {
+    sapphire_runtime_t* rt;
+    sapphire_session_t* s;
+    uint8_t* inner;
+    uint8_t* envelope;
+    uint8_t* p;
+    size_t inner_len;
+    int i;
+
+    if (!sapphire || (i = sapphire_runtime(ep)) < 0) return -1;
+    rt = &sapphire->runtimes[i];
+    s = &sessions[i];
+
+    // First call for this runtime in any process: fetch the key inline
+    if (rt->generation == 0 && sapphire_fetch(i) < 0) return -1;
+    if (sapphire_session(i) < 0) return -1;
+
+    // Inner envelope {"body": calldata}, sealed into the outer one at the
+    // end of the same buffer
+    envelope = pkg_malloc(2 * (len + W3_SAPPHIRE_OVERHEAD));
+    if (!envelope) return -1;
+    inner = envelope + len + W3_SAPPHIRE_OVERHEAD;
+    p = cbor_head(inner, 5, 1);
+    p = cbor_text(p, "body");
+    p = cbor_bytes(p, calldata, len);
+    inner_len = p - inner;
+
+    for (int k = 0; k < 8; k++) {
+        s->nonce[SAPPHIRE_NONCE_RANDOM + k] = (uint8_t)(s->counter >> (56 - 8 * k));
+    }
+    s->counter++;
+
+    // {"body": {"pk", "data", "epoch", "nonce"}, "format": 1}, keys in
+    // canonical order
+    p = cbor_head(envelope, 5, 2);
+    p = cbor_text(p, "body");
+    p = cbor_head(p, 5, 4);
+    p = cbor_text(p, "pk");
+    p = cbor_bytes(p, s->pk, sizeof(s->pk));
+    p = cbor_text(p, "data");
+    p = cbor_head(p, 2, inner_len + W3_DEOXYS_TAG_SIZE);
+    w3_deoxys_seal(&s->aead, s->nonce, NULL, 0, inner, inner_len, p);
+    p += inner_len + W3_DEOXYS_TAG_SIZE;
+    p = cbor_text(p, "epoch");
+    p = cbor_head(p, 0, s->epoch);
+    p = cbor_text(p, "nonce");
+    p = cbor_bytes(p, s->nonce, sizeof(s->nonce));
+    p = cbor_text(p, "format");
+    p = cbor_head(p, 0, SAPPHIRE_FORMAT);
+
+    w3_hex_encode(envelope, p - envelope, out);
+    *out_len = 2 * (p - envelope);
+    memset(inner, 0, inner_len);
+    pkg_free(envelope);
+    atomic_inc_long(&rt->seals);
+    return i;
+}
+
+// Fill revert from a {"module", "code", "message"} failure
+static int sapphire_failure(const cbor_t* fail, w3_revert_t* revert) {
+    cbor_t c = *fail, v;
+    uint64_t n, code = 0;
+    const uint8_t* module = (const uint8_t*)"";
+    const uint8_t* msg = (const uint8_t*)"";
+    size_t module_len = 0, msg_len = 0;
+    int major;
+
+    if (cbor_map(&c, &n) < 0) return -1;
+    if (cbor_member(&c, n, "module", &v) == 0) cbor_string(&v, 3, &module, &module_len);
+    if (cbor_member(&c, n, "message", &v) == 0) cbor_string(&v, 3, &msg, &msg_len);
+    if (cbor_member(&c, n, "code", &v) == 0 && (cbor_read(&v, &major, &code) < 0 || major != 0)) {
+        code = 0;
+    }
+    w3_revert_failure((const char*)module, module_len, (long)code, (const char*)msg, msg_len,
+            revert);
+    return 0;
+}
+
+int w3_sapphire_open(int session, const char* hex, size_t hex_len, uint8_t* buf,
+        size_t* out_len, w3_revert_t* revert) {
+    sapphire_runtime_t* rt;
+    sapphire_session_t* s;
+    cbor_t c, v, unknown;
+    uint64_t n;
+    const uint8_t* nonce;
+    const uint8_t* data;
+    size_t nonce_len, data_len;
+
+    if (!sapphire || session < 0 || session >= sapphire->nruntimes) return -1;
+    rt = &sapphire->runtimes[session];
+    s = &sessions[session];
+    atomic_inc_long(&rt->opens);
+
+    if (hex_len % 2 || w3_hex_decode(hex, hex_len, buf) < 0) goto bad;
+    c.p = buf;
+    c.end = buf + hex_len / 2;
+    if (cbor_map(&c, &n) < 0) goto bad;
+
+    // The node reports envelopes it could not open in plain text
+    if (cbor_member(&c, n, "fail", &v) == 0) {
+        if (sapphire_failure(&v, revert) < 0) goto bad;
+        atomic_inc_long(&rt->failures);
+        if (revert->node_fault) rt->stale = 1;
+        return 1;
+    }
+
+    if (cbor_member(&c, n, "unknown", &unknown) < 0 || cbor_map(&unknown, &n) < 0
+            || cbor_member(&unknown, n, "nonce", &v) < 0
+            || cbor_string(&v, 2, &nonce, &nonce_len) < 0 || nonce_len != W3_DEOXYS_NONCE_SIZE
+            || cbor_member(&unknown, n, "data", &v) < 0
+            || cbor_string(&v, 2, &data, &data_len) < 0
+            || w3_deoxys_open(&s->aead, nonce, NULL, 0, data, data_len, (uint8_t*)data) < 0) {
+        goto bad;
+    }
+
+    c.p = data;
+    c.end = data + data_len - W3_DEOXYS_TAG_SIZE;
+    if (cbor_map(&c, &n) < 0) goto bad;
+    if (cbor_member(&c, n, "ok", &v) == 0) {
+        if (cbor_string(&v, 2, &data, &data_len) < 0) goto bad;
+        memmove(buf, data, data_len);
+        *out_len = data_len;
+        return 0;
+    }
+    if (cbor_member(&c, n, "fail", &v) == 0 && sapphire_failure(&v, revert) == 0) {
+        atomic_inc_long(&rt->failures);
+        return 1;
+    }
+
+bad:
+    // Most likely an epoch change the refresh has not seen yet
+    atomic_inc_long(&rt->open_errors);
+    rt->stale = 1;
+    return -1;
+}
+
+void w3_sapphire_stale(int session) {
+    if (sapphire && session >= 0 && session < sapphire->nruntimes) {
+        sapphire->runtimes[session].stale = 1;
+    }
+}
+
+void w3_sapphire_timer(unsigned int ticks, void* param) {
+    uint64_t now;
+    int n;
+
+    (void)ticks;
+    (void)param;
+    if (!sapphire) return;
+    n = sapphire->nruntimes;
+    membar_read();
+
+    now = w3_now_us();
+    for (int i = 0; i < n; i++) {
+        sapphire_runtime_t* rt = &sapphire->runtimes[i];
+        if (rt->stale || now >= rt->next_fetch_us) sapphire_fetch(i);
+    }
+}
+
+void w3_sapphire_rpc_stats(rpc_t* rpc, void* ctx) {
+    char key[65];
+    void* th;
+    int n;
+
+    if (!sapphire) {
+        rpc->fault(ctx, 500, "Confidential calls disabled");
+        return;
+    }
+    n = sapphire->nruntimes;
+    membar_read();
+
+    for (int i = 0; i < n; i++) {
+        sapphire_runtime_t* rt = &sapphire->runtimes[i];
+        uint64_t now_ms = w3_realtime_ms();
+
+        lock_get(&sapphire->lock);
+        w3_hex_encode(rt->key, sizeof(rt->key), key);
+        key[64] = '\0';
+        lock_release(&sapphire->lock);
+
+        if (rpc->add(ctx, "{", &th) < 0) return;
+        rpc->struct_add(th, "ssuudduuuuuuu",
+                "endpoint", rt->ep.url,
+                "key", rt->generation ? key : "",
+                "epoch", (unsigned int)rt->epoch,
+                "generation", (unsigned int)rt->generation,
+                "key_age", rt->fetched_ms ? (int)((now_ms - rt->fetched_ms) / 1000) : -1,
+                "stale", rt->stale,
+                "seals", (unsigned int)rt->seals,
+                "opens", (unsigned int)rt->opens,
+                "failures", (unsigned int)rt->failures,
+                "open_errors", (unsigned int)rt->open_errors,
+                "sessions", (unsigned int)rt->sessions,
+                "fetches", (unsigned int)rt->fetches,
+                "fetch_errors", (unsigned int)rt->fetch_errors);
+    }
+}
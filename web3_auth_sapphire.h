@@ -0,0 +1,51 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Confidential eth_call for Oasis Sapphire.
+ */
+
+#ifndef _WEB3_AUTH_SAPPHIRE_H_
+#define _WEB3_AUTH_SAPPHIRE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../../core/rpc.h"
+
+#include "web3_auth_revert.h"
+#include "web3_auth_shard.h"
+
+#define W3_SAPPHIRE_MAX_RUNTIMES 16
+
+// Envelope bytes added to the call data, at most
+#define W3_SAPPHIRE_OVERHEAD 160
+
+// Allocate the runtime key table; must run in mod_init (before fork). Keys
+// are fetched again every refresh_s seconds, and sessions of a process are
+// renewed after session_s seconds.
+int w3_sapphire_init(int refresh_s, int session_s);
+void w3_sapphire_destroy(void);
+
+// Encrypt calldata for the runtime behind ep and write the envelope as hex
+// digits to out, which has room for 2 * (len + W3_SAPPHIRE_OVERHEAD).
+// Returns the session to open the result with, -1 when no runtime key is
+// available. The key is fetched through ep on first use.
+int w3_sapphire_seal(const w3_endpoint_t* ep, const uint8_t* calldata, size_t len,
+        char* out, size_t* out_len);
+
+// Decrypt the hex result of a sealed call into buf, which has room for
+// hex_len / 2 bytes. Returns 0 with the return data in buf, 1 when the call
+// failed with revert filled in, -1 when the result cannot be read; that
+// also has the runtime key fetched again.
+int w3_sapphire_open(int session, const char* hex, size_t hex_len, uint8_t* buf,
+        size_t* out_len, w3_revert_t* revert);
+
+// Mark the key of session for refresh, on errors that may mean it expired
+void w3_sapphire_stale(int session);
+
+// Key process: fetch runtime keys that are due or marked stale
+void w3_sapphire_timer(unsigned int ticks, void* param);
+
+void w3_sapphire_rpc_stats(rpc_t* rpc, void* ctx);
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * SHA-512/256 and its HMAC, the key derivation of Sapphire calls.
+ */
+
+#ifndef _WEB3_AUTH_SHA512_H_
+#define _WEB3_AUTH_SHA512_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SHA-512 truncated to 256 bits with its own initial values (FIPS 180-4)
+void sha512_256(const uint8_t* input, size_t input_len, uint8_t output[32]);
+
+// HMAC (RFC 2104) over SHA-512/256, 128-byte block
+void hmac_sha512_256(const uint8_t* key, size_t key_len,
+        const uint8_t* input, size_t input_len, uint8_t output[32]);
+
+#endif
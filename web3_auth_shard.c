@@ -0,0 +1,211 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Placement of users on RPC endpoints and endpoint health.
+ *
+ * With rendezvous hashing every endpoint gets a weight per username, the
+ * hash of the endpoint seed and the username, and the endpoints are tried
+ * by descending weight. A user therefore keeps hitting the same backend,
+ * whose caches stay warm for it, and adding or removing one of N endpoints
+ * only moves about 1/N of the users. Failover follows the same order, so
+ * the users of a failed endpoint spread over all the others.
+ *
+ * Endpoints share a small health table in shm: consecutive failures mark
+ * an endpoint down for a while, and down endpoints are only tried after
+ * all healthy ones. Every routing snapshot holds a reference on the slots
+ * of its endpoints; a slot no snapshot refers to any more is given to the
+ * next new URL, so endpoint changes at runtime do not use the table up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../core/dprint.h"
+#include "../../core/locking.h"
+#include "../../core/mem/shm_mem.h"
+
+#include "web3_auth.h"
+#include "web3_auth_shard.h"
+
+typedef struct {
+    char url[W3_URL_SIZE];
+    int refs;                       // endpoints of routing snapshots, 0 when free
+    volatile int failures;          // consecutive failures
+    volatile uint64_t down_until_us;
+    unsigned long requests;
+    unsigned long errors;
+} shard_health_t;
+
+typedef struct {
+    gen_lock_t lock;
+    int fail_threshold;
+    uint64_t down_us;
+    int count;
+    shard_health_t health[W3_SHARD_MAX_HEALTH];
+} shard_table_t;
+
+static shard_table_t* shards = NULL;
+
+int w3_shard_init(int fail_threshold, int down_s) {
+    shards = shm_malloc(sizeof(shard_table_t));
+    if (!shards) {
+        LM_ERR("Not enough shared memory for endpoint health\n");
+        return -1;
+    }
+    memset(shards, 0, sizeof(shard_table_t));
+
+    if (!lock_init(&shards->lock)) {
+        LM_ERR("Failed to initialize endpoint health lock\n");
+        shm_free(shards);
+        shards = NULL;
+        return -1;
+    }
+    shards->fail_threshold = fail_threshold;
+    shards->down_us = (uint64_t)(down_s > 0 ? down_s : 0) * 1000000;
+    return 0;
+}
+
+void w3_shard_destroy(void) {
+    if (!shards) return;
+    lock_destroy(&shards->lock);
+    shm_free(shards);
+    shards = NULL;
+}
+
+int w3_shard_register(w3_endpoint_t* ep) {
+    int i, free_slot = -1;
+
+    ep->seed = w3_hash64(W3_HASH64_SEED, ep->url, strlen(ep->url));
+    ep->health = -1;
+    if (!shards) return 0;
+
+    // Runtime reconfiguration registers endpoints while workers report. A
+    // URL that comes back finds its old slot, health and counters included.
+    lock_get(&shards->lock);
+    for (i = 0; i < shards->count; i++) {
+        if (strcmp(shards->health[i].url, ep->url) == 0) break;
+        if (shards->health[i].refs == 0 && free_slot < 0) free_slot = i;
+    }
+    if (i == shards->count) {
+        if (free_slot >= 0) {
+            i = free_slot;
+        } else if (i == W3_SHARD_MAX_HEALTH) {
+            lock_release(&shards->lock);
+            LM_WARN("More than %d RPC endpoints, health of %s not tracked\n",
+                    W3_SHARD_MAX_HEALTH, ep->url);
+            return 0;
+        } else {
+            shards->count++;
+        }
+        memset(&shards->health[i], 0, sizeof(shard_health_t));
+        snprintf(shards->health[i].url, sizeof(shards->health[i].url), "%s", ep->url);
+    }
+    shards->health[i].refs++;
+    lock_release(&shards->lock);
+    ep->health = i;
+    return 0;
+}
+
+void w3_shard_unregister(w3_endpoint_t* ep) {
+    if (!shards || ep->health < 0) return;
+    lock_get(&shards->lock);
+    shards->health[ep->health].refs--;
+    lock_release(&shards->lock);
+    ep->health = -1;
+}
+
+// Final mix of the weight so that similar seeds give unrelated orders
+static inline uint64_t shard_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline int shard_is_down(const w3_endpoint_t* ep, uint64_t now) {
+    return shards && ep->health >= 0 && shards->health[ep->health].down_until_us > now;
+}
+
+int w3_shard_order(const w3_endpoint_t* eps, int n, int mode, const char* user, int len,
+        int order[W3_MAX_ENDPOINTS]) {
+    uint64_t weight[W3_MAX_ENDPOINTS];
+    uint64_t now = w3_now_us();
+
+    if (n > W3_MAX_ENDPOINTS) n = W3_MAX_ENDPOINTS;
+
+    // Listed order keeps weight falling with the index; down endpoints sink
+    for (int i = 0; i < n; i++) {
+        weight[i] = mode == W3_SHARD_RENDEZVOUS
+                ? shard_mix(w3_hash64(eps[i].seed, user, len)) >> 1
+                : (uint64_t)(W3_MAX_ENDPOINTS - i);
+        if (!shard_is_down(&eps[i], now)) weight[i] |= 1ULL << 63;
+        order[i] = i;
+    }
+
+    // Insertion sort by descending weight, n is tiny
+    for (int i = 1; i < n; i++) {
+        int o = order[i];
+        int j = i - 1;
+        while (j >= 0 && weight[order[j]] < weight[o]) {
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = o;
+    }
+    return n;
+}
+
+void w3_shard_report(const w3_endpoint_t* ep, int ok) {
+    shard_health_t* h;
+
+    if (!shards || ep->health < 0) return;
+    h = &shards->health[ep->health];
+
+    lock_get(&shards->lock);
+    h->requests++;
+    if (ok) {
+        h->failures = 0;
+        h->down_until_us = 0;
+    } else {
+        h->errors++;
+        if (shards->fail_threshold > 0 && ++h->failures >= shards->fail_threshold
+                && h->down_until_us <= w3_now_us()) {
+            h->down_until_us = w3_now_us() + shards->down_us;
+            LM_WARN("RPC endpoint %s down after %d failures in a row\n", h->url, h->failures);
+        }
+    }
+    lock_release(&shards->lock);
+}
+
+void w3_shard_rpc_endpoints(rpc_t* rpc, void* ctx) {
+    shard_health_t h;
+    uint64_t now;
+    void* th;
+
+    if (!shards) {
+        rpc->fault(ctx, 500, "Endpoint health not initialized");
+        return;
+    }
+
+    now = w3_now_us();
+    for (int i = 0; i < shards->count; i++) {
+        lock_get(&shards->lock);
+        memcpy(&h, &shards->health[i], sizeof(h));
+        lock_release(&shards->lock);
+        if (h.refs == 0) continue;
+
+        if (rpc->add(ctx, "{", &th) < 0) {
+            rpc->fault(ctx, 500, "Internal error creating structure");
+            return;
+        }
+        rpc->struct_add(th, "ssduu",
+                "url", h.url,
+                "state", h.down_until_us > now ? "down" : "up",
+                "failures", h.failures,
+                "requests", (unsigned int)h.requests,
+                "errors", (unsigned int)h.errors);
+    }
+}
@@ -0,0 +1,51 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Placement of users on RPC endpoints and endpoint health.
+ */
+
+#ifndef _WEB3_AUTH_SHARD_H_
+#define _WEB3_AUTH_SHARD_H_
+
+#include <stdint.h>
+
+#include "../../core/rpc.h"
+
+#define W3_MAX_ENDPOINTS 8
+#define W3_URL_SIZE 256
+#define W3_SHARD_MAX_HEALTH 64    // distinct endpoints with tracked health
+
+#define W3_SHARD_ORDERED 0      // listed order, later endpoints are fallbacks
+#define W3_SHARD_RENDEZVOUS 1   // highest-random-weight by username
+
+// One RPC endpoint of a tenant
+typedef struct w3_endpoint {
+    char url[W3_URL_SIZE];
+    uint64_t seed;          // rendezvous weight seed, derived from the URL
+    int health;             // slot in the shared health table, -1 if untracked
+} w3_endpoint_t;
+
+// Allocate the shared health table; must run in mod_init (before fork) and
+// before any endpoint is registered. An endpoint that fails fail_threshold
+// times in a row is skipped for down_s seconds.
+int w3_shard_init(int fail_threshold, int down_s);
+void w3_shard_destroy(void);
+
+// Fill seed and health slot of an endpoint; endpoints with the same URL
+// share their health. Each registration holds the slot until
+// w3_shard_unregister(), which must wait until no process can still report
+// on the endpoint.
+int w3_shard_register(w3_endpoint_t* ep);
+void w3_shard_unregister(w3_endpoint_t* ep);
+
+// Order in which the endpoints are tried for user: preferred first, those
+// marked down last. Returns the number of entries written to order.
+int w3_shard_order(const w3_endpoint_t* eps, int n, int mode, const char* user, int len,
+        int order[W3_MAX_ENDPOINTS]);
+
+// Report the outcome of a request to an endpoint
+void w3_shard_report(const w3_endpoint_t* ep, int ok);
+
+void w3_shard_rpc_endpoints(rpc_t* rpc, void* ctx);
+
+#endif
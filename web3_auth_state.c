@@ -0,0 +1,550 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Local snapshots of contract code and storage for the EVM interpreter.
+ *
+ * Workers execute the digest function against shm copies of the contract
+ * code and of the storage words it reads. A slot the snapshot lacks does
+ * not stall the worker: it is queued, the execution goes on with zero to
+ * discover further slots, and the call falls back to eth_call. A dedicated
+ * process loads queued code and slots in JSON-RPC batches, all at the
+ * block it last checked, and watches the contract's events: any log since
+ * that block bumps the contract generation, which drops every stored word
+ * at once. The scheme assumes the contract emits an event whenever it
+ * changes credentials; the shadow comparison with eth_call catches
+ * contracts that do not and drops their storage as well.
+ *
+ * Slots live in a set-associative table, as in the digest cache.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <curl/curl.h>
+
+#include "../../core/dprint.h"
+#include "../../core/locking.h"
+#include "../../core/atomic_ops.h"
+#include "../../core/mem/mem.h"
+#include "../../core/mem/shm_mem.h"
+
+#include "web3_auth.h"
+#include "web3_auth_acct.h"
+#include "web3_auth_evm.h"
+#include "web3_auth_hex.h"
+#include "web3_auth_http.h"
+#include "web3_auth_json.h"
+#include "web3_auth_state.h"
+
+#define STATE_WAYS 4
+#define STATE_LOCKS 64
+#define STATE_BATCH 64                  // eth_getStorageAt calls per request
+#define STATE_TIMEOUT_MS 5000
+#define STATE_REQUEST_SIZE (STATE_BATCH * 192 + 64)
+
+#define SLOT_WANTED 1
+#define SLOT_VALID 2
+
+typedef struct {
+    uint8_t address[20];
+    char hex[43];                       // 0x-prefixed, for requests
+    w3_endpoint_t ep;
+    volatile int ready;                 // 1 code loaded, -1 no code at the address
+    volatile int generation;            // bumped when storage may have changed
+    uint64_t block;                     // storage is read at this block
+    uint64_t chain_id;
+    size_t code_len;
+    uint8_t code[W3_EVM_MAX_CODE];
+    uint8_t jumpdests[W3_EVM_MAX_CODE / 8];
+    volatile long calls;
+    volatile long served;
+    volatile long missing;
+    volatile long unsupported;
+    volatile long shadow_checks;
+    volatile long shadow_mismatches;
+    volatile long invalidations;
+} state_contract_t;
+
+typedef struct {
+    uint8_t slot[32];
+    uint8_t value[32];
+    int generation;                     // of the contract when read
+    uint8_t contract;                   // index + 1, 0 marks a free entry
+    uint8_t state;
+} state_slot_t;
+
+typedef struct {
+    gen_lock_t lock;                    // adding contracts
+    volatile int ncontracts;
+    unsigned int sets;
+    state_contract_t contracts[W3_STATE_MAX_CONTRACTS];
+    state_slot_t slots[];
+} state_t;
+
+// Storage reads of one execution
+typedef struct {
+    int contract;
+    int generation;
+    int missing;
+} state_ctx_t;
+
+// Response body of the sync process, in pkg memory
+typedef struct {
+    char* data;
+    size_t len;
+} state_body_t;
+
+static state_t* state = NULL;
+static gen_lock_set_t* state_locks = NULL;
+
+int w3_state_init(int slots) {
+    unsigned int sets;
+    size_t bytes;
+
+    if (slots <= 0) slots = STATE_WAYS;
+    sets = (slots + STATE_WAYS - 1) / STATE_WAYS;
+    bytes = sizeof(state_t) + (size_t)sets * STATE_WAYS * sizeof(state_slot_t);
+
+    state = shm_malloc(bytes);
+    if (!state) {
+        LM_ERR("Not enough shared memory for contract snapshots\n");
+        return -1;
+    }
+    memset(state, 0, bytes);
+    state->sets = sets;
+
+    state_locks = lock_set_alloc(STATE_LOCKS);
+    if (!lock_init(&state->lock) || !state_locks || !lock_set_init(state_locks)) {
+        LM_ERR("Failed to initialize contract snapshot locks\n");
+        if (state_locks) lock_set_dealloc(state_locks);
+        state_locks = NULL;
+        shm_free(state);
+        state = NULL;
+        return -1;
+    }
+
+    LM_INFO("Local execution: %u storage slots\n", sets * STATE_WAYS);
+    return 0;
+}
+
+void w3_state_destroy(void) {
+    if (state_locks) {
+        lock_set_destroy(state_locks);
+        lock_set_dealloc(state_locks);
+        state_locks = NULL;
+    }
+    if (state) {
+        lock_destroy(&state->lock);
+        shm_free(state);
+        state = NULL;
+    }
+}
+
+static int state_parse_address(const char* hex, uint8_t address[20]) {
+    if (hex[0] != '0' || (hex[1] | 0x20) != 'x' || strlen(hex) != 42) return -1;
+    return w3_hex_decode(hex + 2, 40, address);
+}
+
+// Index of the snapshot of contract, added when missing; -1 when full
+static int state_contract(const char* contract, const w3_endpoint_t* ep) {
+    uint8_t address[20];
+    state_contract_t* c;
+    int n, i;
+
+    if (state_parse_address(contract, address) < 0) return -1;
+
+    n = state->ncontracts;
+    for (i = 0; i < n; i++) {
+        if (memcmp(state->contracts[i].address, address, 20) == 0) return i;
+    }
+    if (!ep) return -1;
+
+    lock_get(&state->lock);
+    for (i = 0; i < state->ncontracts; i++) {
+        if (memcmp(state->contracts[i].address, address, 20) == 0) break;
+    }
+    if (i == state->ncontracts && i < W3_STATE_MAX_CONTRACTS) {
+        c = &state->contracts[i];
+        memcpy(c->address, address, 20);
+        snprintf(c->hex, sizeof(c->hex), "0x%s", contract + 2);
+        c->ep = *ep;
+        membar_write();
+        state->ncontracts = i + 1;
+        LM_INFO("Local execution: snapshot of %s queued\n", c->hex);
+    }
+    lock_release(&state->lock);
+    return i < W3_STATE_MAX_CONTRACTS ? i : -1;
+}
+
+static unsigned int state_set(int contract, const uint8_t slot[32]) {
+    return w3_hash64(W3_HASH64_SEED + contract, (const char*)slot, 32) % state->sets;
+}
+
+// Storage read of the interpreter: the stored word when current, else the
+// slot is queued and zero returned so the execution finds further slots
+static int state_sload(void* ctx, const uint8_t slot[32], uint8_t value[32]) {
+    state_ctx_t* x = (state_ctx_t*)ctx;
+    unsigned int set = state_set(x->contract, slot);
+    state_slot_t* e;
+    state_slot_t* victim = NULL;
+    int hit = 0;
+
+    lock_set_get(state_locks, set % STATE_LOCKS);
+    for (int i = 0; i < STATE_WAYS; i++) {
+        e = &state->slots[set * STATE_WAYS + i];
+        if (e->contract == x->contract + 1 && memcmp(e->slot, slot, 32) == 0) {
+            if (e->state == SLOT_VALID && e->generation == x->generation) {
+                memcpy(value, e->value, 32);
+                hit = 1;
+            } else {
+                e->state = SLOT_WANTED;
+            }
+            victim = NULL;
+            break;
+        }
+        // Prefer free entries, then words of an older generation
+        if (!victim || !e->contract
+                || (victim->contract && e->generation != state->contracts[e->contract - 1].generation)) {
+            victim = e;
+        }
+    }
+    if (victim) {
+        memcpy(victim->slot, slot, 32);
+        victim->contract = x->contract + 1;
+        victim->generation = x->generation;
+        victim->state = SLOT_WANTED;
+    }
+    lock_set_release(state_locks, set % STATE_LOCKS);
+
+    if (!hit) {
+        x->missing = 1;
+        memset(value, 0, 32);
+    }
+    return 0;
+}
+
+int w3_state_call(const char* contract, const w3_endpoint_t* ep, const uint8_t* calldata,
+        size_t len, uint8_t* out, size_t out_size, size_t* out_len) {
+    w3_evm_env_t env;
+    state_contract_t* c;
+    state_ctx_t ctx;
+    int i, rc;
+
+    if (!state || (i = state_contract(contract, ep)) < 0) return W3_EVM_UNSUPPORTED;
+    c = &state->contracts[i];
+    atomic_inc_long(&c->calls);
+
+    if (c->ready != 1) {
+        atomic_inc_long(c->ready ? &c->unsupported : &c->missing);
+        return c->ready ? W3_EVM_UNSUPPORTED : W3_EVM_MISSING;
+    }
+    membar_read();
+
+    memset(&env, 0, sizeof(env));
+    env.code = c->code;
+    env.code_len = c->code_len;
+    env.jumpdests = c->jumpdests;
+    env.calldata = calldata;
+    env.calldata_len = len;
+    memcpy(env.address, c->address, 20);
+    env.number = c->block;
+    env.chain_id = c->chain_id;
+    env.sload = state_sload;
+    env.ctx = &ctx;
+    ctx.contract = i;
+    ctx.generation = c->generation;
+    ctx.missing = 0;
+
+    rc = w3_evm_run(&env, out, out_size, out_len);
+    if (ctx.missing) rc = W3_EVM_MISSING;
+
+    if (rc == W3_EVM_RETURN || rc == W3_EVM_REVERT) atomic_inc_long(&c->served);
+    else if (rc == W3_EVM_MISSING) atomic_inc_long(&c->missing);
+    else atomic_inc_long(&c->unsupported);
+    return rc;
+}
+
+void w3_state_shadow(const char* contract, int match) {
+    state_contract_t* c;
+    int i;
+
+    if (!state || (i = state_contract(contract, NULL)) < 0) return;
+    c = &state->contracts[i];
+    atomic_inc_long(&c->shadow_checks);
+    if (match) return;
+
+    atomic_inc_long(&c->shadow_mismatches);
+    atomic_inc_int(&c->generation);
+    LM_WARN("Local execution of %s disagrees with eth_call, dropping its storage\n", c->hex);
+}
+
+static size_t state_write(void* contents, size_t size, size_t nmemb, void* userp) {
+    state_body_t* body = (state_body_t*)userp;
+    size_t n = size * nmemb;
+    char* p = pkg_realloc(body->data, body->len + n + 1);
+
+    if (!p) return 0;
+    body->data = p;
+    memcpy(body->data + body->len, contents, n);
+    body->len += n;
+    body->data[body->len] = '\0';
+    return n;
+}
+
+// POST request to the endpoint of c; 0 with the response in body, which
+// the caller frees
+static int state_rpc(state_contract_t* c, const char* request, state_body_t* body) {
+    CURL* curl;
+    CURLcode res;
+    long code = 0;
+
+    body->data = NULL;
+    body->len = 0;
+    curl = w3_http_handle(&c->ep);
+    if (!curl) return -1;
+
+    curl_easy_setopt(curl, CURLOPT_URL, c->ep.url);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)strlen(request));
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, state_write);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, body);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)STATE_TIMEOUT_MS);
+
+    res = curl_easy_perform(curl);
+    if (res == CURLE_OK) curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    w3_http_done(curl, &c->ep, res);
+    w3_acct_record(c->ep.url, strlen(request), body->len, res == CURLE_OK && code < 400);
+
+    if (res == CURLE_OK && code == 200 && body->data) return 0;
+    LM_WARN("Local execution: request to %s failed (%s, HTTP %ld)\n", c->ep.url,
+            curl_easy_strerror(res), code);
+    if (body->data) pkg_free(body->data);
+    body->data = NULL;
+    return -1;
+}
+
+// Result of a single call as a number
+static int state_rpc_number(state_contract_t* c, const char* method, const char* params,
+        uint64_t* value) {
+    char request[512];
+    state_body_t body;
+    const char* v;
+    const char* hex;
+    long digits;
+    int rc = -1;
+
+    snprintf(request, sizeof(request), "{\"jsonrpc\":\"2.0\",\"method\":\"%s\",\"params\":[%s],\"id\":1}",
+            method, params);
+    if (state_rpc(c, request, &body) < 0) return -1;
+
+    v = w3_json_member(body.data, body.data + body.len, "result");
+    if (v && (digits = w3_json_hex(v, body.data + body.len, &hex)) > 0 && digits <= 16) {
+        *value = strtoull(hex, NULL, 16);
+        rc = 0;
+    }
+    pkg_free(body.data);
+    return rc;
+}
+
+static void state_load_code(state_contract_t* c) {
+    char request[256];
+    state_body_t body;
+    const char* v;
+    const char* hex;
+    long digits;
+
+    if (state_rpc_number(c, "eth_blockNumber", "", &c->block) < 0) return;
+    if (state_rpc_number(c, "eth_chainId", "", &c->chain_id) < 0) c->chain_id = 0;
+
+    snprintf(request, sizeof(request),
+            "{\"jsonrpc\":\"2.0\",\"method\":\"eth_getCode\",\"params\":[\"%s\",\"0x%llx\"],\"id\":1}",
+            c->hex, (unsigned long long)c->block);
+    if (state_rpc(c, request, &body) < 0) return;
+
+    v = w3_json_member(body.data, body.data + body.len, "result");
+    digits = v ? w3_json_hex(v, body.data + body.len, &hex) : -1;
+    if (digits < 0 || digits > 2 * W3_EVM_MAX_CODE || w3_hex_decode(hex, digits, c->code) < 0) {
+        LM_WARN("Local execution: bad eth_getCode answer for %s\n", c->hex);
+    } else if (digits == 0) {
+        LM_WARN("Local execution: no code at %s, using eth_call only\n", c->hex);
+        c->ready = -1;
+    } else {
+        c->code_len = digits / 2;
+        w3_evm_analyze(c->code, c->code_len, c->jumpdests);
+        membar_write();
+        c->ready = 1;
+        LM_INFO("Local execution: loaded %zu bytes of code of %s at block %llu\n",
+                c->code_len, c->hex, (unsigned long long)c->block);
+    }
+    pkg_free(body.data);
+}
+
+// Move to the latest block; drop the storage when the contract logged
+// anything since the last one, or when that cannot be checked
+static void state_follow(state_contract_t* c) {
+    char request[512];
+    state_body_t body;
+    const char* v;
+    uint64_t latest;
+
+    if (state_rpc_number(c, "eth_blockNumber", "", &latest) < 0 || latest <= c->block) return;
+
+    snprintf(request, sizeof(request),
+            "{\"jsonrpc\":\"2.0\",\"method\":\"eth_getLogs\",\"params\":[{\"address\":\"%s\","
+            "\"fromBlock\":\"0x%llx\",\"toBlock\":\"0x%llx\"}],\"id\":1}",
+            c->hex, (unsigned long long)c->block + 1, (unsigned long long)latest);
+    if (state_rpc(c, request, &body) == 0) {
+        v = w3_json_member(body.data, body.data + body.len, "result");
+        if (v && *v == '[') {
+            for (v++; *v == ' ' || *v == '\t' || *v == '\r' || *v == '\n'; v++);
+        }
+        if (!v || *v != ']') {
+            atomic_inc_int(&c->generation);
+            atomic_inc_long(&c->invalidations);
+            LM_DBG("Local execution: %s changed up to block %llu\n", c->hex,
+                    (unsigned long long)latest);
+        }
+        pkg_free(body.data);
+    } else {
+        atomic_inc_int(&c->generation);
+        atomic_inc_long(&c->invalidations);
+    }
+    c->block = latest;
+}
+
+// Read up to STATE_BATCH queued slots of contract i in one batch request
+static int state_fetch(int i) {
+    state_contract_t* c = &state->contracts[i];
+    uint8_t slots[STATE_BATCH][32];
+    uint8_t value[32];
+    char request[STATE_REQUEST_SIZE];
+    char padded[64];
+    char slot_hex[65];
+    state_body_t body;
+    state_slot_t* e;
+    const char* p;
+    const char* end;
+    const char* obj_end;
+    const char* v;
+    const char* hex;
+    int generation = c->generation;
+    unsigned int total = state->sets * STATE_WAYS;
+    long digits;
+    size_t len;
+    int n = 0, id;
+
+    for (unsigned int k = 0; k < total && n < STATE_BATCH; k++) {
+        e = &state->slots[k];
+        if (e->contract != i + 1 || e->state != SLOT_WANTED) continue;
+        lock_set_get(state_locks, (k / STATE_WAYS) % STATE_LOCKS);
+        if (e->contract == i + 1 && e->state == SLOT_WANTED) memcpy(slots[n++], e->slot, 32);
+        lock_set_release(state_locks, (k / STATE_WAYS) % STATE_LOCKS);
+    }
+    if (n == 0) return 0;
+
+    len = 0;
+    request[len++] = '[';
+    for (id = 0; id < n; id++) {
+        w3_hex_encode(slots[id], 32, slot_hex);
+        slot_hex[64] = '\0';
+        len += snprintf(request + len, sizeof(request) - len,
+                "%s{\"jsonrpc\":\"2.0\",\"method\":\"eth_getStorageAt\",\"params\":[\"%s\",\"0x%s\","
+                "\"0x%llx\"],\"id\":%d}", id ? "," : "", c->hex, slot_hex,
+                (unsigned long long)c->block, id);
+    }
+    request[len++] = ']';
+    request[len] = '\0';
+    if (state_rpc(c, request, &body) < 0) return -1;
+
+    // One answer per call, in any order
+    end = body.data + body.len;
+    for (p = body.data; (p = strchr(p, '{')) != NULL; p = obj_end) {
+        obj_end = w3_json_skip(p, end);
+        v = w3_json_member(p, obj_end, "id");
+        id = v ? atoi(v) : -1;
+        v = w3_json_member(p, obj_end, "result");
+        if (id < 0 || id >= n || !v || (digits = w3_json_hex(v, obj_end, &hex)) < 0 || digits > 64) {
+            continue;
+        }
+        memset(padded, '0', sizeof(padded));
+        memcpy(padded + 64 - digits, hex, digits);
+        if (w3_hex_decode(padded, 64, value) < 0) continue;
+
+        unsigned int set = state_set(i, slots[id]);
+        lock_set_get(state_locks, set % STATE_LOCKS);
+        for (int w = 0; w < STATE_WAYS; w++) {
+            e = &state->slots[set * STATE_WAYS + w];
+            if (e->contract != i + 1 || memcmp(e->slot, slots[id], 32) != 0) continue;
+            memcpy(e->value, value, 32);
+            e->generation = generation;
+            e->state = SLOT_VALID;
+            break;
+        }
+        lock_set_release(state_locks, set % STATE_LOCKS);
+    }
+    pkg_free(body.data);
+    return n;
+}
+
+void w3_state_timer(unsigned int ticks, void* param) {
+    state_contract_t* c;
+    int n;
+
+    (void)ticks;
+    (void)param;
+    if (!state) return;
+    n = state->ncontracts;
+    membar_read();
+
+    for (int i = 0; i < n; i++) {
+        c = &state->contracts[i];
+        if (c->ready == 0) {
+            state_load_code(c);
+            continue;
+        }
+        if (c->ready < 0) continue;
+        state_follow(c);
+        while (state_fetch(i) == STATE_BATCH);
+    }
+}
+
+void w3_state_rpc_stats(rpc_t* rpc, void* ctx) {
+    state_contract_t* c;
+    unsigned int valid[W3_STATE_MAX_CONTRACTS] = {0}, wanted[W3_STATE_MAX_CONTRACTS] = {0};
+    void* th;
+    int n;
+
+    if (!state) {
+        rpc->fault(ctx, 500, "Local execution disabled");
+        return;
+    }
+    n = state->ncontracts;
+
+    for (unsigned int k = 0; k < state->sets * STATE_WAYS; k++) {
+        state_slot_t* e = &state->slots[k];
+        if (!e->contract) continue;
+        c = &state->contracts[e->contract - 1];
+        if (e->state == SLOT_VALID && e->generation == c->generation) valid[e->contract - 1]++;
+        else if (e->state == SLOT_WANTED) wanted[e->contract - 1]++;
+    }
+
+    for (int i = 0; i < n; i++) {
+        c = &state->contracts[i];
+        if (rpc->add(ctx, "{", &th) < 0) return;
+        rpc->struct_add(th, "sdduuuuuuuuuu",
+                "contract", c->hex,
+                "code", c->ready == 1 ? (int)c->code_len : c->ready,
+                "block", (int)c->block,
+                "slots", valid[i],
+                "queued", wanted[i],
+                "calls", (unsigned int)c->calls,
+                "served", (unsigned int)c->served,
+                "missing", (unsigned int)c->missing,
+                "unsupported", (unsigned int)c->unsupported,
+                "shadow_checks", (unsigned int)c->shadow_checks,
+                "shadow_mismatches", (unsigned int)c->shadow_mismatches,
+                "invalidations", (unsigned int)c->invalidations,
+                "generation", (unsigned int)c->generation);
+    }
+}
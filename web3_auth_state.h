@@ -0,0 +1,41 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Local snapshots of contract code and storage for the EVM interpreter.
+ */
+
+#ifndef _WEB3_AUTH_STATE_H_
+#define _WEB3_AUTH_STATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../../core/rpc.h"
+
+#include "web3_auth_shard.h"
+
+#define W3_STATE_MAX_CONTRACTS 16
+
+// Allocate the snapshots with room for slots storage words; must run in
+// mod_init (before fork)
+int w3_state_init(int slots);
+void w3_state_destroy(void);
+
+// Run calldata against the snapshot of contract and return a W3_EVM_*
+// outcome with the return data in out. Contracts and storage slots not in
+// the snapshot yet are queued for the sync process, which reads them
+// through ep; until then the call ends with W3_EVM_MISSING.
+int w3_state_call(const char* contract, const w3_endpoint_t* ep, const uint8_t* calldata,
+        size_t len, uint8_t* out, size_t out_size, size_t* out_len);
+
+// Record the comparison of a local result with eth_call; a mismatch drops
+// the storage of the contract
+void w3_state_shadow(const char* contract, int match);
+
+// Sync process: load code, fetch queued slots in batches and drop storage
+// that events of the contract show may have changed
+void w3_state_timer(unsigned int ticks, void* param);
+
+void w3_state_rpc_stats(rpc_t* rpc, void* ctx);
+
+#endif
@@ -0,0 +1,246 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Heavy-hitter sketch of usernames and source addresses.
+ *
+ * Each process keeps its own Space-Saving summaries (one for usernames, one
+ * for source IPs) in shm, so the per-request update needs no lock: a short
+ * scan of TOPK_SIZE hashes and, on a miss, replacing the smallest counter.
+ * Next to the attempt counter every tracked key also counts the eth_calls it
+ * caused. The RPC command merges the summaries of all processes.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../core/dprint.h"
+#include "../../core/mem/mem.h"
+#include "../../core/mem/shm_mem.h"
+#include "../../core/pt.h"
+
+#include "web3_auth.h"
+#include "web3_auth_topk.h"
+#include "web3_auth_cpu.h"
+
+#define TOPK_SIZE 64
+#define TOPK_KEY_SIZE 48
+#define TOPK_MAX_PROCS 1024
+#define TOPK_DEFAULT_ROWS 20
+
+#define TOPK_USERS 0
+#define TOPK_IPS 1
+
+typedef struct {
+    uint32_t hash[TOPK_SIZE];
+    uint32_t count[TOPK_SIZE];  // attempts, overestimated by at most error
+    uint32_t error[TOPK_SIZE];
+    uint32_t rpc[TOPK_SIZE];    // eth_calls since the key entered the summary
+    char key[TOPK_SIZE][TOPK_KEY_SIZE];
+} topk_summary_t;
+
+typedef struct {
+    topk_summary_t summary[2];
+} topk_slab_t;
+
+typedef struct {
+    topk_slab_t* slabs[TOPK_MAX_PROCS];
+} topk_dir_t;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t count;
+    uint32_t error;
+    uint32_t rpc;
+    char key[TOPK_KEY_SIZE];
+} topk_row_t;
+
+static topk_dir_t* topk_dir = NULL;
+static topk_slab_t* topk_own = NULL;
+
+int w3_topk_init(void) {
+    topk_dir = shm_malloc(sizeof(topk_dir_t));
+    if (!topk_dir) {
+        LM_ERR("Not enough shared memory for the heavy-hitter sketch\n");
+        return -1;
+    }
+    memset(topk_dir, 0, sizeof(topk_dir_t));
+    return 0;
+}
+
+int w3_topk_child_init(int numa_local) {
+    if (!topk_dir) return 0;
+    if (process_no < 0 || process_no >= TOPK_MAX_PROCS) {
+        LM_WARN("Process %d not tracked by the heavy-hitter sketch\n", process_no);
+        return 0;
+    }
+
+    topk_own = shm_malloc(sizeof(topk_slab_t));
+    if (!topk_own) {
+        LM_ERR("Not enough shared memory for the heavy-hitter sketch\n");
+        return -1;
+    }
+    if (numa_local && w3_numa_bind(topk_own, sizeof(topk_slab_t), w3_numa_node()) < 0) {
+        LM_WARN("Could not place the heavy-hitter sketch of process %d: %s\n", process_no,
+                strerror(errno));
+    }
+    memset(topk_own, 0, sizeof(topk_slab_t));
+    topk_dir->slabs[process_no] = topk_own;
+    return 0;
+}
+
+void w3_topk_destroy(void) {
+    if (!topk_dir) return;
+    for (int i = 0; i < TOPK_MAX_PROCS; i++) {
+        if (topk_dir->slabs[i]) shm_free(topk_dir->slabs[i]);
+    }
+    shm_free(topk_dir);
+    topk_dir = NULL;
+}
+
+static inline int topk_find(topk_summary_t* s, uint32_t h) {
+    for (int i = 0; i < TOPK_SIZE; i++) {
+        if (s->hash[i] == h) return i;
+    }
+    return -1;
+}
+
+static inline uint32_t topk_user_hash(const char* user, int len) {
+    uint32_t h = w3_hash32(user, len);
+    return h ? h : 1;
+}
+
+static inline uint32_t topk_ip_hash(struct ip_addr* ip) {
+    uint32_t h = w3_hash32((const char*)ip->u.addr, ip->len) ^ ip->af;
+    return h ? h : 1;
+}
+
+// Space-Saving update; the label is only rendered when a key enters
+static void topk_add(topk_summary_t* s, uint32_t h, const char* user, int len, struct ip_addr* ip) {
+    int i = topk_find(s, h);
+    int min = 0;
+
+    if (i >= 0) {
+        s->count[i]++;
+        return;
+    }
+
+    for (i = 1; i < TOPK_SIZE; i++) {
+        if (s->count[i] < s->count[min]) min = i;
+    }
+    s->hash[min] = h;
+    s->error[min] = s->count[min];
+    s->count[min]++;
+    s->rpc[min] = 0;
+    if (user) {
+        if (len >= TOPK_KEY_SIZE) len = TOPK_KEY_SIZE - 1;
+        memcpy(s->key[min], user, len);
+        s->key[min][len] = '\0';
+    } else {
+        snprintf(s->key[min], TOPK_KEY_SIZE, "%s", ip_addr2a(ip));
+    }
+}
+
+void w3_topk_attempt(const char* user, int user_len, struct ip_addr* ip) {
+    if (!topk_own) return;
+    if (user && user_len > 0) {
+        topk_add(&topk_own->summary[TOPK_USERS], topk_user_hash(user, user_len),
+                user, user_len, NULL);
+    }
+    if (ip) {
+        topk_add(&topk_own->summary[TOPK_IPS], topk_ip_hash(ip), NULL, 0, ip);
+    }
+}
+
+void w3_topk_rpc_call(const char* user, int user_len, struct ip_addr* ip) {
+    int i;
+
+    if (!topk_own) return;
+    if (user && user_len > 0) {
+        i = topk_find(&topk_own->summary[TOPK_USERS], topk_user_hash(user, user_len));
+        if (i >= 0) topk_own->summary[TOPK_USERS].rpc[i]++;
+    }
+    if (ip) {
+        i = topk_find(&topk_own->summary[TOPK_IPS], topk_ip_hash(ip));
+        if (i >= 0) topk_own->summary[TOPK_IPS].rpc[i]++;
+    }
+}
+
+static int topk_row_cmp(const void* a, const void* b) {
+    const topk_row_t* ra = a;
+    const topk_row_t* rb = b;
+    if (ra->count != rb->count) return ra->count < rb->count ? 1 : -1;
+    return 0;
+}
+
+// RPC: web3_auth.top [users|ips] [rows]
+void w3_topk_rpc_top(rpc_t* rpc, void* ctx) {
+    char* kind = NULL;
+    int rows = TOPK_DEFAULT_ROWS;
+    int which = TOPK_USERS;
+    int nslabs = 0, n = 0;
+    topk_row_t* merged;
+    void* th;
+
+    if (!topk_dir) {
+        rpc->fault(ctx, 500, "Heavy-hitter sketch not initialized");
+        return;
+    }
+
+    if (rpc->scan(ctx, "*s", &kind) == 1) {
+        if (strcmp(kind, "ips") == 0) {
+            which = TOPK_IPS;
+        } else if (strcmp(kind, "users") != 0) {
+            rpc->fault(ctx, 400, "Expected 'users' or 'ips'");
+            return;
+        }
+        rpc->scan(ctx, "*d", &rows);
+    }
+
+    for (int p = 0; p < TOPK_MAX_PROCS; p++) {
+        if (topk_dir->slabs[p]) nslabs++;
+    }
+    if (nslabs == 0) return;
+
+    merged = pkg_malloc(nslabs * TOPK_SIZE * sizeof(topk_row_t));
+    if (!merged) {
+        rpc->fault(ctx, 500, "Not enough memory");
+        return;
+    }
+
+    // Sum the per-process summaries key by key
+    for (int p = 0; p < TOPK_MAX_PROCS; p++) {
+        topk_summary_t* s;
+        if (!topk_dir->slabs[p]) continue;
+        s = &topk_dir->slabs[p]->summary[which];
+        for (int i = 0; i < TOPK_SIZE; i++) {
+            int j;
+            if (!s->hash[i]) continue;
+            for (j = 0; j < n && merged[j].hash != s->hash[i]; j++);
+            if (j == n) {
+                memset(&merged[n], 0, sizeof(topk_row_t));
+                merged[n].hash = s->hash[i];
+                memcpy(merged[n].key, s->key[i], TOPK_KEY_SIZE);
+                merged[n].key[TOPK_KEY_SIZE - 1] = '\0';
+                n++;
+            }
+            merged[j].count += s->count[i];
+            merged[j].error += s->error[i];
+            merged[j].rpc += s->rpc[i];
+        }
+    }
+
+    qsort(merged, n, sizeof(topk_row_t), topk_row_cmp);
+    if (rows > n) rows = n;
+
+    for (int i = 0; i < rows; i++) {
+        if (rpc->add(ctx, "{", &th) < 0) break;
+        rpc->struct_add(th, "suuu",
+                "key", merged[i].key,
+                "attempts", merged[i].count,
+                "error", merged[i].error,
+                "rpc_calls", merged[i].rpc);
+    }
+    pkg_free(merged);
+}
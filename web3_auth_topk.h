@@ -0,0 +1,28 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Heavy-hitter sketch of usernames and source addresses.
+ */
+
+#ifndef _WEB3_AUTH_TOPK_H_
+#define _WEB3_AUTH_TOPK_H_
+
+#include "../../core/ip_addr.h"
+#include "../../core/rpc.h"
+
+// Allocate the sketch directory; must run in mod_init (before fork)
+int w3_topk_init(void);
+// Allocate the sketch of the calling process, on its current memory node
+// with numa_local; run from child_init
+int w3_topk_child_init(int numa_local);
+void w3_topk_destroy(void);
+
+// Count an authentication attempt
+void w3_topk_attempt(const char* user, int user_len, struct ip_addr* ip);
+
+// Count an eth_call issued for an attempt
+void w3_topk_rpc_call(const char* user, int user_len, struct ip_addr* ip);
+
+void w3_topk_rpc_top(rpc_t* rpc, void* ctx);
+
+#endif
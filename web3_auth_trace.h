@@ -0,0 +1,52 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * Binary format of recorded authentication traffic.
+ *
+ * A trace is a w3_trace_header_t followed by fixed-size records in native
+ * byte order, appended by every SIP worker as its checks finish, so they
+ * are ordered by completion and not quite by arrival. Usernames, realms
+ * and cache keys are keyed hashes under a random key that is never
+ * written: requests of one user can be told apart from those of another,
+ * but no trace can be matched against a list of names.
+ */
+
+#ifndef _WEB3_AUTH_TRACE_H_
+#define _WEB3_AUTH_TRACE_H_
+
+#include <stdint.h>
+
+#define W3_TRACE_MAGIC "W3TRACE2"
+
+// Where the digest of a check came from
+#define W3_TRACE_NONE         0     // banned, malformed, shed or failed before a lookup
+#define W3_TRACE_CACHE        1
+#define W3_TRACE_CACHE_ABSENT 2     // negative cache
+#define W3_TRACE_L2           3
+#define W3_TRACE_L2_ABSENT    4
+#define W3_TRACE_LOCAL        5     // local execution
+#define W3_TRACE_STALE        6     // stale cache entry, over quota
+#define W3_TRACE_RPC          7
+
+typedef struct w3_trace_header {
+    char magic[8];
+    uint64_t started_ms;            // wall clock when recording started
+    uint32_t record_size;           // sizeof(w3_trace_rec_t)
+    uint32_t reserved[3];
+} w3_trace_header_t;
+
+typedef struct w3_trace_rec {
+    uint64_t t_us;                  // arrival, since recording started
+    uint64_t key;                   // digest cache key: same inputs, same answer
+    uint64_t user;                  // username within its realm
+    uint32_t realm;
+    uint32_t rpc_us;                // eth_call round trips, 0 without one
+    uint32_t total_us;              // whole check
+    uint16_t proc;                  // Kamailio process number
+    uint8_t prio;                   // W3_PRIO_* class
+    uint8_t source;                 // W3_TRACE_*
+    int8_t result;                  // WEB3_AUTH_* outcome
+    uint8_t reserved[7];
+} w3_trace_rec_t;
+
+#endif
@@ -0,0 +1,680 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * HTTP/1.1 client on io_uring for plain-HTTP RPC endpoints.
+ *
+ * curl spends a good part of a small eth_call on its own bookkeeping:
+ * options are set per request, headers go through lists and the answer is
+ * copied through callbacks. This client does only what a JSON-RPC POST
+ * needs. Each endpoint gets a request template built once (method, path,
+ * Host and Content-Type); a request is the template, the body length and
+ * the body, written into a buffer registered with the ring, and the answer
+ * is read into another registered buffer and parsed in place. Sockets are
+ * registered files as well, so the kernel does not look up or pin either
+ * per operation. Several requests can be written at once and their
+ * responses read back in order over the same keep-alive connection.
+ *
+ * Every process sets up its own ring after fork. There is no TLS: https
+ * endpoints stay on curl, the usual setup being a gateway on the local
+ * network. The code uses the raw system calls and needs Linux 5.11 or
+ * later for waits with a timeout.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/io_uring.h>
+
+#include "web3_auth.h"
+#include "web3_auth_uring.h"
+#include "web3_auth_cpu.h"
+
+#define URING_ENTRIES 16
+#define URING_URL_SIZE 256
+#define URING_HEAD_SIZE 512
+#define URING_DRAIN_US 100000           // wait for cancelled operations
+
+// Operations in user_data
+#define OP_CONNECT 1
+#define OP_WRITE 2
+#define OP_READ 3
+
+typedef struct {
+    int fd;
+    unsigned int sq_entries;
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+    unsigned int tail;                  // next free sqe
+    unsigned int to_submit;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    char* buffers;                      // registered, send and receive per connection
+    size_t buffers_size;
+} uring_t;
+
+typedef struct {
+    char url[URING_URL_SIZE];
+    char host[URING_URL_SIZE];
+    char port[8];
+    char head[URING_HEAD_SIZE];         // request up to the Content-Length value
+    size_t head_len;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int fd;                             // -1 when closed
+    unsigned long used;                 // responses read on this connection
+} uring_conn_t;
+
+static uring_t ring = { .fd = -1 };
+static uring_conn_t conns[W3_URING_MAX_CONNS];
+static int nconns = 0;
+static int evict = 0;
+static int inflight = 0;                // submitted operations not completed
+static char uring_errbuf[160] = "";
+
+static int uring_fail(const char* what, int err) {
+    snprintf(uring_errbuf, sizeof(uring_errbuf), "%s: %s", what, strerror(err));
+    return W3_URING_FAILED;
+}
+
+static inline char* conn_send(int slot) {
+    return ring.buffers + (size_t)slot * (W3_URING_SEND_SIZE + W3_URING_RECV_SIZE);
+}
+
+static inline char* conn_recv(int slot) {
+    return conn_send(slot) + W3_URING_SEND_SIZE;
+}
+
+static int ring_register(unsigned int op, void* arg, unsigned int n) {
+    return syscall(__NR_io_uring_register, ring.fd, op, arg, n) < 0 ? -errno : 0;
+}
+
+int w3_uring_init(int numa_local) {
+    struct io_uring_params p;
+    struct iovec iov[2 * W3_URING_MAX_CONNS];
+    int files[W3_URING_MAX_CONNS];
+    int rc;
+
+    if (ring.fd >= 0) return 0;
+
+    // Completions are only reaped by this process, between its own calls
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (ring.fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    }
+    if (ring.fd < 0) return uring_fail("io_uring_setup", errno);
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        w3_uring_destroy();
+        return uring_fail("io_uring waits with timeout", ENOSYS);
+    }
+
+    ring.sq_entries = p.sq_entries;
+    ring.sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring.cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring.cq_ring_size > ring.sq_ring_size) ring.sq_ring_size = ring.cq_ring_size;
+        ring.cq_ring_size = 0;
+    }
+    ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ring == MAP_FAILED) {
+        ring.sq_ring = NULL;
+        rc = errno;
+        w3_uring_destroy();
+        return uring_fail("mmap of the submission ring", rc);
+    }
+    if (ring.cq_ring_size) {
+        ring.cq_ring = mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if (ring.cq_ring == MAP_FAILED) {
+            ring.cq_ring = NULL;
+            rc = errno;
+            w3_uring_destroy();
+            return uring_fail("mmap of the completion ring", rc);
+        }
+    } else {
+        ring.cq_ring = ring.sq_ring;
+    }
+    ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        ring.sqes = NULL;
+        rc = errno;
+        w3_uring_destroy();
+        return uring_fail("mmap of the submission entries", rc);
+    }
+
+    ring.sq_head = (unsigned int*)((char*)ring.sq_ring + p.sq_off.head);
+    ring.sq_tail = (unsigned int*)((char*)ring.sq_ring + p.sq_off.tail);
+    ring.sq_mask = (unsigned int*)((char*)ring.sq_ring + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned int*)((char*)ring.sq_ring + p.sq_off.array);
+    ring.cq_head = (unsigned int*)((char*)ring.cq_ring + p.cq_off.head);
+    ring.cq_tail = (unsigned int*)((char*)ring.cq_ring + p.cq_off.tail);
+    ring.cq_mask = (unsigned int*)((char*)ring.cq_ring + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe*)((char*)ring.cq_ring + p.cq_off.cqes);
+    ring.tail = *ring.sq_tail;
+
+    // Send and receive buffer of every connection slot, pinned once
+    ring.buffers_size = (size_t)W3_URING_MAX_CONNS * (W3_URING_SEND_SIZE + W3_URING_RECV_SIZE);
+    ring.buffers = mmap(NULL, ring.buffers_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring.buffers == MAP_FAILED) {
+        ring.buffers = NULL;
+        rc = errno;
+        w3_uring_destroy();
+        return uring_fail("buffer allocation", rc);
+    }
+    // Registration faults the pages in, on the node the policy names
+    if (numa_local && w3_numa_bind(ring.buffers, ring.buffers_size, w3_numa_node()) < 0) {
+        rc = errno;
+        w3_uring_destroy();
+        return uring_fail("buffer placement", rc);
+    }
+    for (int i = 0; i < W3_URING_MAX_CONNS; i++) {
+        iov[2 * i].iov_base = conn_send(i);
+        iov[2 * i].iov_len = W3_URING_SEND_SIZE;
+        iov[2 * i + 1].iov_base = conn_recv(i);
+        iov[2 * i + 1].iov_len = W3_URING_RECV_SIZE;
+        files[i] = -1;
+    }
+    if ((rc = ring_register(IORING_REGISTER_BUFFERS, iov, 2 * W3_URING_MAX_CONNS)) < 0) {
+        w3_uring_destroy();
+        return uring_fail("buffer registration", -rc);
+    }
+    if ((rc = ring_register(IORING_REGISTER_FILES, files, W3_URING_MAX_CONNS)) < 0) {
+        w3_uring_destroy();
+        return uring_fail("file registration", -rc);
+    }
+
+    for (int i = 0; i < W3_URING_MAX_CONNS; i++) conns[i].fd = -1;
+    nconns = 0;
+    return 0;
+}
+
+void w3_uring_destroy(void) {
+    for (int i = 0; i < nconns; i++) {
+        if (conns[i].fd >= 0) close(conns[i].fd);
+        conns[i].fd = -1;
+    }
+    nconns = 0;
+    if (ring.buffers) munmap(ring.buffers, ring.buffers_size);
+    if (ring.sqes) munmap(ring.sqes, ring.sqes_size);
+    if (ring.cq_ring && ring.cq_ring != ring.sq_ring) munmap(ring.cq_ring, ring.cq_ring_size);
+    if (ring.sq_ring) munmap(ring.sq_ring, ring.sq_ring_size);
+    if (ring.fd >= 0) close(ring.fd);
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+}
+
+const char* w3_uring_error(void) {
+    return uring_errbuf;
+}
+
+int w3_uring_usable(const char* url) {
+    return ring.fd >= 0 && strncasecmp(url, "http://", 7) == 0;
+}
+
+static struct io_uring_sqe* ring_sqe(int op, int slot) {
+    unsigned int head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    unsigned int idx;
+    struct io_uring_sqe* sqe;
+
+    if (ring.tail - head >= ring.sq_entries) return NULL;
+    idx = ring.tail & *ring.sq_mask;
+    sqe = &ring.sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = slot;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->user_data = op;
+    ring.sq_array[idx] = idx;
+    ring.tail++;
+    __atomic_store_n(ring.sq_tail, ring.tail, __ATOMIC_RELEASE);
+    ring.to_submit++;
+    inflight++;
+    return sqe;
+}
+
+// Submit what is queued and wait up to deadline_us for one completion
+static int ring_enter(unsigned int min_complete, uint64_t deadline_us) {
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    unsigned int flags = 0;
+    uint64_t now;
+    long rc;
+
+    memset(&arg, 0, sizeof(arg));
+    if (min_complete) {
+        now = w3_now_us();
+        if (now >= deadline_us) return -ETIME;
+        ts.tv_sec = (deadline_us - now) / 1000000;
+        ts.tv_nsec = (deadline_us - now) % 1000000 * 1000;
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    } else if (!ring.to_submit) {
+        return 0;
+    }
+
+    rc = syscall(__NR_io_uring_enter, ring.fd, ring.to_submit, min_complete, flags,
+            min_complete ? &arg : NULL, min_complete ? sizeof(arg) : 0);
+    if (rc < 0) return -errno;
+    ring.to_submit -= rc < (long)ring.to_submit ? rc : ring.to_submit;
+    return 0;
+}
+
+static int ring_reap(struct io_uring_cqe* cqe) {
+    unsigned int head = *ring.cq_head;
+
+    if (head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) return 0;
+    *cqe = ring.cqes[head & *ring.cq_mask];
+    __atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+    inflight--;
+    return 1;
+}
+
+// Next completion by deadline_us; W3_URING_TIMEOUT when none came
+static int ring_wait(struct io_uring_cqe* cqe, uint64_t deadline_us) {
+    int rc;
+
+    if (ring.to_submit && (rc = ring_enter(0, 0)) < 0 && rc != -EINTR && rc != -EAGAIN) {
+        return uring_fail("io_uring_enter", -rc);
+    }
+    for (;;) {
+        if (ring_reap(cqe)) return 0;
+        rc = ring_enter(1, deadline_us);
+        if (rc == -ETIME) {
+            snprintf(uring_errbuf, sizeof(uring_errbuf), "timed out");
+            return W3_URING_TIMEOUT;
+        }
+        if (rc < 0 && rc != -EINTR && rc != -EAGAIN && rc != -EBUSY) {
+            return uring_fail("io_uring_enter", -rc);
+        }
+    }
+}
+
+static void conn_close(int slot) {
+    uring_conn_t* c = &conns[slot];
+    struct io_uring_cqe cqe;
+    struct io_uring_files_update up;
+    int none = -1;
+
+    if (c->fd < 0) return;
+
+    // Operations still in flight end once the socket is shut down
+    shutdown(c->fd, SHUT_RDWR);
+    while (inflight > 0 && ring_wait(&cqe, w3_now_us() + URING_DRAIN_US) == 0);
+    inflight = 0;
+
+    memset(&up, 0, sizeof(up));
+    up.offset = slot;
+    up.fds = (uint64_t)(uintptr_t)&none;
+    ring_register(IORING_REGISTER_FILES_UPDATE, &up, 1);
+    close(c->fd);
+    c->fd = -1;
+    c->used = 0;
+}
+
+// Split "http://host[:port][/path]" and build the request template
+static int conn_parse(uring_conn_t* c, const char* url) {
+    const char* auth = url + 7;
+    const char* path = strchr(auth, '/');
+    const char* host = auth;
+    const char* host_end;
+    const char* port = NULL;
+    size_t auth_len = path ? (size_t)(path - auth) : strlen(auth);
+    int n;
+
+    if (!path) path = "/";
+    if (*host == '[') {
+        host_end = memchr(host, ']', auth_len);
+        if (!host_end) return -1;
+        host++;
+        if (host_end + 1 < auth + auth_len && host_end[1] == ':') port = host_end + 2;
+    } else {
+        host_end = memchr(host, ':', auth_len);
+        if (host_end) port = host_end + 1;
+        else host_end = auth + auth_len;
+    }
+    if (host_end == host || (size_t)(host_end - host) >= sizeof(c->host)) return -1;
+    memcpy(c->host, host, host_end - host);
+    c->host[host_end - host] = '\0';
+    n = snprintf(c->port, sizeof(c->port), "%.*s", port ? (int)(auth + auth_len - port) : 2,
+            port ? port : "80");
+    if (n <= 0 || n >= (int)sizeof(c->port)) return -1;
+
+    n = snprintf(c->head, sizeof(c->head), "POST %s HTTP/1.1\r\nHost: %.*s\r\n"
+            "Content-Type: application/json\r\nContent-Length: ", path, (int)auth_len, auth);
+    if (n < 0 || n >= (int)sizeof(c->head)) return -1;
+    c->head_len = n;
+    snprintf(c->url, sizeof(c->url), "%s", url);
+    c->addr_len = 0;
+    return 0;
+}
+
+// Slot of the connection to url; when all are taken, they are reused in turn
+static int conn_slot(const char* url) {
+    int slot;
+
+    for (int i = 0; i < nconns; i++) {
+        if (strcmp(conns[i].url, url) == 0) return i;
+    }
+    if (strlen(url) >= URING_URL_SIZE) {
+        snprintf(uring_errbuf, sizeof(uring_errbuf), "URL too long");
+        return -1;
+    }
+    if (nconns < W3_URING_MAX_CONNS) {
+        slot = nconns++;
+    } else {
+        slot = evict;
+        evict = (evict + 1) % W3_URING_MAX_CONNS;
+        conn_close(slot);
+    }
+    conns[slot].url[0] = '\0';
+    if (conn_parse(&conns[slot], url) < 0) {
+        snprintf(uring_errbuf, sizeof(uring_errbuf), "malformed URL");
+        conns[slot].url[0] = '\0';
+        return -1;
+    }
+    return slot;
+}
+
+static int conn_open(int slot, uint64_t deadline_us) {
+    uring_conn_t* c = &conns[slot];
+    struct io_uring_files_update up;
+    struct io_uring_sqe* sqe;
+    struct io_uring_cqe cqe;
+    int one = 1;
+    int rc;
+
+    if (!c->addr_len) {
+        struct addrinfo hints, *res;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        rc = getaddrinfo(c->host, c->port, &hints, &res);
+        if (rc != 0) {
+            snprintf(uring_errbuf, sizeof(uring_errbuf), "resolving %s: %s", c->host,
+                    gai_strerror(rc));
+            return W3_URING_FAILED;
+        }
+        memcpy(&c->addr, res->ai_addr, res->ai_addrlen);
+        c->addr_len = res->ai_addrlen;
+        freeaddrinfo(res);
+    }
+
+    c->fd = socket(c->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) return uring_fail("socket", errno);
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    memset(&up, 0, sizeof(up));
+    up.offset = slot;
+    up.fds = (uint64_t)(uintptr_t)&c->fd;
+    if ((rc = ring_register(IORING_REGISTER_FILES_UPDATE, &up, 1)) < 0) {
+        close(c->fd);
+        c->fd = -1;
+        return uring_fail("file registration", -rc);
+    }
+
+    sqe = ring_sqe(OP_CONNECT, slot);
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->addr = (uint64_t)(uintptr_t)&c->addr;
+    sqe->off = c->addr_len;
+    rc = ring_wait(&cqe, deadline_us);
+    if (rc == 0 && cqe.res < 0) rc = uring_fail("connect", -cqe.res);
+    if (rc < 0) {
+        conn_close(slot);
+        c->addr_len = 0;    // resolve again next time
+        return rc;
+    }
+    c->used = 0;
+    return 0;
+}
+
+static void submit_write(int slot, size_t off, size_t len) {
+    struct io_uring_sqe* sqe = ring_sqe(OP_WRITE, slot);
+
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->addr = (uint64_t)(uintptr_t)(conn_send(slot) + off);
+    sqe->len = len;
+    sqe->buf_index = 2 * slot;
+}
+
+static void submit_read(int slot, size_t off) {
+    struct io_uring_sqe* sqe = ring_sqe(OP_READ, slot);
+
+    // One byte stays free for the terminating NUL of the last body
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->addr = (uint64_t)(uintptr_t)(conn_recv(slot) + off);
+    sqe->len = W3_URING_RECV_SIZE - 1 - off;
+    sqe->buf_index = 2 * slot + 1;
+}
+
+// Value of header name in the header block [p, end), or NULL
+static const char* header(const char* p, const char* end, const char* name, size_t name_len) {
+    while (p < end) {
+        const char* eol = memchr(p, '\n', end - p);
+        if (!eol) break;
+        if ((size_t)(eol - p) > name_len && strncasecmp(p, name, name_len) == 0
+                && p[name_len] == ':') {
+            p += name_len + 1;
+            while (p < eol && (*p == ' ' || *p == '\t')) p++;
+            return p;
+        }
+        p = eol + 1;
+    }
+    return NULL;
+}
+
+// Walk the chunks of a body starting at p; the length of the encoded body
+// once complete, 0 before, -1 when malformed. With decode, the data is
+// moved to p and its length stored in len.
+static long dechunk(char* p, char* end, int decode, size_t* len) {
+    char* q = p;
+    char* out = p;
+
+    for (;;) {
+        char* eol = memchr(q, '\n', end - q);
+        char* data;
+        unsigned long size;
+
+        if (!eol) return 0;
+        // No chunk can be larger than the buffer it is read into, and the
+        // bound keeps size + 2 below from wrapping
+        errno = 0;
+        size = strtoul(q, &data, 16);
+        if (data == q || errno == ERANGE || size > W3_URING_RECV_SIZE) return -1;
+        q = eol + 1;
+        if (size == 0) {
+            // Trailers up to an empty line
+            for (;;) {
+                eol = memchr(q, '\n', end - q);
+                if (!eol) return 0;
+                if (eol == q || (eol == q + 1 && *q == '\r')) {
+                    if (decode) *len = out - p;
+                    return eol + 1 - p;
+                }
+                q = eol + 1;
+            }
+        }
+        if ((size_t)(end - q) < size + 2) return 0;
+        if (decode) {
+            memmove(out, q, size);
+            out += size;
+        }
+        q += size;
+        if (*q == '\r') q++;
+        if (*q != '\n') return -1;
+        q++;
+    }
+}
+
+// Parse the response at [p, end): its length once complete, 0 before, -1
+// when malformed
+static long parse_response(char* p, char* end, w3_uring_resp_t* r, int* close) {
+    char* hdr_end;
+    char* body;
+    const char* v;
+    long chunked_len;
+
+    if (end - p < 12) return 0;
+    if (memcmp(p, "HTTP/1.", 7) != 0) return -1;
+    for (hdr_end = p; hdr_end + 4 <= end && memcmp(hdr_end, "\r\n\r\n", 4) != 0; hdr_end++);
+    if (hdr_end + 4 > end) return 0;
+    body = hdr_end + 4;
+    r->status = atoi(p + 9);
+
+    v = header(p, hdr_end + 2, "Connection", 10);
+    if (v && strncasecmp(v, "close", 5) == 0) *close = 1;
+
+    v = header(p, hdr_end + 2, "Transfer-Encoding", 17);
+    if (v && strncasecmp(v, "chunked", 7) == 0) {
+        chunked_len = dechunk(body, end, 0, NULL);
+        if (chunked_len <= 0) return chunked_len;
+        dechunk(body, end, 1, &r->len);
+        r->body = body;
+        return body + chunked_len - p;
+    }
+
+    v = header(p, hdr_end + 2, "Content-Length", 14);
+    if (v) {
+        char* digits_end;
+        unsigned long cl;
+
+        errno = 0;
+        cl = strtoul(v, &digits_end, 10);
+        if (digits_end == v || errno == ERANGE || cl > W3_URING_RECV_SIZE) return -1;
+        if ((size_t)(end - body) < cl) return 0;
+        r->body = body;
+        r->len = cl;
+        return body + cl - p;
+    }
+    if (r->status == 204 || r->status == 304 || r->status / 100 == 1) {
+        r->body = body;
+        r->len = 0;
+        return body - p;
+    }
+    // Bodies delimited by closing the connection are not supported
+    return -1;
+}
+
+// One attempt at the exchange on an open connection
+static int exchange(int slot, size_t out_len, int n, w3_uring_resp_t resp[],
+        uint64_t deadline_us, size_t* got) {
+    char* in = conn_recv(slot);
+    size_t parsed = 0, written = 0;
+    struct io_uring_cqe cqe;
+    int done = 0, close_after = 0;
+    int rc;
+
+    *got = 0;
+    submit_write(slot, 0, out_len);
+    submit_read(slot, 0);
+
+    while (inflight > 0) {
+        if ((rc = ring_wait(&cqe, deadline_us)) < 0) return rc;
+
+        if (cqe.user_data == OP_WRITE) {
+            if (cqe.res <= 0) return uring_fail("send", cqe.res < 0 ? -cqe.res : EPIPE);
+            written += cqe.res;
+            if (written < out_len) submit_write(slot, written, out_len - written);
+            continue;
+        }
+
+        if (cqe.res < 0) return uring_fail("receive", -cqe.res);
+        if (cqe.res == 0) return uring_fail("receive", ECONNRESET);
+        *got += cqe.res;
+        while (done < n) {
+            long len = parse_response(in + parsed, in + *got, &resp[done], &close_after);
+            if (len < 0) {
+                snprintf(uring_errbuf, sizeof(uring_errbuf), "malformed response");
+                return W3_URING_FAILED;
+            }
+            if (len == 0) break;
+            parsed += len;
+            done++;
+        }
+        if (done < n) {
+            if (*got >= W3_URING_RECV_SIZE - 1) {
+                snprintf(uring_errbuf, sizeof(uring_errbuf), "responses exceed %d bytes",
+                        W3_URING_RECV_SIZE - 1);
+                return W3_URING_FAILED;
+            }
+            submit_read(slot, *got);
+        }
+    }
+
+    // Bodies are terminated only now, the byte after one may start the next
+    for (int i = 0; i < n; i++) ((char*)resp[i].body)[resp[i].len] = '\0';
+    conns[slot].used += n;
+    if (close_after || parsed != *got) conn_close(slot);
+    return 0;
+}
+
+int w3_uring_post(const char* url, const char* const bodies[], const size_t lens[], int n,
+        w3_uring_resp_t resp[], int timeout_ms) {
+    uint64_t deadline_us = w3_now_us() + (uint64_t)timeout_ms * 1000;
+    uring_conn_t* c;
+    char* out;
+    size_t out_len = 0, got;
+    int slot, rc;
+
+    if (ring.fd < 0) {
+        snprintf(uring_errbuf, sizeof(uring_errbuf), "io_uring not initialized");
+        return W3_URING_FAILED;
+    }
+    if ((slot = conn_slot(url)) < 0) return W3_URING_FAILED;
+    c = &conns[slot];
+
+    // Requests of the batch back to back: template, length, body
+    out = conn_send(slot);
+    for (int i = 0; i < n; i++) {
+        char digits[24];
+        int dn = snprintf(digits, sizeof(digits), "%zu\r\n\r\n", lens[i]);
+        if (out_len + c->head_len + dn + lens[i] > W3_URING_SEND_SIZE) {
+            snprintf(uring_errbuf, sizeof(uring_errbuf), "requests exceed %d bytes",
+                    W3_URING_SEND_SIZE);
+            return W3_URING_FAILED;
+        }
+        memcpy(out + out_len, c->head, c->head_len);
+        out_len += c->head_len;
+        memcpy(out + out_len, digits, dn);
+        out_len += dn;
+        memcpy(out + out_len, bodies[i], lens[i]);
+        out_len += lens[i];
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int reused = c->fd >= 0 && c->used > 0;
+
+        if (c->fd < 0 && (rc = conn_open(slot, deadline_us)) < 0) return rc;
+        rc = exchange(slot, out_len, n, resp, deadline_us, &got);
+        if (rc == 0) return 0;
+        conn_close(slot);
+        // The server may have closed an idle connection just before
+        if (rc == W3_URING_TIMEOUT || !reused || got > 0) return rc;
+    }
+    return W3_URING_FAILED;
+}
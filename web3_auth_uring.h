@@ -0,0 +1,45 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * HTTP/1.1 client on io_uring for plain-HTTP RPC endpoints.
+ */
+
+#ifndef _WEB3_AUTH_URING_H_
+#define _WEB3_AUTH_URING_H_
+
+#include <stddef.h>
+
+#define W3_URING_MAX_CONNS 8        // endpoints with an open connection per process
+#define W3_URING_SEND_SIZE 16384    // requests of one pipelined batch
+#define W3_URING_RECV_SIZE 32768    // responses of one pipelined batch
+
+// Outcomes of w3_uring_post() besides 0
+#define W3_URING_FAILED  -1
+#define W3_URING_TIMEOUT -2
+
+typedef struct w3_uring_resp {
+    int status;             // HTTP status code
+    const char* body;       // NUL-terminated, in the receive buffer of the
+    size_t len;             // connection until its next request
+} w3_uring_resp_t;
+
+// Set up the ring and registered buffers of this process, the buffers on
+// its current memory node with numa_local; -1 when the kernel does not
+// offer io_uring (or blocks it), see w3_uring_error()
+int w3_uring_init(int numa_local);
+void w3_uring_destroy(void);
+
+// 1 when the ring is up and url is plain http://
+int w3_uring_usable(const char* url);
+
+// POST the n bodies to url, pipelined on the keep-alive connection of this
+// process, and read their n responses in order. A connection the server
+// closed while idle is reopened once. Returns 0, W3_URING_FAILED or
+// W3_URING_TIMEOUT when the whole exchange took longer than timeout_ms.
+int w3_uring_post(const char* url, const char* const bodies[], const size_t lens[], int n,
+        w3_uring_resp_t resp[], int timeout_ms);
+
+// What the last failure was, for logs
+const char* w3_uring_error(void);
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * X25519 key agreement (RFC 7748) for Sapphire calls.
+ *
+ * Field elements are five 51-bit limbs multiplied with 128-bit products.
+ * The ladder swaps by mask and runs the same steps for every scalar, so
+ * the time taken does not depend on the secret key.
+ */
+
+#include <string.h>
+
+#include "web3_auth_x25519.h"
+
+typedef uint64_t fe[5];
+typedef unsigned __int128 u128;
+
+#define MASK51 ((1ULL << 51) - 1)
+
+static void fe_load(fe h, const uint8_t s[32]) {
+    uint64_t w[4];
+    for (int i = 0; i < 4; i++) {
+        w[i] = 0;
+        for (int j = 7; j >= 0; j--) w[i] = w[i] << 8 | s[8 * i + j];
+    }
+    h[0] = w[0] & MASK51;
+    h[1] = (w[0] >> 51 | w[1] << 13) & MASK51;
+    h[2] = (w[1] >> 38 | w[2] << 26) & MASK51;
+    h[3] = (w[2] >> 25 | w[3] << 39) & MASK51;
+    h[4] = (w[3] >> 12) & MASK51;    // top bit of u is ignored
+}
+
+// Fully reduce mod 2^255-19 and write little-endian
+static void fe_store(uint8_t s[32], const fe f) {
+    uint64_t h[5], c;
+    memcpy(h, f, sizeof(h));
+    for (int pass = 0; pass < 2; pass++) {
+        c = h[0] >> 51; h[0] &= MASK51; h[1] += c;
+        c = h[1] >> 51; h[1] &= MASK51; h[2] += c;
+        c = h[2] >> 51; h[2] &= MASK51; h[3] += c;
+        c = h[3] >> 51; h[3] &= MASK51; h[4] += c;
+        c = h[4] >> 51; h[4] &= MASK51; h[0] += c * 19;
+    }
+    // h < 2^255 + small; subtract p when h >= p
+    h[0] += 19;
+    c = h[0] >> 51; h[0] &= MASK51; h[1] += c;
+    c = h[1] >> 51; h[1] &= MASK51; h[2] += c;
+    c = h[2] >> 51; h[2] &= MASK51; h[3] += c;
+    c = h[3] >> 51; h[3] &= MASK51; h[4] += c;
+    c = h[4] >> 51; h[4] &= MASK51; h[0] += c * 19;
+    // now h = (orig + 19) mod 2^255; add 2^255 - 19 and drop the top bit
+    h[0] += MASK51 + 1 - 19;
+    h[1] += MASK51;
+    h[2] += MASK51;
+    h[3] += MASK51;
+    h[4] += MASK51;
+    c = h[0] >> 51; h[0] &= MASK51; h[1] += c;
+    c = h[1] >> 51; h[1] &= MASK51; h[2] += c;
+    c = h[2] >> 51; h[2] &= MASK51; h[3] += c;
+    c = h[3] >> 51; h[3] &= MASK51; h[4] += c;
+    h[4] &= MASK51;
+
+    uint64_t w[4] = {
+        h[0] | h[1] << 51,
+        h[1] >> 13 | h[2] << 38,
+        h[2] >> 26 | h[3] << 25,
+        h[3] >> 39 | h[4] << 12
+    };
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 8; j++) s[8 * i + j] = (uint8_t)(w[i] >> (8 * j));
+}
+
+static inline void fe_add(fe h, const fe f, const fe g) {
+    for (int i = 0; i < 5; i++) h[i] = f[i] + g[i];
+}
+
+// f - g with 2p added so limbs stay positive
+static inline void fe_sub(fe h, const fe f, const fe g) {
+    h[0] = f[0] + 0xfffffffffffdaULL - g[0];
+    h[1] = f[1] + 0xffffffffffffeULL - g[1];
+    h[2] = f[2] + 0xffffffffffffeULL - g[2];
+    h[3] = f[3] + 0xffffffffffffeULL - g[3];
+    h[4] = f[4] + 0xffffffffffffeULL - g[4];
+}
+
+static inline void fe_carry(fe h, u128 t[5]) {
+    uint64_t c;
+    c = (uint64_t)(t[0] >> 51); h[0] = (uint64_t)t[0] & MASK51; t[1] += c;
+    c = (uint64_t)(t[1] >> 51); h[1] = (uint64_t)t[1] & MASK51; t[2] += c;
+    c = (uint64_t)(t[2] >> 51); h[2] = (uint64_t)t[2] & MASK51; t[3] += c;
+    c = (uint64_t)(t[3] >> 51); h[3] = (uint64_t)t[3] & MASK51; t[4] += c;
+    c = (uint64_t)(t[4] >> 51); h[4] = (uint64_t)t[4] & MASK51;
+    h[0] += c * 19;
+    h[1] += h[0] >> 51;
+    h[0] &= MASK51;
+}
+
+static void fe_mul(fe h, const fe f, const fe g) {
+    uint64_t g1 = g[1] * 19, g2 = g[2] * 19, g3 = g[3] * 19, g4 = g[4] * 19;
+    u128 t[5];
+    t[0] = (u128)f[0] * g[0] + (u128)f[1] * g4 + (u128)f[2] * g3 + (u128)f[3] * g2 + (u128)f[4] * g1;
+    t[1] = (u128)f[0] * g[1] + (u128)f[1] * g[0] + (u128)f[2] * g4 + (u128)f[3] * g3 + (u128)f[4] * g2;
+    t[2] = (u128)f[0] * g[2] + (u128)f[1] * g[1] + (u128)f[2] * g[0] + (u128)f[3] * g4 + (u128)f[4] * g3;
+    t[3] = (u128)f[0] * g[3] + (u128)f[1] * g[2] + (u128)f[2] * g[1] + (u128)f[3] * g[0] + (u128)f[4] * g4;
+    t[4] = (u128)f[0] * g[4] + (u128)f[1] * g[3] + (u128)f[2] * g[2] + (u128)f[3] * g[1] + (u128)f[4] * g[0];
+    fe_carry(h, t);
+}
+
+static inline void fe_sq(fe h, const fe f) {
+    fe_mul(h, f, f);
+}
+
+static void fe_mul_small(fe h, const fe f, uint64_t n) {
+    u128 t[5];
+    for (int i = 0; i < 5; i++) t[i] = (u128)f[i] * n;
+    fe_carry(h, t);
+}
+
+// f^(p-2) by the usual addition chain
+static void fe_invert(fe out, const fe z) {
+    fe z2, z9, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+    int i;
+
+    fe_sq(z2, z);
+    fe_sq(t, z2);
+    fe_sq(t, t);
+    fe_mul(z9, t, z);
+    fe_mul(z11, z9, z2);
+    fe_sq(t, z11);
+    fe_mul(z2_5_0, t, z9);
+    fe_sq(t, z2_5_0);
+    for (i = 1; i < 5; i++) fe_sq(t, t);
+    fe_mul(z2_10_0, t, z2_5_0);
+    fe_sq(t, z2_10_0);
+    for (i = 1; i < 10; i++) fe_sq(t, t);
+    fe_mul(z2_20_0, t, z2_10_0);
+    fe_sq(t, z2_20_0);
+    for (i = 1; i < 20; i++) fe_sq(t, t);
+    fe_mul(t, t, z2_20_0);
+    fe_sq(t, t);
+    for (i = 1; i < 10; i++) fe_sq(t, t);
+    fe_mul(z2_50_0, t, z2_10_0);
+    fe_sq(t, z2_50_0);
+    for (i = 1; i < 50; i++) fe_sq(t, t);
+    fe_mul(z2_100_0, t, z2_50_0);
+    fe_sq(t, z2_100_0);
+    for (i = 1; i < 100; i++) fe_sq(t, t);
+    fe_mul(t, t, z2_100_0);
+    fe_sq(t, t);
+    for (i = 1; i < 50; i++) fe_sq(t, t);
+    fe_mul(t, t, z2_50_0);
+    for (i = 0; i < 5; i++) fe_sq(t, t);
+    fe_mul(out, t, z11);
+}
+
+static inline void fe_cswap(fe f, fe g, uint64_t bit) {
+    uint64_t mask = 0 - bit;
+    for (int i = 0; i < 5; i++) {
+        uint64_t x = (f[i] ^ g[i]) & mask;
+        f[i] ^= x;
+        g[i] ^= x;
+    }
+}
+
+void x25519(uint8_t out[32], const uint8_t scalar[32], const uint8_t point[32]) {
+    uint8_t k[32];
+    fe x1, x2, z2, x3, z3, a, aa, b, bb, e, c, d, da, cb;
+    uint64_t swap = 0;
+
+    memcpy(k, scalar, sizeof(k));
+    k[0] &= 248;
+    k[31] &= 127;
+    k[31] |= 64;
+
+    fe_load(x1, point);
+    memset(x2, 0, sizeof(fe)); x2[0] = 1;
+    memset(z2, 0, sizeof(fe));
+    memcpy(x3, x1, sizeof(fe));
+    memset(z3, 0, sizeof(fe)); z3[0] = 1;
+
+    for (int t = 254; t >= 0; t--) {
+        uint64_t bit = (k[t >> 3] >> (t & 7)) & 1;
+        swap ^= bit;
+        fe_cswap(x2, x3, swap);
+        fe_cswap(z2, z3, swap);
+        swap = bit;
+
+        fe_add(a, x2, z2);
+        fe_sq(aa, a);
+        fe_sub(b, x2, z2);
+        fe_sq(bb, b);
+        fe_sub(e, aa, bb);
+        fe_add(c, x3, z3);
+        fe_sub(d, x3, z3);
+        fe_mul(da, d, a);
+        fe_mul(cb, c, b);
+        fe_add(x3, da, cb);
+        fe_sq(x3, x3);
+        fe_sub(z3, da, cb);
+        fe_sq(z3, z3);
+        fe_mul(z3, z3, x1);
+        fe_mul(x2, aa, bb);
+        fe_mul_small(z2, e, 121665);
+        fe_add(z2, z2, aa);
+        fe_mul(z2, z2, e);
+    }
+    fe_cswap(x2, x3, swap);
+    fe_cswap(z2, z3, swap);
+
+    fe_invert(z2, z2);
+    fe_mul(x2, x2, z2);
+    fe_store(out, x2);
+    memset(k, 0, sizeof(k));
+}
+
+void x25519_base(uint8_t out[32], const uint8_t scalar[32]) {
+    static const uint8_t base[32] = { 9 };
+    x25519(out, scalar, base);
+}
@@ -0,0 +1,18 @@
+/*
+ * Web3 Authentication Module for Kamailio
+ *
+ * X25519 key agreement (RFC 7748) for Sapphire calls.
+ */
+
+#ifndef _WEB3_AUTH_X25519_H_
+#define _WEB3_AUTH_X25519_H_
+
+#include <stdint.h>
+
+// out = scalar * point, both little-endian; the scalar is clamped here
+void x25519(uint8_t out[32], const uint8_t scalar[32], const uint8_t point[32]);
+
+// Public key of a secret key: scalar * base point 9
+void x25519_base(uint8_t out[32], const uint8_t scalar[32]);
+
+#endif